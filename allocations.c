@@ -1,5 +1,7 @@
 #include <assert.h>
 #include <jemalloc/jemalloc.h>
+#include <stdatomic.h>
+#include <string.h>
 
 #define CHUNKS 1024 * 512
 
@@ -19,6 +21,8 @@ struct Pool64 {
     struct Node node;
   } chunks[CHUNKS];
   struct Node *head;
+  // The pool is shared by the parser and the writer thread.
+  atomic_flag lock;
 };
 
 struct Pool64 *getPool64() {
@@ -30,19 +34,32 @@ struct Pool64 *getPool64() {
     }
     memory.chunks[CHUNKS - 1].node.next = NULL;
     memory.head = &memory.chunks[0].node;
+    atomic_flag_clear(&memory.lock);
     pool = &memory;
   }
   return pool;
 }
 
+static void lockPool64(struct Pool64 *pool) {
+  while (atomic_flag_test_and_set_explicit(&pool->lock, memory_order_acquire))
+    ;
+}
+
+static void unlockPool64(struct Pool64 *pool) {
+  atomic_flag_clear_explicit(&pool->lock, memory_order_release);
+}
+
 void *allocInPool64(struct Pool64 *pool) {
+  lockPool64(pool);
   struct Node *node = pool->head;
   if (node == NULL) {
     // fprintf(stderr, "no space\n");
+    unlockPool64(pool);
     return NULL;
   }
 
   pool->head = pool->head->next;
+  unlockPool64(pool);
   return node;
 }
 
@@ -66,8 +83,10 @@ bool freeFromPool64(void *ptr) {
   assert(index < CHUNKS);
 
   struct Node *head = ptr;
+  lockPool64(pool);
   head->next = pool->head;
   pool->head = head;
+  unlockPool64(pool);
   return true;
 }
 
@@ -91,7 +110,23 @@ void *calloc(size_t __count, size_t __size) {
   return je_calloc(__count, __size);
 }
 
-void *realloc(void *__ptr, size_t __size) { return je_realloc(__ptr, __size); }
+void *realloc(void *__ptr, size_t __size) {
+  struct Pool64 *pool = getPool64();
+  void *poolBegin = &pool->chunks;
+  void *poolEnd = ((void *)&pool->chunks) + sizeof(struct Chunk64[CHUNKS]);
+  if (__ptr < poolBegin || poolEnd <= __ptr) {
+    return je_realloc(__ptr, __size);
+  }
+
+  // Pool chunks cannot grow in place; move the block out of the pool.
+  void *mem = je_malloc(__size > CHUNKSIZE ? __size : CHUNKSIZE);
+  if (mem == NULL) {
+    return NULL;
+  }
+  memcpy(mem, __ptr, __size < CHUNKSIZE ? __size : CHUNKSIZE);
+  freeFromPool64(__ptr);
+  return mem;
+}
 
 void free(void *ptr) {
   if (freeFromPool(ptr)) {
@@ -0,0 +1,537 @@
+#include "apply_changes.h"
+
+#include "import.h"
+#include "location_store.h"
+#include "metrics.h"
+#include "osc.h"
+#include "pragma_profile.h"
+#include "schema.h"
+#include "spatial_index.h"
+#include "string_dict.h"
+#include "timing.h"
+#include "vocabulary.h"
+
+#include <assert.h>
+#include <readosm.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <string.h>
+
+// --apply-changes: the statements removing an element before its new
+// version is inserted, or for good on a delete. ?1 is the element ID. The
+// node statements get the new location in ?2 and ?3, NULL for a delete;
+// nodes that appear, disappear or move are recorded so the extents of
+// their ways can be recomputed.
+static const struct TableDefinition applyNodeDefinitions[] = {
+    {"INSERT OR IGNORE INTO temp.apply_moved_nodes SELECT ?1 "
+     "WHERE NOT EXISTS (SELECT 1 FROM nodes WHERE id = ?1 "
+     "AND latitude IS ?2 AND longitude IS ?3);",
+     LAYOUT_SPATIAL_INDEX, LAYOUT_COMPACT_NODES},
+    {"INSERT OR IGNORE INTO temp.apply_moved_nodes SELECT ?1 "
+     "WHERE NOT EXISTS (SELECT 1 FROM nodes WHERE id = ?1 "
+     "AND lat IS ?2 AND lon IS ?3);",
+     LAYOUT_SPATIAL_INDEX | LAYOUT_COMPACT_NODES},
+    {"DELETE FROM node_tags WHERE node_id = ?1;", 0, LAYOUT_INTERNED_TAGS},
+    {"DELETE FROM node_tag_ids WHERE node_id = ?1;", LAYOUT_INTERNED_TAGS},
+    {"DELETE FROM node_names WHERE node_id = ?1;"},
+    {"DELETE FROM node_rtree WHERE id = ?1;", LAYOUT_SPATIAL_INDEX},
+    {"DELETE FROM nodes WHERE id = ?1;"},
+};
+
+static const struct TableDefinition applyWayDefinitions[] = {
+    {"INSERT INTO temp.apply_way_nodes "
+     "SELECT u.id FROM ways w, unpack_ids(w.nodes) u WHERE w.id = ?1;",
+     LAYOUT_PACKED_WAY_NODES},
+    {"INSERT OR IGNORE INTO temp.apply_ways VALUES (?1);"},
+    {"DELETE FROM way_tags WHERE way_id = ?1;", 0, LAYOUT_INTERNED_TAGS},
+    {"DELETE FROM way_tag_ids WHERE way_id = ?1;", LAYOUT_INTERNED_TAGS},
+    {"DELETE FROM way_nodes WHERE way_id = ?1;", 0, LAYOUT_PACKED_WAY_NODES},
+    {"DELETE FROM ways WHERE id = ?1;"},
+};
+
+static const struct TableDefinition applyRelationDefinitions[] = {
+    {"DELETE FROM relation_tags WHERE relation_id = ?1;", 0,
+     LAYOUT_INTERNED_TAGS},
+    {"DELETE FROM relation_tag_ids WHERE relation_id = ?1;",
+     LAYOUT_INTERNED_TAGS},
+    {"DELETE FROM relation_members WHERE relation_id = ?1;"},
+    {"DELETE FROM relations WHERE id = ?1;"},
+};
+
+// The IDs touched by the change file and the names it removed and added.
+// node_names is filled by insertNode while its trigger is dropped, so the
+// temporary triggers see every name exactly once.
+static const struct TableDefinition applySetupDefinitions[] = {
+    {"CREATE TEMP TABLE apply_ways (id INTEGER PRIMARY KEY);"},
+    {"CREATE TEMP TABLE apply_way_nodes (node_id INTEGER);",
+     LAYOUT_PACKED_WAY_NODES},
+    {"CREATE TEMP TABLE apply_moved_nodes (id INTEGER PRIMARY KEY);",
+     LAYOUT_SPATIAL_INDEX},
+    {"CREATE TEMP TABLE apply_removed_names (name TEXT);"},
+    {"CREATE TEMP TABLE apply_added_names (name TEXT);"},
+    {"CREATE TEMP TRIGGER apply_removed_names AFTER DELETE ON main.node_names "
+     "BEGIN"
+     "   INSERT INTO apply_removed_names VALUES (old.name);"
+     "END;"},
+    {"CREATE TEMP TRIGGER apply_added_names AFTER INSERT ON main.node_names "
+     "BEGIN"
+     "   INSERT INTO apply_added_names VALUES (new.name);"
+     "END;"},
+};
+
+// Brings node_ways and way_rtree up to date for the touched ways only. The
+// node_ways lists of the nodes the touched ways had or have are rebuilt
+// from their other ways plus the new node lists.
+static const struct TableDefinition applyDerivedDefinitions[] = {
+    {"INSERT INTO temp.apply_way_nodes "
+     "SELECT u.id FROM temp.apply_ways a JOIN ways w ON w.id = a.id, "
+     "unpack_ids(w.nodes) u;",
+     LAYOUT_PACKED_WAY_NODES},
+    {"CREATE TEMP TABLE apply_node_ways AS "
+     "SELECT node_id, pack_sorted_ids(way_id) AS way_ids FROM ("
+     "  SELECT n.node_id, u.id AS way_id FROM node_ways n, "
+     "  unpack_ids(n.way_ids) u "
+     "  WHERE n.node_id IN (SELECT node_id FROM temp.apply_way_nodes) "
+     "  AND u.id NOT IN (SELECT id FROM temp.apply_ways) "
+     "  UNION ALL "
+     "  SELECT u.id, w.id FROM temp.apply_ways a JOIN ways w ON w.id = a.id, "
+     "  unpack_ids(w.nodes) u"
+     ") GROUP BY node_id;",
+     LAYOUT_PACKED_WAY_NODES},
+    {"DELETE FROM node_ways "
+     "WHERE node_id IN (SELECT node_id FROM temp.apply_way_nodes);",
+     LAYOUT_PACKED_WAY_NODES},
+    {"INSERT INTO node_ways(node_id, way_ids) "
+     "SELECT node_id, way_ids FROM temp.apply_node_ways;",
+     LAYOUT_PACKED_WAY_NODES},
+
+    // Ways whose nodes moved have new extents as well.
+    {"INSERT OR IGNORE INTO temp.apply_ways "
+     "SELECT u.id FROM node_ways n, unpack_ids(n.way_ids) u "
+     "WHERE n.node_id IN (SELECT id FROM temp.apply_moved_nodes);",
+     LAYOUT_SPATIAL_INDEX | LAYOUT_PACKED_WAY_NODES},
+    {"INSERT OR IGNORE INTO temp.apply_ways "
+     "SELECT way_id FROM way_nodes "
+     "WHERE node_id IN (SELECT id FROM temp.apply_moved_nodes);",
+     LAYOUT_SPATIAL_INDEX, LAYOUT_PACKED_WAY_NODES},
+    {"DELETE FROM way_rtree WHERE id IN (SELECT id FROM temp.apply_ways);",
+     LAYOUT_SPATIAL_INDEX},
+    // Rounded through 1e-7 degrees like the staged extents of an import.
+    {"INSERT INTO way_rtree "
+     "SELECT w.way_id, min(degrees_to_e7(n.latitude)) / 1e7, "
+     "max(degrees_to_e7(n.latitude)) / 1e7, "
+     "min(degrees_to_e7(n.longitude)) / 1e7, "
+     "max(degrees_to_e7(n.longitude)) / 1e7 "
+     "FROM temp.apply_ways a JOIN way_nodes w ON w.way_id = a.id "
+     "JOIN nodes n ON n.id = w.node_id GROUP BY w.way_id;",
+     LAYOUT_SPATIAL_INDEX, LAYOUT_COMPACT_NODES},
+    {"INSERT INTO way_rtree "
+     "SELECT w.way_id, min(n.lat) / 1e7, max(n.lat) / 1e7, "
+     "min(n.lon) / 1e7, max(n.lon) / 1e7 "
+     "FROM temp.apply_ways a JOIN way_nodes w ON w.way_id = a.id "
+     "JOIN nodes n ON n.id = w.node_id GROUP BY w.way_id;",
+     LAYOUT_SPATIAL_INDEX | LAYOUT_COMPACT_NODES},
+};
+
+#define APPLY_MAX_STATEMENTS 8
+
+struct ApplyStatements {
+  sqlite3_stmt *stmts[APPLY_MAX_STATEMENTS];
+  int count;
+};
+
+struct ApplyContext {
+  struct OsmParseContext stats;
+  int layout;
+  struct ApplyStatements nodeStatements;
+  struct ApplyStatements wayStatements;
+  struct ApplyStatements relationStatements;
+  // Staged node_rtree entries of a node changed twice in one file.
+  sqlite3_stmt *unstageNodeStmt;
+  // Elements seen so far, as "n123", "w123" and "r123". The batches are
+  // flushed before an element is removed again, so no buffered row of its
+  // earlier version survives.
+  struct StringDict touched;
+  long long created;
+  long long modified;
+  long long deleted;
+};
+
+static int prepareApplyStatements(sqlite3 *handle, int layout,
+                                  const struct TableDefinition *definitions,
+                                  int count,
+                                  struct ApplyStatements *statements) {
+  statements->count = 0;
+  for (int i = 0; i < count; ++i) {
+    if (!inLayout(layout, definitions[i].required, definitions[i].excluded)) {
+      continue;
+    }
+    assert(statements->count < APPLY_MAX_STATEMENTS);
+    int ret = sqlite3_prepare_v2(handle, definitions[i].query, -1,
+                                 &statements->stmts[statements->count], NULL);
+    if (ret != SQLITE_OK) {
+      fprintf(stderr, "Failed to prepare \"%s\": %s\n", definitions[i].query,
+              sqlite3_errmsg(handle));
+      return ret;
+    }
+    statements->count++;
+  }
+  return SQLITE_OK;
+}
+
+static void finalizeApplyStatements(struct ApplyStatements *statements) {
+  for (int i = 0; i < statements->count; ++i) {
+    sqlite3_finalize(statements->stmts[i]);
+  }
+  statements->count = 0;
+}
+
+// Runs the statements for id. With node set, the statements taking three
+// parameters also get its location.
+static int runApplyStatements(struct ApplyStatements *statements,
+                              long long id, int compact,
+                              const readosm_node *node) {
+  int ret;
+  for (int i = 0; i < statements->count; ++i) {
+    sqlite3_stmt *stmt = statements->stmts[i];
+    sqlite3_bind_int64(stmt, 1, id);
+    if (node != NULL && sqlite3_bind_parameter_count(stmt) == 3) {
+      bindNodeCoordinate(stmt, 2, compact, node->latitude);
+      bindNodeCoordinate(stmt, 3, compact, node->longitude);
+    }
+    if ((ret = stepStatement(stmt)) != SQLITE_OK) {
+      return ret;
+    }
+  }
+  return SQLITE_OK;
+}
+
+static int flushApplyBatches(struct ApplyContext *apply) {
+  struct OsmParseContext *stats = &apply->stats;
+  int ret;
+  if ((ret = flushInsertNodeContext(&stats->insertNodeContext)) !=
+          SQLITE_OK ||
+      (ret = flushInsertWayContext(&stats->insertWayContext)) != SQLITE_OK ||
+      (ret = flushInsertRelationContext(&stats->insertRelationContext)) !=
+          SQLITE_OK) {
+    return ret;
+  }
+  if (stats->insertNodeContext.spatial != NULL &&
+      (ret = spatialIndexFlush(stats->insertNodeContext.spatial)) !=
+          SQLITE_OK) {
+    return ret;
+  }
+  return SQLITE_OK;
+}
+
+// Removes the stored version of an element, type 'n', 'w' or 'r'. node is
+// the new version of a node, NULL for a delete.
+static int removeElement(struct ApplyContext *apply, char type, long long id,
+                         struct ApplyStatements *statements,
+                         const readosm_node *node) {
+  char key[32];
+  long long seen;
+  snprintf(key, sizeof(key), "%c%lld", type, id);
+  if (stringDictFind(&apply->touched, key, &seen)) {
+    int ret;
+    if ((ret = flushApplyBatches(apply)) != SQLITE_OK) {
+      return ret;
+    }
+    if (type == 'n' && apply->unstageNodeStmt != NULL) {
+      sqlite3_bind_int64(apply->unstageNodeStmt, 1, id);
+      if ((ret = stepStatement(apply->unstageNodeStmt)) != SQLITE_OK) {
+        return ret;
+      }
+    }
+  } else if (stringDictInsert(&apply->touched, key, 0) != 0) {
+    return SQLITE_NOMEM;
+  }
+  return runApplyStatements(statements, id,
+                            apply->layout & LAYOUT_COMPACT_NODES, node);
+}
+
+static void countAction(struct ApplyContext *apply, enum OscAction action) {
+  switch (action) {
+  case OSC_CREATE:
+    apply->created++;
+    break;
+  case OSC_MODIFY:
+    apply->modified++;
+    break;
+  case OSC_DELETE:
+    apply->deleted++;
+    break;
+  }
+}
+
+static int apply_node(const void *user_data, enum OscAction action,
+                      const readosm_node *node) {
+  struct ApplyContext *apply = (struct ApplyContext *)user_data;
+  struct OsmParseContext *stats = &apply->stats;
+  int ret;
+  if ((ret = removeElement(apply, 'n', node->id, &apply->nodeStatements,
+                           action == OSC_DELETE ? NULL : node)) !=
+          SQLITE_OK ||
+      (action != OSC_DELETE &&
+       (ret = insertNode(&stats->insertNodeContext, node)) != SQLITE_OK)) {
+    fprintf(stderr, "Failed to apply node %lld: %s\n", node->id,
+            sqlite3_errmsg(stats->dbHandle));
+    return READOSM_ABORT;
+  }
+  countAction(apply, action);
+  stats->nodes++;
+  maybePrintStats(stats, stats->nodes);
+  maybeEmitMetrics(stats);
+  return READOSM_OK;
+}
+
+static int apply_way(const void *user_data, enum OscAction action,
+                     const readosm_way *way) {
+  struct ApplyContext *apply = (struct ApplyContext *)user_data;
+  struct OsmParseContext *stats = &apply->stats;
+  int ret;
+  if ((ret = removeElement(apply, 'w', way->id, &apply->wayStatements,
+                           NULL)) != SQLITE_OK ||
+      (action != OSC_DELETE &&
+       (ret = insertWay(&stats->insertWayContext, way)) != SQLITE_OK)) {
+    fprintf(stderr, "Failed to apply way %lld: %s\n", way->id,
+            sqlite3_errmsg(stats->dbHandle));
+    return READOSM_ABORT;
+  }
+  countAction(apply, action);
+  stats->ways++;
+  maybePrintStats(stats, stats->ways);
+  maybeEmitMetrics(stats);
+  return READOSM_OK;
+}
+
+static int apply_relation(const void *user_data, enum OscAction action,
+                          const readosm_relation *relation) {
+  struct ApplyContext *apply = (struct ApplyContext *)user_data;
+  struct OsmParseContext *stats = &apply->stats;
+  int ret;
+  if ((ret = removeElement(apply, 'r', relation->id,
+                           &apply->relationStatements, NULL)) != SQLITE_OK ||
+      (action != OSC_DELETE &&
+       (ret = insertRelation(&stats->insertRelationContext, relation)) !=
+           SQLITE_OK)) {
+    fprintf(stderr, "Failed to apply relation %lld: %s\n", relation->id,
+            sqlite3_errmsg(stats->dbHandle));
+    return READOSM_ABORT;
+  }
+  countAction(apply, action);
+  stats->relation++;
+  maybePrintStats(stats, stats->relation);
+  maybeEmitMetrics(stats);
+  return READOSM_OK;
+}
+
+int runApplyChanges(const struct ImportOptions *options) {
+  int ret;
+  const char *errMsg;
+  sqlite3 *dbHandle = NULL;
+  struct ApplyContext apply;
+  memset(&apply, 0, sizeof(apply));
+  stringDictInit(&apply.touched);
+  struct OsmParseContext *stats = &apply.stats;
+
+  if ((ret = sqlite3_open_v2(options->outputPath, &dbHandle,
+                             SQLITE_OPEN_READWRITE, NULL)) != SQLITE_OK) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Fail;
+  }
+
+  int existingTables, hasLayout;
+  if ((ret = hasSchemaObject(dbHandle, "table", "nodes", &existingTables)) !=
+          SQLITE_OK ||
+      (ret = hasSchemaObject(dbHandle, "table", "schema_layout",
+                             &hasLayout)) != SQLITE_OK) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Fail;
+  }
+  if (!existingTables) {
+    ret = SQLITE_ERROR;
+    errMsg = "Changes can only be applied to an imported database";
+    goto Fail;
+  }
+  if (hasLayout && (ret = loadLayout(dbHandle, &apply.layout)) != SQLITE_OK) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Fail;
+  }
+
+  if ((ret = pragmaProfileApply(dbHandle, options->profile)) != SQLITE_OK) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Fail;
+  }
+
+  // The per-ID deletes rely on the secondary indexes, which an interrupted
+  // deferred import may not have built.
+  double started = monotonicSeconds();
+  if ((ret = createIndexes(dbHandle, apply.layout, 0)) != SQLITE_OK ||
+      (ret = sqlite3_exec(dbHandle, "BEGIN TRANSACTION", NULL, NULL, NULL)) !=
+          SQLITE_OK ||
+      (ret = installTriggers(dbHandle, apply.layout)) != SQLITE_OK ||
+      (ret = sqlite3_exec(dbHandle, "DROP TRIGGER node_names;", NULL, NULL,
+                          NULL)) != SQLITE_OK ||
+      (ret = runTableDefinitions(dbHandle, apply.layout,
+                                 applySetupDefinitions,
+                                 sizeof(applySetupDefinitions) /
+                                     sizeof(applySetupDefinitions[0]))) !=
+          SQLITE_OK) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Fail;
+  }
+
+  stats->dbHandle = dbHandle;
+  struct TagDictionary *tags = NULL;
+  if (apply.layout & LAYOUT_INTERNED_TAGS) {
+    tags = &stats->tagDictionary;
+    if ((ret = initTagDictionary(dbHandle, tags)) != SQLITE_OK) {
+      errMsg = sqlite3_errmsg(dbHandle);
+      goto Fail;
+    }
+  }
+
+  // Way extents are recomputed in SQL once all nodes are written, so only
+  // the nodes go through the spatial index. A location store is kept up
+  // to date when one is given.
+  struct SpatialIndex *spatial = NULL;
+  if (apply.layout & LAYOUT_SPATIAL_INDEX) {
+    spatial = &stats->spatialIndex;
+    struct LocationStore *locations = NULL;
+    if (options->locationStorePath != NULL) {
+      locations = &stats->locationStore;
+      if (locationStoreOpen(locations, options->locationStorePath) != 0) {
+        ret = SQLITE_CANTOPEN;
+        errMsg = "Failed to open the location store";
+        goto Fail;
+      }
+    }
+    if ((ret = spatialIndexInit(spatial, dbHandle, locations,
+                                apply.layout & LAYOUT_COMPACT_NODES)) !=
+            SQLITE_OK ||
+        (ret = sqlite3_prepare_v2(
+             dbHandle, "DELETE FROM node_rtree_staging WHERE id = ?1;", -1,
+             &apply.unstageNodeStmt, NULL)) != SQLITE_OK) {
+      errMsg = sqlite3_errmsg(dbHandle);
+      goto Fail;
+    }
+  }
+
+  if ((ret = initInsertNodeContext(dbHandle, tags, spatial, apply.layout,
+                                   &stats->insertNodeContext)) != SQLITE_OK ||
+      (ret = initInsertWayContext(dbHandle, tags, NULL,
+                                  apply.layout & LAYOUT_PACKED_WAY_NODES,
+                                  &stats->insertWayContext)) != SQLITE_OK ||
+      (ret = initInsertRelationContext(dbHandle, tags,
+                                       &stats->insertRelationContext)) !=
+          SQLITE_OK) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Fail;
+  }
+
+  if ((ret = prepareApplyStatements(
+           dbHandle, apply.layout, applyNodeDefinitions,
+           sizeof(applyNodeDefinitions) / sizeof(applyNodeDefinitions[0]),
+           &apply.nodeStatements)) != SQLITE_OK ||
+      (ret = prepareApplyStatements(
+           dbHandle, apply.layout, applyWayDefinitions,
+           sizeof(applyWayDefinitions) / sizeof(applyWayDefinitions[0]),
+           &apply.wayStatements)) != SQLITE_OK ||
+      (ret = prepareApplyStatements(
+           dbHandle, apply.layout, applyRelationDefinitions,
+           sizeof(applyRelationDefinitions) /
+               sizeof(applyRelationDefinitions[0]),
+           &apply.relationStatements)) != SQLITE_OK) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Fail;
+  }
+
+  if ((ret = oscParse(options->inputPath, &apply, apply_node, apply_way,
+                      apply_relation)) != READOSM_OK) {
+    errMsg = "Fail to parse osmChange";
+    goto Fail;
+  }
+  if ((ret = flushApplyBatches(&apply)) != SQLITE_OK) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Fail;
+  }
+  metricsAddPhase(METRICS_PHASE_LOAD, monotonicSeconds() - started);
+
+  double phaseStarted = monotonicSeconds();
+  if ((ret = runTableDefinitions(dbHandle, apply.layout,
+                                 applyDerivedDefinitions,
+                                 sizeof(applyDerivedDefinitions) /
+                                     sizeof(applyDerivedDefinitions[0]))) !=
+          SQLITE_OK ||
+      (spatial != NULL && (ret = spatialIndexBuild(dbHandle)) != SQLITE_OK)) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Fail;
+  }
+  metricsAddPhase(METRICS_PHASE_SPATIAL_INDEX,
+                  monotonicSeconds() - phaseStarted);
+
+  struct VocabularyStats vocabulary;
+  phaseStarted = monotonicSeconds();
+  if ((ret = vocabularyUpdate(dbHandle, "named_nodes_spellfix",
+                              "SELECT name FROM temp.apply_removed_names;",
+                              "SELECT name FROM temp.apply_added_names;",
+                              &vocabulary)) != SQLITE_OK) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Fail;
+  }
+  metricsAddPhase(METRICS_PHASE_VOCABULARY, monotonicSeconds() - phaseStarted);
+
+  if ((ret = installTriggers(dbHandle, apply.layout)) != SQLITE_OK ||
+      (ret = sqlite3_exec(dbHandle, "END TRANSACTION", NULL, NULL, NULL)) !=
+          SQLITE_OK ||
+      (ret = pragmaProfileRestore(dbHandle, options->profile)) != SQLITE_OK) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Fail;
+  }
+
+  finalizeApplyStatements(&apply.nodeStatements);
+  finalizeApplyStatements(&apply.wayStatements);
+  finalizeApplyStatements(&apply.relationStatements);
+  sqlite3_finalize(apply.unstageNodeStmt);
+  if ((ret = finalizeInsertNodeContext(&stats->insertNodeContext)) !=
+          SQLITE_OK ||
+      (ret = finalizeInsertWayContext(&stats->insertWayContext)) !=
+          SQLITE_OK ||
+      (ret = finalizeInsertRelationContext(&stats->insertRelationContext)) !=
+          SQLITE_OK ||
+      (tags != NULL && (ret = finalizeTagDictionary(tags)) != SQLITE_OK) ||
+      (spatial != NULL && (ret = spatialIndexFinalize(spatial)) != SQLITE_OK)) {
+    errMsg = "Failed to finalize statements";
+    goto Fail;
+  }
+  if (spatial != NULL && spatial->locations != NULL) {
+    locationStoreClose(spatial->locations);
+  }
+
+  struct MetricsProgress progress;
+  metricsProgress(stats, &progress);
+  metricsFinish(dbHandle, &progress, "ok");
+  sqlite3_close(dbHandle);
+  stringDictFree(&apply.touched);
+
+  fprintf(stdout,
+          "Applied: created=%lld modified=%lld deleted=%lld in %.2fs "
+          "(%lld vocabulary words updated)\n",
+          apply.created, apply.modified, apply.deleted,
+          monotonicSeconds() - started, vocabulary.words);
+  printStats(stats);
+  printMemoryStats();
+  printWriteBehindStats();
+  return 0;
+
+Fail:
+  // Nothing of the change file is committed, so it can be applied again.
+  fprintf(stderr, "%s\n", errMsg);
+  struct MetricsProgress failedProgress;
+  metricsProgress(stats, &failedProgress);
+  metricsFinish(dbHandle, &failedProgress, "failed");
+  sqlite3_close(dbHandle);
+  stringDictFree(&apply.touched);
+  return ret;
+}
@@ -0,0 +1,12 @@
+#ifndef APPLY_CHANGES_H
+#define APPLY_CHANGES_H
+
+#include "import.h"
+
+// --apply-changes: applies an osmChange file to an existing database in a
+// single transaction. Changed elements are removed and written again with
+// the import statements; node_ways, the R*Trees, the full-text index and
+// the spellfix1 vocabulary are only updated for the touched IDs.
+int runApplyChanges(const struct ImportOptions *options);
+
+#endif
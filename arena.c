@@ -0,0 +1,93 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN 8
+
+struct ArenaChunk {
+  struct ArenaChunk *next;
+  size_t size;
+  size_t used;
+  char data[];
+};
+
+static struct ArenaChunk *newChunk(size_t size) {
+  struct ArenaChunk *chunk = malloc(sizeof(struct ArenaChunk) + size);
+  if (chunk == NULL) {
+    return NULL;
+  }
+  chunk->next = NULL;
+  chunk->size = size;
+  chunk->used = 0;
+  return chunk;
+}
+
+void arenaInit(struct Arena *arena, size_t chunkSize) {
+  arena->head = NULL;
+  arena->current = NULL;
+  arena->chunkSize = chunkSize;
+}
+
+void *arenaAlloc(struct Arena *arena, size_t size) {
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  struct ArenaChunk *chunk = arena->current;
+  while (chunk != NULL && chunk->size - chunk->used < size) {
+    // Chunks after current were emptied by arenaReset; skip the ones that
+    // are too small for this request.
+    chunk = chunk->next;
+    if (chunk != NULL) {
+      chunk->used = 0;
+    }
+  }
+
+  if (chunk == NULL) {
+    size_t chunkSize = size > arena->chunkSize ? size : arena->chunkSize;
+    if ((chunk = newChunk(chunkSize)) == NULL) {
+      return NULL;
+    }
+    if (arena->current == NULL) {
+      arena->head = chunk;
+    } else {
+      // Splice after current so the reusable chunks remain reachable.
+      chunk->next = arena->current->next;
+      arena->current->next = chunk;
+    }
+  }
+
+  arena->current = chunk;
+  void *mem = chunk->data + chunk->used;
+  chunk->used += size;
+  return mem;
+}
+
+const char *arenaStrdup(struct Arena *arena, const char *str) {
+  if (str == NULL) {
+    return NULL;
+  }
+  size_t len = strlen(str) + 1;
+  char *copy = arenaAlloc(arena, len);
+  if (copy != NULL) {
+    memcpy(copy, str, len);
+  }
+  return copy;
+}
+
+void arenaReset(struct Arena *arena) {
+  arena->current = arena->head;
+  if (arena->head != NULL) {
+    arena->head->used = 0;
+  }
+}
+
+void arenaFree(struct Arena *arena) {
+  struct ArenaChunk *chunk = arena->head;
+  while (chunk != NULL) {
+    struct ArenaChunk *next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  arena->head = NULL;
+  arena->current = NULL;
+}
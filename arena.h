@@ -0,0 +1,23 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct ArenaChunk;
+
+// Bump allocator for short-lived element copies. Memory is handed out from
+// a list of chunks that are kept across arenaReset so a recycled arena stops
+// touching malloc once it has grown to its working size.
+struct Arena {
+  struct ArenaChunk *head;
+  struct ArenaChunk *current;
+  size_t chunkSize;
+};
+
+void arenaInit(struct Arena *arena, size_t chunkSize);
+void *arenaAlloc(struct Arena *arena, size_t size);
+const char *arenaStrdup(struct Arena *arena, const char *str);
+void arenaReset(struct Arena *arena);
+void arenaFree(struct Arena *arena);
+
+#endif
@@ -0,0 +1,169 @@
+#include "batch_insert.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const int batchWidths[BATCH_INSERT_WIDTHS] = {BATCH_INSERT_MAX_ROWS, 64,
+                                                     8, 1};
+
+static int prepareBatchStatement(struct BatchInsert *batch,
+                                 const char *insertPrefix, int rows,
+                                 sqlite3_stmt **stmt) {
+  // "(?,?,?)," per row plus the prefix and " VALUES ".
+  size_t rowLength = 2 * batch->columnCount + 2;
+  size_t length = strlen(insertPrefix) + 9 + rowLength * rows;
+  char *query = malloc(length);
+  if (query == NULL) {
+    return SQLITE_NOMEM;
+  }
+
+  char *out = query + sprintf(query, "%s VALUES ", insertPrefix);
+  for (int row = 0; row < rows; ++row) {
+    *out++ = row == 0 ? '(' : ',';
+    if (row != 0) {
+      *out++ = '(';
+    }
+    for (int column = 0; column < batch->columnCount; ++column) {
+      if (column != 0) {
+        *out++ = ',';
+      }
+      *out++ = '?';
+    }
+    *out++ = ')';
+  }
+  *out = '\0';
+
+  int ret = sqlite3_prepare_v2(batch->dbHandle, query, -1, stmt, NULL);
+  if (ret != SQLITE_OK) {
+    fprintf(stderr, "batchInsertInit: Failed to prepare %d row insert: %s\n",
+            rows, sqlite3_errmsg(batch->dbHandle));
+  }
+  free(query);
+  return ret;
+}
+
+int batchInsertInit(struct BatchInsert *batch, sqlite3 *db,
+                    const char *insertPrefix, const char *columnTypes) {
+  memset(batch, 0, sizeof(*batch));
+  batch->dbHandle = db;
+  batch->columnTypes = columnTypes;
+  batch->columnCount = strlen(columnTypes);
+  arenaInit(&batch->arena, 64 * 1024);
+
+  batch->values = malloc(sizeof(struct BatchValue) * batch->columnCount *
+                         BATCH_INSERT_MAX_ROWS);
+  if (batch->values == NULL) {
+    return SQLITE_NOMEM;
+  }
+
+  int ret;
+  for (int i = 0; i < BATCH_INSERT_WIDTHS; ++i) {
+    if ((ret = prepareBatchStatement(batch, insertPrefix, batchWidths[i],
+                                     &batch->stmts[i])) != SQLITE_OK) {
+      return ret;
+    }
+  }
+
+  return SQLITE_OK;
+}
+
+static struct BatchValue *currentValue(struct BatchInsert *batch,
+                                       int column) {
+  return &batch->values[batch->rowCount * batch->columnCount + column];
+}
+
+void batchInsertInt64(struct BatchInsert *batch, int column, long long value) {
+  currentValue(batch, column)->integer = value;
+}
+
+int batchInsertText(struct BatchInsert *batch, int column, const char *value) {
+  const char *copy = arenaStrdup(&batch->arena, value);
+  currentValue(batch, column)->text = copy;
+  return copy == NULL && value != NULL ? SQLITE_NOMEM : SQLITE_OK;
+}
+
+static int executeRows(struct BatchInsert *batch, sqlite3_stmt *stmt,
+                       int firstRow, int rows) {
+  int ret;
+  int param = 1;
+  const struct BatchValue *value =
+      &batch->values[firstRow * batch->columnCount];
+  long long begin = metricsBegin();
+
+  for (int row = 0; row < rows; ++row) {
+    for (int column = 0; column < batch->columnCount; ++column, ++value) {
+      if (batch->columnTypes[column] == 'i') {
+        ret = sqlite3_bind_int64(stmt, param++, value->integer);
+      } else if (value->text != NULL) {
+        ret = sqlite3_bind_text(stmt, param++, value->text, -1, SQLITE_STATIC);
+      } else {
+        ret = sqlite3_bind_null(stmt, param++);
+      }
+
+      if (ret != SQLITE_OK) {
+        fprintf(stderr, "batchInsert: Failed to bind param %d\n", param - 1);
+        return ret;
+      }
+    }
+  }
+
+  metricsEnd(METRICS_PHASE_BIND, begin);
+
+  // Every parameter is rebound before the next step, so there is no need to
+  // clear bindings.
+  begin = metricsBegin();
+  ret = sqlite3_step(stmt);
+  metricsEndStep(begin, rows);
+  if (ret != SQLITE_DONE) {
+    fprintf(stderr, "batchInsert: Failed to step %d row insert\n", rows);
+    sqlite3_reset(stmt);
+    return ret;
+  }
+
+  return sqlite3_reset(stmt);
+}
+
+int batchInsertFlush(struct BatchInsert *batch) {
+  int ret;
+  int row = 0;
+
+  for (int i = 0; i < BATCH_INSERT_WIDTHS; ++i) {
+    while (batch->rowCount - row >= batchWidths[i]) {
+      if ((ret = executeRows(batch, batch->stmts[i], row, batchWidths[i])) !=
+          SQLITE_OK) {
+        return ret;
+      }
+      row += batchWidths[i];
+    }
+  }
+
+  batch->rowCount = 0;
+  arenaReset(&batch->arena);
+  return SQLITE_OK;
+}
+
+int batchInsertEndRow(struct BatchInsert *batch) {
+  if (++batch->rowCount == BATCH_INSERT_MAX_ROWS) {
+    return batchInsertFlush(batch);
+  }
+  return SQLITE_OK;
+}
+
+int batchInsertFinalize(struct BatchInsert *batch) {
+  int ret = SQLITE_OK;
+  for (int i = 0; i < BATCH_INSERT_WIDTHS; ++i) {
+    if (batch->stmts[i] != NULL) {
+      int stmtRet = sqlite3_finalize(batch->stmts[i]);
+      if (ret == SQLITE_OK) {
+        ret = stmtRet;
+      }
+      batch->stmts[i] = NULL;
+    }
+  }
+  free(batch->values);
+  batch->values = NULL;
+  arenaFree(&batch->arena);
+  return ret;
+}
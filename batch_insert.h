@@ -0,0 +1,46 @@
+#ifndef BATCH_INSERT_H
+#define BATCH_INSERT_H
+
+#include "arena.h"
+
+#include <sqlite3.h>
+
+#define BATCH_INSERT_WIDTHS 4
+#define BATCH_INSERT_MAX_ROWS 256
+
+struct BatchValue {
+  long long integer;
+  const char *text;
+};
+
+// Buffers rows for one table and writes them with multi-row
+// "INSERT ... VALUES (...),(...)" statements of 256, 64, 8 and 1 rows, so the
+// VDBE program, bind and reset overhead is paid per statement instead of per
+// row. Text values are copied, callers may reuse their buffers immediately.
+struct BatchInsert {
+  sqlite3 *dbHandle;
+  const char *columnTypes; // one of 'i' (int64) or 't' (text) per column
+  int columnCount;
+  int rowCount;
+  sqlite3_stmt *stmts[BATCH_INSERT_WIDTHS];
+  struct BatchValue *values;
+  struct Arena arena;
+};
+
+// insertPrefix is everything before VALUES, e.g.
+// "INSERT OR IGNORE INTO way_nodes(way_id, node_id)".
+int batchInsertInit(struct BatchInsert *batch, sqlite3 *db,
+                    const char *insertPrefix, const char *columnTypes);
+
+// Values are set column by column, then batchInsertEndRow completes the row
+// and writes the buffer out once it holds BATCH_INSERT_MAX_ROWS rows.
+// batchInsertText returns SQLITE_NOMEM if the copy could not be made; a
+// NULL value is bound as SQL NULL.
+void batchInsertInt64(struct BatchInsert *batch, int column, long long value);
+int batchInsertText(struct BatchInsert *batch, int column, const char *value);
+int batchInsertEndRow(struct BatchInsert *batch);
+
+int batchInsertFlush(struct BatchInsert *batch);
+int batchInsertFinalize(struct BatchInsert *batch);
+
+#endif
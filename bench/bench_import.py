@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Importer throughput benchmark, run by the bench_import target.
+
+Generates deterministic .osm and .osm.pbf inputs with osmgen, runs main over
+them with --metrics and reports elements per second for every phase. The
+first run records the rates as the baseline; later runs are compared to it
+and exit with status 1 if a phase is more than --tolerance percent slower.
+"""
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+
+# name, main arguments before the input, input format, writes a database
+CASES = [
+    ("parse_osm", ["--parse-only"], "osm", False),
+    ("parse_pbf", ["--parse-only"], "osm.pbf", False),
+    ("import_osm", [], "osm", True),
+    ("import_pbf", [], "osm.pbf", True),
+    ("import_pbf_bulk", ["--profile=bulk"], "osm.pbf", True),
+    ("import_pbf_spatial", ["--spatial-index"], "osm.pbf", True),
+]
+
+# Phases reported as elements per second of the input.
+PHASES = ["load", "parse", "indexes", "node_ways", "spatial_index", "names",
+          "vocabulary"]
+
+
+def generate(args, extension):
+    path = os.path.join(args.work_dir,
+                        "bench-%d-%d.%s" % (args.nodes, args.seed, extension))
+    if not os.path.exists(path):
+        subprocess.run([args.osmgen, "--nodes=%d" % args.nodes,
+                        "--seed=%d" % args.seed, path],
+                       check=True, stdout=subprocess.DEVNULL)
+    return path
+
+
+def run_case(args, flags, input_path, writes_database):
+    metrics_path = os.path.join(args.work_dir, "metrics.json")
+    database = os.path.join(args.work_dir, "bench.sqlite")
+    for path in (metrics_path, database, database + "-wal",
+                 database + "-shm"):
+        if os.path.exists(path):
+            os.remove(path)
+
+    command = [args.main, "--metrics=" + metrics_path] + flags + [input_path]
+    if writes_database:
+        command.append(database)
+    subprocess.run(command, check=True, stdout=subprocess.DEVNULL)
+
+    with open(metrics_path) as f:
+        final = [json.loads(line) for line in f][-1]
+    if final.get("status") != "ok":
+        sys.exit("%s did not finish" % " ".join(command))
+
+    elements = sum(final["elements"].values())
+    rates = {}
+    for phase in PHASES:
+        seconds = final["phases"][phase]
+        if seconds > 0:
+            rates[phase] = elements / seconds
+    return rates
+
+
+def best(runs):
+    rates = {}
+    for run in runs:
+        for phase, rate in run.items():
+            rates[phase] = max(rate, rates.get(phase, 0))
+    return rates
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--main", required=True)
+    parser.add_argument("--osmgen", required=True)
+    parser.add_argument("--work-dir", required=True)
+    parser.add_argument("--baseline", required=True)
+    parser.add_argument("--nodes", type=int, default=1000000)
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--repeat", type=int, default=1,
+                        help="runs per case, the fastest one counts")
+    parser.add_argument("--update-baseline", action="store_true")
+    parser.add_argument("--tolerance", type=float, default=10.0,
+                        help="slowdown in percent that fails the run as a "
+                             "regression")
+    args = parser.parse_args()
+
+    os.makedirs(args.work_dir, exist_ok=True)
+    inputs = {extension: generate(args, extension)
+              for extension in ("osm", "osm.pbf")}
+
+    results = {}
+    for name, flags, extension, writes_database in CASES:
+        runs = [run_case(args, flags, inputs[extension], writes_database)
+                for _ in range(args.repeat)]
+        results[name] = best(runs)
+
+    baseline = None
+    if os.path.exists(args.baseline) and not args.update_baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        if baseline.get("nodes") != args.nodes:
+            print("Baseline was recorded for %s nodes, not comparing" %
+                  baseline.get("nodes"))
+            baseline = None
+
+    regressions = 0
+    print("%-18s %-13s %14s %14s %8s" %
+          ("case", "phase", "elements/s", "baseline", "change"))
+    for name, rates in results.items():
+        for phase, rate in rates.items():
+            line = "%-18s %-13s %14.0f" % (name, phase, rate)
+            old = (baseline or {}).get("cases", {}).get(name, {}).get(phase)
+            if old:
+                change = 100.0 * (rate - old) / old
+                line += " %14.0f %+7.1f%%" % (old, change)
+                if change < -args.tolerance:
+                    line += "  regression"
+                    regressions += 1
+            print(line)
+
+    if baseline is None:
+        with open(args.baseline, "w") as f:
+            json.dump({"nodes": args.nodes, "cases": results}, f, indent=2)
+        print("Recorded baseline in %s" % args.baseline)
+    elif regressions:
+        print("%d phase(s) more than %.0f%% slower than the baseline" %
+              (regressions, args.tolerance))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,868 @@
+// Deterministic synthetic OSM data for bench_import. Elements are drawn
+// from a seeded generator independently of the output format, so an .osm
+// and an .osm.pbf written with the same options hold the same data.
+
+#include "string_dict.h"
+
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#define MAX_TAGS 16
+#define MAX_MEMBERS 64
+#define MAX_WAY_LENGTH 2000
+#define BLOCK_ELEMENTS 8000
+
+// 2020-01-01T00:00:00Z; timestamps spread over the following three years.
+#define TIMESTAMP_BASE 1577836800LL
+#define TIMESTAMP_RANGE (3LL * 365 * 24 * 3600)
+
+// Nodes stay inside this box, in 1e-7 degrees.
+#define MIN_LAT 470000000LL
+#define MAX_LAT 480000000LL
+#define MIN_LON 80000000LL
+#define MAX_LON 100000000LL
+
+struct GenOptions {
+  long long nodes;
+  long long ways;
+  long long relations;
+  uint64_t seed;
+  // Share of nodes with tags, and the tag count limit for any element.
+  int taggedPercent;
+  int maxTags;
+  int wayMin, wayMax;
+  int membersMin, membersMax;
+  const char *outputPath;
+};
+
+// splitmix64, so every platform generates the same file for a seed.
+static uint64_t rngState;
+
+static uint64_t rngNext(void) {
+  uint64_t z = (rngState += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// Uniform in [min, max].
+static long long rngRange(long long min, long long max) {
+  return min + (long long)(rngNext() % (uint64_t)(max - min + 1));
+}
+
+static int rngPercent(int percent) { return (int)(rngNext() % 100) < percent; }
+
+struct WeightedString {
+  const char *value;
+  int weight;
+};
+
+static const char *rngWeighted(const struct WeightedString *choices,
+                               int count) {
+  int total = 0;
+  for (int i = 0; i < count; ++i) {
+    total += choices[i].weight;
+  }
+  int pick = (int)(rngNext() % total);
+  for (int i = 0; i < count; ++i) {
+    if ((pick -= choices[i].weight) < 0) {
+      return choices[i].value;
+    }
+  }
+  return choices[count - 1].value;
+}
+
+#define COUNT(array) ((int)(sizeof(array) / sizeof(array[0])))
+#define WEIGHTED(array) rngWeighted(array, COUNT(array))
+
+// Skewed roughly like a city extract: few keys cover most tags.
+static const struct WeightedString nodeKeys[] = {
+    {"highway", 20}, {"name", 18},    {"amenity", 12},
+    {"shop", 8},     {"natural", 8},  {"addr:housenumber", 10},
+    {"addr:street", 10}, {"barrier", 5}, {"opening_hours", 4},
+    {"operator", 3}, {"source", 2},
+};
+
+static const struct WeightedString wayKeys[] = {
+    {"highway", 30}, {"building", 30}, {"name", 15},    {"surface", 8},
+    {"oneway", 6},   {"landuse", 5},   {"maxspeed", 4}, {"lanes", 2},
+};
+
+static const struct WeightedString highwayValues[] = {
+    {"residential", 30}, {"service", 25}, {"footway", 15},
+    {"crossing", 10},    {"bus_stop", 8}, {"primary", 5},
+    {"secondary", 4},    {"track", 3},
+};
+
+static const struct WeightedString amenityValues[] = {
+    {"bench", 20},     {"parking", 15}, {"restaurant", 12}, {"cafe", 10},
+    {"school", 5},     {"pharmacy", 4}, {"bank", 4},        {"fuel", 3},
+    {"post_box", 8},   {"toilets", 4},
+};
+
+static const struct WeightedString genericValues[] = {
+    {"yes", 40}, {"no", 10}, {"house", 15}, {"asphalt", 10},
+    {"tree", 10}, {"gate", 5}, {"grass", 5}, {"survey", 5},
+};
+
+static const char *nameWords[] = {
+    "Linden",  "Oak",     "Mill",   "Church", "Station", "Market",
+    "Garden",  "River",   "Castle", "Bridge", "Forest",  "Meadow",
+    "Spring",  "Harbour", "Hill",   "Lake",   "Stone",   "Valley",
+    "Zürich",  "Bäckerei", "Café",  "Müller", "Straße",  "Église",
+};
+
+static const char *nameKinds[] = {"Street", "Road",  "Lane",   "Square",
+                                  "Park",   "House", "School", "Bakery"};
+
+struct GenTag {
+  const char *key;
+  const char *value;
+  char buffer[64];
+};
+
+struct GenMember {
+  int type; // 0 node, 1 way, 2 relation
+  long long ref;
+  const char *role;
+};
+
+enum GenType { GEN_NODE, GEN_WAY, GEN_RELATION };
+
+struct GenElement {
+  enum GenType type;
+  long long id;
+  int version;
+  long long changeset;
+  int uid;
+  char user[16];
+  long long timestamp;
+  long long lat, lon;
+  int tagCount;
+  struct GenTag tags[MAX_TAGS];
+  int refCount;
+  long long refs[MAX_WAY_LENGTH];
+  int memberCount;
+  struct GenMember members[MAX_MEMBERS];
+};
+
+static const char *memberTypes[] = {"node", "way", "relation"};
+
+static void genName(struct GenTag *tag) {
+  snprintf(tag->buffer, sizeof(tag->buffer), "%s %s",
+           nameWords[rngNext() % COUNT(nameWords)],
+           nameKinds[rngNext() % COUNT(nameKinds)]);
+  tag->value = tag->buffer;
+}
+
+static void genValue(struct GenTag *tag) {
+  const char *key = tag->key;
+  if (strcmp(key, "name") == 0 || strcmp(key, "addr:street") == 0) {
+    genName(tag);
+  } else if (strcmp(key, "addr:housenumber") == 0 ||
+             strcmp(key, "maxspeed") == 0 || strcmp(key, "lanes") == 0) {
+    snprintf(tag->buffer, sizeof(tag->buffer), "%lld", rngRange(1, 120));
+    tag->value = tag->buffer;
+  } else if (strcmp(key, "highway") == 0) {
+    tag->value = WEIGHTED(highwayValues);
+  } else if (strcmp(key, "amenity") == 0) {
+    tag->value = WEIGHTED(amenityValues);
+  } else {
+    tag->value = WEIGHTED(genericValues);
+  }
+}
+
+static int hasKey(const struct GenElement *e, const char *key) {
+  for (int i = 0; i < e->tagCount; ++i) {
+    if (strcmp(e->tags[i].key, key) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void genTags(struct GenElement *e, const struct WeightedString *keys,
+                    int keyCount, int count) {
+  e->tagCount = 0;
+  // Bounded retries keep the keys of an element distinct.
+  for (int attempt = 0; e->tagCount < count && attempt < 4 * count;
+       ++attempt) {
+    const char *key = rngWeighted(keys, keyCount);
+    if (hasKey(e, key)) {
+      continue;
+    }
+    struct GenTag *tag = &e->tags[e->tagCount++];
+    tag->key = key;
+    genValue(tag);
+  }
+}
+
+static void genInfo(struct GenElement *e, long long id) {
+  e->id = id;
+  e->version = (int)rngRange(1, 5);
+  e->changeset = rngRange(1, 100000000);
+  e->uid = (int)rngRange(1, 5000);
+  snprintf(e->user, sizeof(e->user), "user%d", e->uid);
+  e->timestamp = TIMESTAMP_BASE + rngRange(0, TIMESTAMP_RANGE);
+}
+
+// Node positions follow a random walk with occasional jumps, so that
+// consecutive IDs are close together as in real extracts.
+static long long walkLat, walkLon;
+
+static long long clamp(long long value, long long min, long long max) {
+  return value < min ? min : value > max ? max : value;
+}
+
+static void genNode(const struct GenOptions *options, long long id,
+                    struct GenElement *e) {
+  e->type = GEN_NODE;
+  genInfo(e, id);
+  if (id % 1000 == 1) {
+    walkLat = rngRange(MIN_LAT, MAX_LAT);
+    walkLon = rngRange(MIN_LON, MAX_LON);
+  } else {
+    walkLat = clamp(walkLat + rngRange(-5000, 5000), MIN_LAT, MAX_LAT);
+    walkLon = clamp(walkLon + rngRange(-5000, 5000), MIN_LON, MAX_LON);
+  }
+  e->lat = walkLat;
+  e->lon = walkLon;
+  e->tagCount = 0;
+  if (rngPercent(options->taggedPercent)) {
+    genTags(e, nodeKeys, COUNT(nodeKeys), (int)rngRange(1, options->maxTags));
+  }
+}
+
+static void genWay(const struct GenOptions *options, long long id,
+                   struct GenElement *e) {
+  e->type = GEN_WAY;
+  genInfo(e, id);
+  e->refCount = (int)rngRange(options->wayMin, options->wayMax);
+  // Runs of nearby node IDs; closed ways repeat their first node.
+  long long first = rngRange(1, options->nodes);
+  int closed = e->refCount > 3 && rngPercent(40);
+  for (int i = 0; i < e->refCount; ++i) {
+    e->refs[i] = (first - 1 + i) % options->nodes + 1;
+  }
+  if (closed) {
+    e->refs[e->refCount - 1] = e->refs[0];
+  }
+  genTags(e, wayKeys, COUNT(wayKeys), (int)rngRange(1, options->maxTags));
+}
+
+static void genRelation(const struct GenOptions *options, long long id,
+                        struct GenElement *e) {
+  static const char *types[] = {"multipolygon", "route", "restriction"};
+  static const char *roles[][3] = {{"outer", "outer", "inner"},
+                                   {"", "stop", "platform"},
+                                   {"from", "via", "to"}};
+  e->type = GEN_RELATION;
+  genInfo(e, id);
+  int kind = (int)(rngNext() % COUNT(types));
+
+  e->memberCount = (int)rngRange(options->membersMin, options->membersMax);
+  for (int i = 0; i < e->memberCount; ++i) {
+    struct GenMember *m = &e->members[i];
+    m->role = roles[kind][rngNext() % 3];
+    if (id > 1 && rngPercent(5)) {
+      m->type = 2;
+      m->ref = rngRange(1, id - 1);
+    } else if (options->ways > 0 && (kind != 1 || rngPercent(70))) {
+      m->type = 1;
+      m->ref = rngRange(1, options->ways);
+    } else {
+      m->type = 0;
+      m->ref = rngRange(1, options->nodes);
+    }
+  }
+
+  e->tagCount = 1;
+  e->tags[0].key = "type";
+  e->tags[0].value = types[kind];
+  if (rngPercent(60)) {
+    struct GenTag *name = &e->tags[e->tagCount++];
+    name->key = "name";
+    genName(name);
+  }
+}
+
+// XML output.
+
+static void writeEscaped(FILE *out, const char *str) {
+  for (; *str != '\0'; ++str) {
+    switch (*str) {
+    case '&':
+      fputs("&amp;", out);
+      break;
+    case '<':
+      fputs("&lt;", out);
+      break;
+    case '"':
+      fputs("&quot;", out);
+      break;
+    default:
+      fputc(*str, out);
+    }
+  }
+}
+
+// Exact decimal form of a 1e-7 degree value.
+static void writeE7(FILE *out, long long value) {
+  if (value < 0) {
+    fputc('-', out);
+    value = -value;
+  }
+  fprintf(out, "%lld.%07lld", value / 10000000, value % 10000000);
+}
+
+static void writeXmlElement(FILE *out, const struct GenElement *e) {
+  static const char *names[] = {"node", "way", "relation"};
+  char timestamp[32];
+  time_t seconds = (time_t)e->timestamp;
+  struct tm tm;
+  gmtime_r(&seconds, &tm);
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+  fprintf(out, " <%s id=\"%lld\"", names[e->type], e->id);
+  if (e->type == GEN_NODE) {
+    fputs(" lat=\"", out);
+    writeE7(out, e->lat);
+    fputs("\" lon=\"", out);
+    writeE7(out, e->lon);
+    fputc('"', out);
+  }
+  fprintf(out,
+          " version=\"%d\" changeset=\"%lld\" user=\"%s\" uid=\"%d\" "
+          "timestamp=\"%s\"",
+          e->version, e->changeset, e->user, e->uid, timestamp);
+
+  int children = e->tagCount != 0 || (e->type == GEN_WAY && e->refCount) ||
+                 (e->type == GEN_RELATION && e->memberCount);
+  if (!children) {
+    fputs("/>\n", out);
+    return;
+  }
+  fputs(">\n", out);
+  if (e->type == GEN_WAY) {
+    for (int i = 0; i < e->refCount; ++i) {
+      fprintf(out, "  <nd ref=\"%lld\"/>\n", e->refs[i]);
+    }
+  } else if (e->type == GEN_RELATION) {
+    for (int i = 0; i < e->memberCount; ++i) {
+      const struct GenMember *m = &e->members[i];
+      fprintf(out, "  <member type=\"%s\" ref=\"%lld\" role=\"%s\"/>\n",
+              memberTypes[m->type], m->ref, m->role);
+    }
+  }
+  for (int i = 0; i < e->tagCount; ++i) {
+    fputs("  <tag k=\"", out);
+    writeEscaped(out, e->tags[i].key);
+    fputs("\" v=\"", out);
+    writeEscaped(out, e->tags[i].value);
+    fputs("\"/>\n", out);
+  }
+  fprintf(out, " </%s>\n", names[e->type]);
+}
+
+// PBF output: protobuf encoding of the fileformat.proto and osmformat.proto
+// messages pbf.c reads.
+
+struct Buffer {
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+};
+
+static void bufferReserve(struct Buffer *b, size_t extra) {
+  if (b->size + extra <= b->capacity) {
+    return;
+  }
+  size_t capacity = b->capacity ? b->capacity : 256;
+  while (capacity < b->size + extra) {
+    capacity *= 2;
+  }
+  if ((b->data = realloc(b->data, capacity)) == NULL) {
+    perror("osmgen");
+    exit(1);
+  }
+  b->capacity = capacity;
+}
+
+static void bufferAppend(struct Buffer *b, const void *data, size_t size) {
+  bufferReserve(b, size);
+  memcpy(b->data + b->size, data, size);
+  b->size += size;
+}
+
+static void bufferVarint(struct Buffer *b, uint64_t value) {
+  bufferReserve(b, 10);
+  while (value >= 0x80) {
+    b->data[b->size++] = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  b->data[b->size++] = (unsigned char)value;
+}
+
+static void bufferSint(struct Buffer *b, long long value) {
+  bufferVarint(b, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+}
+
+static void bufferUintField(struct Buffer *b, int field, uint64_t value) {
+  bufferVarint(b, (uint64_t)field << 3);
+  bufferVarint(b, value);
+}
+
+static void bufferBytesField(struct Buffer *b, int field, const void *data,
+                             size_t size) {
+  bufferVarint(b, (uint64_t)field << 3 | 2);
+  bufferVarint(b, size);
+  bufferAppend(b, data, size);
+}
+
+static void bufferMessageField(struct Buffer *b, int field,
+                               const struct Buffer *message) {
+  bufferBytesField(b, field, message->data, message->size);
+}
+
+// Packed fields are collected in their own buffers and emptied on use.
+static void bufferPackedField(struct Buffer *b, int field,
+                              struct Buffer *packed) {
+  bufferMessageField(b, field, packed);
+  packed->size = 0;
+}
+
+struct PbfWriter {
+  FILE *out;
+  enum GenType blockType;
+  int blockElements;
+
+  struct StringDict strings;
+  // StringTable message, built as strings are added.
+  struct Buffer stringTable;
+  long long stringCount;
+
+  // DenseNodes columns with their delta state.
+  struct Buffer ids, lats, lons, keysVals, versions, timestamps, changesets,
+      uids, users;
+  long long lastId, lastLat, lastLon, lastTimestamp, lastChangeset, lastUid,
+      lastUser;
+
+  // Encoded Way or Relation messages of the PrimitiveGroup.
+  struct Buffer group;
+
+  struct Buffer message, info, keys, values, packed, packed2, packed3, block,
+      blob, header;
+};
+
+static long long stringId(struct PbfWriter *w, const char *str) {
+  long long id;
+  if (stringDictFind(&w->strings, str, &id)) {
+    return id;
+  }
+  id = w->stringCount++;
+  if (stringDictInsert(&w->strings, str, id) != 0) {
+    fprintf(stderr, "osmgen: out of memory\n");
+    exit(1);
+  }
+  bufferBytesField(&w->stringTable, 1, str, strlen(str));
+  return id;
+}
+
+static void startBlock(struct PbfWriter *w, enum GenType type) {
+  w->blockType = type;
+  w->blockElements = 0;
+  stringDictInit(&w->strings);
+  w->stringTable.size = 0;
+  w->stringCount = 0;
+  // String 0 is reserved as the delimiter in DenseNodes.keys_vals.
+  stringId(w, "");
+  w->lastId = w->lastLat = w->lastLon = w->lastTimestamp = 0;
+  w->lastChangeset = w->lastUid = w->lastUser = 0;
+}
+
+static void writeBlob(struct PbfWriter *w, const char *type,
+                      const struct Buffer *payload) {
+  uLong bound = compressBound(payload->size);
+  struct Buffer *blob = &w->blob;
+  blob->size = 0;
+  bufferUintField(blob, 2, payload->size);
+
+  w->packed.size = 0;
+  bufferReserve(&w->packed, bound);
+  uLongf compressedSize = bound;
+  if (compress2(w->packed.data, &compressedSize, payload->data,
+                payload->size, Z_DEFAULT_COMPRESSION) != Z_OK) {
+    fprintf(stderr, "osmgen: compression failed\n");
+    exit(1);
+  }
+  bufferBytesField(blob, 3, w->packed.data, compressedSize);
+  w->packed.size = 0;
+
+  struct Buffer *header = &w->header;
+  header->size = 0;
+  bufferBytesField(header, 1, type, strlen(type));
+  bufferUintField(header, 3, blob->size);
+
+  unsigned char length[4] = {
+      (unsigned char)(header->size >> 24), (unsigned char)(header->size >> 16),
+      (unsigned char)(header->size >> 8), (unsigned char)header->size};
+  fwrite(length, 1, 4, w->out);
+  fwrite(header->data, 1, header->size, w->out);
+  fwrite(blob->data, 1, blob->size, w->out);
+}
+
+static void flushBlock(struct PbfWriter *w) {
+  if (w->blockElements == 0) {
+    stringDictFree(&w->strings);
+    return;
+  }
+
+  struct Buffer *group = &w->group;
+  if (w->blockType == GEN_NODE) {
+    struct Buffer *info = &w->info, *dense = &w->message;
+    info->size = dense->size = 0;
+    bufferPackedField(info, 1, &w->versions);
+    bufferPackedField(info, 2, &w->timestamps);
+    bufferPackedField(info, 3, &w->changesets);
+    bufferPackedField(info, 4, &w->uids);
+    bufferPackedField(info, 5, &w->users);
+    bufferPackedField(dense, 1, &w->ids);
+    bufferMessageField(dense, 5, info);
+    bufferPackedField(dense, 8, &w->lats);
+    bufferPackedField(dense, 9, &w->lons);
+    bufferPackedField(dense, 10, &w->keysVals);
+    bufferMessageField(group, 2, dense);
+  }
+
+  struct Buffer *block = &w->block;
+  block->size = 0;
+  bufferMessageField(block, 1, &w->stringTable);
+  bufferPackedField(block, 2, group);
+  writeBlob(w, "OSMData", block);
+  stringDictFree(&w->strings);
+}
+
+static void encodeInfo(struct PbfWriter *w, const struct GenElement *e) {
+  struct Buffer *info = &w->info;
+  info->size = 0;
+  bufferUintField(info, 1, e->version);
+  bufferUintField(info, 2, e->timestamp);
+  bufferUintField(info, 3, e->changeset);
+  bufferUintField(info, 4, e->uid);
+  bufferUintField(info, 5, stringId(w, e->user));
+}
+
+// Way and Relation share fields 1 to 4.
+static void encodeHeader(struct PbfWriter *w, const struct GenElement *e) {
+  struct Buffer *m = &w->message;
+  m->size = 0;
+  bufferUintField(m, 1, e->id);
+  for (int i = 0; i < e->tagCount; ++i) {
+    bufferVarint(&w->keys, stringId(w, e->tags[i].key));
+    bufferVarint(&w->values, stringId(w, e->tags[i].value));
+  }
+  bufferPackedField(m, 2, &w->keys);
+  bufferPackedField(m, 3, &w->values);
+  encodeInfo(w, e);
+  bufferMessageField(m, 4, &w->info);
+}
+
+static void writePbfElement(struct PbfWriter *w, const struct GenElement *e) {
+  if (e->type != w->blockType || w->blockElements == BLOCK_ELEMENTS) {
+    flushBlock(w);
+    startBlock(w, e->type);
+  }
+  w->blockElements++;
+
+  if (e->type == GEN_NODE) {
+    bufferSint(&w->ids, e->id - w->lastId);
+    bufferSint(&w->lats, e->lat - w->lastLat);
+    bufferSint(&w->lons, e->lon - w->lastLon);
+    for (int i = 0; i < e->tagCount; ++i) {
+      bufferVarint(&w->keysVals, stringId(w, e->tags[i].key));
+      bufferVarint(&w->keysVals, stringId(w, e->tags[i].value));
+    }
+    bufferVarint(&w->keysVals, 0);
+
+    long long user = stringId(w, e->user);
+    bufferVarint(&w->versions, e->version);
+    bufferSint(&w->timestamps, e->timestamp - w->lastTimestamp);
+    bufferSint(&w->changesets, e->changeset - w->lastChangeset);
+    bufferSint(&w->uids, e->uid - w->lastUid);
+    bufferSint(&w->users, user - w->lastUser);
+    w->lastId = e->id;
+    w->lastLat = e->lat;
+    w->lastLon = e->lon;
+    w->lastTimestamp = e->timestamp;
+    w->lastChangeset = e->changeset;
+    w->lastUid = e->uid;
+    w->lastUser = user;
+    return;
+  }
+
+  encodeHeader(w, e);
+  struct Buffer *m = &w->message;
+  long long last = 0;
+  if (e->type == GEN_WAY) {
+    for (int i = 0; i < e->refCount; ++i) {
+      bufferSint(&w->packed, e->refs[i] - last);
+      last = e->refs[i];
+    }
+    bufferPackedField(m, 8, &w->packed);
+    bufferMessageField(&w->group, 3, m);
+    return;
+  }
+
+  for (int i = 0; i < e->memberCount; ++i) {
+    const struct GenMember *member = &e->members[i];
+    bufferVarint(&w->packed, stringId(w, member->role));
+    bufferSint(&w->packed2, member->ref - last);
+    bufferVarint(&w->packed3, member->type);
+    last = member->ref;
+  }
+  bufferPackedField(m, 8, &w->packed);
+  bufferPackedField(m, 9, &w->packed2);
+  bufferPackedField(m, 10, &w->packed3);
+  bufferMessageField(&w->group, 4, m);
+}
+
+static void startPbf(struct PbfWriter *w, FILE *out) {
+  memset(w, 0, sizeof(*w));
+  w->out = out;
+  struct Buffer *header = &w->block;
+  static const char *features[] = {"OsmSchema-V0.6", "DenseNodes"};
+  for (int i = 0; i < COUNT(features); ++i) {
+    bufferBytesField(header, 4, features[i], strlen(features[i]));
+  }
+  bufferBytesField(header, 16, "osmgen", 6);
+  writeBlob(w, "OSMHeader", header);
+  startBlock(w, GEN_NODE);
+}
+
+static void finishPbf(struct PbfWriter *w) {
+  flushBlock(w);
+  struct Buffer *buffers[] = {
+      &w->stringTable, &w->ids,      &w->lats,       &w->lons,
+      &w->keysVals,    &w->versions, &w->timestamps, &w->changesets,
+      &w->uids,        &w->users,    &w->group,      &w->message,
+      &w->info,        &w->keys,     &w->values,     &w->packed,
+      &w->packed2,     &w->packed3,  &w->block,      &w->blob,
+      &w->header,
+  };
+  for (int i = 0; i < COUNT(buffers); ++i) {
+    free(buffers[i]->data);
+  }
+}
+
+static int hasSuffix(const char *str, const char *suffix) {
+  size_t length = strlen(str), suffixLength = strlen(suffix);
+  return length >= suffixLength &&
+         strcmp(str + length - suffixLength, suffix) == 0;
+}
+
+static void printUsage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [options] <output.osm|output.osm.pbf>\n"
+          "\n"
+          "  --nodes=N            nodes (default 1000000)\n"
+          "  --ways=N             ways (default nodes / 8)\n"
+          "  --relations=N        relations (default nodes / 500)\n"
+          "  --seed=N             generator seed (default 1)\n"
+          "  --tagged-nodes=P     percentage of nodes with tags "
+          "(default 10)\n"
+          "  --max-tags=N         tags per tagged element, at most %d "
+          "(default 4)\n"
+          "  --way-length=MIN:MAX nodes per way (default 2:20)\n"
+          "  --members=MIN:MAX    members per relation (default 2:10)\n",
+          program, MAX_TAGS);
+}
+
+static int parseCount(const char *value, long long min, long long max,
+                      long long *out) {
+  char *end;
+  long long parsed = strtoll(value, &end, 10);
+  if (*value == '\0' || *end != '\0' || parsed < min || parsed > max) {
+    return -1;
+  }
+  *out = parsed;
+  return 0;
+}
+
+static int parseRange(const char *value, int max, int *min, int *maxOut) {
+  int low, high;
+  char tail;
+  if (sscanf(value, "%d:%d%c", &low, &high, &tail) != 2 || low < 1 ||
+      high < low || high > max) {
+    return -1;
+  }
+  *min = low;
+  *maxOut = high;
+  return 0;
+}
+
+static int parseOptions(int argc, char **argv, struct GenOptions *options) {
+  enum { OPT_NODES = 256, OPT_WAYS, OPT_RELATIONS, OPT_SEED,
+         OPT_TAGGED_NODES, OPT_MAX_TAGS, OPT_WAY_LENGTH, OPT_MEMBERS };
+  static const struct option longOptions[] = {
+      {"nodes", required_argument, NULL, OPT_NODES},
+      {"ways", required_argument, NULL, OPT_WAYS},
+      {"relations", required_argument, NULL, OPT_RELATIONS},
+      {"seed", required_argument, NULL, OPT_SEED},
+      {"tagged-nodes", required_argument, NULL, OPT_TAGGED_NODES},
+      {"max-tags", required_argument, NULL, OPT_MAX_TAGS},
+      {"way-length", required_argument, NULL, OPT_WAY_LENGTH},
+      {"members", required_argument, NULL, OPT_MEMBERS},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
+
+  memset(options, 0, sizeof(*options));
+  options->nodes = 1000000;
+  options->ways = options->relations = -1;
+  options->seed = 1;
+  options->taggedPercent = 10;
+  options->maxTags = 4;
+  options->wayMin = 2;
+  options->wayMax = 20;
+  options->membersMin = 2;
+  options->membersMax = 10;
+
+  int opt;
+  long long value;
+  while ((opt = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+    switch (opt) {
+    case OPT_NODES:
+      if (parseCount(optarg, 1, 1LL << 40, &options->nodes) != 0) {
+        fprintf(stderr, "Invalid value for --nodes: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_WAYS:
+      if (parseCount(optarg, 0, 1LL << 40, &options->ways) != 0) {
+        fprintf(stderr, "Invalid value for --ways: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_RELATIONS:
+      if (parseCount(optarg, 0, 1LL << 40, &options->relations) != 0) {
+        fprintf(stderr, "Invalid value for --relations: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_SEED:
+      if (parseCount(optarg, 0, INT64_MAX, &value) != 0) {
+        fprintf(stderr, "Invalid value for --seed: %s\n", optarg);
+        return -1;
+      }
+      options->seed = (uint64_t)value;
+      break;
+    case OPT_TAGGED_NODES:
+      if (parseCount(optarg, 0, 100, &value) != 0) {
+        fprintf(stderr, "Invalid value for --tagged-nodes: %s\n", optarg);
+        return -1;
+      }
+      options->taggedPercent = (int)value;
+      break;
+    case OPT_MAX_TAGS:
+      if (parseCount(optarg, 1, MAX_TAGS, &value) != 0) {
+        fprintf(stderr, "Invalid value for --max-tags: %s\n", optarg);
+        return -1;
+      }
+      options->maxTags = (int)value;
+      break;
+    case OPT_WAY_LENGTH:
+      if (parseRange(optarg, MAX_WAY_LENGTH, &options->wayMin,
+                     &options->wayMax) != 0) {
+        fprintf(stderr, "Invalid value for --way-length: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_MEMBERS:
+      if (parseRange(optarg, MAX_MEMBERS, &options->membersMin,
+                     &options->membersMax) != 0) {
+        fprintf(stderr, "Invalid value for --members: %s\n", optarg);
+        return -1;
+      }
+      break;
+    default:
+      return -1;
+    }
+  }
+
+  if (argc - optind != 1) {
+    return -1;
+  }
+  if (options->ways < 0) {
+    options->ways = options->nodes / 8;
+  }
+  if (options->relations < 0) {
+    options->relations = options->nodes / 500;
+  }
+  options->outputPath = argv[optind];
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  struct GenOptions options;
+  if (parseOptions(argc, argv, &options) != 0) {
+    printUsage(argv[0]);
+    return 2;
+  }
+
+  FILE *out = fopen(options.outputPath, "wb");
+  if (out == NULL) {
+    perror(options.outputPath);
+    return 1;
+  }
+
+  int pbf = hasSuffix(options.outputPath, ".pbf");
+  static struct PbfWriter writer;
+  if (pbf) {
+    startPbf(&writer, out);
+  } else {
+    fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+          "<osm version=\"0.6\" generator=\"osmgen\">\n",
+          out);
+  }
+
+  rngState = options.seed;
+  static struct GenElement element;
+  long long counts[] = {options.nodes, options.ways, options.relations};
+  for (int type = GEN_NODE; type <= GEN_RELATION; ++type) {
+    for (long long id = 1; id <= counts[type]; ++id) {
+      if (type == GEN_NODE) {
+        genNode(&options, id, &element);
+      } else if (type == GEN_WAY) {
+        genWay(&options, id, &element);
+      } else {
+        genRelation(&options, id, &element);
+      }
+
+      if (pbf) {
+        writePbfElement(&writer, &element);
+      } else {
+        writeXmlElement(out, &element);
+      }
+    }
+  }
+
+  if (pbf) {
+    finishPbf(&writer);
+  } else {
+    fputs("</osm>\n", out);
+  }
+
+  if (fclose(out) != 0) {
+    perror(options.outputPath);
+    return 1;
+  }
+  fprintf(stdout, "Wrote %lld nodes, %lld ways, %lld relations to %s\n",
+          options.nodes, options.ways, options.relations,
+          options.outputPath);
+  return 0;
+}
@@ -0,0 +1,460 @@
+#include "columnar.h"
+#include "columnar_format.h"
+#include "coordinates.h"
+#include "memory_budget.h"
+#include "string_dict.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MAX_COLUMNS 4
+
+enum ColumnarTable {
+  TABLE_NODES,
+  TABLE_NODE_TAGS,
+  TABLE_WAYS,
+  TABLE_WAY_NODES,
+  TABLE_WAY_TAGS,
+  TABLE_RELATIONS,
+  TABLE_RELATION_MEMBERS,
+  TABLE_RELATION_TAGS,
+  TABLE_COUNT
+};
+
+struct ColumnSpec {
+  const char *name;
+  enum ColumnarType type;
+};
+
+struct TableSpec {
+  const char *name;
+  int columnCount;
+  struct ColumnSpec columns[MAX_COLUMNS];
+};
+
+static const struct TableSpec tableSpecs[TABLE_COUNT] = {
+    {"nodes", 3,
+     {{"id", COLUMNAR_INT64}, {"lat", COLUMNAR_INT32},
+      {"lon", COLUMNAR_INT32}}},
+    {"node_tags", 3,
+     {{"node_id", COLUMNAR_INT64}, {"key", COLUMNAR_STRING_ID},
+      {"value", COLUMNAR_STRING_ID}}},
+    {"ways", 2, {{"id", COLUMNAR_INT64}, {"node_count", COLUMNAR_INT32}}},
+    {"way_nodes", 2,
+     {{"way_id", COLUMNAR_INT64}, {"node_id", COLUMNAR_INT64}}},
+    {"way_tags", 3,
+     {{"way_id", COLUMNAR_INT64}, {"key", COLUMNAR_STRING_ID},
+      {"value", COLUMNAR_STRING_ID}}},
+    {"relations", 2,
+     {{"id", COLUMNAR_INT64}, {"member_count", COLUMNAR_INT32}}},
+    {"relation_members", 4,
+     {{"relation_id", COLUMNAR_INT64}, {"member_type", COLUMNAR_INT32},
+      {"member_id", COLUMNAR_INT64}, {"role", COLUMNAR_STRING_ID}}},
+    {"relation_tags", 3,
+     {{"relation_id", COLUMNAR_INT64}, {"key", COLUMNAR_STRING_ID},
+      {"value", COLUMNAR_STRING_ID}}},
+};
+
+struct TableWriter {
+  const struct TableSpec *spec;
+  char *path;
+  FILE *file;
+  uint64_t offset;
+  // The current row group, a value array per column; allocated with the
+  // first row.
+  int64_t *values[MAX_COLUMNS];
+  uint32_t rows;
+  uint64_t rowCount;
+  uint64_t rowGroupCount;
+  // Footer entries of the row groups written so far.
+  unsigned char *footer;
+  size_t footerSize;
+  size_t footerCapacity;
+};
+
+struct ColumnarExport {
+  char *directory;
+  struct TableWriter tables[TABLE_COUNT];
+  struct StringDict strings;
+  long long stringCount;
+  long long chargedBytes;
+  // A column chunk converted to its width.
+  unsigned char *chunk;
+};
+
+static int columnWidth(enum ColumnarType type) {
+  return type == COLUMNAR_INT64 ? 8 : 4;
+}
+
+static size_t chunkSize(enum ColumnarType type, uint32_t rows) {
+  return ((size_t)rows * columnWidth(type) + 7) & ~(size_t)7;
+}
+
+static void charge(struct ColumnarExport *out, long long bytes) {
+  memoryBudgetCharge(MEMORY_COLUMNAR, bytes);
+  out->chargedBytes += bytes;
+}
+
+static int writeAll(struct TableWriter *table, const void *data,
+                    size_t size) {
+  if (fwrite(data, 1, size, table->file) != size) {
+    perror(table->path);
+    return -1;
+  }
+  table->offset += size;
+  return 0;
+}
+
+static int openTable(struct ColumnarExport *out, enum ColumnarTable kind) {
+  struct TableWriter *table = &out->tables[kind];
+  const struct TableSpec *spec = &tableSpecs[kind];
+  table->spec = spec;
+  size_t size = strlen(out->directory) + strlen(spec->name) + 6;
+  if ((table->path = malloc(size)) == NULL) {
+    fprintf(stderr, "Out of memory opening the columnar export\n");
+    return -1;
+  }
+  snprintf(table->path, size, "%s/%s.col", out->directory, spec->name);
+  if ((table->file = fopen(table->path, "wb")) == NULL) {
+    perror(table->path);
+    return -1;
+  }
+
+  // Written again with the counts and the footer offset at the end.
+  struct ColumnarHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+  header.byteOrder = COLUMNAR_BYTE_ORDER;
+  header.columnCount = spec->columnCount;
+  header.rowGroupRows = COLUMNAR_ROW_GROUP_ROWS;
+  if (writeAll(table, &header, sizeof(header)) != 0) {
+    return -1;
+  }
+  for (int i = 0; i < spec->columnCount; ++i) {
+    struct ColumnarColumnInfo column;
+    memset(&column, 0, sizeof(column));
+    snprintf(column.name, sizeof(column.name), "%s", spec->columns[i].name);
+    column.type = spec->columns[i].type;
+    column.width = columnWidth(spec->columns[i].type);
+    if (writeAll(table, &column, sizeof(column)) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int appendFooter(struct TableWriter *table, const void *data,
+                        size_t size) {
+  if (table->footerSize + size > table->footerCapacity) {
+    size_t capacity = table->footerCapacity ? table->footerCapacity * 2 : 4096;
+    unsigned char *grown = realloc(table->footer, capacity);
+    if (grown == NULL) {
+      fprintf(stderr, "Out of memory in the columnar export\n");
+      return -1;
+    }
+    table->footer = grown;
+    table->footerCapacity = capacity;
+  }
+  memcpy(table->footer + table->footerSize, data, size);
+  table->footerSize += size;
+  return 0;
+}
+
+// Writes the buffered rows as a row group, a chunk per column with its
+// minimum and maximum in the footer.
+static int flushRowGroup(struct ColumnarExport *out,
+                         struct TableWriter *table) {
+  if (table->rows == 0) {
+    return 0;
+  }
+  struct ColumnarRowGroupInfo group = {table->rowCount, table->rows, 0};
+  if (appendFooter(table, &group, sizeof(group)) != 0) {
+    return -1;
+  }
+  for (int i = 0; i < table->spec->columnCount; ++i) {
+    enum ColumnarType type = table->spec->columns[i].type;
+    const int64_t *values = table->values[i];
+    struct ColumnarChunkInfo chunk = {table->offset, values[0], values[0]};
+    size_t size = chunkSize(type, table->rows);
+    memset(out->chunk, 0, size);
+    for (uint32_t row = 0; row < table->rows; ++row) {
+      int64_t value = values[row];
+      chunk.min = value < chunk.min ? value : chunk.min;
+      chunk.max = value > chunk.max ? value : chunk.max;
+      if (type == COLUMNAR_INT64) {
+        ((int64_t *)out->chunk)[row] = value;
+      } else if (type == COLUMNAR_INT32) {
+        ((int32_t *)out->chunk)[row] = (int32_t)value;
+      } else {
+        ((uint32_t *)out->chunk)[row] = (uint32_t)value;
+      }
+    }
+    if (writeAll(table, out->chunk, size) != 0 ||
+        appendFooter(table, &chunk, sizeof(chunk)) != 0) {
+      return -1;
+    }
+  }
+  table->rowCount += table->rows;
+  table->rowGroupCount++;
+  table->rows = 0;
+  return 0;
+}
+
+static int addRow(struct ColumnarExport *out, enum ColumnarTable kind,
+                  const int64_t *row) {
+  struct TableWriter *table = &out->tables[kind];
+  if (table->values[0] == NULL) {
+    for (int i = 0; i < table->spec->columnCount; ++i) {
+      if ((table->values[i] =
+               malloc(COLUMNAR_ROW_GROUP_ROWS * sizeof(int64_t))) == NULL) {
+        fprintf(stderr, "Out of memory in the columnar export\n");
+        return -1;
+      }
+      charge(out, COLUMNAR_ROW_GROUP_ROWS * sizeof(int64_t));
+    }
+  }
+  for (int i = 0; i < table->spec->columnCount; ++i) {
+    table->values[i][table->rows] = row[i];
+  }
+  return ++table->rows == COLUMNAR_ROW_GROUP_ROWS ? flushRowGroup(out, table)
+                                                  : 0;
+}
+
+static int stringId(struct ColumnarExport *out, const char *str,
+                    int64_t *id) {
+  long long found;
+  if (stringDictFind(&out->strings, str, &found)) {
+    *id = found;
+    return 0;
+  }
+  if (out->stringCount == UINT32_MAX ||
+      stringDictInsert(&out->strings, str, out->stringCount) != 0) {
+    fprintf(stderr, "Too many strings for the columnar export\n");
+    return -1;
+  }
+  charge(out, strlen(str) + 1 + 2 * sizeof(struct StringDictEntry));
+  *id = out->stringCount++;
+  return 0;
+}
+
+static int addTags(struct ColumnarExport *out, enum ColumnarTable kind,
+                   long long id, const readosm_tag *tags, int count) {
+  for (int i = 0; i < count; ++i) {
+    int64_t row[3] = {id};
+    if (stringId(out, tags[i].key, &row[1]) != 0 ||
+        stringId(out, tags[i].value, &row[2]) != 0 ||
+        addRow(out, kind, row) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+struct ColumnarExport *columnarExportOpen(const char *directory) {
+  if (mkdir(directory, 0777) != 0 && errno != EEXIST) {
+    perror(directory);
+    return NULL;
+  }
+  struct ColumnarExport *out = calloc(1, sizeof(struct ColumnarExport));
+  if (out == NULL) {
+    fprintf(stderr, "Out of memory opening the columnar export\n");
+    return NULL;
+  }
+  stringDictInit(&out->strings);
+  if ((out->directory = strdup(directory)) == NULL ||
+      (out->chunk = malloc(COLUMNAR_ROW_GROUP_ROWS * sizeof(int64_t))) ==
+          NULL) {
+    fprintf(stderr, "Out of memory opening the columnar export\n");
+    columnarExportFree(out);
+    return NULL;
+  }
+  charge(out, COLUMNAR_ROW_GROUP_ROWS * sizeof(int64_t));
+  for (int i = 0; i < TABLE_COUNT; ++i) {
+    if (openTable(out, i) != 0) {
+      columnarExportFree(out);
+      return NULL;
+    }
+  }
+  return out;
+}
+
+int columnarExportNode(struct ColumnarExport *out, const readosm_node *node) {
+  int64_t row[3] = {node->id, coordinateToE7(node->latitude),
+                    coordinateToE7(node->longitude)};
+  if (addRow(out, TABLE_NODES, row) != 0) {
+    return -1;
+  }
+  return addTags(out, TABLE_NODE_TAGS, node->id, node->tags, node->tag_count);
+}
+
+int columnarExportWay(struct ColumnarExport *out, const readosm_way *way) {
+  int64_t row[2] = {way->id, way->node_ref_count};
+  if (addRow(out, TABLE_WAYS, row) != 0) {
+    return -1;
+  }
+  for (int i = 0; i < way->node_ref_count; ++i) {
+    int64_t ref[2] = {way->id, way->node_refs[i]};
+    if (addRow(out, TABLE_WAY_NODES, ref) != 0) {
+      return -1;
+    }
+  }
+  return addTags(out, TABLE_WAY_TAGS, way->id, way->tags, way->tag_count);
+}
+
+int columnarExportRelation(struct ColumnarExport *out,
+                           const readosm_relation *relation) {
+  int64_t row[2] = {relation->id, relation->member_count};
+  if (addRow(out, TABLE_RELATIONS, row) != 0) {
+    return -1;
+  }
+  for (int i = 0; i < relation->member_count; ++i) {
+    const readosm_member *member = &relation->members[i];
+    int64_t memberRow[4] = {relation->id,
+                            member->member_type == READOSM_MEMBER_NODE  ? 0
+                            : member->member_type == READOSM_MEMBER_WAY ? 1
+                                                                        : 2,
+                            member->id};
+    if (stringId(out, member->role != NULL ? member->role : "",
+                 &memberRow[3]) != 0 ||
+        addRow(out, TABLE_RELATION_MEMBERS, memberRow) != 0) {
+      return -1;
+    }
+  }
+  return addTags(out, TABLE_RELATION_TAGS, relation->id, relation->tags,
+                 relation->tag_count);
+}
+
+static int finishTable(struct ColumnarExport *out,
+                       struct TableWriter *table) {
+  if (flushRowGroup(out, table) != 0) {
+    return -1;
+  }
+  struct ColumnarHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC));
+  header.byteOrder = COLUMNAR_BYTE_ORDER;
+  header.columnCount = table->spec->columnCount;
+  header.rowGroupRows = COLUMNAR_ROW_GROUP_ROWS;
+  header.rowCount = table->rowCount;
+  header.rowGroupCount = table->rowGroupCount;
+  header.footerOffset = table->offset;
+  if (writeAll(table, table->footer, table->footerSize) != 0) {
+    return -1;
+  }
+  if (fseek(table->file, 0, SEEK_SET) != 0 ||
+      fwrite(&header, sizeof(header), 1, table->file) != 1 ||
+      fclose(table->file) != 0) {
+    perror(table->path);
+    table->file = NULL;
+    return -1;
+  }
+  table->file = NULL;
+  return 0;
+}
+
+static int writeDictionary(struct ColumnarExport *out) {
+  const char **strings = calloc(out->stringCount + 1, sizeof(char *));
+  size_t size = strlen(out->directory) + sizeof("/strings.dict");
+  char *path = malloc(size);
+  FILE *file = NULL;
+  if (strings == NULL || path == NULL) {
+    fprintf(stderr, "Out of memory writing the columnar dictionary\n");
+    goto Fail;
+  }
+  snprintf(path, size, "%s/strings.dict", out->directory);
+  for (size_t i = 0; i < out->strings.capacity; ++i) {
+    const struct StringDictEntry *entry = &out->strings.entries[i];
+    if (entry->str != NULL) {
+      strings[entry->id] = entry->str;
+    }
+  }
+
+  struct ColumnarDictionaryHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, COLUMNAR_DICTIONARY_MAGIC,
+         sizeof(COLUMNAR_DICTIONARY_MAGIC));
+  header.byteOrder = COLUMNAR_BYTE_ORDER;
+  header.count = out->stringCount;
+  header.dataOffset = sizeof(header) + (out->stringCount + 1) * 8;
+  if ((file = fopen(path, "wb")) == NULL ||
+      fwrite(&header, sizeof(header), 1, file) != 1) {
+    goto Error;
+  }
+  uint64_t offset = 0;
+  for (long long i = 0; i <= out->stringCount; ++i) {
+    if (fwrite(&offset, sizeof(offset), 1, file) != 1) {
+      goto Error;
+    }
+    if (i < out->stringCount) {
+      offset += strlen(strings[i]) + 1;
+    }
+  }
+  for (long long i = 0; i < out->stringCount; ++i) {
+    if (fwrite(strings[i], strlen(strings[i]) + 1, 1, file) != 1) {
+      goto Error;
+    }
+  }
+  if (fclose(file) != 0) {
+    file = NULL;
+    goto Error;
+  }
+  free(strings);
+  free(path);
+  return 0;
+
+Error:
+  perror(path);
+Fail:
+  if (file != NULL) {
+    fclose(file);
+  }
+  free(strings);
+  free(path);
+  return -1;
+}
+
+int columnarExportClose(struct ColumnarExport *out) {
+  int ret = 0;
+  for (int i = 0; i < TABLE_COUNT && ret == 0; ++i) {
+    ret = finishTable(out, &out->tables[i]);
+  }
+  if (ret == 0) {
+    ret = writeDictionary(out);
+  }
+  if (ret == 0) {
+    fprintf(stdout,
+            "Columnar: %llu nodes, %llu ways, %llu relations, "
+            "%lld strings in %s\n",
+            (unsigned long long)out->tables[TABLE_NODES].rowCount,
+            (unsigned long long)out->tables[TABLE_WAYS].rowCount,
+            (unsigned long long)out->tables[TABLE_RELATIONS].rowCount,
+            out->stringCount, out->directory);
+  }
+  columnarExportFree(out);
+  return ret;
+}
+
+void columnarExportFree(struct ColumnarExport *out) {
+  if (out == NULL) {
+    return;
+  }
+  for (int i = 0; i < TABLE_COUNT; ++i) {
+    struct TableWriter *table = &out->tables[i];
+    if (table->file != NULL) {
+      fclose(table->file);
+    }
+    for (int j = 0; j < MAX_COLUMNS; ++j) {
+      free(table->values[j]);
+    }
+    free(table->footer);
+    free(table->path);
+  }
+  stringDictFree(&out->strings);
+  memoryBudgetRelease(MEMORY_COLUMNAR, out->chargedBytes);
+  free(out->chunk);
+  free(out->directory);
+  free(out);
+}
@@ -0,0 +1,43 @@
+#ifndef COLUMNAR_H
+#define COLUMNAR_H
+
+#include <readosm.h>
+
+// --columnar: a copy of the imported elements in the column files of
+// columnar_format.h, written by the parsing thread in the same pass as the
+// database. The directory gets a file per table, <table>.col:
+//
+//   nodes            id, lat, lon (1e-7 degrees)
+//   node_tags        node_id, key, value
+//   ways             id, node_count
+//   way_nodes        way_id, node_id
+//   way_tags         way_id, key, value
+//   relations        id, member_count
+//   relation_members relation_id, member_type (0 node, 1 way, 2 relation),
+//                    member_id, role
+//   relation_tags    relation_id, key, value
+//
+// with rows in input order, so the nodes of a way and the members of a
+// relation are in sequence. Tag keys, values and roles are IDs into
+// strings.dict, in order of first use. Only a row group's worth of rows per
+// table and the dictionary are kept in memory. Read the files with
+// columnar_reader.h.
+struct ColumnarExport;
+
+// Creates directory if needed. Returns NULL after printing the error.
+struct ColumnarExport *columnarExportOpen(const char *directory);
+
+// Return 0, or -1 after printing the error.
+int columnarExportNode(struct ColumnarExport *out, const readosm_node *node);
+int columnarExportWay(struct ColumnarExport *out, const readosm_way *way);
+int columnarExportRelation(struct ColumnarExport *out,
+                           const readosm_relation *relation);
+
+// Writes the last row groups, the footers and the dictionary, then frees
+// out. Returns 0, or -1 after printing the error; a table file the export
+// did not finish has no footer and is rejected by the reader.
+int columnarExportClose(struct ColumnarExport *out);
+// Frees out without finishing the files.
+void columnarExportFree(struct ColumnarExport *out);
+
+#endif
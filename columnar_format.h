@@ -0,0 +1,71 @@
+#ifndef COLUMNAR_FORMAT_H
+#define COLUMNAR_FORMAT_H
+
+#include <stdint.h>
+
+// On-disk layout of the --columnar export, shared by the writer in
+// columnar.c and the reader in columnar_reader.c. Integers are in the byte
+// order of the machine that wrote the file, recorded in byteOrder; every
+// structure and column chunk starts on an 8-byte boundary, so a mapped file
+// can be read in place.
+//
+// A table file is a header, the column descriptors, the row groups and a
+// footer with an entry per row group. A row group holds up to rowGroupRows
+// rows as one contiguous chunk per column, in column order.
+#define COLUMNAR_MAGIC "OSMCOL1"
+#define COLUMNAR_DICTIONARY_MAGIC "OSMDIC1"
+#define COLUMNAR_BYTE_ORDER 0x01020304u
+#define COLUMNAR_ROW_GROUP_ROWS 65536
+#define COLUMNAR_NAME_SIZE 24
+
+enum ColumnarType {
+  COLUMNAR_INT64 = 1,
+  // Coordinates in 1e-7 degrees, see coordinates.h.
+  COLUMNAR_INT32 = 2,
+  // Indexes into the string dictionary.
+  COLUMNAR_STRING_ID = 3,
+};
+
+struct ColumnarHeader {
+  char magic[8];
+  uint32_t byteOrder;
+  uint32_t columnCount;
+  uint32_t rowGroupRows;
+  uint32_t reserved;
+  uint64_t rowCount;
+  uint64_t rowGroupCount;
+  // 0 until the export finished.
+  uint64_t footerOffset;
+};
+
+struct ColumnarColumnInfo {
+  char name[COLUMNAR_NAME_SIZE];
+  uint32_t type;
+  // Bytes per value.
+  uint32_t width;
+};
+
+// Followed in the footer by columnCount ColumnarChunkInfo.
+struct ColumnarRowGroupInfo {
+  uint64_t firstRow;
+  uint32_t rows;
+  uint32_t reserved;
+};
+
+struct ColumnarChunkInfo {
+  uint64_t offset;
+  int64_t min;
+  int64_t max;
+};
+
+// The string dictionary is a header, count + 1 offsets into the string
+// data and the data, NUL-terminated strings in ID order.
+struct ColumnarDictionaryHeader {
+  char magic[8];
+  uint32_t byteOrder;
+  uint32_t reserved;
+  uint64_t count;
+  uint64_t dataOffset;
+};
+
+#endif
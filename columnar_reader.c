@@ -0,0 +1,218 @@
+#include "columnar_reader.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const void *mapFile(const char *path, size_t *size) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror(path);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror(path);
+    close(fd);
+    return NULL;
+  }
+  *size = st.st_size;
+  void *map = *size > 0
+                  ? mmap(NULL, *size, PROT_READ, MAP_SHARED, fd, 0)
+                  : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED) {
+    if (*size > 0) {
+      perror(path);
+    } else {
+      fprintf(stderr, "%s is empty\n", path);
+    }
+    return NULL;
+  }
+  // Scans go through the file front to back.
+  madvise(map, *size, MADV_SEQUENTIAL);
+  return map;
+}
+
+static size_t groupEntrySize(const struct ColumnarFile *file) {
+  return sizeof(struct ColumnarRowGroupInfo) +
+         (size_t)file->header->columnCount * sizeof(struct ColumnarChunkInfo);
+}
+
+static const struct ColumnarRowGroupInfo *
+groupInfo(const struct ColumnarFile *file, uint64_t group) {
+  return (const struct ColumnarRowGroupInfo *)(file->map +
+                                               file->header->footerOffset +
+                                               group * groupEntrySize(file));
+}
+
+static const struct ColumnarChunkInfo *
+chunkInfo(const struct ColumnarFile *file, uint64_t group, int column) {
+  return (const struct ColumnarChunkInfo *)(groupInfo(file, group) + 1) +
+         column;
+}
+
+// Checks that the footer and every chunk it points to are in the file.
+static int validFile(const struct ColumnarFile *file) {
+  const struct ColumnarHeader *header = file->header;
+  size_t columnsEnd = sizeof(*header) + (size_t)header->columnCount *
+                                            sizeof(struct ColumnarColumnInfo);
+  if (header->columnCount == 0 || header->columnCount > 64 ||
+      columnsEnd > file->size || header->footerOffset < columnsEnd ||
+      header->footerOffset > file->size || header->footerOffset % 8 != 0 ||
+      header->rowGroupCount >
+          (file->size - header->footerOffset) / groupEntrySize(file)) {
+    return 0;
+  }
+  for (uint32_t column = 0; column < header->columnCount; ++column) {
+    uint32_t width = file->columns[column].width;
+    if (width != (file->columns[column].type == COLUMNAR_INT64 ? 8 : 4)) {
+      return 0;
+    }
+  }
+  uint64_t rows = 0;
+  for (uint64_t group = 0; group < header->rowGroupCount; ++group) {
+    const struct ColumnarRowGroupInfo *info = groupInfo(file, group);
+    if (info->firstRow != rows || info->rows == 0 ||
+        info->rows > header->rowGroupRows) {
+      return 0;
+    }
+    rows += info->rows;
+    for (uint32_t column = 0; column < header->columnCount; ++column) {
+      uint64_t offset = chunkInfo(file, group, column)->offset;
+      uint64_t size = (uint64_t)info->rows * file->columns[column].width;
+      if (offset % 8 != 0 || offset < columnsEnd ||
+          offset > header->footerOffset ||
+          size > header->footerOffset - offset) {
+        return 0;
+      }
+    }
+  }
+  return rows == header->rowCount;
+}
+
+int columnarFileOpen(struct ColumnarFile *file, const char *path) {
+  memset(file, 0, sizeof(*file));
+  if ((file->map = mapFile(path, &file->size)) == NULL) {
+    return -1;
+  }
+  file->header = (const struct ColumnarHeader *)file->map;
+  file->columns = (const struct ColumnarColumnInfo *)(file->header + 1);
+  if (file->size < sizeof(struct ColumnarHeader) ||
+      memcmp(file->header->magic, COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)) !=
+          0 ||
+      file->header->byteOrder != COLUMNAR_BYTE_ORDER) {
+    fprintf(stderr, "%s is not a columnar file of this byte order\n", path);
+    columnarFileClose(file);
+    return -1;
+  }
+  if (file->header->footerOffset == 0 || !validFile(file)) {
+    fprintf(stderr, "%s is incomplete or corrupt\n", path);
+    columnarFileClose(file);
+    return -1;
+  }
+  return 0;
+}
+
+void columnarFileClose(struct ColumnarFile *file) {
+  if (file->map != NULL) {
+    munmap((void *)file->map, file->size);
+  }
+  memset(file, 0, sizeof(*file));
+}
+
+int columnarFileColumn(const struct ColumnarFile *file, const char *name) {
+  for (uint32_t i = 0; i < file->header->columnCount; ++i) {
+    if (strncmp(file->columns[i].name, name, COLUMNAR_NAME_SIZE) == 0) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+uint64_t columnarFileRowCount(const struct ColumnarFile *file) {
+  return file->header->rowCount;
+}
+
+uint64_t columnarFileRowGroupCount(const struct ColumnarFile *file) {
+  return file->header->rowGroupCount;
+}
+
+void columnarFileRowGroup(const struct ColumnarFile *file, uint64_t group,
+                          struct ColumnarRowGroup *out) {
+  const struct ColumnarRowGroupInfo *info = groupInfo(file, group);
+  out->firstRow = info->firstRow;
+  out->rows = info->rows;
+}
+
+const void *columnarFileChunk(const struct ColumnarFile *file, uint64_t group,
+                              int column) {
+  return file->map + chunkInfo(file, group, column)->offset;
+}
+
+void columnarFileChunkRange(const struct ColumnarFile *file, uint64_t group,
+                            int column, int64_t *min, int64_t *max) {
+  const struct ColumnarChunkInfo *info = chunkInfo(file, group, column);
+  *min = info->min;
+  *max = info->max;
+}
+
+int64_t columnarFileValue(const struct ColumnarFile *file, uint64_t group,
+                          int column, uint32_t row) {
+  const void *chunk = columnarFileChunk(file, group, column);
+  switch (file->columns[column].type) {
+  case COLUMNAR_INT64:
+    return ((const int64_t *)chunk)[row];
+  case COLUMNAR_INT32:
+    return ((const int32_t *)chunk)[row];
+  default:
+    return ((const uint32_t *)chunk)[row];
+  }
+}
+
+int columnarDictionaryOpen(struct ColumnarDictionary *dict,
+                           const char *path) {
+  memset(dict, 0, sizeof(*dict));
+  if ((dict->map = mapFile(path, &dict->size)) == NULL) {
+    return -1;
+  }
+  const struct ColumnarDictionaryHeader *header =
+      (const struct ColumnarDictionaryHeader *)dict->map;
+  if (dict->size < sizeof(*header) ||
+      memcmp(header->magic, COLUMNAR_DICTIONARY_MAGIC,
+             sizeof(COLUMNAR_DICTIONARY_MAGIC)) != 0 ||
+      header->byteOrder != COLUMNAR_BYTE_ORDER ||
+      header->count >= (dict->size - sizeof(*header)) / 8 ||
+      header->dataOffset != sizeof(*header) + (header->count + 1) * 8) {
+    fprintf(stderr, "%s is not a columnar dictionary of this byte order\n",
+            path);
+    columnarDictionaryClose(dict);
+    return -1;
+  }
+  dict->count = header->count;
+  dict->offsets = (const uint64_t *)(header + 1);
+  dict->data = (const char *)dict->map + header->dataOffset;
+  // Offsets increase, so if the last string ends in the file, all do.
+  if (dict->offsets[dict->count] > dict->size - header->dataOffset ||
+      (dict->count > 0 && dict->data[dict->offsets[dict->count] - 1] != 0)) {
+    fprintf(stderr, "%s is incomplete or corrupt\n", path);
+    columnarDictionaryClose(dict);
+    return -1;
+  }
+  return 0;
+}
+
+void columnarDictionaryClose(struct ColumnarDictionary *dict) {
+  if (dict->map != NULL) {
+    munmap((void *)dict->map, dict->size);
+  }
+  memset(dict, 0, sizeof(*dict));
+}
+
+const char *columnarDictionaryString(const struct ColumnarDictionary *dict,
+                                     uint64_t id) {
+  return id < dict->count ? dict->data + dict->offsets[id] : NULL;
+}
@@ -0,0 +1,65 @@
+#ifndef COLUMNAR_READER_H
+#define COLUMNAR_READER_H
+
+#include "columnar_format.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Read access to the files of a --columnar export, see columnar.h. Files
+// are memory-mapped; the column chunks are returned as pointers into the
+// mapping, so a scan is a sequential read of the arrays, and row groups
+// whose min/max rule them out need not be touched at all.
+struct ColumnarFile {
+  const unsigned char *map;
+  size_t size;
+  const struct ColumnarHeader *header;
+  const struct ColumnarColumnInfo *columns;
+};
+
+struct ColumnarRowGroup {
+  uint64_t firstRow;
+  uint32_t rows;
+};
+
+// Return 0, or -1 after printing the error.
+int columnarFileOpen(struct ColumnarFile *file, const char *path);
+void columnarFileClose(struct ColumnarFile *file);
+
+// Index of the named column, -1 if the table has none.
+int columnarFileColumn(const struct ColumnarFile *file, const char *name);
+
+uint64_t columnarFileRowCount(const struct ColumnarFile *file);
+uint64_t columnarFileRowGroupCount(const struct ColumnarFile *file);
+void columnarFileRowGroup(const struct ColumnarFile *file, uint64_t group,
+                          struct ColumnarRowGroup *out);
+
+// The values of column in the row group, rows of them, as int64_t for
+// COLUMNAR_INT64, int32_t for COLUMNAR_INT32 and uint32_t for
+// COLUMNAR_STRING_ID columns.
+const void *columnarFileChunk(const struct ColumnarFile *file, uint64_t group,
+                              int column);
+void columnarFileChunkRange(const struct ColumnarFile *file, uint64_t group,
+                            int column, int64_t *min, int64_t *max);
+
+// Any column as int64_t, for callers that do not switch on the type.
+int64_t columnarFileValue(const struct ColumnarFile *file, uint64_t group,
+                          int column, uint32_t row);
+
+struct ColumnarDictionary {
+  const unsigned char *map;
+  size_t size;
+  uint64_t count;
+  const uint64_t *offsets;
+  const char *data;
+};
+
+// strings.dict of the export.
+int columnarDictionaryOpen(struct ColumnarDictionary *dict, const char *path);
+void columnarDictionaryClose(struct ColumnarDictionary *dict);
+
+// The string with the ID, NULL if there is none.
+const char *columnarDictionaryString(const struct ColumnarDictionary *dict,
+                                     uint64_t id);
+
+#endif
@@ -0,0 +1,973 @@
+#include "compress_vfs.h"
+
+// Compiled into the importer, or on its own as a loadable extension with
+// COMPRESS_VFS_EXTENSION defined.
+#ifdef COMPRESS_VFS_EXTENSION
+#include <sqlite3ext.h>
+SQLITE_EXTENSION_INIT1
+#else
+#include <sqlite3.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define SECTOR_SIZE 512
+#define HEADER_SIZE (64 * 1024)
+#define HEADER_SECTORS (HEADER_SIZE / SECTOR_SIZE)
+// Magic, page size, page count, generation, map chunk count, then the
+// sector of every map chunk, all little-endian.
+#define HEADER_FIXED_SIZE 32
+#define MAX_MAP_CHUNKS ((HEADER_SIZE - HEADER_FIXED_SIZE) / 4)
+
+// A map entry is the first sector and the stored length of a page.
+#define ENTRY_SIZE 8
+#define MAP_CHUNK_ENTRIES 8192
+#define MAP_CHUNK_SIZE (MAP_CHUNK_ENTRIES * ENTRY_SIZE)
+#define MAP_CHUNK_SECTORS (MAP_CHUNK_SIZE / SECTOR_SIZE)
+
+// Stored length flags. RAW pages did not compress; FRESH, in memory only,
+// marks sectors allocated since the map was last written, which no map on
+// disk refers to.
+#define ENTRY_RAW 0x80000000u
+#define ENTRY_FRESH 0x40000000u
+#define ENTRY_LENGTH 0x00ffffffu
+
+#define MAX_PAGE_SIZE 65536
+#define MAX_EXTENT_SECTORS (MAX_PAGE_SIZE / SECTOR_SIZE)
+
+static const char fileMagic[16] = "SQLiteIdx zlib1";
+
+static const int atomicWrites =
+    SQLITE_IOCAP_ATOMIC | SQLITE_IOCAP_ATOMIC512 | SQLITE_IOCAP_ATOMIC1K |
+    SQLITE_IOCAP_ATOMIC2K | SQLITE_IOCAP_ATOMIC4K | SQLITE_IOCAP_ATOMIC8K |
+    SQLITE_IOCAP_ATOMIC16K | SQLITE_IOCAP_ATOMIC32K | SQLITE_IOCAP_ATOMIC64K |
+    SQLITE_IOCAP_SAFE_APPEND | SQLITE_IOCAP_BATCH_ATOMIC;
+
+struct PageEntry {
+  uint32_t sector;
+  uint32_t length;
+};
+
+struct Extent {
+  uint32_t sector;
+  uint32_t count;
+};
+
+struct ExtentList {
+  struct Extent *extents;
+  size_t count;
+  size_t capacity;
+};
+
+struct CachedPage {
+  // Page number + 1, 0 while empty.
+  uint32_t page;
+  unsigned char *data;
+};
+
+struct CompressFile {
+  sqlite3_file base;
+  // The underlying file, allocated right after this struct.
+  sqlite3_file *real;
+  int lockLevel;
+  // zlib level of the pages written, see compressVfsRegister.
+  int level;
+
+  int pageSize;
+  uint32_t pageCount;
+  uint32_t generation;
+  int headerDirty;
+
+  struct PageEntry *entries;
+  uint32_t *chunkSectors;
+  unsigned char *dirtyChunks;
+  uint32_t chunkCount;
+
+  // First sector past every allocated extent.
+  uint32_t endSector;
+  // Free extents by sector count, up to MAX_EXTENT_SECTORS.
+  struct ExtentList freeExtents[MAX_EXTENT_SECTORS + 1];
+  // Sectors freed since the map was last written, and freed before the
+  // last map write but not yet synced.
+  struct ExtentList pending;
+  struct ExtentList written;
+
+  struct CachedPage *cache;
+  int cachePages;
+  unsigned char *buffer;
+  uLong bufferSize;
+};
+
+static struct {
+  sqlite3_vfs vfs;
+  sqlite3_vfs *real;
+  int level;
+  int cachePages;
+} compressVfs;
+
+static const sqlite3_io_methods compressIoMethods;
+
+static uint32_t readU32(const unsigned char *p) {
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+         (uint32_t)p[3] << 24;
+}
+
+static void writeU32(unsigned char *p, uint32_t value) {
+  p[0] = (unsigned char)value;
+  p[1] = (unsigned char)(value >> 8);
+  p[2] = (unsigned char)(value >> 16);
+  p[3] = (unsigned char)(value >> 24);
+}
+
+static uint32_t sectorsFor(uint32_t length) {
+  return ((length & ENTRY_LENGTH) + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+static sqlite3_int64 sectorOffset(uint32_t sector) {
+  return (sqlite3_int64)sector * SECTOR_SIZE;
+}
+
+static int addExtent(struct ExtentList *list, uint32_t sector,
+                     uint32_t count) {
+  if (list->count == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : 64;
+    struct Extent *grown =
+        realloc(list->extents, capacity * sizeof(struct Extent));
+    if (grown == NULL) {
+      return SQLITE_NOMEM;
+    }
+    list->extents = grown;
+    list->capacity = capacity;
+  }
+  list->extents[list->count].sector = sector;
+  list->extents[list->count].count = count;
+  list->count++;
+  return SQLITE_OK;
+}
+
+static void clearExtents(struct ExtentList *list) {
+  free(list->extents);
+  memset(list, 0, sizeof(*list));
+}
+
+// Makes count sectors from sector reusable.
+static int freeSectors(struct CompressFile *file, uint32_t sector,
+                       uint32_t count) {
+  while (count > 0) {
+    uint32_t piece = count < MAX_EXTENT_SECTORS ? count : MAX_EXTENT_SECTORS;
+    int ret;
+    if ((ret = addExtent(&file->freeExtents[piece], sector, piece)) !=
+        SQLITE_OK) {
+      return ret;
+    }
+    sector += piece;
+    count -= piece;
+  }
+  return SQLITE_OK;
+}
+
+static int releaseExtents(struct CompressFile *file, struct ExtentList *list) {
+  int ret = SQLITE_OK;
+  for (size_t i = 0; i < list->count && ret == SQLITE_OK; ++i) {
+    ret = freeSectors(file, list->extents[i].sector, list->extents[i].count);
+  }
+  list->count = 0;
+  return ret;
+}
+
+// Returns the first of count free sectors, taken from the smallest free
+// extent that holds them or from the end of the file.
+static int allocateSectors(struct CompressFile *file, uint32_t count,
+                           uint32_t *sector) {
+  for (uint32_t size = count; size <= MAX_EXTENT_SECTORS; ++size) {
+    struct ExtentList *list = &file->freeExtents[size];
+    if (list->count != 0) {
+      *sector = list->extents[--list->count].sector;
+      return size > count ? freeSectors(file, *sector + count, size - count)
+                          : SQLITE_OK;
+    }
+  }
+  if (file->endSector > UINT32_MAX - count) {
+    return SQLITE_FULL;
+  }
+  *sector = file->endSector;
+  file->endSector += count;
+  return SQLITE_OK;
+}
+
+// Gives up count sectors from sector of a page entry: at once if the
+// sectors are fresh, after the next map write otherwise.
+static int dropSectors(struct CompressFile *file, const struct PageEntry *entry,
+                       uint32_t sector, uint32_t count) {
+  if (count == 0) {
+    return SQLITE_OK;
+  }
+  return entry->length & ENTRY_FRESH
+             ? freeSectors(file, sector, count)
+             : addExtent(&file->pending, sector, count);
+}
+
+static void clearCache(struct CompressFile *file) {
+  for (int i = 0; file->cache != NULL && i < file->cachePages; ++i) {
+    file->cache[i].page = 0;
+  }
+}
+
+static void freeState(struct CompressFile *file) {
+  for (int i = 0; file->cache != NULL && i < file->cachePages; ++i) {
+    free(file->cache[i].data);
+  }
+  free(file->cache);
+  free(file->buffer);
+  free(file->entries);
+  free(file->chunkSectors);
+  free(file->dirtyChunks);
+  for (int i = 0; i <= MAX_EXTENT_SECTORS; ++i) {
+    clearExtents(&file->freeExtents[i]);
+  }
+  clearExtents(&file->pending);
+  clearExtents(&file->written);
+  file->cache = NULL;
+  file->buffer = NULL;
+  file->entries = NULL;
+  file->chunkSectors = NULL;
+  file->dirtyChunks = NULL;
+  file->chunkCount = 0;
+}
+
+// Sizes the page cache and the compression buffer for pageSize.
+static int setPageSize(struct CompressFile *file, int pageSize) {
+  if (pageSize < 512 || pageSize > MAX_PAGE_SIZE ||
+      (pageSize & (pageSize - 1)) != 0) {
+    return SQLITE_CORRUPT;
+  }
+  if (file->cache == NULL) {
+    file->cache = calloc(file->cachePages, sizeof(struct CachedPage));
+    if (file->cache == NULL) {
+      return SQLITE_NOMEM;
+    }
+  }
+  if (pageSize == file->pageSize && file->buffer != NULL) {
+    return SQLITE_OK;
+  }
+  for (int i = 0; i < file->cachePages; ++i) {
+    free(file->cache[i].data);
+    file->cache[i].data = NULL;
+    file->cache[i].page = 0;
+  }
+  free(file->buffer);
+  file->bufferSize = compressBound(pageSize);
+  if ((file->buffer = malloc(file->bufferSize)) == NULL) {
+    return SQLITE_NOMEM;
+  }
+  file->pageSize = pageSize;
+  return SQLITE_OK;
+}
+
+// Makes room for the map chunks up to chunk, placing the new ones.
+static int ensureChunks(struct CompressFile *file, uint32_t chunk) {
+  if (chunk < file->chunkCount) {
+    return SQLITE_OK;
+  }
+  if (chunk >= MAX_MAP_CHUNKS) {
+    return SQLITE_FULL;
+  }
+  uint32_t count = chunk + 1;
+  struct PageEntry *entries = realloc(
+      file->entries, (size_t)count * MAP_CHUNK_ENTRIES * sizeof(*entries));
+  if (entries == NULL) {
+    return SQLITE_NOMEM;
+  }
+  file->entries = entries;
+  uint32_t *sectors = realloc(file->chunkSectors, count * sizeof(*sectors));
+  if (sectors == NULL) {
+    return SQLITE_NOMEM;
+  }
+  file->chunkSectors = sectors;
+  unsigned char *dirty = realloc(file->dirtyChunks, count);
+  if (dirty == NULL) {
+    return SQLITE_NOMEM;
+  }
+  file->dirtyChunks = dirty;
+
+  memset(entries + (size_t)file->chunkCount * MAP_CHUNK_ENTRIES, 0,
+         (size_t)(count - file->chunkCount) * MAP_CHUNK_ENTRIES *
+             sizeof(*entries));
+  for (uint32_t i = file->chunkCount; i < count; ++i) {
+    int ret;
+    if ((ret = allocateSectors(file, MAP_CHUNK_SECTORS, &sectors[i])) !=
+        SQLITE_OK) {
+      return ret;
+    }
+    dirty[i] = 1;
+    // Counted once placed, so a failure above leaves a consistent map.
+    file->chunkCount = i + 1;
+  }
+  file->headerDirty = 1;
+  return SQLITE_OK;
+}
+
+// Writes the dirty map chunks and the header. Sectors that were pending
+// become written: reusable once this map is synced, or at the next map
+// write without a sync in between.
+static int writeMap(struct CompressFile *file) {
+  if (!file->headerDirty) {
+    return SQLITE_OK;
+  }
+
+  int ret;
+  unsigned char *chunk = malloc(MAP_CHUNK_SIZE);
+  if (chunk == NULL) {
+    return SQLITE_NOMEM;
+  }
+  for (uint32_t i = 0; i < file->chunkCount; ++i) {
+    if (!file->dirtyChunks[i]) {
+      continue;
+    }
+    struct PageEntry *entries = file->entries + (size_t)i * MAP_CHUNK_ENTRIES;
+    for (int j = 0; j < MAP_CHUNK_ENTRIES; ++j) {
+      entries[j].length &= ~ENTRY_FRESH;
+      writeU32(chunk + j * ENTRY_SIZE, entries[j].sector);
+      writeU32(chunk + j * ENTRY_SIZE + 4, entries[j].length);
+    }
+    if ((ret = file->real->pMethods->xWrite(
+             file->real, chunk, MAP_CHUNK_SIZE,
+             sectorOffset(file->chunkSectors[i]))) != SQLITE_OK) {
+      free(chunk);
+      return ret;
+    }
+    file->dirtyChunks[i] = 0;
+  }
+
+  size_t headerSize = HEADER_FIXED_SIZE + (size_t)file->chunkCount * 4;
+  memset(chunk, 0, headerSize);
+  memcpy(chunk, fileMagic, sizeof(fileMagic));
+  writeU32(chunk + 16, (uint32_t)file->pageSize);
+  writeU32(chunk + 20, file->pageCount);
+  writeU32(chunk + 24, ++file->generation);
+  writeU32(chunk + 28, file->chunkCount);
+  for (uint32_t i = 0; i < file->chunkCount; ++i) {
+    writeU32(chunk + HEADER_FIXED_SIZE + i * 4, file->chunkSectors[i]);
+  }
+  ret = file->real->pMethods->xWrite(file->real, chunk, (int)headerSize, 0);
+  free(chunk);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  file->headerDirty = 0;
+
+  if ((ret = releaseExtents(file, &file->written)) != SQLITE_OK) {
+    return ret;
+  }
+  struct ExtentList swap = file->written;
+  file->written = file->pending;
+  file->pending = swap;
+  return SQLITE_OK;
+}
+
+static int compareExtents(const void *a, const void *b) {
+  uint32_t x = ((const struct Extent *)a)->sector;
+  uint32_t y = ((const struct Extent *)b)->sector;
+  return x < y ? -1 : x > y;
+}
+
+// Reads the header and the map and derives the free sectors: everything
+// below the end of the last extent in use that no page, chunk or the
+// header covers.
+static int loadMap(struct CompressFile *file) {
+  unsigned char *header = malloc(HEADER_SIZE);
+  if (header == NULL) {
+    return SQLITE_NOMEM;
+  }
+  int ret = file->real->pMethods->xRead(file->real, header, HEADER_SIZE, 0);
+  if (ret != SQLITE_OK && ret != SQLITE_IOERR_SHORT_READ) {
+    free(header);
+    return ret;
+  }
+  uint32_t pageSize = readU32(header + 16);
+  uint32_t chunkCount = readU32(header + 28);
+  if (memcmp(header, fileMagic, sizeof(fileMagic)) != 0 ||
+      chunkCount > MAX_MAP_CHUNKS) {
+    free(header);
+    return SQLITE_CORRUPT;
+  }
+
+  freeState(file);
+  file->pageCount = readU32(header + 20);
+  file->generation = readU32(header + 24);
+  file->headerDirty = 0;
+  file->endSector = HEADER_SECTORS;
+  ret = SQLITE_OK;
+  if (pageSize != 0) {
+    ret = setPageSize(file, (int)pageSize);
+  } else {
+    file->pageSize = 0;
+  }
+  if (ret == SQLITE_OK && chunkCount != 0) {
+    ret = ensureChunks(file, chunkCount - 1);
+  }
+  for (uint32_t i = 0; ret == SQLITE_OK && i < chunkCount; ++i) {
+    file->chunkSectors[i] = readU32(header + HEADER_FIXED_SIZE + i * 4);
+    file->dirtyChunks[i] = 0;
+  }
+  free(header);
+  file->headerDirty = 0;
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+
+  struct ExtentList used;
+  memset(&used, 0, sizeof(used));
+  unsigned char *chunk = malloc(MAP_CHUNK_SIZE);
+  if (chunk == NULL) {
+    return SQLITE_NOMEM;
+  }
+  ret = addExtent(&used, 0, HEADER_SECTORS);
+  for (uint32_t i = 0; ret == SQLITE_OK && i < chunkCount; ++i) {
+    if ((ret = addExtent(&used, file->chunkSectors[i], MAP_CHUNK_SECTORS)) !=
+            SQLITE_OK ||
+        (ret = file->real->pMethods->xRead(
+             file->real, chunk, MAP_CHUNK_SIZE,
+             sectorOffset(file->chunkSectors[i]))) != SQLITE_OK) {
+      break;
+    }
+    struct PageEntry *entries = file->entries + (size_t)i * MAP_CHUNK_ENTRIES;
+    for (int j = 0; j < MAP_CHUNK_ENTRIES && ret == SQLITE_OK; ++j) {
+      entries[j].sector = readU32(chunk + j * ENTRY_SIZE);
+      entries[j].length = readU32(chunk + j * ENTRY_SIZE + 4) & ~ENTRY_FRESH;
+      if ((entries[j].length & ENTRY_LENGTH) != 0) {
+        ret = addExtent(&used, entries[j].sector,
+                        sectorsFor(entries[j].length));
+      }
+    }
+  }
+  free(chunk);
+
+  if (ret == SQLITE_OK) {
+    qsort(used.extents, used.count, sizeof(struct Extent), compareExtents);
+    uint32_t end = 0;
+    for (size_t i = 0; i < used.count && ret == SQLITE_OK; ++i) {
+      if (used.extents[i].sector > end) {
+        ret = freeSectors(file, end, used.extents[i].sector - end);
+      }
+      uint32_t extentEnd = used.extents[i].sector + used.extents[i].count;
+      end = extentEnd > end ? extentEnd : end;
+    }
+    file->endSector = end;
+  }
+  clearExtents(&used);
+  return ret == SQLITE_IOERR_SHORT_READ ? SQLITE_CORRUPT : ret;
+}
+
+// Reloads the map if another connection wrote the file since it was read.
+static int refreshMap(struct CompressFile *file) {
+  if (file->headerDirty) {
+    return SQLITE_OK;
+  }
+  unsigned char header[HEADER_FIXED_SIZE];
+  int ret = file->real->pMethods->xRead(file->real, header, sizeof(header), 0);
+  if (ret == SQLITE_IOERR_SHORT_READ) {
+    // Still empty.
+    return SQLITE_OK;
+  }
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  if (readU32(header + 24) == file->generation) {
+    return SQLITE_OK;
+  }
+  clearCache(file);
+  return loadMap(file);
+}
+
+// Returns the decompressed page, from the cache if it is there.
+static int loadPage(struct CompressFile *file, uint32_t page,
+                    unsigned char **data) {
+  struct CachedPage *cached = &file->cache[page % file->cachePages];
+  if (cached->page == page + 1) {
+    *data = cached->data;
+    return SQLITE_OK;
+  }
+  if (cached->data == NULL &&
+      (cached->data = malloc(file->pageSize)) == NULL) {
+    return SQLITE_NOMEM;
+  }
+  cached->page = 0;
+
+  const struct PageEntry *entry =
+      page < (uint64_t)file->chunkCount * MAP_CHUNK_ENTRIES
+          ? &file->entries[page]
+          : NULL;
+  uint32_t length = entry != NULL ? entry->length & ENTRY_LENGTH : 0;
+  int ret = SQLITE_OK;
+  if (length == 0) {
+    // Never written.
+    memset(cached->data, 0, file->pageSize);
+  } else if (entry->length & ENTRY_RAW) {
+    ret = file->real->pMethods->xRead(file->real, cached->data,
+                                      file->pageSize,
+                                      sectorOffset(entry->sector));
+  } else if (length > file->bufferSize) {
+    ret = SQLITE_CORRUPT;
+  } else if ((ret = file->real->pMethods->xRead(
+                  file->real, file->buffer, (int)length,
+                  sectorOffset(entry->sector))) == SQLITE_OK) {
+    uLongf size = file->pageSize;
+    if (uncompress(cached->data, &size, file->buffer, length) != Z_OK ||
+        size != (uLongf)file->pageSize) {
+      ret = SQLITE_CORRUPT;
+    }
+  }
+  if (ret != SQLITE_OK) {
+    return ret == SQLITE_IOERR_SHORT_READ ? SQLITE_CORRUPT : ret;
+  }
+  cached->page = page + 1;
+  *data = cached->data;
+  return SQLITE_OK;
+}
+
+static int writePage(struct CompressFile *file, uint32_t page,
+                     const void *data) {
+  int ret;
+  if ((ret = ensureChunks(file, page / MAP_CHUNK_ENTRIES)) != SQLITE_OK) {
+    return ret;
+  }
+
+  const void *stored = file->buffer;
+  uLongf size = file->bufferSize;
+  uint32_t length;
+  // Pages that would not save a sector are stored as they are.
+  if (compress2(file->buffer, &size, data, file->pageSize,
+                file->level) == Z_OK &&
+      size + SECTOR_SIZE <= (uLongf)file->pageSize) {
+    length = (uint32_t)size;
+  } else {
+    stored = data;
+    length = (uint32_t)file->pageSize | ENTRY_RAW;
+  }
+
+  struct PageEntry *entry = &file->entries[page];
+  uint32_t sectors = sectorsFor(length);
+  uint32_t oldSectors = sectorsFor(entry->length);
+  uint32_t sector;
+  if (oldSectors >= sectors && oldSectors != 0) {
+    // In place; a hot journal rewrites the page wherever the map on disk
+    // points, which is the same sectors.
+    sector = entry->sector;
+    if ((ret = dropSectors(file, entry, sector + sectors,
+                           oldSectors - sectors)) != SQLITE_OK) {
+      return ret;
+    }
+    length |= entry->length & ENTRY_FRESH;
+  } else {
+    if ((ret = allocateSectors(file, sectors, &sector)) != SQLITE_OK ||
+        (ret = dropSectors(file, entry, entry->sector, oldSectors)) !=
+            SQLITE_OK) {
+      return ret;
+    }
+    length |= ENTRY_FRESH;
+  }
+
+  if ((ret = file->real->pMethods->xWrite(file->real, stored,
+                                          (int)(length & ENTRY_LENGTH),
+                                          sectorOffset(sector))) !=
+      SQLITE_OK) {
+    return ret;
+  }
+  entry->sector = sector;
+  entry->length = length;
+  file->dirtyChunks[page / MAP_CHUNK_ENTRIES] = 1;
+  file->headerDirty = 1;
+  if (page >= file->pageCount) {
+    file->pageCount = page + 1;
+  }
+
+  struct CachedPage *cached = &file->cache[page % file->cachePages];
+  if (cached->data != NULL) {
+    memcpy(cached->data, data, file->pageSize);
+    cached->page = page + 1;
+  }
+  return SQLITE_OK;
+}
+
+static int compressClose(sqlite3_file *base) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  int ret = writeMap(file);
+  int closeRet = file->real->pMethods->xClose(file->real);
+  freeState(file);
+  return ret != SQLITE_OK ? ret : closeRet;
+}
+
+static int compressRead(sqlite3_file *base, void *out, int amount,
+                        sqlite3_int64 offset) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  unsigned char *dest = out;
+  sqlite3_int64 size = (sqlite3_int64)file->pageCount * file->pageSize;
+  while (amount > 0) {
+    if (offset >= size) {
+      memset(dest, 0, amount);
+      return SQLITE_IOERR_SHORT_READ;
+    }
+    uint32_t page = (uint32_t)(offset / file->pageSize);
+    int within = (int)(offset % file->pageSize);
+    int n = file->pageSize - within < amount ? file->pageSize - within
+                                             : amount;
+    unsigned char *data;
+    int ret;
+    if ((ret = loadPage(file, page, &data)) != SQLITE_OK) {
+      return ret;
+    }
+    memcpy(dest, data + within, n);
+    dest += n;
+    offset += n;
+    amount -= n;
+  }
+  return SQLITE_OK;
+}
+
+// SQLite writes whole pages to database files.
+static int compressWrite(sqlite3_file *base, const void *data, int amount,
+                         sqlite3_int64 offset) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  int ret;
+  if (file->pageCount == 0 && amount != file->pageSize &&
+      (ret = setPageSize(file, amount)) != SQLITE_OK) {
+    return SQLITE_IOERR_WRITE;
+  }
+  if (amount != file->pageSize || offset % amount != 0 ||
+      offset / amount > UINT32_MAX - 1) {
+    return SQLITE_IOERR_WRITE;
+  }
+  return writePage(file, (uint32_t)(offset / amount), data);
+}
+
+static int compressTruncate(sqlite3_file *base, sqlite3_int64 size) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  if (file->pageSize == 0) {
+    return SQLITE_OK;
+  }
+  uint32_t count = (uint32_t)((size + file->pageSize - 1) / file->pageSize);
+  for (uint32_t page = count; page < file->pageCount; ++page) {
+    struct PageEntry *entry = &file->entries[page];
+    int ret;
+    if ((ret = dropSectors(file, entry, entry->sector,
+                           sectorsFor(entry->length))) != SQLITE_OK) {
+      return ret;
+    }
+    entry->sector = 0;
+    entry->length = 0;
+    file->dirtyChunks[page / MAP_CHUNK_ENTRIES] = 1;
+    struct CachedPage *cached = &file->cache[page % file->cachePages];
+    if (cached->page == page + 1) {
+      cached->page = 0;
+    }
+  }
+  if (count < file->pageCount) {
+    file->pageCount = count;
+    file->headerDirty = 1;
+  }
+  return SQLITE_OK;
+}
+
+static int compressSync(sqlite3_file *base, int flags) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  int ret;
+  if ((ret = writeMap(file)) != SQLITE_OK ||
+      (ret = file->real->pMethods->xSync(file->real, flags)) != SQLITE_OK) {
+    return ret;
+  }
+  return releaseExtents(file, &file->written);
+}
+
+static int compressFileSize(sqlite3_file *base, sqlite3_int64 *size) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  *size = (sqlite3_int64)file->pageCount * file->pageSize;
+  return SQLITE_OK;
+}
+
+static int compressLock(sqlite3_file *base, int level) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  int ret = file->real->pMethods->xLock(file->real, level);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  int previous = file->lockLevel;
+  file->lockLevel = level;
+  return previous == SQLITE_LOCK_NONE ? refreshMap(file) : SQLITE_OK;
+}
+
+static int compressUnlock(sqlite3_file *base, int level) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  int ret = file->real->pMethods->xUnlock(file->real, level);
+  if (ret == SQLITE_OK) {
+    file->lockLevel = level;
+  }
+  return ret;
+}
+
+static int compressCheckReservedLock(sqlite3_file *base, int *reserved) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  return file->real->pMethods->xCheckReservedLock(file->real, reserved);
+}
+
+static int compressFileControl(sqlite3_file *base, int op, void *arg) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  switch (op) {
+  case SQLITE_FCNTL_SYNC:
+    // Sent at every commit, also with synchronous=OFF, where no xSync
+    // follows.
+  case SQLITE_FCNTL_CKPT_DONE: {
+    int ret = writeMap(file);
+    if (ret == SQLITE_OK) {
+      ret = file->real->pMethods->xFileControl(file->real, op, arg);
+    }
+    return ret == SQLITE_NOTFOUND ? SQLITE_OK : ret;
+  }
+  case SQLITE_FCNTL_SIZE_HINT:
+  case SQLITE_FCNTL_CHUNK_SIZE:
+    // In logical bytes, which say nothing about the file's size.
+    return SQLITE_OK;
+  case SQLITE_FCNTL_VFSNAME: {
+    int ret = file->real->pMethods->xFileControl(file->real, op, arg);
+    if (ret == SQLITE_OK) {
+      *(char **)arg =
+          sqlite3_mprintf("%s/%z", COMPRESS_VFS_NAME, *(char **)arg);
+    }
+    return ret;
+  }
+  default:
+    return file->real->pMethods->xFileControl(file->real, op, arg);
+  }
+}
+
+static int compressSectorSize(sqlite3_file *base) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  return file->real->pMethods->xSectorSize(file->real);
+}
+
+static int compressDeviceCharacteristics(sqlite3_file *base) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  return file->real->pMethods->xDeviceCharacteristics(file->real) &
+         ~atomicWrites;
+}
+
+static int compressShmMap(sqlite3_file *base, int region, int size,
+                          int extend, void volatile **memory) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  return file->real->pMethods->xShmMap(file->real, region, size, extend,
+                                       memory);
+}
+
+static int compressShmLock(sqlite3_file *base, int offset, int count,
+                           int flags) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  int ret = file->real->pMethods->xShmLock(file->real, offset, count, flags);
+  // A WAL read transaction is starting; another connection may have
+  // checkpointed into the file since.
+  if (ret == SQLITE_OK &&
+      flags == (SQLITE_SHM_LOCK | SQLITE_SHM_SHARED)) {
+    ret = refreshMap(file);
+  }
+  return ret;
+}
+
+static void compressShmBarrier(sqlite3_file *base) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  file->real->pMethods->xShmBarrier(file->real);
+}
+
+static int compressShmUnmap(sqlite3_file *base, int deleteFlag) {
+  struct CompressFile *file = (struct CompressFile *)base;
+  return file->real->pMethods->xShmUnmap(file->real, deleteFlag);
+}
+
+// Pages are never mapped, SQLite falls back to xRead.
+static int compressFetch(sqlite3_file *base, sqlite3_int64 offset,
+                         int amount, void **pages) {
+  *pages = NULL;
+  return SQLITE_OK;
+}
+
+static int compressUnfetch(sqlite3_file *base, sqlite3_int64 offset,
+                           void *page) {
+  return SQLITE_OK;
+}
+
+static const sqlite3_io_methods compressIoMethods = {
+    3,
+    compressClose,
+    compressRead,
+    compressWrite,
+    compressTruncate,
+    compressSync,
+    compressFileSize,
+    compressLock,
+    compressUnlock,
+    compressCheckReservedLock,
+    compressFileControl,
+    compressSectorSize,
+    compressDeviceCharacteristics,
+    compressShmMap,
+    compressShmLock,
+    compressShmBarrier,
+    compressShmUnmap,
+    compressFetch,
+    compressUnfetch,
+};
+
+static int compressOpen(sqlite3_vfs *vfs, const char *name,
+                        sqlite3_file *base, int flags, int *outFlags) {
+  // Everything but database files is the real VFS's business, in the
+  // same memory.
+  if (!(flags & SQLITE_OPEN_MAIN_DB)) {
+    return compressVfs.real->xOpen(compressVfs.real, name, base, flags,
+                                   outFlags);
+  }
+
+  struct CompressFile *file = (struct CompressFile *)base;
+  memset(file, 0, sizeof(*file));
+  file->real = (sqlite3_file *)(file + 1);
+  file->cachePages = compressVfs.cachePages;
+  sqlite3_int64 level = sqlite3_uri_int64(name, "compress", compressVfs.level);
+  file->level = level < 0 || level > 9 ? compressVfs.level : (int)level;
+  int ret = compressVfs.real->xOpen(compressVfs.real, name, file->real,
+                                    flags, outFlags);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+
+  sqlite3_int64 size;
+  char magic[16];
+  if ((ret = file->real->pMethods->xFileSize(file->real, &size)) !=
+      SQLITE_OK) {
+    file->real->pMethods->xClose(file->real);
+    return ret;
+  }
+  if ((size == 0 && file->level == 0) ||
+      (size >= (sqlite3_int64)sizeof(magic) &&
+       (ret = file->real->pMethods->xRead(file->real, magic, sizeof(magic),
+                                          0)) == SQLITE_OK &&
+       memcmp(magic, fileMagic, sizeof(magic)) != 0)) {
+    // An uncompressed database, or something SQLite will reject itself.
+    file->real->pMethods->xClose(file->real);
+    return compressVfs.real->xOpen(compressVfs.real, name, base, flags,
+                                   outFlags);
+  }
+
+  if (size == 0) {
+    file->endSector = HEADER_SECTORS;
+    if ((file->cache = calloc(file->cachePages, sizeof(struct CachedPage))) ==
+        NULL) {
+      ret = SQLITE_NOMEM;
+    }
+  } else if (ret == SQLITE_OK) {
+    ret = loadMap(file);
+  }
+  if (ret != SQLITE_OK) {
+    file->real->pMethods->xClose(file->real);
+    freeState(file);
+    return ret;
+  }
+  base->pMethods = &compressIoMethods;
+  return SQLITE_OK;
+}
+
+static int compressDelete(sqlite3_vfs *vfs, const char *name, int syncDir) {
+  return compressVfs.real->xDelete(compressVfs.real, name, syncDir);
+}
+
+static int compressAccess(sqlite3_vfs *vfs, const char *name, int flags,
+                          int *result) {
+  return compressVfs.real->xAccess(compressVfs.real, name, flags, result);
+}
+
+static int compressFullPathname(sqlite3_vfs *vfs, const char *name,
+                                int size, char *out) {
+  return compressVfs.real->xFullPathname(compressVfs.real, name, size, out);
+}
+
+static void *compressDlOpen(sqlite3_vfs *vfs, const char *path) {
+  return compressVfs.real->xDlOpen(compressVfs.real, path);
+}
+
+static void compressDlError(sqlite3_vfs *vfs, int size, char *message) {
+  compressVfs.real->xDlError(compressVfs.real, size, message);
+}
+
+static void (*compressDlSym(sqlite3_vfs *vfs, void *handle,
+                            const char *symbol))(void) {
+  return compressVfs.real->xDlSym(compressVfs.real, handle, symbol);
+}
+
+static void compressDlClose(sqlite3_vfs *vfs, void *handle) {
+  compressVfs.real->xDlClose(compressVfs.real, handle);
+}
+
+static int compressRandomness(sqlite3_vfs *vfs, int size, char *out) {
+  return compressVfs.real->xRandomness(compressVfs.real, size, out);
+}
+
+static int compressSleep(sqlite3_vfs *vfs, int micros) {
+  return compressVfs.real->xSleep(compressVfs.real, micros);
+}
+
+static int compressCurrentTime(sqlite3_vfs *vfs, double *now) {
+  return compressVfs.real->xCurrentTime(compressVfs.real, now);
+}
+
+static int compressGetLastError(sqlite3_vfs *vfs, int size, char *out) {
+  return compressVfs.real->xGetLastError(compressVfs.real, size, out);
+}
+
+static int compressCurrentTimeInt64(sqlite3_vfs *vfs, sqlite3_int64 *now) {
+  return compressVfs.real->xCurrentTimeInt64(compressVfs.real, now);
+}
+
+int compressVfsRegister(int level, int cachePages, int makeDefault) {
+  if (compressVfs.real != NULL) {
+    return SQLITE_MISUSE;
+  }
+  sqlite3_vfs *real = sqlite3_vfs_find(NULL);
+  if (real == NULL) {
+    return SQLITE_ERROR;
+  }
+  compressVfs.real = real;
+  compressVfs.level = level;
+  compressVfs.cachePages = cachePages > 0 ? cachePages : 1;
+
+  sqlite3_vfs *vfs = &compressVfs.vfs;
+  vfs->iVersion = 2;
+  vfs->szOsFile = (int)sizeof(struct CompressFile) + real->szOsFile;
+  vfs->mxPathname = real->mxPathname;
+  vfs->zName = COMPRESS_VFS_NAME;
+  vfs->xOpen = compressOpen;
+  vfs->xDelete = compressDelete;
+  vfs->xAccess = compressAccess;
+  vfs->xFullPathname = compressFullPathname;
+  vfs->xDlOpen = compressDlOpen;
+  vfs->xDlError = compressDlError;
+  vfs->xDlSym = compressDlSym;
+  vfs->xDlClose = compressDlClose;
+  vfs->xRandomness = compressRandomness;
+  vfs->xSleep = compressSleep;
+  vfs->xCurrentTime = compressCurrentTime;
+  vfs->xGetLastError = compressGetLastError;
+  vfs->xCurrentTimeInt64 = compressCurrentTimeInt64;
+  return sqlite3_vfs_register(vfs, makeDefault);
+}
+
+#ifdef COMPRESS_VFS_EXTENSION
+// Loading the extension makes the VFS the default for the rest of the
+// process, so databases written with --compress open as usual. New
+// databases stay uncompressed unless their URI asks for a level, as in
+// file:new.db?compress=6.
+int sqlite3_compressvfs_init(sqlite3 *db, char **pzErrMsg,
+                             const sqlite3_api_routines *pApi) {
+  SQLITE_EXTENSION_INIT2(pApi);
+  int ret = compressVfsRegister(0, 256, 1);
+  return ret == SQLITE_OK ? SQLITE_OK_LOAD_PERMANENTLY : ret;
+}
+#endif
@@ -0,0 +1,31 @@
+#ifndef COMPRESS_VFS_H
+#define COMPRESS_VFS_H
+
+// SQLite VFS storing the pages of database files zlib-compressed, for
+// --compress. It sits on top of the default VFS; journals, WAL files and
+// temporary files pass through unchanged, and so do existing uncompressed
+// databases, which stay uncompressed.
+//
+// A compressed file starts with a 64 KiB header holding the page size,
+// the page count and the locations of the page map chunks. The map has an
+// entry per page, the 512-byte sector its data starts at and its stored
+// length, so pages can be of any compressed size. A page is rewritten in
+// place while it still fits in its sectors and moved otherwise; sectors
+// freed by a move are only reused once the map no longer referring to
+// them is on disk, so a hot journal can always be rolled back. The map is
+// written at every commit and checkpoint. Free sectors are reused by later
+// writes; the file itself never shrinks.
+//
+// Every open database keeps a cache of decompressed pages, on top of
+// SQLite's page cache; reads within a page, like the header reads SQLite
+// does on every transaction, decompress it once.
+#define COMPRESS_VFS_NAME "compress"
+
+// Registers the VFS over the current default, as the new default if
+// makeDefault is set. level is the zlib level of new databases, 0 to
+// create them uncompressed and only read and update compressed ones;
+// cachePages is the number of decompressed pages cached per open database.
+// A "compress" URI parameter of 0 to 9 overrides level for one database.
+int compressVfsRegister(int level, int cachePages, int makeDefault);
+
+#endif
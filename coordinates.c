@@ -0,0 +1,54 @@
+#include "coordinates.h"
+
+// Compiled into the importer, or on its own as a loadable extension with
+// COORDINATES_EXTENSION defined.
+#ifdef COORDINATES_EXTENSION
+#include <sqlite3ext.h>
+SQLITE_EXTENSION_INIT1
+#else
+#include <sqlite3.h>
+#endif
+
+#include <math.h>
+#include <stddef.h>
+
+long long coordinateToE7(double degrees) {
+  return llround(degrees * COORDINATE_E7_SCALE);
+}
+
+double coordinateFromE7(long long e7) { return e7 / COORDINATE_E7_SCALE; }
+
+static void e7ToDegrees(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+  sqlite3_result_double(ctx, coordinateFromE7(sqlite3_value_int64(argv[0])));
+}
+
+static void degreesToE7(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+  sqlite3_result_int64(ctx, coordinateToE7(sqlite3_value_double(argv[0])));
+}
+
+// Registers e7_to_degrees(int) and degrees_to_e7(real), for queries on
+// --compact-nodes databases, e.g.
+//   SELECT * FROM nodes WHERE lat BETWEEN degrees_to_e7(51.5)
+//                                     AND degrees_to_e7(51.6);
+int sqlite3_coordinates_init(sqlite3 *db, char **pzErrMsg,
+                             const sqlite3_api_routines *pApi) {
+#ifdef COORDINATES_EXTENSION
+  SQLITE_EXTENSION_INIT2(pApi);
+#endif
+  int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS;
+  int ret;
+  if ((ret = sqlite3_create_function(db, "e7_to_degrees", 1, flags, NULL,
+                                     e7ToDegrees, NULL, NULL)) != SQLITE_OK) {
+    return ret;
+  }
+  return sqlite3_create_function(db, "degrees_to_e7", 1, flags, NULL,
+                                 degreesToE7, NULL, NULL);
+}
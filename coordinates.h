@@ -0,0 +1,15 @@
+#ifndef COORDINATES_H
+#define COORDINATES_H
+
+// Fixed-point coordinates: degrees scaled by 1e7 and rounded, the
+// resolution of the OSM database and of the PBF format, which fits an int32
+// for every valid latitude and longitude.
+#define COORDINATE_E7_SCALE 10000000.0
+
+long long coordinateToE7(double degrees);
+
+// Division rather than multiplication by 1e-7 gives the double closest to
+// the decimal value, the one the XML parser produced.
+double coordinateFromE7(long long e7);
+
+#endif
@@ -0,0 +1,70 @@
+#include "id_set.h"
+#include "memory_budget.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define WORDS_PER_PAGE (ID_SET_PAGE_BITS / 64)
+
+void idSetInit(struct IdSet *set) { memset(set, 0, sizeof(*set)); }
+
+int idSetAdd(struct IdSet *set, long long id) {
+  struct IdSetPages *pages = id < 0 ? &set->negative : &set->positive;
+  uint64_t bit = id < 0 ? -(uint64_t)id : (uint64_t)id;
+  size_t page = bit / ID_SET_PAGE_BITS;
+  if (page >= pages->count) {
+    size_t count = pages->count ? pages->count : 64;
+    while (count <= page) {
+      count *= 2;
+    }
+    uint64_t **grown = realloc(pages->pages, count * sizeof(uint64_t *));
+    if (grown == NULL) {
+      return -1;
+    }
+    memset(grown + pages->count, 0,
+           (count - pages->count) * sizeof(uint64_t *));
+    pages->pages = grown;
+    pages->count = count;
+  }
+  if (pages->pages[page] == NULL) {
+    if ((pages->pages[page] = calloc(WORDS_PER_PAGE, sizeof(uint64_t))) ==
+        NULL) {
+      return -1;
+    }
+    // The bitmaps cannot spill; they are only reported.
+    memoryBudgetCharge(MEMORY_ID_SETS, WORDS_PER_PAGE * sizeof(uint64_t));
+  }
+  uint64_t *word = &pages->pages[page][bit % ID_SET_PAGE_BITS / 64];
+  uint64_t mask = 1ULL << (bit % 64);
+  if ((*word & mask) == 0) {
+    *word |= mask;
+    set->count++;
+  }
+  return 0;
+}
+
+int idSetContains(const struct IdSet *set, long long id) {
+  const struct IdSetPages *pages = id < 0 ? &set->negative : &set->positive;
+  uint64_t bit = id < 0 ? -(uint64_t)id : (uint64_t)id;
+  size_t page = bit / ID_SET_PAGE_BITS;
+  if (page >= pages->count || pages->pages[page] == NULL) {
+    return 0;
+  }
+  return (pages->pages[page][bit % ID_SET_PAGE_BITS / 64] >> (bit % 64)) & 1;
+}
+
+static void freePages(struct IdSetPages *pages) {
+  for (size_t i = 0; i < pages->count; ++i) {
+    if (pages->pages[i] != NULL) {
+      memoryBudgetRelease(MEMORY_ID_SETS, WORDS_PER_PAGE * sizeof(uint64_t));
+      free(pages->pages[i]);
+    }
+  }
+  free(pages->pages);
+}
+
+void idSetFree(struct IdSet *set) {
+  freePages(&set->positive);
+  freePages(&set->negative);
+  memset(set, 0, sizeof(*set));
+}
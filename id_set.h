@@ -0,0 +1,34 @@
+#ifndef ID_SET_H
+#define ID_SET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Set of OSM IDs as a bitmap split into pages of ID_SET_PAGE_BITS IDs,
+// allocated when the first ID in their range is added: one bit per ID of
+// the ranges in use, about 1.5 GB for every node of a planet and a few
+// megabytes for a city extract. Negative IDs, as in unsaved editor data,
+// have pages of their own.
+#define ID_SET_PAGE_BITS (1 << 16)
+
+struct IdSetPages {
+  uint64_t **pages;
+  size_t count;
+};
+
+struct IdSet {
+  struct IdSetPages positive;
+  struct IdSetPages negative;
+  long long count;
+};
+
+void idSetInit(struct IdSet *set);
+
+// Returns 0, or -1 when out of memory.
+int idSetAdd(struct IdSet *set, long long id);
+
+int idSetContains(const struct IdSet *set, long long id);
+
+void idSetFree(struct IdSet *set);
+
+#endif
@@ -0,0 +1,1683 @@
+#include "import.h"
+
+#include "batch_insert.h"
+#include "columnar.h"
+#include "coordinates.h"
+#include "id_set.h"
+#include "intern_table.h"
+#include "location_store.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "packed_ids.h"
+#include "pbf.h"
+#include "pipeline.h"
+#include "pragma_profile.h"
+#include "region.h"
+#include "schema.h"
+#include "spatial_index.h"
+#include "tag_filter.h"
+#include "timing.h"
+#include "vocabulary.h"
+#include "write_behind_vfs.h"
+
+#include <readosm.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+static int prepareInsertNodeStatement(struct InsertNodeContext *ctx) {
+  static const char *nodeQuery = "INSERT OR IGNORE INTO nodes "
+                                 "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8);";
+  static const char *locationQuery = "INSERT OR IGNORE INTO nodes "
+                                     "VALUES (?1, ?2, ?3);";
+  int ret;
+  const char *tail;
+  sqlite3 *handle = ctx->dbHandle;
+
+  return sqlite3_prepare_v2(
+      handle,
+      ctx->layout & LAYOUT_NO_NODE_METADATA ? locationQuery : nodeQuery, -1,
+      &ctx->insertNodeStmt, &tail);
+}
+
+static int prepareInsertWayStatement(struct InsertWayContext *ctx) {
+  static const char *nodeQuery = "INSERT OR IGNORE INTO ways "
+                                 "VALUES (?1, ?2, ?3, ?4, ?5);";
+  static const char *packedQuery = "INSERT OR IGNORE INTO ways "
+                                   "VALUES (?1, ?2, ?3, ?4, ?5, ?6);";
+  int ret;
+  const char *tail;
+  sqlite3 *handle = ctx->dbHandle;
+
+  return sqlite3_prepare_v2(handle, ctx->packedNodes ? packedQuery : nodeQuery,
+                            -1, &ctx->insertWayStmt, &tail);
+}
+
+static int prepareInsertRelationStatement(struct InsertRelationContext *ctx) {
+  static const char *relationQuery = "INSERT OR IGNORE INTO relations "
+                                     "VALUES (?1, ?2, ?3, ?4, ?5);";
+  return sqlite3_prepare_v2(ctx->dbHandle, relationQuery, -1,
+                            &ctx->insertRelationStmt, NULL);
+}
+
+static int prepareInsertNodeTagBatch(struct InsertNodeContext *ctx) {
+  if (ctx->tags != NULL) {
+    return batchInsertInit(
+        &ctx->tagBatch, ctx->dbHandle,
+        "INSERT OR IGNORE INTO node_tag_ids(node_id, key_id, value_id)", "iii");
+  }
+  return batchInsertInit(&ctx->tagBatch, ctx->dbHandle,
+                         "INSERT OR IGNORE INTO node_tags(node_id, key, value)",
+                         "itt");
+}
+
+static int prepareInsertNodeNameBatch(struct InsertNodeContext *ctx) {
+  return batchInsertInit(&ctx->nameBatch, ctx->dbHandle,
+                         "INSERT INTO node_names(node_id, name)", "it");
+}
+
+static int prepareInsertWayTagBatch(struct InsertWayContext *ctx) {
+  if (ctx->tags != NULL) {
+    return batchInsertInit(
+        &ctx->tagBatch, ctx->dbHandle,
+        "INSERT OR IGNORE INTO way_tag_ids(way_id, key_id, value_id)", "iii");
+  }
+  return batchInsertInit(&ctx->tagBatch, ctx->dbHandle,
+                         "INSERT OR IGNORE INTO way_tags(way_id, key, value)",
+                         "itt");
+}
+
+static int prepareInsertWayNodeReferenceBatch(struct InsertWayContext *ctx) {
+  return batchInsertInit(&ctx->nodeRefBatch, ctx->dbHandle,
+                         "INSERT OR IGNORE INTO way_nodes(way_id, node_id)",
+                         "ii");
+}
+
+static int prepareInsertRelationTagBatch(struct InsertRelationContext *ctx) {
+  if (ctx->tags != NULL) {
+    return batchInsertInit(&ctx->tagBatch, ctx->dbHandle,
+                           "INSERT OR IGNORE INTO relation_tag_ids("
+                           "relation_id, key_id, value_id)",
+                           "iii");
+  }
+  return batchInsertInit(
+      &ctx->tagBatch, ctx->dbHandle,
+      "INSERT OR IGNORE INTO relation_tags(relation_id, key, value)", "itt");
+}
+
+static int prepareInsertRelationMemberBatch(struct InsertRelationContext *ctx) {
+  return batchInsertInit(&ctx->memberBatch, ctx->dbHandle,
+                         "INSERT OR IGNORE INTO relation_members(relation_id, "
+                         "sequence, member_type, member_id, role_id)",
+                         "iiiii");
+}
+
+int initTagDictionary(sqlite3 *db, struct TagDictionary *tags) {
+  int ret;
+  if ((ret = internTableInit(&tags->keys, db, "tag_keys", "key")) !=
+      SQLITE_OK) {
+    return ret;
+  }
+  return internTableInit(&tags->values, db, "tag_values", "value");
+}
+
+int finalizeTagDictionary(struct TagDictionary *tags) {
+  int ret = internTableFinalize(&tags->keys);
+  int valuesRet = internTableFinalize(&tags->values);
+  return ret != SQLITE_OK ? ret : valuesRet;
+}
+
+int initInsertNodeContext(sqlite3 *db, struct TagDictionary *tags,
+                          struct SpatialIndex *spatial, int layout,
+                          struct InsertNodeContext *ctx) {
+  ctx->dbHandle = db;
+  ctx->insertNodeStmt = NULL;
+  ctx->tags = tags;
+  ctx->spatial = spatial;
+  ctx->layout = layout;
+  int ret;
+  if ((ret = prepareInsertNodeStatement(ctx)) != SQLITE_OK) {
+    fprintf(stderr, "Failed to prepare insert node statement: %d\n", ret);
+    return ret;
+  }
+
+  if ((ret = prepareInsertNodeTagBatch(ctx)) != SQLITE_OK) {
+    fprintf(stderr, "Failed to prepare insert node tag statement: %d\n", ret);
+    return ret;
+  }
+
+  if ((ret = prepareInsertNodeNameBatch(ctx)) != SQLITE_OK) {
+    fprintf(stderr, "Failed to prepare insert node name statement: %d\n", ret);
+    return ret;
+  }
+
+  return SQLITE_OK;
+}
+
+int initInsertWayContext(sqlite3 *db, struct TagDictionary *tags,
+                         struct SpatialIndex *spatial, int packedNodes,
+                         struct InsertWayContext *ctx) {
+  ctx->dbHandle = db;
+  ctx->insertWayStmt = NULL;
+  ctx->tags = tags;
+  ctx->spatial = spatial;
+  ctx->packedNodes = packedNodes;
+  ctx->packBuffer = NULL;
+  ctx->packCapacity = 0;
+
+  int ret;
+  if ((ret = prepareInsertWayStatement(ctx)) != SQLITE_OK) {
+    fprintf(stderr, "Failed to prepare insert way statement: %d\n", ret);
+    return ret;
+  }
+
+  if ((ret = prepareInsertWayTagBatch(ctx)) != SQLITE_OK) {
+    fprintf(stderr, "Failed to prepare insert way tag statement: %d\n", ret);
+    return ret;
+  }
+
+  if (!packedNodes &&
+      (ret = prepareInsertWayNodeReferenceBatch(ctx)) != SQLITE_OK) {
+    fprintf(stderr,
+            "Failed to prepare insert way node reference statement: %d\n", ret);
+    return ret;
+  }
+
+  return SQLITE_OK;
+}
+
+int initInsertRelationContext(sqlite3 *db, struct TagDictionary *tags,
+                              struct InsertRelationContext *ctx) {
+  ctx->dbHandle = db;
+  ctx->insertRelationStmt = NULL;
+  ctx->tags = tags;
+
+  int ret;
+  if ((ret = prepareInsertRelationStatement(ctx)) != SQLITE_OK) {
+    fprintf(stderr, "Failed to prepare insert relation statement: %d\n", ret);
+    return ret;
+  }
+
+  if ((ret = prepareInsertRelationTagBatch(ctx)) != SQLITE_OK) {
+    fprintf(stderr, "Failed to prepare insert relation tag statement: %d\n",
+            ret);
+    return ret;
+  }
+
+  if ((ret = prepareInsertRelationMemberBatch(ctx)) != SQLITE_OK) {
+    fprintf(stderr,
+            "Failed to prepare insert relation member statement: %d\n", ret);
+    return ret;
+  }
+
+  if ((ret = internTableInit(&ctx->roles, db, "relation_roles", "role")) !=
+      SQLITE_OK) {
+    return ret;
+  }
+
+  return SQLITE_OK;
+}
+
+int flushInsertNodeContext(struct InsertNodeContext *ctx) {
+  int ret;
+  if ((ret = batchInsertFlush(&ctx->tagBatch)) != SQLITE_OK) {
+    return ret;
+  }
+  return batchInsertFlush(&ctx->nameBatch);
+}
+
+int flushInsertWayContext(struct InsertWayContext *ctx) {
+  int ret;
+  if ((ret = batchInsertFlush(&ctx->tagBatch)) != SQLITE_OK) {
+    return ret;
+  }
+  return ctx->packedNodes ? SQLITE_OK : batchInsertFlush(&ctx->nodeRefBatch);
+}
+
+int flushInsertRelationContext(struct InsertRelationContext *ctx) {
+  int ret;
+  if ((ret = batchInsertFlush(&ctx->tagBatch)) != SQLITE_OK) {
+    return ret;
+  }
+  return batchInsertFlush(&ctx->memberBatch);
+}
+
+int finalizeInsertNodeContext(struct InsertNodeContext *ctx) {
+  int ret = sqlite3_finalize(ctx->insertNodeStmt);
+  int batchRet = batchInsertFinalize(&ctx->tagBatch);
+  int nameRet = batchInsertFinalize(&ctx->nameBatch);
+  ctx->insertNodeStmt = NULL;
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  return batchRet != SQLITE_OK ? batchRet : nameRet;
+}
+
+int finalizeInsertWayContext(struct InsertWayContext *ctx) {
+  int ret = sqlite3_finalize(ctx->insertWayStmt);
+  int tagRet = batchInsertFinalize(&ctx->tagBatch);
+  int nodeRefRet =
+      ctx->packedNodes ? SQLITE_OK : batchInsertFinalize(&ctx->nodeRefBatch);
+  ctx->insertWayStmt = NULL;
+  free(ctx->packBuffer);
+  ctx->packBuffer = NULL;
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  return tagRet != SQLITE_OK ? tagRet : nodeRefRet;
+}
+
+int finalizeInsertRelationContext(struct InsertRelationContext *ctx) {
+  int ret = sqlite3_finalize(ctx->insertRelationStmt);
+  int roleRet = internTableFinalize(&ctx->roles);
+  int tagRet = batchInsertFinalize(&ctx->tagBatch);
+  int memberRet = batchInsertFinalize(&ctx->memberBatch);
+  ctx->insertRelationStmt = NULL;
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  if (roleRet != SQLITE_OK) {
+    return roleRet;
+  }
+  return tagRet != SQLITE_OK ? tagRet : memberRet;
+}
+
+static int needPrint(int value) { return value != 0 && value % 100000 == 0; }
+
+void printStats(struct OsmParseContext *stats) {
+  fprintf(stdout, "Nodes=%-10d Ways=%-10d Relation=%-10d\n", stats->nodes,
+          stats->ways, stats->relation);
+}
+
+void printFilterStats(struct OsmParseContext *stats) {
+  if (stats->filter != NULL || stats->region != NULL) {
+    fprintf(stdout, "Filtered out=%lld\n", stats->filtered);
+  }
+}
+
+void printWriteBehindStats(void) {
+  if (!writeBehindVfsEnabled()) {
+    return;
+  }
+  struct WriteBehindStats wb;
+  writeBehindVfsStats(&wb);
+  const double mib = 1024.0 * 1024.0;
+  fprintf(stdout,
+          "Write-behind: writes=%lld calls=%lld (%.1f writes/call) "
+          "batches=%lld queue=%d (peak %d) %.1fM/s stalled=%.2fs\n",
+          wb.writes, wb.calls,
+          wb.calls > 0 ? (double)wb.writes / wb.calls : 0.0, wb.batches,
+          wb.queueDepth, wb.peakQueueDepth,
+          wb.busySeconds > 0 ? wb.bytes / mib / wb.busySeconds : 0.0,
+          wb.stallSeconds);
+}
+
+void printMemoryStats(void) {
+  if (memoryBudgetLimit() == 0) {
+    return;
+  }
+  const double mib = 1024.0 * 1024.0;
+  fprintf(stdout,
+          "Memory: budget=%.1fM buffers=%.1fM (peak %.1fM) "
+          "sqlite=%.1fM (peak %.1fM)\n",
+          memoryBudgetLimit() / mib, memoryBudgetTotal() / mib,
+          memoryBudgetPeak() / mib, sqlite3_memory_used() / mib,
+          sqlite3_memory_highwater(0) / mib);
+}
+
+void maybePrintStats(struct OsmParseContext *stats, int count) {
+  if (needPrint(count) && !stats->shardWriter) {
+    printStats(stats);
+    printMemoryStats();
+    printWriteBehindStats();
+  }
+}
+
+static int loadProgress(sqlite3 *handle, struct ImportProgress *progress) {
+  sqlite3_stmt *stmt;
+  memset(progress, 0, sizeof(*progress));
+  int ret = sqlite3_prepare_v2(handle,
+                               "SELECT last_node_id, last_way_id, "
+                               "last_relation_id, blob_offset "
+                               "FROM import_progress WHERE id = 1;",
+                               -1, &stmt, NULL);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  if ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+    progress->lastNodeId = sqlite3_column_int64(stmt, 0);
+    progress->lastWayId = sqlite3_column_int64(stmt, 1);
+    progress->lastRelationId = sqlite3_column_int64(stmt, 2);
+    progress->blobOffset = sqlite3_column_int64(stmt, 3);
+  }
+  sqlite3_finalize(stmt);
+  return ret == SQLITE_ROW || ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static int prepareSaveProgressStatement(struct OsmParseContext *ctx) {
+  static const char *progressQuery =
+      "INSERT OR REPLACE INTO import_progress"
+      "(id, last_node_id, last_way_id, last_relation_id, blob_offset) "
+      "VALUES (1, ?1, ?2, ?3, ?4);";
+  return sqlite3_prepare_v2(ctx->dbHandle, progressQuery, -1,
+                            &ctx->saveProgressStmt, NULL);
+}
+
+// Flushes the insert batches and records the progress row inside the
+// current transaction, so both become durable with the same commit.
+static int saveProgress(struct OsmParseContext *ctx) {
+  int ret;
+  if ((ret = flushInsertNodeContext(&ctx->insertNodeContext)) != SQLITE_OK) {
+    return ret;
+  }
+  if ((ret = flushInsertWayContext(&ctx->insertWayContext)) != SQLITE_OK) {
+    return ret;
+  }
+  if ((ret = flushInsertRelationContext(&ctx->insertRelationContext)) !=
+      SQLITE_OK) {
+    return ret;
+  }
+  if (ctx->insertNodeContext.spatial != NULL &&
+      (ret = spatialIndexFlush(ctx->insertNodeContext.spatial)) !=
+          SQLITE_OK) {
+    return ret;
+  }
+
+  sqlite3_stmt *stmt = ctx->saveProgressStmt;
+  sqlite3_bind_int64(stmt, 1, ctx->progress.lastNodeId);
+  sqlite3_bind_int64(stmt, 2, ctx->progress.lastWayId);
+  sqlite3_bind_int64(stmt, 3, ctx->progress.lastRelationId);
+  sqlite3_bind_int64(stmt, 4, ctx->progress.blobOffset);
+  return stepStatement(stmt);
+}
+
+static int commitChunk(struct OsmParseContext *ctx) {
+  int ret;
+  if ((ret = saveProgress(ctx)) != SQLITE_OK) {
+    return ret;
+  }
+  if ((ret = sqlite3_exec(ctx->dbHandle, "END TRANSACTION", NULL, NULL,
+                          NULL)) != SQLITE_OK) {
+    return ret;
+  }
+  if ((ret = sqlite3_exec(ctx->dbHandle, "BEGIN TRANSACTION", NULL, NULL,
+                          NULL)) != SQLITE_OK) {
+    return ret;
+  }
+
+  ctx->commits++;
+  ctx->sinceCommit = 0;
+  if (ctx->commitInterval > 0) {
+    ctx->lastCommit = monotonicSeconds();
+  }
+  return SQLITE_OK;
+}
+
+// Input position of the element being written, see PbfOptions.blobOffset.
+static long long writerSourceOffset(struct OsmParseContext *ctx) {
+  if (ctx->pipeline != NULL) {
+    return pipelineWriterPosition(ctx->pipeline);
+  }
+  return ctx->sourceOffset;
+}
+
+void metricsProgress(struct OsmParseContext *ctx,
+                     struct MetricsProgress *progress) {
+  progress->nodes = ctx->nodes;
+  progress->ways = ctx->ways;
+  progress->relations = ctx->relation;
+  // Only the PBF readers report an input position.
+  long long offset = writerSourceOffset(ctx);
+  progress->inputPosition = offset > 0 ? offset : -1;
+}
+
+void maybeEmitMetrics(struct OsmParseContext *ctx) {
+  if (metricsEnabled() && !ctx->shardWriter) {
+    struct MetricsProgress progress;
+    metricsProgress(ctx, &progress);
+    metricsMaybeEmit(ctx->dbHandle, &progress);
+  }
+}
+
+static int maybeCommit(struct OsmParseContext *ctx) {
+  ++ctx->sinceCommit;
+  if (ctx->commitEvery > 0 && ctx->sinceCommit >= ctx->commitEvery) {
+    return commitChunk(ctx);
+  }
+
+  // Only look at the clock every 1024 elements.
+  if (ctx->commitInterval > 0 && (ctx->sinceCommit & 1023) == 0 &&
+      monotonicSeconds() - ctx->lastCommit >= ctx->commitInterval) {
+    return commitChunk(ctx);
+  }
+
+  return SQLITE_OK;
+}
+
+// Resume skips are decided on the parsing thread, before any copy into the
+// pipeline. A later element type in the progress row means the whole
+// earlier section of the file was committed.
+static int skipNode(struct OsmParseContext *ctx, long long id) {
+  if (!ctx->resume) {
+    return 0;
+  }
+  struct ImportProgress *from = &ctx->resumeFrom;
+  if (from->lastWayId != 0 || from->lastRelationId != 0 ||
+      id <= from->lastNodeId) {
+    ctx->skipped++;
+    return 1;
+  }
+  return 0;
+}
+
+static int skipWay(struct OsmParseContext *ctx, long long id) {
+  if (!ctx->resume) {
+    return 0;
+  }
+  struct ImportProgress *from = &ctx->resumeFrom;
+  if (from->lastRelationId != 0 || id <= from->lastWayId) {
+    ctx->skipped++;
+    return 1;
+  }
+  return 0;
+}
+
+static int skipRelation(struct OsmParseContext *ctx, long long id) {
+  if (!ctx->resume) {
+    return 0;
+  }
+  if (id <= ctx->resumeFrom.lastRelationId) {
+    ctx->skipped++;
+    return 1;
+  }
+  return 0;
+}
+
+// kept is 0 for an element outside the import, -1 if recording the region
+// failed.
+static int dropElement(struct OsmParseContext *ctx, int kept) {
+  if (kept < 0) {
+    fprintf(stderr, "Out of memory recording the elements in the region\n");
+    return -1;
+  }
+  ctx->filtered++;
+  return 1;
+}
+
+// Kept elements go to the --columnar export, if any, from the filter*
+// functions below. -1 if writing it failed.
+static int exportNode(struct OsmParseContext *ctx, const readosm_node *node) {
+  return ctx->columnar != NULL && columnarExportNode(ctx->columnar, node) != 0
+             ? -1
+             : 0;
+}
+
+static int exportWay(struct OsmParseContext *ctx, const readosm_way *way) {
+  return ctx->columnar != NULL && columnarExportWay(ctx->columnar, way) != 0
+             ? -1
+             : 0;
+}
+
+static int exportRelation(struct OsmParseContext *ctx,
+                          const readosm_relation *relation) {
+  return ctx->columnar != NULL &&
+                 columnarExportRelation(ctx->columnar, relation) != 0
+             ? -1
+             : 0;
+}
+
+int filterNode(struct OsmParseContext *ctx, const readosm_node *node) {
+  if (ctx->region != NULL) {
+    int kept = regionKeepNode(ctx->region, node);
+    if (kept <= 0) {
+      return dropElement(ctx, kept);
+    }
+  }
+  if (ctx->filter == NULL ||
+      tagFilterMatch(ctx->filter, node->tags, node->tag_count) ||
+      (ctx->referencedNodes != NULL &&
+       idSetContains(ctx->referencedNodes, node->id))) {
+    return exportNode(ctx, node);
+  }
+  return dropElement(ctx, 0);
+}
+
+int filterWay(struct OsmParseContext *ctx, const readosm_way *way) {
+  if (ctx->region != NULL) {
+    int kept = regionKeepWay(ctx->region, way);
+    if (kept <= 0) {
+      return dropElement(ctx, kept);
+    }
+  }
+  if (ctx->filter == NULL ||
+      tagFilterMatch(ctx->filter, way->tags, way->tag_count)) {
+    return exportWay(ctx, way);
+  }
+  return dropElement(ctx, 0);
+}
+
+int filterRelation(struct OsmParseContext *ctx,
+                   const readosm_relation *relation) {
+  if (ctx->region != NULL) {
+    int kept = regionKeepRelation(ctx->region, relation);
+    if (kept <= 0) {
+      return dropElement(ctx, kept);
+    }
+  }
+  if (ctx->filter == NULL ||
+      tagFilterMatch(ctx->filter, relation->tags, relation->tag_count)) {
+    return exportRelation(ctx, relation);
+  }
+  return dropElement(ctx, 0);
+}
+
+int write_node(const void *user_data, const readosm_node *node) {
+  struct OsmParseContext *stats = (struct OsmParseContext *)user_data;
+  stats->nodes++;
+  maybePrintStats(stats, stats->nodes);
+  int ret = insertNode(&stats->insertNodeContext, node);
+  if (ret != SQLITE_OK) {
+    fprintf(stderr, "Failed to insert node: %d\n", ret);
+    return READOSM_ABORT;
+  }
+
+  stats->progress.lastNodeId = node->id;
+  stats->progress.blobOffset = writerSourceOffset(stats);
+  if ((ret = maybeCommit(stats)) != SQLITE_OK) {
+    fprintf(stderr, "Failed to commit: %s\n", sqlite3_errmsg(stats->dbHandle));
+    return READOSM_ABORT;
+  }
+
+  maybeEmitMetrics(stats);
+  return READOSM_OK;
+}
+
+int write_way(const void *user_data, const readosm_way *way) {
+  struct OsmParseContext *stats = (struct OsmParseContext *)user_data;
+  stats->ways++;
+  maybePrintStats(stats, stats->ways);
+  int ret = insertWay(&stats->insertWayContext, way);
+  if (ret != SQLITE_OK) {
+    fprintf(stderr, "Failed to insert way: %d\n", ret);
+    return READOSM_ABORT;
+  }
+
+  stats->progress.lastWayId = way->id;
+  stats->progress.blobOffset = writerSourceOffset(stats);
+  if ((ret = maybeCommit(stats)) != SQLITE_OK) {
+    fprintf(stderr, "Failed to commit: %s\n", sqlite3_errmsg(stats->dbHandle));
+    return READOSM_ABORT;
+  }
+
+  maybeEmitMetrics(stats);
+  return READOSM_OK;
+}
+
+int write_relation(const void *user_data,
+                   const readosm_relation *relation) {
+  struct OsmParseContext *stats = (struct OsmParseContext *)user_data;
+  stats->relation++;
+  maybePrintStats(stats, stats->relation);
+  int ret = insertRelation(&stats->insertRelationContext, relation);
+  if (ret != SQLITE_OK) {
+    fprintf(stderr, "Failed to insert relation: %d\n", ret);
+    return READOSM_ABORT;
+  }
+
+  stats->progress.lastRelationId = relation->id;
+  stats->progress.blobOffset = writerSourceOffset(stats);
+  if ((ret = maybeCommit(stats)) != SQLITE_OK) {
+    fprintf(stderr, "Failed to commit: %s\n", sqlite3_errmsg(stats->dbHandle));
+    return READOSM_ABORT;
+  }
+
+  maybeEmitMetrics(stats);
+  return READOSM_OK;
+}
+
+static int countOnly(struct OsmParseContext *ctx, int *count) {
+  ++*count;
+  maybePrintStats(ctx, *count);
+  maybeEmitMetrics(ctx);
+  return READOSM_OK;
+}
+
+static int on_node(const void *user_data, const readosm_node *node) {
+  struct OsmParseContext *stats = (struct OsmParseContext *)user_data;
+  if (stats->parseOnly) {
+    return countOnly(stats, &stats->nodes);
+  }
+  int dropped = filterNode(stats, node);
+  if (dropped != 0) {
+    return dropped < 0 ? READOSM_ABORT : READOSM_OK;
+  }
+  if (skipNode(stats, node->id)) {
+    return READOSM_OK;
+  }
+  if (stats->pipeline != NULL) {
+    return pipelinePushNode(stats->pipeline, node);
+  }
+  return write_node(user_data, node);
+}
+
+static int on_way(const void *user_data, const readosm_way *way) {
+  struct OsmParseContext *stats = (struct OsmParseContext *)user_data;
+  if (stats->parseOnly) {
+    return countOnly(stats, &stats->ways);
+  }
+  int dropped = filterWay(stats, way);
+  if (dropped != 0) {
+    return dropped < 0 ? READOSM_ABORT : READOSM_OK;
+  }
+  if (skipWay(stats, way->id)) {
+    return READOSM_OK;
+  }
+  if (stats->pipeline != NULL) {
+    return pipelinePushWay(stats->pipeline, way);
+  }
+  return write_way(user_data, way);
+}
+
+static int on_relation(const void *user_data,
+                       const readosm_relation *relation) {
+  struct OsmParseContext *stats = (struct OsmParseContext *)user_data;
+  if (stats->parseOnly) {
+    return countOnly(stats, &stats->relation);
+  }
+  int dropped = filterRelation(stats, relation);
+  if (dropped != 0) {
+    return dropped < 0 ? READOSM_ABORT : READOSM_OK;
+  }
+  if (skipRelation(stats, relation->id)) {
+    return READOSM_OK;
+  }
+  if (stats->pipeline != NULL) {
+    return pipelinePushRelation(stats->pipeline, relation);
+  }
+  return write_relation(user_data, relation);
+}
+
+int bindNodeCoordinate(sqlite3_stmt *stmt, int param, int compact,
+                       double degrees) {
+  if (compact) {
+    return sqlite3_bind_int64(stmt, param, coordinateToE7(degrees));
+  }
+  return sqlite3_bind_double(stmt, param, degrees);
+}
+
+static int bindNode(sqlite3_stmt *stmt, int layout, const readosm_node *node) {
+  int ret;
+  int compact = layout & LAYOUT_COMPACT_NODES;
+  if ((ret = sqlite3_bind_int64(stmt, 1, node->id)) != SQLITE_OK) {
+    fprintf(stderr, "bindNode: Failed to bind 1 param to node statement");
+    return ret;
+  }
+
+  if ((ret = bindNodeCoordinate(stmt, 2, compact, node->latitude)) !=
+      SQLITE_OK) {
+    fprintf(stderr, "bindNode: Failed to bind 2 param to node statement");
+    return ret;
+  }
+
+  if ((ret = bindNodeCoordinate(stmt, 3, compact, node->longitude)) !=
+      SQLITE_OK) {
+    fprintf(stderr, "bindNode: Failed to bind 3 param to node statement");
+    return ret;
+  }
+
+  if (layout & LAYOUT_NO_NODE_METADATA) {
+    return SQLITE_OK;
+  }
+
+  if ((ret = sqlite3_bind_int64(stmt, 4, node->version)) != SQLITE_OK) {
+    fprintf(stderr, "bindNode: Failed to bind 4 param to node statement");
+    return ret;
+  }
+
+  if ((ret = sqlite3_bind_int64(stmt, 5, node->changeset)) != SQLITE_OK) {
+    fprintf(stderr, "bindNode: Failed to bind 5 param to node statement");
+    return ret;
+  }
+
+  if (node->user) {
+    if ((ret = sqlite3_bind_text(stmt, 6, node->user, strlen(node->user),
+                                 NULL)) != SQLITE_OK) {
+      fprintf(stderr, "bindNode: Failed to bind 6 param to node statement");
+      return ret;
+    }
+  } else {
+    if ((ret = sqlite3_bind_text(stmt, 6, NULL, 0, NULL)) != SQLITE_OK) {
+      fprintf(stderr,
+              "bindNode: Failed to bind 6 (NULL) param to node statement");
+      return ret;
+    }
+  }
+
+  if ((ret = sqlite3_bind_int64(stmt, 7, node->uid)) != SQLITE_OK) {
+    fprintf(stderr, "bindNode: Failed to bind 7 param to node statement");
+    return ret;
+  }
+
+  if (node->timestamp) {
+    if ((ret = sqlite3_bind_text(stmt, 8, node->timestamp,
+                                 strlen(node->timestamp), NULL)) != SQLITE_OK) {
+      fprintf(stderr, "bindNode: Failed to bind 8 param to node statement");
+      return ret;
+    }
+  } else {
+    if ((ret = sqlite3_bind_text(stmt, 8, NULL, 0, NULL)) != SQLITE_OK) {
+      fprintf(stderr,
+              "bindNode: Failed to bind 8 (NULL) param to node statement");
+      return ret;
+    }
+  }
+
+  return ret;
+}
+
+static int addTag(struct BatchInsert *batch, struct TagDictionary *tags,
+                  long long parent_id, const readosm_tag *tag) {
+  batchInsertInt64(batch, 0, parent_id);
+  if (tags != NULL) {
+    int ret;
+    long long keyId, valueId;
+    if ((ret = internTableLookup(&tags->keys, tag->key, &keyId)) !=
+            SQLITE_OK ||
+        (ret = internTableLookup(&tags->values, tag->value, &valueId)) !=
+            SQLITE_OK) {
+      return ret;
+    }
+    batchInsertInt64(batch, 1, keyId);
+    batchInsertInt64(batch, 2, valueId);
+  } else if (batchInsertText(batch, 1, tag->key) != SQLITE_OK ||
+             batchInsertText(batch, 2, tag->value) != SQLITE_OK) {
+    return SQLITE_NOMEM;
+  }
+  return batchInsertEndRow(batch);
+}
+
+// Same test as the node_names trigger: key LIKE 'name%', where LIKE
+// ignores ASCII case.
+static int isNameTag(const readosm_tag *tag) {
+  return tag->key != NULL && strncasecmp(tag->key, "name", 4) == 0;
+}
+
+static int addName(struct BatchInsert *batch, long long node_id,
+                   const readosm_tag *tag) {
+  batchInsertInt64(batch, 0, node_id);
+  if (batchInsertText(batch, 1, tag->value) != SQLITE_OK) {
+    return SQLITE_NOMEM;
+  }
+  return batchInsertEndRow(batch);
+}
+
+int stepStatement(sqlite3_stmt *stmt) {
+  int ret;
+  long long begin = metricsBegin();
+  ret = sqlite3_step(stmt);
+  metricsEndStep(begin, 1);
+  if (ret != SQLITE_DONE) {
+    fprintf(stderr, "stepStatement: Failed to step node statement");
+    return ret;
+  }
+
+  if ((ret = sqlite3_clear_bindings(stmt)) != SQLITE_OK) {
+    fprintf(stderr,
+            "stepStatement: Failed to clear bindings in node statement");
+    return ret;
+  }
+
+  if ((ret = sqlite3_reset(stmt)) != SQLITE_OK) {
+    fprintf(stderr, "stepStatement: Failed to reset node statement");
+    return ret;
+  }
+
+  return SQLITE_OK;
+}
+
+int insertNode(struct InsertNodeContext *ctx, const readosm_node *node) {
+
+  int ret;
+  const char *tail;
+  char *errMsg;
+  sqlite3 *handle = ctx->dbHandle;
+
+  long long begin = metricsBegin();
+  ret = bindNode(ctx->insertNodeStmt, ctx->layout, node);
+  metricsEnd(METRICS_PHASE_BIND, begin);
+  if (ret != SQLITE_OK) {
+    errMsg = "Failed to bind node";
+    goto Fail;
+  }
+
+  if ((ret = stepStatement(ctx->insertNodeStmt)) != SQLITE_OK) {
+    errMsg = "Failed to step node statement";
+    goto Fail;
+  }
+
+  if (node->tag_count != 0) {
+    for (int i = 0; i < node->tag_count; ++i) {
+      if ((ret = addTag(&ctx->tagBatch, ctx->tags, node->id,
+                        &node->tags[i])) != SQLITE_OK) {
+        errMsg = "Failed to insert node tags";
+        goto Fail;
+      }
+      if (isNameTag(&node->tags[i]) &&
+          (ret = addName(&ctx->nameBatch, node->id, &node->tags[i])) !=
+              SQLITE_OK) {
+        errMsg = "Failed to insert node names";
+        goto Fail;
+      }
+    }
+  }
+
+  if (ctx->spatial != NULL &&
+      (ret = spatialIndexAddNode(ctx->spatial, node->id, node->latitude,
+                                 node->longitude, node->tag_count != 0)) !=
+          SQLITE_OK) {
+    errMsg = "Failed to record node location";
+    goto Fail;
+  }
+
+  return SQLITE_OK;
+
+Fail:
+  // The open transaction is never committed. main's sqlite3_close fails
+  // with SQLITE_BUSY while the insert statements are live, so nothing is
+  // rolled back here; the next open rolls the uncommitted chunk back from
+  // the journal or WAL, and the database again matches import_progress.
+  fprintf(stderr, "%s\n", errMsg);
+  fprintf(stderr, "%s\n", sqlite3_errmsg(handle));
+  return ret;
+}
+
+static int bindWay(sqlite3_stmt *stmt, const readosm_way *way) {
+  int ret;
+
+  if ((ret = sqlite3_bind_int64(stmt, 1, way->id)) != SQLITE_OK) {
+    fprintf(stderr, "bindWay: Failed to bind 1 param to node statement");
+    return ret;
+  }
+
+  if ((ret = sqlite3_bind_int64(stmt, 2, way->changeset)) != SQLITE_OK) {
+    fprintf(stderr, "bindWay: Failed to bind 2 param to node statement");
+    return ret;
+  }
+
+  if (way->user) {
+    if ((ret = sqlite3_bind_text(stmt, 3, way->user, strlen(way->user),
+                                 NULL)) != SQLITE_OK) {
+      fprintf(stderr, "bindWay: Failed to bind 3 param to node statement");
+      return ret;
+    }
+  } else {
+    if ((ret = sqlite3_bind_text(stmt, 3, NULL, 0, NULL)) != SQLITE_OK) {
+      fprintf(stderr,
+              "bindWay: Failed to bind 3 (NULL) param to node statement");
+      return ret;
+    }
+  }
+
+  if ((ret = sqlite3_bind_int64(stmt, 4, way->uid)) != SQLITE_OK) {
+    fprintf(stderr, "bindWay: Failed to bind 4 param to node statement");
+    return ret;
+  }
+
+  if (way->timestamp) {
+    if ((ret = sqlite3_bind_text(stmt, 5, way->timestamp,
+                                 strlen(way->timestamp), NULL)) != SQLITE_OK) {
+      fprintf(stderr, "bindWay: Failed to bind 5 param to node statement");
+      return ret;
+    }
+  } else {
+    if ((ret = sqlite3_bind_text(stmt, 5, NULL, 0, NULL)) != SQLITE_OK) {
+      fprintf(stderr,
+              "bindWay: Failed to bind 5 (NULL) param to node statement");
+      return ret;
+    }
+  }
+
+  return ret;
+}
+
+static int bindPackedNodes(struct InsertWayContext *ctx,
+                           const readosm_way *way) {
+  size_t needed = PACKED_IDS_MAX_SIZE(way->node_ref_count);
+  if (needed > ctx->packCapacity) {
+    unsigned char *buffer = realloc(ctx->packBuffer, needed);
+    if (buffer == NULL) {
+      return SQLITE_NOMEM;
+    }
+    ctx->packBuffer = buffer;
+    ctx->packCapacity = needed;
+  }
+  size_t size = packIds(way->node_refs, way->node_ref_count, ctx->packBuffer);
+  // The buffer is only reused after the statement has been stepped.
+  return sqlite3_bind_blob(ctx->insertWayStmt, 6, ctx->packBuffer, (int)size,
+                           SQLITE_STATIC);
+}
+
+int insertWay(struct InsertWayContext *ctx, const readosm_way *way) {
+  int ret;
+  const char *tail;
+  char *errMsg;
+  sqlite3 *handle = ctx->dbHandle;
+
+  long long begin = metricsBegin();
+  if ((ret = bindWay(ctx->insertWayStmt, way)) != SQLITE_OK) {
+    errMsg = "insertWay: Failed to bind way";
+    goto Fail;
+  }
+
+  if (ctx->packedNodes &&
+      (ret = bindPackedNodes(ctx, way)) != SQLITE_OK) {
+    errMsg = "insertWay: Failed to bind packed node refs";
+    goto Fail;
+  }
+  metricsEnd(METRICS_PHASE_BIND, begin);
+
+  if ((ret = stepStatement(ctx->insertWayStmt)) != SQLITE_OK) {
+    errMsg = "Failed to step insert way statement";
+    goto Fail;
+  }
+
+  for (int i = 0; i < way->tag_count; ++i) {
+    if ((ret = addTag(&ctx->tagBatch, ctx->tags, way->id, &way->tags[i])) !=
+        SQLITE_OK) {
+      errMsg = "Failed to insert way tags";
+      goto Fail;
+    }
+  }
+
+  if (ctx->spatial != NULL &&
+      (ret = spatialIndexAddWay(ctx->spatial, way->id, way->node_refs,
+                                way->node_ref_count)) != SQLITE_OK) {
+    errMsg = "Failed to stage way for way_rtree";
+    goto Fail;
+  }
+
+  if (ctx->packedNodes) {
+    return SQLITE_OK;
+  }
+
+  for (int i = 0; i < way->node_ref_count; ++i) {
+    batchInsertInt64(&ctx->nodeRefBatch, 0, way->id);
+    batchInsertInt64(&ctx->nodeRefBatch, 1, way->node_refs[i]);
+    if ((ret = batchInsertEndRow(&ctx->nodeRefBatch)) != SQLITE_OK) {
+      errMsg = "Failed to insert way node refs";
+      goto Fail;
+    }
+  }
+
+  return SQLITE_OK;
+
+Fail:
+  // Left uncommitted and rolled back on the next open, see insertNode.
+  fprintf(stderr, "%s\n", errMsg);
+  fprintf(stderr, "%s\n", sqlite3_errmsg(handle));
+  return ret;
+}
+
+static int bindRelation(sqlite3_stmt *stmt, const readosm_relation *relation) {
+  int ret;
+
+  if ((ret = sqlite3_bind_int64(stmt, 1, relation->id)) != SQLITE_OK) {
+    fprintf(stderr, "bindRelation: Failed to bind 1 param");
+    return ret;
+  }
+
+  if ((ret = sqlite3_bind_int64(stmt, 2, relation->changeset)) != SQLITE_OK) {
+    fprintf(stderr, "bindRelation: Failed to bind 2 param");
+    return ret;
+  }
+
+  if ((ret = sqlite3_bind_text(stmt, 3, relation->user,
+                               relation->user ? strlen(relation->user) : 0,
+                               NULL)) != SQLITE_OK) {
+    fprintf(stderr, "bindRelation: Failed to bind 3 param");
+    return ret;
+  }
+
+  if ((ret = sqlite3_bind_int64(stmt, 4, relation->uid)) != SQLITE_OK) {
+    fprintf(stderr, "bindRelation: Failed to bind 4 param");
+    return ret;
+  }
+
+  if ((ret = sqlite3_bind_text(stmt, 5, relation->timestamp,
+                               relation->timestamp
+                                   ? strlen(relation->timestamp)
+                                   : 0,
+                               NULL)) != SQLITE_OK) {
+    fprintf(stderr, "bindRelation: Failed to bind 5 param");
+    return ret;
+  }
+
+  return ret;
+}
+
+static int memberTypeCode(int memberType) {
+  switch (memberType) {
+  case READOSM_MEMBER_NODE:
+    return 0;
+  case READOSM_MEMBER_WAY:
+    return 1;
+  case READOSM_MEMBER_RELATION:
+    return 2;
+  default:
+    return -1;
+  }
+}
+
+int insertRelation(struct InsertRelationContext *ctx,
+                   const readosm_relation *relation) {
+  int ret;
+  char *errMsg;
+  sqlite3 *handle = ctx->dbHandle;
+
+  long long begin = metricsBegin();
+  if ((ret = bindRelation(ctx->insertRelationStmt, relation)) != SQLITE_OK) {
+    errMsg = "insertRelation: Failed to bind relation";
+    goto Fail;
+  }
+  metricsEnd(METRICS_PHASE_BIND, begin);
+
+  if ((ret = stepStatement(ctx->insertRelationStmt)) != SQLITE_OK) {
+    errMsg = "Failed to step insert relation statement";
+    goto Fail;
+  }
+
+  for (int i = 0; i < relation->tag_count; ++i) {
+    if ((ret = addTag(&ctx->tagBatch, ctx->tags, relation->id,
+                      &relation->tags[i])) != SQLITE_OK) {
+      errMsg = "Failed to insert relation tags";
+      goto Fail;
+    }
+  }
+
+  for (int i = 0; i < relation->member_count; ++i) {
+    const readosm_member *member = &relation->members[i];
+    int type = memberTypeCode(member->member_type);
+    if (type < 0) {
+      ret = SQLITE_MISMATCH;
+      errMsg = "Unknown relation member type";
+      goto Fail;
+    }
+
+    long long roleId;
+    if ((ret = internTableLookup(&ctx->roles, member->role, &roleId)) !=
+        SQLITE_OK) {
+      errMsg = "Failed to insert relation role";
+      goto Fail;
+    }
+
+    batchInsertInt64(&ctx->memberBatch, 0, relation->id);
+    batchInsertInt64(&ctx->memberBatch, 1, i);
+    batchInsertInt64(&ctx->memberBatch, 2, type);
+    batchInsertInt64(&ctx->memberBatch, 3, member->id);
+    batchInsertInt64(&ctx->memberBatch, 4, roleId);
+    if ((ret = batchInsertEndRow(&ctx->memberBatch)) != SQLITE_OK) {
+      errMsg = "Failed to insert relation members";
+      goto Fail;
+    }
+  }
+
+  return SQLITE_OK;
+
+Fail:
+  // Left uncommitted and rolled back on the next open, see insertNode.
+  fprintf(stderr, "%s\n", errMsg);
+  fprintf(stderr, "%s\n", sqlite3_errmsg(handle));
+  return ret;
+}
+
+// Reads the input with the native PBF reader or readosm. sourceOffset
+// receives the PBF blob position, startOffset skips to a blob on resume.
+// With metrics, parseInput passes the elements through the timed_*
+// callbacks, which add up the time spent outside the reader.
+struct TimedParse {
+  const void *user_data;
+  readosm_node_callback node_fnct;
+  readosm_way_callback way_fnct;
+  readosm_relation_callback relation_fnct;
+  long long callbackNanoseconds;
+};
+
+static int timed_node(const void *user_data, const readosm_node *node) {
+  struct TimedParse *timed = (struct TimedParse *)user_data;
+  long long begin = metricsBegin();
+  int ret = timed->node_fnct(timed->user_data, node);
+  timed->callbackNanoseconds += metricsBegin() - begin;
+  return ret;
+}
+
+static int timed_way(const void *user_data, const readosm_way *way) {
+  struct TimedParse *timed = (struct TimedParse *)user_data;
+  long long begin = metricsBegin();
+  int ret = timed->way_fnct(timed->user_data, way);
+  timed->callbackNanoseconds += metricsBegin() - begin;
+  return ret;
+}
+
+static int timed_relation(const void *user_data,
+                          const readosm_relation *relation) {
+  struct TimedParse *timed = (struct TimedParse *)user_data;
+  long long begin = metricsBegin();
+  int ret = timed->relation_fnct(timed->user_data, relation);
+  timed->callbackNanoseconds += metricsBegin() - begin;
+  return ret;
+}
+
+static int readInput(const struct ImportOptions *options,
+                     const void *user_data, long long *sourceOffset,
+                     long long startOffset, readosm_node_callback node_fnct,
+                     readosm_way_callback way_fnct,
+                     readosm_relation_callback relation_fnct) {
+  int ret;
+
+  if (options->pbfReader == PBF_READER_NATIVE &&
+      pbfIsPbfPath(options->inputPath)) {
+    struct PbfOptions pbfOptions = {options->pbfThreads, startOffset,
+                                    sourceOffset};
+    return pbfParse(options->inputPath, &pbfOptions, user_data, node_fnct,
+                    way_fnct, relation_fnct);
+  }
+
+  const void *handle = NULL;
+  if ((ret = readosm_open(options->inputPath, &handle)) != READOSM_OK) {
+    fprintf(stderr, "Fail to open OSM: %d\n", ret);
+    readosm_close(handle);
+    return ret;
+  }
+  ret = readosm_parse(handle, user_data, node_fnct, way_fnct, relation_fnct);
+  readosm_close(handle);
+  return ret;
+}
+
+int parseInput(const struct ImportOptions *options,
+               const void *user_data, long long *sourceOffset,
+               long long startOffset, readosm_node_callback node_fnct,
+               readosm_way_callback way_fnct,
+               readosm_relation_callback relation_fnct) {
+  if (!metricsEnabled()) {
+    return readInput(options, user_data, sourceOffset, startOffset,
+                     node_fnct, way_fnct, relation_fnct);
+  }
+  struct TimedParse timed = {user_data, node_fnct, way_fnct, relation_fnct,
+                             0};
+  long long begin = metricsBegin();
+  int ret = readInput(options, &timed, sourceOffset, startOffset,
+                      node_fnct != NULL ? timed_node : NULL,
+                      way_fnct != NULL ? timed_way : NULL,
+                      relation_fnct != NULL ? timed_relation : NULL);
+  long long elapsed = metricsBegin() - begin - timed.callbackNanoseconds;
+  metricsAddPhase(METRICS_PHASE_PARSE, elapsed / 1e9);
+  return ret;
+}
+
+// parseInput with the on_* callbacks of an import into stats.
+static int parseImportInput(const struct ImportOptions *options,
+                            struct OsmParseContext *stats) {
+  return parseInput(options, stats, &stats->sourceOffset,
+                    stats->resume ? stats->resumeFrom.blobOffset : 0, on_node,
+                    on_way, on_relation);
+}
+
+int onlineCpus(void) {
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus < 1 ? 1 : (int)cpus;
+}
+
+int finishColumnar(struct ImportOptions *options) {
+  struct ColumnarExport *out = options->columnar;
+  options->columnar = NULL;
+  return out != NULL ? columnarExportClose(out) : 0;
+}
+
+static void printPipelineStats(struct Pipeline *pipeline) {
+  struct PipelineStats stats;
+  pipelineGetStats(pipeline, &stats);
+  fprintf(stdout,
+          "Pipeline: batches=%lld parser blocked %.2fs, writer blocked "
+          "%.2fs\n",
+          stats.batches, stats.producerBlockedSeconds,
+          stats.writerBlockedSeconds);
+}
+
+int runParseOnly(const struct ImportOptions *options) {
+  struct OsmParseContext stats;
+  memset(&stats, 0, sizeof(stats));
+  stats.parseOnly = 1;
+
+  double started = monotonicSeconds();
+  int ret = parseImportInput(options, &stats);
+  double seconds = monotonicSeconds() - started;
+  metricsAddPhase(METRICS_PHASE_LOAD, seconds);
+
+  struct MetricsProgress progress;
+  metricsProgress(&stats, &progress);
+  metricsFinish(NULL, &progress, ret == READOSM_OK ? "ok" : "failed");
+  if (ret != READOSM_OK) {
+    fprintf(stderr, "Fail to parse OSM\n");
+    return ret;
+  }
+
+  long long elements = (long long)stats.nodes + stats.ways + stats.relation;
+  fprintf(stdout, "Parse: %lld elements in %.2fs (%.0f elements/s)\n",
+          elements, seconds, seconds > 0 ? elements / seconds : 0);
+  printStats(&stats);
+  return 0;
+}
+
+int openOutput(struct ImportOptions *options,
+               struct OsmParseContext *stats, int *deferIndexes,
+               const char **errMsg) {
+  int ret;
+  sqlite3 *dbHandle = NULL;
+  ret = sqlite3_open(options->outputPath, &dbHandle);
+  stats->dbHandle = dbHandle;
+  if (ret != SQLITE_OK) {
+    goto Fail;
+  }
+
+  if ((ret = pragmaProfileApply(dbHandle, options->profile)) != SQLITE_OK) {
+    goto Fail;
+  }
+
+  // A database whose tables exist without indexes comes from an
+  // interrupted deferred import and keeps deferring. index_node_tags_id is
+  // part of every layout.
+  int existingDatabase;
+  if ((ret = hasSchemaObject(dbHandle, "index", "index_node_tags_id",
+                             &existingDatabase)) != SQLITE_OK) {
+    goto Fail;
+  }
+
+  if ((options->commitEvery > 0 || options->commitInterval > 0) &&
+      options->profile->journalMode != NULL &&
+      strcmp(options->profile->journalMode, "OFF") == 0) {
+    // Without a journal an interrupted commit can corrupt the file, which
+    // would defeat resuming.
+    if ((ret = sqlite3_exec(dbHandle, "PRAGMA journal_mode = WAL;", NULL,
+                            NULL, NULL)) != SQLITE_OK) {
+      goto Fail;
+    }
+  }
+
+  *deferIndexes =
+      options->indexMode == INDEX_MODE_DEFERRED ||
+      (options->indexMode == INDEX_MODE_AUTO && !existingDatabase);
+
+  // Databases from before schema_layout have the plain layout.
+  int existingTables, hasLayout;
+  if ((ret = hasSchemaObject(dbHandle, "table", "nodes", &existingTables)) !=
+          SQLITE_OK ||
+      (ret = hasSchemaObject(dbHandle, "table", "schema_layout",
+                             &hasLayout)) != SQLITE_OK) {
+    goto Fail;
+  }
+  if (existingTables) {
+    int layout = 0;
+    if (hasLayout && (ret = loadLayout(dbHandle, &layout)) != SQLITE_OK) {
+      goto Fail;
+    }
+    if (layout != options->layout) {
+      fprintf(stdout, "Keeping the layout of the existing database\n");
+    }
+    options->layout = layout;
+  }
+
+  if ((ret = createTables(dbHandle, options->layout)) != SQLITE_OK ||
+      (ret = saveLayout(dbHandle, options->layout)) != SQLITE_OK ||
+      (ret = dropTriggers(dbHandle)) != SQLITE_OK) {
+    goto Fail;
+  }
+
+  if (!*deferIndexes &&
+      (ret = createIndexes(dbHandle, options->layout, 0)) != SQLITE_OK) {
+    goto Fail;
+  }
+
+  stats->commitEvery = options->commitEvery;
+  stats->commitInterval = options->commitInterval;
+  stats->lastCommit = monotonicSeconds();
+  stats->resume = options->resume;
+  stats->filter = options->filter;
+  stats->referencedNodes = options->referencedNodes;
+  stats->region = options->region;
+  stats->columnar = options->columnar;
+
+  if (options->resume) {
+    if ((ret = loadProgress(dbHandle, &stats->resumeFrom)) != SQLITE_OK) {
+      goto Fail;
+    }
+    stats->progress = stats->resumeFrom;
+    fprintf(stdout, "Resuming after node %lld, way %lld, relation %lld\n",
+            stats->resumeFrom.lastNodeId, stats->resumeFrom.lastWayId,
+            stats->resumeFrom.lastRelationId);
+  }
+
+  if ((ret = prepareSaveProgressStatement(stats)) != SQLITE_OK) {
+    goto Fail;
+  }
+
+  struct TagDictionary *tags = NULL;
+  if (options->layout & LAYOUT_INTERNED_TAGS) {
+    tags = &stats->tagDictionary;
+    if ((ret = initTagDictionary(dbHandle, tags)) != SQLITE_OK) {
+      goto Fail;
+    }
+  }
+
+  struct SpatialIndex *spatial = NULL;
+  if (options->layout & LAYOUT_SPATIAL_INDEX) {
+    spatial = &stats->spatialIndex;
+    if (locationStoreOpen(&stats->locationStore,
+                          options->locationStorePath) != 0) {
+      *errMsg = "Failed to open the location store";
+      return SQLITE_CANTOPEN;
+    }
+    if ((ret = spatialIndexInit(spatial, dbHandle, &stats->locationStore,
+                                options->layout & LAYOUT_COMPACT_NODES)) !=
+        SQLITE_OK) {
+      goto Fail;
+    }
+  }
+
+  if ((ret = initInsertNodeContext(dbHandle, tags, spatial, options->layout,
+                                   &stats->insertNodeContext)) != SQLITE_OK) {
+    goto Fail;
+  }
+
+  if ((ret = initInsertWayContext(
+           dbHandle, tags, spatial, options->layout & LAYOUT_PACKED_WAY_NODES,
+           &stats->insertWayContext)) != SQLITE_OK) {
+    goto Fail;
+  }
+
+  if ((ret = initInsertRelationContext(dbHandle, tags,
+                                       &stats->insertRelationContext)) !=
+      SQLITE_OK) {
+    goto Fail;
+  }
+
+  if ((ret = sqlite3_exec(dbHandle, "BEGIN TRANSACTION", NULL, NULL, NULL)) !=
+      SQLITE_OK) {
+    goto Fail;
+  }
+
+  return SQLITE_OK;
+
+Fail:
+  *errMsg = sqlite3_errmsg(dbHandle);
+  return ret;
+}
+
+int finishLoad(struct OsmParseContext *stats, const char **errMsg) {
+  int ret;
+  if ((ret = saveProgress(stats)) != SQLITE_OK ||
+      (ret = sqlite3_exec(stats->dbHandle, "END TRANSACTION", NULL, NULL,
+                          NULL)) != SQLITE_OK) {
+    *errMsg = sqlite3_errmsg(stats->dbHandle);
+    return ret;
+  }
+  return SQLITE_OK;
+}
+
+int finalizeOutput(const struct ImportOptions *options,
+                   struct OsmParseContext *stats,
+                   const char **errMsg) {
+  int ret;
+  if ((ret = finalizeInsertNodeContext(&stats->insertNodeContext)) !=
+      SQLITE_OK) {
+    *errMsg = "Failed to finalize node statements";
+    return ret;
+  }
+
+  if ((ret = finalizeInsertWayContext(&stats->insertWayContext)) !=
+      SQLITE_OK) {
+    *errMsg = "Failed to finalize way statements";
+    return ret;
+  }
+
+  if ((ret = finalizeInsertRelationContext(&stats->insertRelationContext)) !=
+      SQLITE_OK) {
+    *errMsg = "Failed to finalize relation statements";
+    return ret;
+  }
+
+  if ((options->layout & LAYOUT_INTERNED_TAGS) &&
+      (ret = finalizeTagDictionary(&stats->tagDictionary)) != SQLITE_OK) {
+    *errMsg = "Failed to finalize tag dictionary statements";
+    return ret;
+  }
+
+  if (options->layout & LAYOUT_SPATIAL_INDEX) {
+    if ((ret = spatialIndexFinalize(&stats->spatialIndex)) != SQLITE_OK) {
+      *errMsg = "Failed to finalize spatial index statements";
+      return ret;
+    }
+    locationStoreClose(&stats->locationStore);
+  }
+
+  if ((ret = sqlite3_finalize(stats->saveProgressStmt)) != SQLITE_OK) {
+    *errMsg = "Failed to finalize progress statement";
+    return ret;
+  }
+  stats->saveProgressStmt = NULL;
+  return SQLITE_OK;
+}
+
+int completeOutput(const struct ImportOptions *options,
+                   struct OsmParseContext *stats, int deferIndexes,
+                   const char **errMsg) {
+  int ret;
+  sqlite3 *dbHandle = stats->dbHandle;
+
+  double phaseStarted = monotonicSeconds();
+  if (deferIndexes) {
+    if ((ret = sqlite3_exec(dbHandle, "BEGIN TRANSACTION", NULL, NULL,
+                            NULL)) != SQLITE_OK ||
+        (ret = createIndexes(dbHandle, options->layout, 1)) != SQLITE_OK ||
+        (ret = sqlite3_exec(dbHandle, "END TRANSACTION", NULL, NULL, NULL)) !=
+            SQLITE_OK) {
+      goto Fail;
+    }
+  }
+  metricsAddPhase(METRICS_PHASE_INDEXES, monotonicSeconds() - phaseStarted);
+
+  phaseStarted = monotonicSeconds();
+  if (options->layout & LAYOUT_PACKED_WAY_NODES) {
+    if ((ret = sqlite3_exec(dbHandle, "BEGIN TRANSACTION", NULL, NULL,
+                            NULL)) != SQLITE_OK ||
+        (ret = buildNodeWays(dbHandle)) != SQLITE_OK ||
+        (ret = sqlite3_exec(dbHandle, "END TRANSACTION", NULL, NULL, NULL)) !=
+            SQLITE_OK) {
+      goto Fail;
+    }
+  }
+  metricsAddPhase(METRICS_PHASE_NODE_WAYS, monotonicSeconds() - phaseStarted);
+
+  phaseStarted = monotonicSeconds();
+  if (options->layout & LAYOUT_SPATIAL_INDEX) {
+    if ((ret = sqlite3_exec(dbHandle, "BEGIN TRANSACTION", NULL, NULL,
+                            NULL)) != SQLITE_OK ||
+        (ret = spatialIndexBuild(dbHandle)) != SQLITE_OK ||
+        (ret = sqlite3_exec(dbHandle, "END TRANSACTION", NULL, NULL, NULL)) !=
+            SQLITE_OK) {
+      goto Fail;
+    }
+  }
+  metricsAddPhase(METRICS_PHASE_SPATIAL_INDEX,
+                  monotonicSeconds() - phaseStarted);
+
+  phaseStarted = monotonicSeconds();
+  if ((ret = sqlite3_exec(dbHandle, "BEGIN TRANSACTION", NULL, NULL, NULL)) !=
+          SQLITE_OK ||
+      (ret = buildNameIndex(dbHandle)) != SQLITE_OK ||
+      (ret = installTriggers(dbHandle, options->layout)) != SQLITE_OK ||
+      (ret = sqlite3_exec(dbHandle, "END TRANSACTION", NULL, NULL, NULL)) !=
+          SQLITE_OK) {
+    goto Fail;
+  }
+
+  metricsAddPhase(METRICS_PHASE_NAMES, monotonicSeconds() - phaseStarted);
+
+  struct VocabularyStats vocabulary;
+  double vocabularyStarted = monotonicSeconds();
+  if ((ret = sqlite3_exec(dbHandle, "BEGIN TRANSACTION", NULL, NULL, NULL)) !=
+          SQLITE_OK ||
+      (ret = vocabularyBuild(dbHandle, "named_nodes_spellfix", onlineCpus(),
+                             &vocabulary)) != SQLITE_OK ||
+      (ret = sqlite3_exec(dbHandle, "END TRANSACTION", NULL, NULL, NULL)) !=
+          SQLITE_OK) {
+    goto Fail;
+  }
+  double vocabularySeconds = monotonicSeconds() - vocabularyStarted;
+  metricsAddPhase(METRICS_PHASE_VOCABULARY, vocabularySeconds);
+  fprintf(stdout, "Table %-24s built in %.2fs (%lld words, %lld names)\n",
+          "named_nodes_spellfix", vocabularySeconds, vocabulary.words,
+          vocabulary.names);
+
+  double restoreStarted = monotonicSeconds();
+  if ((ret = pragmaProfileRestore(dbHandle, options->profile)) != SQLITE_OK) {
+    goto Fail;
+  }
+  double restoreSeconds = monotonicSeconds() - restoreStarted;
+  metricsAddPhase(METRICS_PHASE_RESTORE, restoreSeconds);
+  if (options->profile->journalMode != NULL) {
+    fprintf(stdout, "Switched to serving settings in %.2fs\n",
+            restoreSeconds);
+  }
+
+  return finalizeOutput(options, stats, errMsg);
+
+Fail:
+  *errMsg = sqlite3_errmsg(dbHandle);
+  return ret;
+}
+
+int runImport(struct ImportOptions *options) {
+  int ret;
+  const char *errMsg;
+  struct OsmParseContext stats;
+  memset(&stats, 0, sizeof(stats));
+
+  int deferIndexes;
+  if ((ret = openOutput(options, &stats, &deferIndexes, &errMsg)) !=
+      SQLITE_OK) {
+    goto Fail;
+  }
+
+  double loadStarted = monotonicSeconds();
+
+  if (options->pipeline) {
+    options->pipelineOptions.sourcePosition = &stats.sourceOffset;
+    if ((ret = pipelineStart(&stats.pipeline, &options->pipelineOptions,
+                             &stats, write_node, write_way,
+                             write_relation)) != READOSM_OK) {
+      errMsg = "Failed to start writer pipeline";
+      goto Fail;
+    }
+
+    ret = parseImportInput(options, &stats);
+    int writerRet = pipelineFinish(stats.pipeline);
+    if (ret == READOSM_OK) {
+      ret = writerRet;
+    }
+  } else {
+    ret = parseImportInput(options, &stats);
+  }
+
+  if (ret != READOSM_OK) {
+    errMsg = "Fail to parse OSM";
+    goto Fail;
+  }
+
+  if (finishColumnar(options) != 0) {
+    ret = SQLITE_IOERR;
+    errMsg = "Failed to finish the columnar export";
+    goto Fail;
+  }
+
+  if ((ret = finishLoad(&stats, &errMsg)) != SQLITE_OK) {
+    goto Fail;
+  }
+
+  double loadSeconds = monotonicSeconds() - loadStarted;
+  metricsAddPhase(METRICS_PHASE_LOAD, loadSeconds);
+  long long elements = (long long)stats.nodes + stats.ways + stats.relation;
+  pragmaProfilePrint(stats.dbHandle, options->profile);
+  fprintf(stdout, "Load: %lld elements in %.2fs (%.0f elements/s)\n",
+          elements, loadSeconds, loadSeconds > 0 ? elements / loadSeconds : 0);
+
+  if ((ret = completeOutput(options, &stats, deferIndexes, &errMsg)) !=
+      SQLITE_OK) {
+    goto Fail;
+  }
+
+  struct MetricsProgress progress;
+  metricsProgress(&stats, &progress);
+  metricsFinish(stats.dbHandle, &progress, "ok");
+
+  sqlite3_close(stats.dbHandle);
+  printStats(&stats);
+  printFilterStats(&stats);
+  printMemoryStats();
+  printWriteBehindStats();
+  if (stats.commits != 0 || stats.skipped != 0) {
+    fprintf(stdout, "Intermediate commits=%d, skipped on resume=%lld\n",
+            stats.commits, stats.skipped);
+  }
+  if (stats.pipeline != NULL) {
+    printPipelineStats(stats.pipeline);
+    pipelineFree(stats.pipeline);
+  }
+  return 0;
+
+Fail:
+  fprintf(stderr, "%s\n", errMsg);
+  struct MetricsProgress failedProgress;
+  metricsProgress(&stats, &failedProgress);
+  metricsFinish(stats.dbHandle, &failedProgress, "failed");
+  sqlite3_close(stats.dbHandle);
+  pipelineFree(stats.pipeline);
+  return ret;
+}
+
+// --keep-referenced-nodes: nodes come before the ways referencing them, so
+// a first pass over the input collects the nodes of the matching ways.
+struct NodeCollector {
+  const struct TagFilter *filter;
+  struct IdSet *nodes;
+};
+
+static int collect_way(const void *user_data, const readosm_way *way) {
+  const struct NodeCollector *collector = user_data;
+  if (!tagFilterMatch(collector->filter, way->tags, way->tag_count)) {
+    return READOSM_OK;
+  }
+  for (int i = 0; i < way->node_ref_count; ++i) {
+    if (idSetAdd(collector->nodes, way->node_refs[i]) != 0) {
+      fprintf(stderr, "Out of memory collecting way nodes\n");
+      return READOSM_ABORT;
+    }
+  }
+  return READOSM_OK;
+}
+
+int collectReferencedNodes(const struct ImportOptions *options,
+                           struct IdSet *nodes) {
+  struct NodeCollector collector = {options->filter, nodes};
+  long long sourceOffset = 0;
+  double started = monotonicSeconds();
+  int ret = parseInput(options, &collector, &sourceOffset, 0, NULL,
+                       collect_way, NULL);
+  if (ret == READOSM_OK) {
+    fprintf(stdout, "Collected %lld nodes of matching ways in %.2fs\n",
+            nodes->count, monotonicSeconds() - started);
+  }
+  return ret;
+}
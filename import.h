@@ -0,0 +1,327 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include "batch_insert.h"
+#include "columnar.h"
+#include "id_set.h"
+#include "intern_table.h"
+#include "location_store.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "pragma_profile.h"
+#include "region.h"
+#include "shard.h"
+#include "spatial_index.h"
+#include "tag_filter.h"
+
+#include <readosm.h>
+#include <sqlite3.h>
+
+enum IndexMode { INDEX_MODE_AUTO, INDEX_MODE_IMMEDIATE, INDEX_MODE_DEFERRED };
+
+enum PbfReader { PBF_READER_NATIVE, PBF_READER_READOSM };
+
+struct ImportOptions {
+  const char *inputPath;
+  const char *outputPath;
+
+  // Deferred builds the secondary indexes after the load, immediate before
+  // it. Auto defers for fresh databases only: appending to an indexed
+  // database keeps the existing indexes live.
+  enum IndexMode indexMode;
+
+  const struct PragmaProfile *profile;
+
+  // SchemaLayout flags for a new database.
+  int layout;
+
+  // .osm.pbf files are decoded by pbf.c on pbfThreads workers unless
+  // readosm is requested.
+  enum PbfReader pbfReader;
+  int pbfThreads;
+
+  // Parse on the calling thread and write on a dedicated one.
+  int pipeline;
+  struct PipelineOptions pipelineOptions;
+
+  // Commit every commitEvery elements and/or commitInterval seconds instead
+  // of once at the end. Zero disables either trigger.
+  long long commitEvery;
+  double commitInterval;
+  // Skip elements already recorded in import_progress.
+  int resume;
+
+  // File backing the node locations of LAYOUT_SPATIAL_INDEX, NULL for a
+  // temporary one.
+  const char *locationStorePath;
+
+  // Only parse the input, for measuring the readers without SQLite.
+  int parseOnly;
+
+  // The input is an osmChange file applied to the existing database in
+  // outputPath, see runApplyChanges.
+  int applyChanges;
+
+  // Split the output over this many databases, see runSharded. 0 writes a
+  // single database.
+  int shards;
+  enum ShardScheme shardScheme;
+
+  // Load nodes, ways and relations into databases of their own and merge
+  // them into the output, see runSplitTables.
+  int splitTables;
+
+  // --filter: only elements whose tags match are imported, NULL imports
+  // everything. With keepReferencedNodes the nodes of matching ways are
+  // kept too; a first pass collects them into referencedNodes.
+  struct TagFilter *filter;
+  int keepReferencedNodes;
+  const struct IdSet *referencedNodes;
+
+  // --bbox or --poly: only the elements in the region are imported, NULL
+  // imports everything. Holds the IDs of the elements kept so far.
+  struct Region *region;
+
+  // JSON lines from metrics.h, every metricsInterval seconds and at exit.
+  const char *metricsPath;
+  double metricsInterval;
+
+  // --memory-budget in bytes, 0 for none. profile then points to
+  // budgetProfile, a copy with the cache and mmap sizes capped to SQLite's
+  // share and temp_store=FILE, so the sorters behind CREATE INDEX and
+  // GROUP BY spill their runs to temporary files.
+  long long memoryBudget;
+  struct PragmaProfile budgetProfile;
+
+  // --compress: zlib level of the pages of new databases, 0 to store
+  // them uncompressed.
+  int compressLevel;
+
+  // --write-behind: bytes of writes buffered for the background I/O
+  // thread, 0 to write synchronously.
+  long long writeBehind;
+
+  // --columnar: directory for a columnar copy of the imported elements,
+  // NULL for none. columnar is the open export while the input is parsed.
+  const char *columnarPath;
+  struct ColumnarExport *columnar;
+};
+
+// Last element IDs covered by a commit. Input files are sorted by type and
+// then ID, so everything up to these IDs is in the database.
+struct ImportProgress {
+  long long lastNodeId;
+  long long lastWayId;
+  long long lastRelationId;
+  // PBF blob holding the last committed element, 0 for other inputs.
+  long long blobOffset;
+};
+
+// Tag strings of the LAYOUT_INTERNED_TAGS layout, shared by the insert
+// contexts.
+struct TagDictionary {
+  struct InternTable keys;
+  struct InternTable values;
+};
+
+// tags is NULL unless tags are interned, spatial unless the layout has
+// LAYOUT_SPATIAL_INDEX. layout selects the columns of the nodes table, see
+// LAYOUT_COMPACT_NODES and LAYOUT_NO_NODE_METADATA.
+struct InsertNodeContext {
+  sqlite3 *dbHandle;
+  sqlite3_stmt *insertNodeStmt;
+  struct TagDictionary *tags;
+  struct SpatialIndex *spatial;
+  int layout;
+  struct BatchInsert tagBatch;
+  struct BatchInsert nameBatch;
+};
+
+// With packedNodes set the node refs are bound to the ways statement from
+// packBuffer and nodeRefBatch is unused.
+struct InsertWayContext {
+  sqlite3 *dbHandle;
+  sqlite3_stmt *insertWayStmt;
+  struct TagDictionary *tags;
+  struct SpatialIndex *spatial;
+  struct BatchInsert tagBatch;
+  struct BatchInsert nodeRefBatch;
+  int packedNodes;
+  unsigned char *packBuffer;
+  size_t packCapacity;
+};
+
+// Member types are stored with the codes of the PBF format: 0 node, 1 way,
+// 2 relation. Roles repeat a lot ("outer", "inner", "stop", ...) and are
+// stored as IDs into relation_roles, which are cached in roles.
+struct InsertRelationContext {
+  sqlite3 *dbHandle;
+  sqlite3_stmt *insertRelationStmt;
+  struct TagDictionary *tags;
+  struct BatchInsert tagBatch;
+  struct BatchInsert memberBatch;
+  struct InternTable roles;
+};
+
+struct OsmParseContext {
+  int nodes;
+  int ways;
+  int relation;
+
+  sqlite3 *dbHandle;
+  struct TagDictionary tagDictionary;
+  struct SpatialIndex spatialIndex;
+  struct LocationStore locationStore;
+  struct InsertNodeContext insertNodeContext;
+  struct InsertWayContext insertWayContext;
+  struct InsertRelationContext insertRelationContext;
+
+  struct Pipeline *pipeline;
+
+  // Chunked commits; only touched by the thread running the insert
+  // callbacks.
+  long long commitEvery;
+  double commitInterval;
+  long long sinceCommit;
+  double lastCommit;
+  int commits;
+  struct ImportProgress progress;
+  sqlite3_stmt *saveProgressStmt;
+
+  // Read by the parsing thread only.
+  long long sourceOffset;
+  int resume;
+  struct ImportProgress resumeFrom;
+  long long skipped;
+  const struct TagFilter *filter;
+  const struct IdSet *referencedNodes;
+  struct Region *region;
+  long long filtered;
+  struct ColumnarExport *columnar;
+
+  // Count elements without writing them, see --parse-only.
+  int parseOnly;
+
+  // Writer of one shard of a sharded import or one part of a split one;
+  // progress is printed and reported by the parsing thread for all of them
+  // together.
+  int shardWriter;
+};
+
+int initTagDictionary(sqlite3 *db, struct TagDictionary *tags);
+int finalizeTagDictionary(struct TagDictionary *tags);
+
+int initInsertNodeContext(sqlite3 *db, struct TagDictionary *tags,
+                          struct SpatialIndex *spatial, int layout,
+                          struct InsertNodeContext *ctx);
+int initInsertWayContext(sqlite3 *db, struct TagDictionary *tags,
+                         struct SpatialIndex *spatial, int packedNodes,
+                         struct InsertWayContext *ctx);
+int initInsertRelationContext(sqlite3 *db, struct TagDictionary *tags,
+                              struct InsertRelationContext *ctx);
+
+// Writes out rows still buffered in the batches. Must run before the
+// enclosing transaction is committed.
+int flushInsertNodeContext(struct InsertNodeContext *ctx);
+int flushInsertWayContext(struct InsertWayContext *ctx);
+int flushInsertRelationContext(struct InsertRelationContext *ctx);
+
+int finalizeInsertNodeContext(struct InsertNodeContext *ctx);
+int finalizeInsertWayContext(struct InsertWayContext *ctx);
+int finalizeInsertRelationContext(struct InsertRelationContext *ctx);
+
+void printStats(struct OsmParseContext *stats);
+void printFilterStats(struct OsmParseContext *stats);
+void printWriteBehindStats(void);
+void printMemoryStats(void);
+
+// count is the counter just incremented; testing all three would print
+// for every element after a type's count stops on a multiple of 100000.
+void maybePrintStats(struct OsmParseContext *stats, int count);
+
+// The element counts and input position reported to metrics.h.
+void metricsProgress(struct OsmParseContext *ctx,
+                     struct MetricsProgress *progress);
+void maybeEmitMetrics(struct OsmParseContext *ctx);
+
+// --filter, --bbox and --poly are applied on the parsing thread too,
+// before an element is copied into the pipeline or bound to a statement.
+// The filter* functions return 0 to keep the element, 1 to drop it and -1
+// on errors. The region is tested first: it records the elements inside
+// for the ways and relations referencing them, whatever their tags.
+int filterNode(struct OsmParseContext *ctx, const readosm_node *node);
+int filterWay(struct OsmParseContext *ctx, const readosm_way *way);
+int filterRelation(struct OsmParseContext *ctx,
+                   const readosm_relation *relation);
+
+// The write_* callbacks do the SQLite work; they run on the parsing thread,
+// or on the writer thread in pipeline mode.
+int write_node(const void *user_data, const readosm_node *node);
+int write_way(const void *user_data, const readosm_way *way);
+int write_relation(const void *user_data,
+                   const readosm_relation *relation);
+
+int bindNodeCoordinate(sqlite3_stmt *stmt, int param, int compact,
+                       double degrees);
+
+// Steps a statement that returns no rows, then clears and resets it.
+int stepStatement(sqlite3_stmt *stmt);
+
+int insertNode(struct InsertNodeContext *ctx, const readosm_node *node);
+int insertWay(struct InsertWayContext *ctx, const readosm_way *way);
+int insertRelation(struct InsertRelationContext *ctx,
+                   const readosm_relation *relation);
+
+// Reads the input into the callbacks, adding the time the reader itself
+// takes to METRICS_PHASE_PARSE.
+int parseInput(const struct ImportOptions *options,
+               const void *user_data, long long *sourceOffset,
+               long long startOffset, readosm_node_callback node_fnct,
+               readosm_way_callback way_fnct,
+               readosm_relation_callback relation_fnct);
+
+// Processors online, for the default worker counts.
+int onlineCpus(void);
+
+// Writes the rest of the --columnar export once the input is parsed.
+int finishColumnar(struct ImportOptions *options);
+
+// --parse-only: the same readers and callbacks, stopping before insertNode
+// and friends.
+int runParseOnly(const struct ImportOptions *options);
+
+// Opens the database at options->outputPath and prepares it for the load:
+// tables, indexes unless they are deferred, and the insert contexts of
+// stats. Returns with a transaction open. options->layout is replaced by
+// the layout of an existing database. stats->dbHandle is set even on
+// failure, for the caller to close.
+int openOutput(struct ImportOptions *options,
+               struct OsmParseContext *stats, int *deferIndexes,
+               const char **errMsg);
+
+// Writes what the batches still hold and commits the load.
+int finishLoad(struct OsmParseContext *stats, const char **errMsg);
+
+// Finalizes the statements openOutput prepared for stats.
+int finalizeOutput(const struct ImportOptions *options,
+                   struct OsmParseContext *stats,
+                   const char **errMsg);
+
+// The work after the load: deferred indexes, node_ways, the R*Trees, the
+// full-text index and the vocabulary, then the serving settings. Finalizes
+// the statements of stats; the caller closes the database.
+int completeOutput(const struct ImportOptions *options,
+                   struct OsmParseContext *stats, int deferIndexes,
+                   const char **errMsg);
+
+// --keep-referenced-nodes: a first pass over the input collecting the
+// nodes of the ways options->filter matches.
+int collectReferencedNodes(const struct ImportOptions *options,
+                           struct IdSet *nodes);
+
+// The single-database import of options->inputPath into
+// options->outputPath, parsing on the calling thread or, with
+// options->pipeline, writing on a thread of its own.
+int runImport(struct ImportOptions *options);
+
+#endif
@@ -0,0 +1,200 @@
+#include "intern_table.h"
+#include "memory_budget.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Switches table to looking up the strings its cache does not hold.
+static int startTableLookups(struct InternTable *table) {
+  // The column needs an index, unless it is UNIQUE and already has one.
+  sqlite3_stmt *stmt;
+  int ret = sqlite3_prepare_v2(table->dbHandle,
+                               "SELECT 1 FROM pragma_index_list(?1) AS l, "
+                               "pragma_index_info(l.name) AS i "
+                               "WHERE i.seqno = 0 AND i.name = ?2;",
+                               -1, &stmt, NULL);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  sqlite3_bind_text(stmt, 1, table->tableName, -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 2, table->columnName, -1, SQLITE_STATIC);
+  ret = sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  if (ret != SQLITE_ROW && ret != SQLITE_DONE) {
+    return ret;
+  }
+
+  char *query;
+  if (ret == SQLITE_DONE) {
+    // Named like the deferred index of the same column, which then exists.
+    query = sqlite3_mprintf(
+        "CREATE INDEX IF NOT EXISTS \"index_%w_%w\" ON \"%w\"(\"%w\");",
+        table->tableName, table->columnName, table->tableName,
+        table->columnName);
+    if (query == NULL) {
+      return SQLITE_NOMEM;
+    }
+    ret = sqlite3_exec(table->dbHandle, query, NULL, NULL, NULL);
+    sqlite3_free(query);
+    if (ret != SQLITE_OK) {
+      return ret;
+    }
+  }
+
+  query = sqlite3_mprintf("SELECT id FROM \"%w\" WHERE \"%w\" = ?1;",
+                          table->tableName, table->columnName);
+  if (query == NULL) {
+    return SQLITE_NOMEM;
+  }
+  ret = sqlite3_prepare_v2(table->dbHandle, query, -1, &table->selectStmt,
+                           NULL);
+  sqlite3_free(query);
+  return ret;
+}
+
+// Caches str if the memory budget allows, returns SQLITE_FULL if not. A
+// cached string costs its copy and its share of the hash table, which is
+// kept between 3/8 and 3/4 full.
+static int cacheString(struct InternTable *table, const char *str,
+                       long long id) {
+  long long bytes = strlen(str) + 1 + 2 * sizeof(struct StringDictEntry);
+  if (!memoryBudgetReserve(MEMORY_DICTIONARIES, bytes)) {
+    return SQLITE_FULL;
+  }
+  table->reservedBytes += bytes;
+  if (stringDictInsert(&table->dict, str, id) != 0) {
+    return SQLITE_NOMEM;
+  }
+  return SQLITE_OK;
+}
+
+static int loadInternTable(struct InternTable *table, const char *tableName,
+                           const char *columnName) {
+  char *query =
+      sqlite3_mprintf("SELECT id, \"%w\" FROM \"%w\";", columnName, tableName);
+  if (query == NULL) {
+    return SQLITE_NOMEM;
+  }
+
+  sqlite3_stmt *stmt;
+  int ret = sqlite3_prepare_v2(table->dbHandle, query, -1, &stmt, NULL);
+  sqlite3_free(query);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+
+  int full = 0;
+  while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+    long long id = sqlite3_column_int64(stmt, 0);
+    const char *str = (const char *)sqlite3_column_text(stmt, 1);
+    if (!full &&
+        (ret = cacheString(table, str ? str : "", id)) != SQLITE_OK) {
+      if (ret != SQLITE_FULL) {
+        break;
+      }
+      // Keep reading for lastId.
+      full = 1;
+    }
+    if (id > table->lastId) {
+      table->lastId = id;
+    }
+  }
+  sqlite3_finalize(stmt);
+  if (ret != SQLITE_DONE) {
+    return ret;
+  }
+  return full ? startTableLookups(table) : SQLITE_OK;
+}
+
+int internTableInit(struct InternTable *table, sqlite3 *db,
+                    const char *tableName, const char *columnName) {
+  table->dbHandle = db;
+  table->insertStmt = NULL;
+  table->selectStmt = NULL;
+  table->tableName = tableName;
+  table->columnName = columnName;
+  table->lastId = 0;
+  table->reservedBytes = 0;
+  stringDictInit(&table->dict);
+
+  char *query =
+      sqlite3_mprintf("INSERT INTO \"%w\"(id, \"%w\") VALUES (?1, ?2);",
+                      tableName, columnName);
+  if (query == NULL) {
+    return SQLITE_NOMEM;
+  }
+  int ret = sqlite3_prepare_v2(db, query, -1, &table->insertStmt, NULL);
+  sqlite3_free(query);
+  if (ret != SQLITE_OK) {
+    fprintf(stderr, "internTableInit: Failed to prepare insert into %s: %s\n",
+            tableName, sqlite3_errmsg(db));
+    return ret;
+  }
+
+  if ((ret = loadInternTable(table, tableName, columnName)) != SQLITE_OK) {
+    fprintf(stderr, "internTableInit: Failed to load %s: %s\n", tableName,
+            sqlite3_errmsg(db));
+    return ret;
+  }
+
+  return SQLITE_OK;
+}
+
+int internTableLookup(struct InternTable *table, const char *str,
+                      long long *id) {
+  if (str == NULL) {
+    str = "";
+  }
+  if (stringDictFind(&table->dict, str, id)) {
+    return SQLITE_OK;
+  }
+
+  int ret;
+  sqlite3_stmt *select = table->selectStmt;
+  if (select != NULL) {
+    sqlite3_bind_text(select, 1, str, -1, SQLITE_STATIC);
+    if ((ret = sqlite3_step(select)) == SQLITE_ROW) {
+      *id = sqlite3_column_int64(select, 0);
+    }
+    sqlite3_reset(select);
+    if (ret == SQLITE_ROW) {
+      return SQLITE_OK;
+    }
+    if (ret != SQLITE_DONE) {
+      return ret;
+    }
+  }
+
+  long long newId = table->lastId + 1;
+  sqlite3_stmt *stmt = table->insertStmt;
+  sqlite3_bind_int64(stmt, 1, newId);
+  sqlite3_bind_text(stmt, 2, str, -1, SQLITE_STATIC);
+  if ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
+    sqlite3_reset(stmt);
+    return ret;
+  }
+  if ((ret = sqlite3_reset(stmt)) != SQLITE_OK) {
+    return ret;
+  }
+  table->lastId = newId;
+  *id = newId;
+  if (select != NULL) {
+    return SQLITE_OK;
+  }
+  ret = cacheString(table, str, newId);
+  return ret == SQLITE_FULL ? startTableLookups(table) : ret;
+}
+
+int internTableFinalize(struct InternTable *table) {
+  int ret = sqlite3_finalize(table->insertStmt);
+  int selectRet = sqlite3_finalize(table->selectStmt);
+  table->insertStmt = NULL;
+  table->selectStmt = NULL;
+  stringDictFree(&table->dict);
+  memoryBudgetRelease(MEMORY_DICTIONARIES, table->reservedBytes);
+  table->reservedBytes = 0;
+  if (ret == SQLITE_OK) {
+    ret = selectRet;
+  }
+  return ret;
+}
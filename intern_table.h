@@ -0,0 +1,39 @@
+#ifndef INTERN_TABLE_H
+#define INTERN_TABLE_H
+
+#include "string_dict.h"
+
+#include <sqlite3.h>
+
+// Maps the strings of a two-column dictionary table "(id INTEGER PRIMARY
+// KEY, <column> TEXT UNIQUE)" to their IDs. The table is cached in memory;
+// strings seen for the first time get the next ID and are inserted right
+// away, so rows referring to them can be written in any order.
+//
+// The cache draws from the memory budget. Once a reservation is refused it
+// stops growing and strings it does not hold are looked up in the table,
+// through an index on the column that is created at that point.
+struct InternTable {
+  sqlite3 *dbHandle;
+  sqlite3_stmt *insertStmt;
+  // Prepared when the cache stops growing.
+  sqlite3_stmt *selectStmt;
+  const char *tableName;
+  const char *columnName;
+  struct StringDict dict;
+  long long lastId;
+  long long reservedBytes;
+};
+
+// Loads the existing rows of table so appends reuse their IDs. tableName
+// and columnName must outlive the table.
+int internTableInit(struct InternTable *table, sqlite3 *db,
+                    const char *tableName, const char *columnName);
+
+// NULL is interned as the empty string.
+int internTableLookup(struct InternTable *table, const char *str,
+                      long long *id);
+
+int internTableFinalize(struct InternTable *table);
+
+#endif
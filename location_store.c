@@ -0,0 +1,145 @@
+#include "location_store.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define LOCATION_STORE_MAGIC "OSMLOCS1"
+// The header takes a page so entries stay page aligned.
+#define LOCATION_STORE_HEADER 4096
+#define LOCATION_STORE_MIN_CAPACITY (1LL << 24)
+
+// Latitudes are stored with a bias so that an all-zero entry, the content
+// of pages never written, means "no location".
+#define LATITUDE_BIAS 900000001LL
+
+struct LocationEntry {
+  uint32_t lat;
+  int32_t lon;
+};
+
+static struct LocationEntry *entries(const struct LocationStore *store) {
+  return (struct LocationEntry *)(store->map + LOCATION_STORE_HEADER);
+}
+
+static int mapStore(struct LocationStore *store, long long capacity) {
+  size_t size =
+      LOCATION_STORE_HEADER + (size_t)capacity * sizeof(struct LocationEntry);
+  if (ftruncate(store->fd, (off_t)size) != 0) {
+    perror("locationStore: ftruncate");
+    return -1;
+  }
+  // The file is sparse, so growing it costs no disk space until written.
+  unsigned char *map =
+      mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, store->fd, 0);
+  if (map == MAP_FAILED) {
+    perror("locationStore: mmap");
+    return -1;
+  }
+  if (store->map != NULL) {
+    munmap(store->map, store->mapSize);
+  }
+  store->map = map;
+  store->mapSize = size;
+  store->capacity = capacity;
+  return 0;
+}
+
+static int openTemporary(void) {
+  const char *dir = getenv("TMPDIR");
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/locations-XXXXXX",
+           dir != NULL && *dir != '\0' ? dir : "/tmp");
+  int fd = mkstemp(path);
+  if (fd >= 0) {
+    unlink(path);
+  }
+  return fd;
+}
+
+int locationStoreOpen(struct LocationStore *store, const char *path) {
+  memset(store, 0, sizeof(*store));
+  store->fd = path != NULL ? open(path, O_RDWR | O_CREAT, 0644)
+                           : openTemporary();
+  if (store->fd < 0) {
+    perror(path != NULL ? path : "locationStore");
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(store->fd, &st) != 0) {
+    perror("locationStore: fstat");
+    locationStoreClose(store);
+    return -1;
+  }
+
+  long long capacity = LOCATION_STORE_MIN_CAPACITY;
+  if (st.st_size > LOCATION_STORE_HEADER) {
+    long long stored = (st.st_size - LOCATION_STORE_HEADER) /
+                       (long long)sizeof(struct LocationEntry);
+    capacity = stored > capacity ? stored : capacity;
+  }
+  if (mapStore(store, capacity) != 0) {
+    locationStoreClose(store);
+    return -1;
+  }
+
+  if (st.st_size == 0) {
+    memcpy(store->map, LOCATION_STORE_MAGIC, 8);
+  } else if (memcmp(store->map, LOCATION_STORE_MAGIC, 8) != 0) {
+    fprintf(stderr, "%s is not a location store\n", path);
+    locationStoreClose(store);
+    return -1;
+  }
+  return 0;
+}
+
+int locationStoreSet(struct LocationStore *store, long long id,
+                     long long latE7, long long lonE7) {
+  if (id < 0) {
+    return 0;
+  }
+  if (id >= store->capacity) {
+    // Input is sorted by ID, so doubling keeps remaps rare.
+    long long capacity = store->capacity;
+    while (capacity <= id) {
+      capacity *= 2;
+    }
+    if (mapStore(store, capacity) != 0) {
+      return -1;
+    }
+  }
+  struct LocationEntry *entry = &entries(store)[id];
+  entry->lat = (uint32_t)(latE7 + LATITUDE_BIAS);
+  entry->lon = (int32_t)lonE7;
+  return 0;
+}
+
+int locationStoreGet(const struct LocationStore *store, long long id,
+                     long long *latE7, long long *lonE7) {
+  if (id < 0 || id >= store->capacity) {
+    return 0;
+  }
+  const struct LocationEntry *entry = &entries(store)[id];
+  if (entry->lat == 0) {
+    return 0;
+  }
+  *latE7 = (long long)entry->lat - LATITUDE_BIAS;
+  *lonE7 = entry->lon;
+  return 1;
+}
+
+void locationStoreClose(struct LocationStore *store) {
+  if (store->map != NULL) {
+    munmap(store->map, store->mapSize);
+  }
+  if (store->fd >= 0) {
+    close(store->fd);
+  }
+  store->map = NULL;
+  store->fd = -1;
+}
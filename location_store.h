@@ -0,0 +1,33 @@
+#ifndef LOCATION_STORE_H
+#define LOCATION_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Node coordinates in a dense array indexed by node ID, in 1e-7 degrees.
+// The array lives in a memory-mapped file: pages are only allocated for the
+// ID ranges in use, and the kernel writes cold pages back to the file
+// instead of holding the whole array in RAM. A file given by path is kept
+// and reused by later runs; otherwise an unlinked temporary file is used.
+struct LocationStore {
+  int fd;
+  unsigned char *map;
+  size_t mapSize;
+  // Entries the current mapping holds, IDs 0 to capacity - 1.
+  long long capacity;
+};
+
+// path may be NULL. Returns 0, or -1 after printing the error.
+int locationStoreOpen(struct LocationStore *store, const char *path);
+
+// Returns 0, or -1 if the store cannot grow to id.
+int locationStoreSet(struct LocationStore *store, long long id,
+                     long long latE7, long long lonE7);
+
+// Returns 1 and sets the coordinates if id has a location, 0 otherwise.
+int locationStoreGet(const struct LocationStore *store, long long id,
+                     long long *latE7, long long *lonE7);
+
+void locationStoreClose(struct LocationStore *store);
+
+#endif
@@ -1,613 +1,592 @@
-#include <assert.h>
+#include "apply_changes.h"
+#include "columnar.h"
+#include "compress_vfs.h"
+#include "id_set.h"
+#include "import.h"
+#include "memory_budget.h"
+#include "metrics.h"
+#include "pragma_profile.h"
+#include "region.h"
+#include "schema.h"
+#include "shard.h"
+#include "shard_import.h"
+#include "split_tables.h"
+#include "tag_filter.h"
+#include "write_behind_vfs.h"
+
+#include <getopt.h>
 #include <readosm.h>
 #include <sqlite3.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-struct InsertNodeContext {
-  sqlite3 *dbHandle;
-  sqlite3_stmt *insertNodeStmt;
-  sqlite3_stmt *insertTagStmt;
-};
-
-struct InsertWayContext {
-  sqlite3 *dbHandle;
-  sqlite3_stmt *insertWayStmt;
-  sqlite3_stmt *insertTagStmt;
-  sqlite3_stmt *insertNodeRefStmt;
-};
-
-struct OsmParseContext {
-  int nodes;
-  int ways;
-  int relation;
-
-  struct InsertNodeContext insertNodeContext;
-  struct InsertWayContext insertWayContext;
-};
-
-static int prepareInsertNodeStatement(struct InsertNodeContext *ctx) {
-  static const char *nodeQuery = "INSERT OR IGNORE INTO nodes "
-                                 "VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8);";
-  int ret;
-  const char *tail;
-  sqlite3 *handle = ctx->dbHandle;
-
-  return sqlite3_prepare_v2(handle, nodeQuery, -1, &ctx->insertNodeStmt, &tail);
-}
-
-static int prepareInsertWayStatement(struct InsertWayContext *ctx) {
-  static const char *nodeQuery = "INSERT OR IGNORE INTO ways "
-                                 "VALUES (?1, ?2, ?3, ?4, ?5);";
-  int ret;
-  const char *tail;
-  sqlite3 *handle = ctx->dbHandle;
-
-  return sqlite3_prepare_v2(handle, nodeQuery, -1, &ctx->insertWayStmt, &tail);
-}
-
-static int prepareInsertNodeTagStatement(struct InsertNodeContext *ctx) {
-  static const char *tagQuery =
-      "INSERT OR IGNORE INTO node_tags(node_id, key, value) "
-      "VALUES (?1, ?2, ?3);";
-  const char *tail;
-  sqlite3 *handle = ctx->dbHandle;
-  return sqlite3_prepare_v2(handle, tagQuery, -1, &ctx->insertTagStmt, &tail);
-}
-
-static int prepareInsertWayTagStatement(struct InsertWayContext *ctx) {
-  static const char *tagQuery =
-      "INSERT OR IGNORE INTO way_tags(way_id, key, value) "
-      "VALUES (?1, ?2, ?3);";
-  const char *tail;
-  sqlite3 *handle = ctx->dbHandle;
-  return sqlite3_prepare_v2(handle, tagQuery, -1, &ctx->insertTagStmt, &tail);
-}
-
-static int
-prepareInsertWayNodeReferenceStatement(struct InsertWayContext *ctx) {
-  static const char *tagQuery =
-      "INSERT OR IGNORE INTO way_nodes(way_id, node_id) "
-      "VALUES (?1, ?2);";
-  const char *tail;
-  sqlite3 *handle = ctx->dbHandle;
-  return sqlite3_prepare_v2(handle, tagQuery, -1, &ctx->insertNodeRefStmt,
-                            &tail);
-}
-
-static int initInsertNodeContext(sqlite3 *db, struct InsertNodeContext *ctx) {
-  ctx->dbHandle = db;
-  ctx->insertNodeStmt = NULL;
-  ctx->insertTagStmt = NULL;
-  int ret;
-  if ((ret = prepareInsertNodeStatement(ctx)) != SQLITE_OK) {
-    fprintf(stderr, "Failed to prepare insert node statement: %d\n", ret);
-    return ret;
-  }
-
-  if ((ret = prepareInsertNodeTagStatement(ctx)) != SQLITE_OK) {
-    fprintf(stderr, "Failed to prepare insert node tag statement: %d\n", ret);
-    return ret;
-  }
-
-  return SQLITE_OK;
-}
-
-static int initInsertWayContext(sqlite3 *db, struct InsertWayContext *ctx) {
-  ctx->dbHandle = db;
-  ctx->insertWayStmt = NULL;
-  ctx->insertTagStmt = NULL;
-  ctx->insertNodeRefStmt = NULL;
-
-  int ret;
-  if ((ret = prepareInsertWayStatement(ctx)) != SQLITE_OK) {
-    fprintf(stderr, "Failed to prepare insert way statement: %d\n", ret);
-    return ret;
-  }
-
-  if ((ret = prepareInsertWayTagStatement(ctx)) != SQLITE_OK) {
-    fprintf(stderr, "Failed to prepare insert way tag statement: %d\n", ret);
-    return ret;
-  }
-
-  if ((ret = prepareInsertWayNodeReferenceStatement(ctx)) != SQLITE_OK) {
-    fprintf(stderr,
-            "Failed to prepare insert way node reference statement: %d\n", ret);
-    return ret;
-  }
-
-  return SQLITE_OK;
-}
-
-static int insertNode(struct InsertNodeContext *ctx, const readosm_node *node);
-static int insertWay(struct InsertWayContext *ctx, const readosm_way *way);
-static int needPrint(int value) { return value != 0 && value % 100000 == 0; }
-
-static void printStats(struct OsmParseContext *stats) {
-  fprintf(stdout, "Nodes=%-10d Ways=%-10d Relation=%-10d\n", stats->nodes,
-          stats->ways, stats->relation);
-}
-
-static void maybePrintStats(struct OsmParseContext *stats) {
-  if (needPrint(stats->nodes) || needPrint(stats->relation) ||
-      needPrint(stats->ways)) {
-    printStats(stats);
-  }
-}
-
-static int on_node(const void *user_data, const readosm_node *node) {
-  struct OsmParseContext *stats = (struct OsmParseContext *)user_data;
-  stats->nodes++;
-  maybePrintStats(stats);
-  int ret = insertNode(&stats->insertNodeContext, node);
-  if (ret != SQLITE_OK) {
-    fprintf(stderr, "Failed to insert node: %d\n", ret);
-    return READOSM_ABORT;
-  }
-
-  return READOSM_OK;
-}
-
-static int on_way(const void *user_data, const readosm_way *way) {
-  struct OsmParseContext *stats = (struct OsmParseContext *)user_data;
-  stats->ways++;
-  maybePrintStats(stats);
-  int ret = insertWay(&stats->insertWayContext, way);
-  if (ret != SQLITE_OK) {
-    fprintf(stderr, "Failed to insert way: %d\n", ret);
-    return READOSM_ABORT;
-  }
-  return READOSM_OK;
-}
-
-static int on_relation(const void *user_data,
-                       const readosm_relation *relation) {
-  ((struct OsmParseContext *)user_data)->relation++;
-  maybePrintStats((struct OsmParseContext *)user_data);
-  return READOSM_OK;
-}
-
-static int bindNode(sqlite3_stmt *stmt, const readosm_node *node) {
-  int ret;
-  if ((ret = sqlite3_bind_int64(stmt, 1, node->id)) != SQLITE_OK) {
-    fprintf(stderr, "bindNode: Failed to bind 1 param to node statement");
-    return ret;
-  }
-
-  if ((ret = sqlite3_bind_double(stmt, 2, node->latitude)) != SQLITE_OK) {
-    fprintf(stderr, "bindNode: Failed to bind 2 param to node statement");
-    return ret;
-  }
-
-  if ((ret = sqlite3_bind_double(stmt, 3, node->longitude)) != SQLITE_OK) {
-    fprintf(stderr, "bindNode: Failed to bind 3 param to node statement");
-    return ret;
-  }
-
-  if ((ret = sqlite3_bind_int64(stmt, 4, node->version)) != SQLITE_OK) {
-    fprintf(stderr, "bindNode: Failed to bind 4 param to node statement");
-    return ret;
-  }
-
-  if ((ret = sqlite3_bind_int64(stmt, 5, node->changeset)) != SQLITE_OK) {
-    fprintf(stderr, "bindNode: Failed to bind 5 param to node statement");
-    return ret;
-  }
-
-  if (node->user) {
-    if ((ret = sqlite3_bind_text(stmt, 6, node->user, strlen(node->user),
-                                 NULL)) != SQLITE_OK) {
-      fprintf(stderr, "bindNode: Failed to bind 6 param to node statement");
-      return ret;
-    }
-  } else {
-    if ((ret = sqlite3_bind_text(stmt, 6, NULL, 0, NULL)) != SQLITE_OK) {
-      fprintf(stderr,
-              "bindNode: Failed to bind 6 (NULL) param to node statement");
-      return ret;
-    }
-  }
-
-  if ((ret = sqlite3_bind_int64(stmt, 7, node->uid)) != SQLITE_OK) {
-    fprintf(stderr, "bindNode: Failed to bind 7 param to node statement");
-    return ret;
-  }
-
-  if (node->timestamp) {
-    if ((ret = sqlite3_bind_text(stmt, 8, node->timestamp,
-                                 strlen(node->timestamp), NULL)) != SQLITE_OK) {
-      fprintf(stderr, "bindNode: Failed to bind 8 param to node statement");
-      return ret;
-    }
-  } else {
-    if ((ret = sqlite3_bind_text(stmt, 8, NULL, 0, NULL)) != SQLITE_OK) {
-      fprintf(stderr,
-              "bindNode: Failed to bind 8 (NULL) param to node statement");
-      return ret;
-    }
-  }
-
-  return ret;
+int sqlite3_spellfix_init(sqlite3 *db, char **pzErrMsg,
+                          const sqlite3_api_routines *pApi);
+int sqlite3_packedids_init(sqlite3 *db, char **pzErrMsg,
+                           const sqlite3_api_routines *pApi);
+int sqlite3_coordinates_init(sqlite3 *db, char **pzErrMsg,
+                             const sqlite3_api_routines *pApi);
+
+static void printUsage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [options] <input.osm|input.osm.pbf> <output.sqlite>\n"
+          "       %s --parse-only [options] <input.osm|input.osm.pbf>\n"
+          "       %s --apply-changes [options] <changes.osc[.gz]> "
+          "<database.sqlite>\n"
+          "\n"
+          "  --pipeline           parse and write on separate threads\n"
+          "  --queue-depth=N      batches buffered between the threads "
+          "(default 64)\n"
+          "  --batch-size=N       elements per batch (default 4096)\n"
+          "  --index-mode=MODE    deferred: build indexes after the load,\n"
+          "                       immediate: maintain them during it\n"
+          "                       (default: deferred for new databases)\n"
+          "  --profile=NAME       connection settings for the load: default\n"
+          "                       or bulk (no journal, no fsync, large\n"
+          "                       cache; switched to WAL afterwards)\n"
+          "  --intern-tags        store tag keys and values as IDs into\n"
+          "                       tag_keys and tag_values (new databases)\n"
+          "  --packed-way-nodes   store way node lists as packed BLOBs in\n"
+          "                       ways.nodes (new databases)\n"
+          "  --compact-nodes      store node coordinates as 1e-7 degree\n"
+          "                       integers in nodes.lat/lon (new databases)\n"
+          "  --no-node-metadata   leave out the node version, changeset,\n"
+          "                       user, uid and timestamp (new databases)\n"
+          "  --spatial-index      index tagged nodes and way bounding boxes\n"
+          "                       in R*Trees (new databases)\n"
+          "  --location-store=PATH keep the node locations used for way\n"
+          "                       extents in PATH and reuse them in later\n"
+          "                       runs (default: a temporary file)\n"
+          "  --commit-every=N     commit every N elements\n"
+          "  --commit-interval=S  commit at least every S seconds\n"
+          "  --resume             skip elements committed by an earlier,\n"
+          "                       interrupted run (see import_progress)\n"
+          "  --pbf-reader=NAME    native (parallel, default) or readosm\n"
+          "  --pbf-threads=N      PBF decoding threads (default: CPUs)\n"
+          "  --parse-only         parse the input without writing a "
+          "database\n"
+          "  --apply-changes      apply an osmChange file to an imported\n"
+          "                       database instead of importing (not\n"
+          "                       with --filter, --bbox, --poly, --shards\n"
+          "                       or --split-tables)\n"
+          "  --shards=N           write N databases <output>.shard0 ... in\n"
+          "                       parallel, with a manifest in <output>\n"
+          "                       and an attach script in <output>.sql\n"
+          "                       (at most %d; not with --spatial-index\n"
+          "                       or --resume)\n"
+          "  --shard-by=SCHEME    tile (default): by node location,\n"
+          "                       id: by blocks of node IDs\n"
+          "  --split-tables       load nodes, ways and relations into\n"
+          "                       temporary databases on separate threads\n"
+          "                       and merge them into a new output\n"
+          "  --filter=EXPR        import only elements whose tags match,\n"
+          "                       e.g. 'highway=* | amenity=restaurant |\n"
+          "                       name~^A'; also !=, !~ and & (binds\n"
+          "                       tighter than |)\n"
+          "  --keep-referenced-nodes\n"
+          "                       also import the nodes of matching ways,\n"
+          "                       found by a first pass over the input\n"
+          "  --bbox=MINLON,MINLAT,MAXLON,MAXLAT\n"
+          "                       import only the nodes in the box and the\n"
+          "                       ways and relations referencing them\n"
+          "                       (not with --resume)\n"
+          "  --poly=FILE          the same for an Osmosis .poly polygon\n"
+          "  --memory-budget=SIZE bound the import's memory to SIZE bytes\n"
+          "                       (K, M or G suffix): buffers shrink and\n"
+          "                       spill to temporary files, SQLite gets\n"
+          "                       half for its caches and sorters\n"
+          "  --compress[=LEVEL]   store the pages of new databases zlib-\n"
+          "                       compressed at LEVEL 1-9 (default 6);\n"
+          "                       other clients read them with the\n"
+          "                       compress_vfs extension\n"
+          "  --write-behind[=SIZE] buffer up to SIZE bytes of writes\n"
+          "                       (default 64M) and issue them, sorted and\n"
+          "                       coalesced, from a background thread\n"
+          "  --columnar=DIR       also write the imported elements to\n"
+          "                       column files in DIR, read with\n"
+          "                       columnar_reader.h\n"
+          "  --metrics=PATH       append import metrics as JSON lines to\n"
+          "                       PATH, - for stdout\n"
+          "  --metrics-interval=S seconds between progress metrics "
+          "(default 10)\n",
+          program, program, program, SQLITE_MAX_SHARDS);
 }
 
-static int bindTag(sqlite3_stmt *stmt, long long parent_id,
-                   const readosm_tag *tag) {
-  int ret;
-  if ((ret = sqlite3_bind_int64(stmt, 1, parent_id)) != SQLITE_OK) {
-    fprintf(stderr, "bindTag: Failed to bind 1 param in tag statement");
-    return ret;
+static int parsePositive(const char *value, const char *name, int *out) {
+  char *end;
+  long parsed = strtol(value, &end, 10);
+  if (*value == '\0' || *end != '\0' || parsed <= 0 || parsed > 1 << 24) {
+    fprintf(stderr, "Invalid value for --%s: %s\n", name, value);
+    return -1;
   }
-
-  if ((ret = sqlite3_bind_text(stmt, 2, tag->key, strlen(tag->key), NULL)) !=
-      SQLITE_OK) {
-    fprintf(stderr, "bindTag: Failed to bind 2 param in tag statement");
-    return ret;
-  }
-
-  if ((ret = sqlite3_bind_text(stmt, 3, tag->value, strlen(tag->value),
-                               NULL)) != SQLITE_OK) {
-    fprintf(stderr, "bindTag: Failed to bind 3 param in tag statement");
-    return ret;
-  }
-
-  return SQLITE_OK;
+  *out = (int)parsed;
+  return 0;
 }
 
-static int step(sqlite3_stmt *stmt) {
-  int ret;
-  if ((ret = sqlite3_step(stmt)) != SQLITE_DONE) {
-    fprintf(stderr, "step: Failed to step node statement");
-    return ret;
-  }
-
-  if ((ret = sqlite3_clear_bindings(stmt)) != SQLITE_OK) {
-    fprintf(stderr, "step: Failed to clear bindings in node statement");
-    return ret;
-  }
-
-  if ((ret = sqlite3_reset(stmt)) != SQLITE_OK) {
-    fprintf(stderr, "step: Failed to reset node statement");
-    return ret;
-  }
-
-  return SQLITE_OK;
+// A byte count with an optional K, M or G suffix.
+static int parseSize(const char *value, const char *name, long long *out) {
+  char *end;
+  long long parsed = strtoll(value, &end, 10);
+  int shift = 0;
+  switch (*end) {
+  case 'K':
+  case 'k':
+    shift = 10;
+    break;
+  case 'M':
+  case 'm':
+    shift = 20;
+    break;
+  case 'G':
+  case 'g':
+    shift = 30;
+    break;
+  }
+  if (shift != 0) {
+    ++end;
+  }
+  if (end == value || *end != '\0' || parsed <= 0 ||
+      parsed > (1LL << 50) >> shift) {
+    fprintf(stderr, "Invalid value for --%s: %s\n", name, value);
+    return -1;
+  }
+  *out = parsed << shift;
+  return 0;
 }
 
-static int insertNode(struct InsertNodeContext *ctx, const readosm_node *node) {
-
-  int ret;
-  const char *tail;
-  char *errMsg;
-  sqlite3 *handle = ctx->dbHandle;
-
-  if ((ret = bindNode(ctx->insertNodeStmt, node)) != SQLITE_OK) {
-    errMsg = "Failed to bind node";
-    goto Fail;
-  }
-
-  if ((ret = step(ctx->insertNodeStmt)) != SQLITE_OK) {
-    errMsg = "Failed to step node statement";
-    goto Fail;
-  }
+static int parseOptions(int argc, char **argv, struct ImportOptions *options) {
+  enum { OPT_PIPELINE = 256, OPT_QUEUE_DEPTH, OPT_BATCH_SIZE, OPT_INDEX_MODE,
+         OPT_PROFILE, OPT_COMMIT_EVERY, OPT_COMMIT_INTERVAL, OPT_RESUME,
+         OPT_PBF_READER, OPT_PBF_THREADS, OPT_INTERN_TAGS,
+         OPT_PACKED_WAY_NODES, OPT_COMPACT_NODES, OPT_NO_NODE_METADATA,
+         OPT_SPATIAL_INDEX, OPT_LOCATION_STORE,
+         OPT_METRICS, OPT_METRICS_INTERVAL, OPT_PARSE_ONLY,
+         OPT_APPLY_CHANGES, OPT_SHARDS, OPT_SHARD_BY,
+         OPT_SPLIT_TABLES, OPT_FILTER, OPT_KEEP_REFERENCED_NODES,
+         OPT_BBOX, OPT_POLY, OPT_MEMORY_BUDGET, OPT_COMPRESS,
+         OPT_WRITE_BEHIND, OPT_COLUMNAR };
+  static const struct option longOptions[] = {
+      {"pipeline", no_argument, NULL, OPT_PIPELINE},
+      {"queue-depth", required_argument, NULL, OPT_QUEUE_DEPTH},
+      {"batch-size", required_argument, NULL, OPT_BATCH_SIZE},
+      {"index-mode", required_argument, NULL, OPT_INDEX_MODE},
+      {"profile", required_argument, NULL, OPT_PROFILE},
+      {"commit-every", required_argument, NULL, OPT_COMMIT_EVERY},
+      {"commit-interval", required_argument, NULL, OPT_COMMIT_INTERVAL},
+      {"resume", no_argument, NULL, OPT_RESUME},
+      {"pbf-reader", required_argument, NULL, OPT_PBF_READER},
+      {"pbf-threads", required_argument, NULL, OPT_PBF_THREADS},
+      {"intern-tags", no_argument, NULL, OPT_INTERN_TAGS},
+      {"packed-way-nodes", no_argument, NULL, OPT_PACKED_WAY_NODES},
+      {"compact-nodes", no_argument, NULL, OPT_COMPACT_NODES},
+      {"no-node-metadata", no_argument, NULL, OPT_NO_NODE_METADATA},
+      {"spatial-index", no_argument, NULL, OPT_SPATIAL_INDEX},
+      {"location-store", required_argument, NULL, OPT_LOCATION_STORE},
+      {"metrics", required_argument, NULL, OPT_METRICS},
+      {"metrics-interval", required_argument, NULL, OPT_METRICS_INTERVAL},
+      {"parse-only", no_argument, NULL, OPT_PARSE_ONLY},
+      {"apply-changes", no_argument, NULL, OPT_APPLY_CHANGES},
+      {"shards", required_argument, NULL, OPT_SHARDS},
+      {"shard-by", required_argument, NULL, OPT_SHARD_BY},
+      {"split-tables", no_argument, NULL, OPT_SPLIT_TABLES},
+      {"filter", required_argument, NULL, OPT_FILTER},
+      {"keep-referenced-nodes", no_argument, NULL,
+       OPT_KEEP_REFERENCED_NODES},
+      {"bbox", required_argument, NULL, OPT_BBOX},
+      {"poly", required_argument, NULL, OPT_POLY},
+      {"memory-budget", required_argument, NULL, OPT_MEMORY_BUDGET},
+      {"compress", optional_argument, NULL, OPT_COMPRESS},
+      {"write-behind", optional_argument, NULL, OPT_WRITE_BEHIND},
+      {"columnar", required_argument, NULL, OPT_COLUMNAR},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0},
+  };
 
-  if (node->tag_count != 0) {
-    for (int i = 0; i < node->tag_count; ++i) {
-      if ((ret = bindTag(ctx->insertTagStmt, node->id, &node->tags[i])) !=
-          SQLITE_OK) {
-        errMsg = "insert_node: Failed to bind tag";
-        goto Fail;
+  memset(options, 0, sizeof(*options));
+  options->pipelineOptions.queueDepth = 64;
+  options->pipelineOptions.batchSize = 4096;
+  options->profile = pragmaProfileFind("default");
+  options->pbfThreads = onlineCpus();
+  options->metricsInterval = 10;
+  options->shardScheme = SHARD_BY_TILE;
+
+  int opt;
+  while ((opt = getopt_long(argc, argv, "h", longOptions, NULL)) != -1) {
+    switch (opt) {
+    case OPT_PIPELINE:
+      options->pipeline = 1;
+      break;
+    case OPT_QUEUE_DEPTH:
+      if (parsePositive(optarg, "queue-depth",
+                        &options->pipelineOptions.queueDepth) != 0) {
+        return -1;
       }
-
-      if ((ret = step(ctx->insertTagStmt)) != SQLITE_OK) {
-        errMsg = "Failed to step node tag statement";
-        goto Fail;
+      break;
+    case OPT_BATCH_SIZE:
+      if (parsePositive(optarg, "batch-size",
+                        &options->pipelineOptions.batchSize) != 0) {
+        return -1;
       }
+      break;
+    case OPT_INDEX_MODE:
+      if (strcmp(optarg, "deferred") == 0) {
+        options->indexMode = INDEX_MODE_DEFERRED;
+      } else if (strcmp(optarg, "immediate") == 0) {
+        options->indexMode = INDEX_MODE_IMMEDIATE;
+      } else {
+        fprintf(stderr, "Invalid value for --index-mode: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_PROFILE:
+      if ((options->profile = pragmaProfileFind(optarg)) == NULL) {
+        fprintf(stderr, "Unknown profile: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_COMMIT_EVERY: {
+      int every;
+      if (parsePositive(optarg, "commit-every", &every) != 0) {
+        return -1;
+      }
+      options->commitEvery = every;
+      break;
     }
-  }
-
-  return SQLITE_OK;
-
-Fail:
-  fprintf(stderr, "%s\n", errMsg);
-  fprintf(stderr, "%s\n", sqlite3_errmsg(handle));
-  sqlite3_exec(handle, "END TRANSACTION", NULL, NULL, &errMsg);
-  return ret;
-}
-
-static int bindWay(sqlite3_stmt *stmt, const readosm_way *way) {
-  int ret;
-
-  if ((ret = sqlite3_bind_int64(stmt, 1, way->id)) != SQLITE_OK) {
-    fprintf(stderr, "bindWay: Failed to bind 1 param to node statement");
-    return ret;
-  }
-
-  if ((ret = sqlite3_bind_int64(stmt, 2, way->changeset)) != SQLITE_OK) {
-    fprintf(stderr, "bindWay: Failed to bind 2 param to node statement");
-    return ret;
-  }
-
-  if (way->user) {
-    if ((ret = sqlite3_bind_text(stmt, 3, way->user, strlen(way->user),
-                                 NULL)) != SQLITE_OK) {
-      fprintf(stderr, "bindWay: Failed to bind 3 param to node statement");
-      return ret;
-    }
-  } else {
-    if ((ret = sqlite3_bind_text(stmt, 3, NULL, 0, NULL)) != SQLITE_OK) {
-      fprintf(stderr,
-              "bindWay: Failed to bind 3 (NULL) param to node statement");
-      return ret;
+    case OPT_COMMIT_INTERVAL: {
+      int seconds;
+      if (parsePositive(optarg, "commit-interval", &seconds) != 0) {
+        return -1;
+      }
+      options->commitInterval = seconds;
+      break;
     }
-  }
-
-  if ((ret = sqlite3_bind_int64(stmt, 4, way->uid)) != SQLITE_OK) {
-    fprintf(stderr, "bindWay: Failed to bind 4 param to node statement");
-    return ret;
-  }
-
-  if (way->timestamp) {
-    if ((ret = sqlite3_bind_text(stmt, 5, way->timestamp,
-                                 strlen(way->timestamp), NULL)) != SQLITE_OK) {
-      fprintf(stderr, "bindWay: Failed to bind 5 param to node statement");
-      return ret;
+    case OPT_RESUME:
+      options->resume = 1;
+      break;
+    case OPT_PBF_READER:
+      if (strcmp(optarg, "native") == 0) {
+        options->pbfReader = PBF_READER_NATIVE;
+      } else if (strcmp(optarg, "readosm") == 0) {
+        options->pbfReader = PBF_READER_READOSM;
+      } else {
+        fprintf(stderr, "Invalid value for --pbf-reader: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_PBF_THREADS:
+      if (parsePositive(optarg, "pbf-threads", &options->pbfThreads) != 0) {
+        return -1;
+      }
+      break;
+    case OPT_INTERN_TAGS:
+      options->layout |= LAYOUT_INTERNED_TAGS;
+      break;
+    case OPT_PACKED_WAY_NODES:
+      options->layout |= LAYOUT_PACKED_WAY_NODES;
+      break;
+    case OPT_COMPACT_NODES:
+      options->layout |= LAYOUT_COMPACT_NODES;
+      break;
+    case OPT_NO_NODE_METADATA:
+      options->layout |= LAYOUT_NO_NODE_METADATA;
+      break;
+    case OPT_SPATIAL_INDEX:
+      options->layout |= LAYOUT_SPATIAL_INDEX;
+      break;
+    case OPT_LOCATION_STORE:
+      options->locationStorePath = optarg;
+      break;
+    case OPT_METRICS:
+      options->metricsPath = optarg;
+      break;
+    case OPT_PARSE_ONLY:
+      options->parseOnly = 1;
+      break;
+    case OPT_APPLY_CHANGES:
+      options->applyChanges = 1;
+      break;
+    case OPT_SHARDS:
+      if (parsePositive(optarg, "shards", &options->shards) != 0) {
+        return -1;
+      }
+      if (options->shards > SQLITE_MAX_SHARDS) {
+        fprintf(stderr, "At most %d shards can be attached together\n",
+                SQLITE_MAX_SHARDS);
+        return -1;
+      }
+      break;
+    case OPT_SHARD_BY:
+      if (strcmp(optarg, "tile") == 0) {
+        options->shardScheme = SHARD_BY_TILE;
+      } else if (strcmp(optarg, "id") == 0) {
+        options->shardScheme = SHARD_BY_ID;
+      } else {
+        fprintf(stderr, "Invalid value for --shard-by: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_SPLIT_TABLES:
+      options->splitTables = 1;
+      break;
+    case OPT_FILTER:
+      if (options->filter != NULL) {
+        fprintf(stderr, "--filter given more than once\n");
+        return -1;
+      }
+      if ((options->filter = malloc(sizeof(struct TagFilter))) == NULL ||
+          tagFilterCompile(options->filter, optarg) != 0) {
+        free(options->filter);
+        options->filter = NULL;
+        return -1;
+      }
+      break;
+    case OPT_KEEP_REFERENCED_NODES:
+      options->keepReferencedNodes = 1;
+      break;
+    case OPT_BBOX:
+    case OPT_POLY:
+      if (options->region != NULL) {
+        fprintf(stderr, "Only one of --bbox and --poly can be given\n");
+        return -1;
+      }
+      if ((options->region = malloc(sizeof(struct Region))) == NULL) {
+        return -1;
+      }
+      if ((opt == OPT_BBOX ? regionInitBox(options->region, optarg)
+                           : regionLoadPoly(options->region, optarg)) != 0) {
+        regionFree(options->region);
+        free(options->region);
+        options->region = NULL;
+        return -1;
+      }
+      break;
+    case OPT_MEMORY_BUDGET:
+      if (parseSize(optarg, "memory-budget", &options->memoryBudget) != 0) {
+        return -1;
+      }
+      break;
+    case OPT_COMPRESS:
+      options->compressLevel = 6;
+      if (optarg != NULL &&
+          parsePositive(optarg, "compress", &options->compressLevel) != 0) {
+        return -1;
+      }
+      if (options->compressLevel > 9) {
+        fprintf(stderr, "Invalid value for --compress: %s\n", optarg);
+        return -1;
+      }
+      break;
+    case OPT_WRITE_BEHIND:
+      options->writeBehind = 64LL << 20;
+      if (optarg != NULL &&
+          parseSize(optarg, "write-behind", &options->writeBehind) != 0) {
+        return -1;
+      }
+      break;
+    case OPT_COLUMNAR:
+      options->columnarPath = optarg;
+      break;
+    case OPT_METRICS_INTERVAL: {
+      int seconds;
+      if (parsePositive(optarg, "metrics-interval", &seconds) != 0) {
+        return -1;
+      }
+      options->metricsInterval = seconds;
+      break;
     }
-  } else {
-    if ((ret = sqlite3_bind_text(stmt, 5, NULL, 0, NULL)) != SQLITE_OK) {
-      fprintf(stderr,
-              "bindWay: Failed to bind 5 (NULL) param to node statement");
-      return ret;
+    default:
+      return -1;
     }
   }
 
-  return ret;
+  if (argc - optind != (options->parseOnly ? 1 : 2)) {
+    return -1;
+  }
+
+  // Way extents and resume positions would need the other shards' nodes
+  // and progress.
+  if (options->shards > 0 &&
+      ((options->layout & LAYOUT_SPATIAL_INDEX) || options->resume)) {
+    fprintf(stderr, "--shards cannot be combined with --spatial-index or "
+                    "--resume\n");
+    return -1;
+  }
+  if (options->keepReferencedNodes && options->filter == NULL) {
+    fprintf(stderr, "--keep-referenced-nodes needs --filter\n");
+    return -1;
+  }
+  // The region learns which ways and relations to keep from the nodes and
+  // ways it sees; a resumed run skips those already committed.
+  if (options->region != NULL && options->resume) {
+    fprintf(stderr, "--bbox and --poly cannot be combined with --resume\n");
+    return -1;
+  }
+  if (options->splitTables && (options->shards > 0 || options->resume)) {
+    fprintf(stderr, "--split-tables cannot be combined with --shards or "
+                    "--resume\n");
+    return -1;
+  }
+  // The changes replace elements by ID in the database at hand; there is
+  // no input to filter, clip or spread over databases.
+  if (options->applyChanges &&
+      (options->filter != NULL || options->keepReferencedNodes ||
+       options->region != NULL || options->shards > 0 ||
+       options->splitTables)) {
+    fprintf(stderr, "--apply-changes cannot be combined with --filter, "
+                    "--keep-referenced-nodes, --bbox, --poly, --shards or "
+                    "--split-tables\n");
+    return -1;
+  }
+  // The export is written in one pass over the elements the run imports.
+  if (options->columnarPath != NULL &&
+      (options->resume || options->parseOnly || options->applyChanges)) {
+    fprintf(stderr, "--columnar cannot be combined with --resume, "
+                    "--parse-only or --apply-changes\n");
+    return -1;
+  }
+
+  options->inputPath = argv[optind];
+  options->outputPath = options->parseOnly ? NULL : argv[optind + 1];
+  return 0;
 }
 
-static int bindNodeRef(sqlite3_stmt *stmt, long long parent, long long node) {
-  int ret;
-
-  if ((ret = sqlite3_bind_int64(stmt, 1, parent)) != SQLITE_OK) {
-    fprintf(stderr, "bindNodeRef: Failed to bind 1 param to node statement");
-    return ret;
-  }
-
-  if ((ret = sqlite3_bind_int64(stmt, 2, node)) != SQLITE_OK) {
-    fprintf(stderr, "bindNodeRef: Failed to bind 2 param to node statement");
-    return ret;
+// Starts the --memory-budget accounting and bounds the load profile to
+// SQLite's share, divided over the connections writing at the same time,
+// and --write-behind to a part of the rest.
+static void applyMemoryBudget(struct ImportOptions *options) {
+  memoryBudgetInit(options->memoryBudget);
+  if (options->memoryBudget == 0) {
+    return;
+  }
+
+  int connections = options->shards > 0   ? options->shards
+                    : options->splitTables ? TABLE_PART_COUNT + 1
+                                           : 1;
+  long long share = memoryBudgetSqliteShare() / connections;
+  struct PragmaProfile *bounded = &options->budgetProfile;
+  *bounded = *options->profile;
+  // SQLite's default cache is 2000 KiB.
+  long long cacheKiB = bounded->cacheSizeKiB != 0 ? bounded->cacheSizeKiB
+                                                  : 2000;
+  if (cacheKiB > share >> 10) {
+    bounded->cacheSizeKiB = share >> 10 > 0 ? share >> 10 : 1;
+  }
+  if (bounded->mmapSize > share) {
+    bounded->mmapSize = share;
+  }
+  bounded->tempStore = "FILE";
+  options->profile = bounded;
+
+  // A quarter of the buffers' half for the write-behind buffer.
+  long long writeBehind =
+      (memoryBudgetLimit() - memoryBudgetSqliteShare()) / 4;
+  if (options->writeBehind > writeBehind) {
+    options->writeBehind = writeBehind > 0 ? writeBehind : 1;
   }
-
-  return ret;
 }
 
-static int insertWay(struct InsertWayContext *ctx, const readosm_way *way) {
-  int ret;
-  const char *tail;
-  char *errMsg;
-  sqlite3 *handle = ctx->dbHandle;
-
-  if ((ret = bindWay(ctx->insertWayStmt, way)) != SQLITE_OK) {
-    errMsg = "insertWay: Failed to bind way";
-    goto Fail;
-  }
-
-  if ((ret = step(ctx->insertWayStmt)) != SQLITE_OK) {
-    errMsg = "Failed to step insert way statement";
-    goto Fail;
-  }
-
-  for (int i = 0; i < way->tag_count; ++i) {
-    if ((ret = bindTag(ctx->insertTagStmt, way->id, &way->tags[i])) !=
-        SQLITE_OK) {
-      errMsg = "Failed to bind way tag";
-      goto Fail;
-    }
-
-    if ((ret = step(ctx->insertTagStmt)) != SQLITE_OK) {
-      errMsg = "Failed to step node way tag statement";
-      goto Fail;
-    }
-  }
-
-  for (int i = 0; i < way->node_ref_count; ++i) {
-    if ((ret = bindNodeRef(ctx->insertNodeRefStmt, way->id,
-                           way->node_refs[i])) != SQLITE_OK) {
-      errMsg = "Failed to bind way node ref";
-      goto Fail;
-    }
-
-    if ((ret = step(ctx->insertNodeRefStmt)) != SQLITE_OK) {
-      errMsg = "Failed to step way node ref statement";
-      goto Fail;
-    }
+// Frees what parseOptions allocated, and the columnar export if a run
+// left it open.
+static void freeOptions(struct ImportOptions *options) {
+  if (options->filter != NULL) {
+    tagFilterFree(options->filter);
+    free(options->filter);
   }
-
-  return SQLITE_OK;
-
-Fail:
-  fprintf(stderr, "%s\n", errMsg);
-  fprintf(stderr, "%s\n", sqlite3_errmsg(handle));
-  sqlite3_exec(handle, "END TRANSACTION", NULL, NULL, &errMsg);
-  return ret;
-}
-
-static int createTables(sqlite3 *handle) {
-
-  const char *tableQueries[] = {
-      "CREATE TABLE IF NOT EXISTS nodes ("
-      "        id        INTEGER PRIMARY KEY,"
-      "        latitude  REAL,"
-      "        longitude REAL,"
-      "        version   INTEGER,"
-      "        changeset INTEGER,"
-      "        user      TEXT,"
-      "        uid       INTEGER,"
-      "        timestamp TEXT"
-      ");",
-      "CREATE INDEX IF NOT EXISTS index_node_id ON nodes(id);",
-      "CREATE TABLE IF NOT EXISTS node_tags ("
-      "       node_id  INTEGER,"
-      "       key      TEXT,"
-      "       value    TEXT,"
-      "       FOREIGN KEY (node_id) REFERENCES nodes(id)"
-      ");",
-      "CREATE INDEX IF NOT EXISTS index_node_tags_id ON node_tags(node_id);",
-      "CREATE INDEX IF NOT EXISTS index_node_tags_key ON node_tags(key);",
-      "CREATE TABLE IF NOT EXISTS ways ("
-      "       id        INTEGER PRIMARY KEY,"
-      "       changeset INTEGER,"
-      "       user      TEXT,"
-      "       uid       INTEGER,"
-      "       timestamp TEXT"
-      ");",
-      "CREATE INDEX IF NOT EXISTS index_way_id ON ways(id);",
-      "CREATE TABLE IF NOT EXISTS way_tags ("
-      "       way_id    INTEGER,"
-      "       key       TEXT,"
-      "       value     TEXT,"
-      "       FOREIGN KEY (way_id) REFERENCES ways(id)"
-      ");",
-      "CREATE INDEX IF NOT EXISTS index_way_tags_id ON way_tags(way_id);",
-      "CREATE INDEX IF NOT EXISTS index_way_tags_key ON way_tags(key);",
-      "CREATE TABLE IF NOT EXISTS way_nodes ("
-      "       way_id    INTEGER,"
-      "       node_id   INTEGER,"
-      "       FOREIGN KEY (node_id) REFERENCES nodes(id),"
-      "       FOREIGN KEY (way_id) REFERENCES ways(id)"
-      ");",
-      "CREATE INDEX IF NOT EXISTS index_way_nodes_way_id ON way_nodes(way_id);",
-      "CREATE INDEX IF NOT EXISTS index_way_nodes_node_id ON "
-      "way_nodes(node_id);",
-      "CREATE TABLE IF NOT EXISTS node_names ("
-      "       node_id   INTEGER,"
-      "       name      TEXT,"
-      "       FOREIGN KEY (node_id) REFERENCES nodes(id)"
-      ");",
-
-      "CREATE VIRTUAL TABLE named_nodes_fts5 USING fts5(id, name);",
-      "CREATE VIRTUAL TABLE named_nodes_spellfix USING spellfix1;",
-      "CREATE TRIGGER IF NOT EXISTS node_names AFTER INSERT ON node_tags "
-      "WHEN new.key LIKE 'name%'"
-      "BEGIN"
-      "   INSERT INTO"
-      "       node_names(node_id, name)"
-      "   VALUES"
-      "       (new.node_id, new.value);"
-      ""
-      "   INSERT INTO"
-      "       named_nodes_fts5(id, name)"
-      "   VALUES"
-      "       (new.node_id, new.value);"
-      "END;",
-
-  };
-
-  char *errMsg = NULL;
-  int ret;
-
-  for (int i = 0; i < sizeof(tableQueries) / sizeof(const char *); ++i) {
-    const char *tableQuery = tableQueries[i];
-    ret = sqlite3_exec(handle, tableQuery, NULL, NULL, &errMsg);
-    if (ret != SQLITE_OK) {
-      fprintf(stderr, "sqlite3_exec error: %s, running query\"%s\"", errMsg,
-              tableQuery);
-      sqlite3_free(errMsg);
-      return ret;
-    }
+  if (options->region != NULL) {
+    regionFree(options->region);
+    free(options->region);
   }
-
-  return SQLITE_OK;
+  columnarExportFree(options->columnar);
 }
 
-int sqlite3_spellfix_init(sqlite3 *db, char **pzErrMsg,
-                          const sqlite3_api_routines *pApi);
-
 int main(int argc, char **argv) {
-  assert(argc == 3);
-
+  struct ImportOptions options;
+  struct IdSet referencedNodes;
+  idSetInit(&referencedNodes);
   int ret = 0;
   const char *errMsg;
-  sqlite3 *dbHandle = NULL;
-  const void *osmHandle = NULL;
 
-  if ((ret = sqlite3_auto_extension((void (*)(void)) &
-                                    sqlite3_spellfix_init)) != SQLITE_OK) {
+  if (parseOptions(argc, argv, &options) != 0) {
+    printUsage(argv[0]);
+    ret = 2;
+    goto Done;
+  }
+  applyMemoryBudget(&options);
+
+  // Before anything is opened: every connection, including the ones of
+  // sharded and split imports, picks up the default VFS. Without --compress
+  // it only recognizes compressed databases, for --resume and
+  // --apply-changes. Registered last, it compresses the pages before they
+  // are buffered for writing.
+  if ((options.writeBehind != 0 &&
+       (ret = writeBehindVfsRegister(options.writeBehind, 1)) !=
+           SQLITE_OK) ||
+      (ret = compressVfsRegister(options.compressLevel, 256, 1)) !=
+          SQLITE_OK) {
     errMsg = sqlite3_errstr(ret);
     goto Fail;
   }
 
-  if ((ret = sqlite3_open(argv[2], &dbHandle)) != SQLITE_OK) {
-    errMsg = sqlite3_errmsg(dbHandle);
-    goto Fail;
-  }
-
-  if ((ret = createTables(dbHandle)) != SQLITE_OK) {
-    errMsg = sqlite3_errmsg(dbHandle);
-    goto Fail;
-  }
-
-  if ((ret = readosm_open(argv[1], &osmHandle)) != READOSM_OK) {
-    errMsg = "Fail to open OSM";
-    goto Fail;
-  }
-
-  struct OsmParseContext stats;
-  memset(&stats, 0, sizeof(stats));
-  stats.insertNodeContext.dbHandle = dbHandle;
-
-  if ((ret = initInsertNodeContext(dbHandle, &stats.insertNodeContext)) !=
-      SQLITE_OK) {
-    errMsg = sqlite3_errmsg(dbHandle);
-    goto Fail;
-  }
-
-  if ((ret = initInsertWayContext(dbHandle, &stats.insertWayContext)) !=
-      SQLITE_OK) {
-    errMsg = sqlite3_errmsg(dbHandle);
+  if ((ret = sqlite3_auto_extension((void (*)(void)) &
+                                    sqlite3_spellfix_init)) != SQLITE_OK ||
+      (ret = sqlite3_auto_extension((void (*)(void)) &
+                                    sqlite3_packedids_init)) != SQLITE_OK ||
+      (ret = sqlite3_auto_extension((void (*)(void)) &
+                                    sqlite3_coordinates_init)) != SQLITE_OK) {
+    errMsg = sqlite3_errstr(ret);
     goto Fail;
   }
 
-  if ((ret = sqlite3_exec(dbHandle, "BEGIN TRANSACTION", NULL, NULL, NULL)) !=
-      SQLITE_OK) {
-    errMsg = sqlite3_errmsg(dbHandle);
+  if (options.metricsPath != NULL &&
+      metricsOpen(options.metricsPath, options.metricsInterval,
+                  options.inputPath) != 0) {
+    ret = 1;
+    errMsg = "Failed to open the metrics output";
     goto Fail;
   }
 
-  if ((ret = readosm_parse(osmHandle, &stats, on_node, on_way, on_relation)) !=
-      READOSM_OK) {
-    errMsg = "Fail to parse OSM";
-    goto Fail;
+  if (options.parseOnly) {
+    ret = runParseOnly(&options);
+    goto Done;
   }
 
-  if ((ret = sqlite3_exec(dbHandle, "END TRANSACTION", NULL, NULL, NULL)) !=
-      SQLITE_OK) {
-    errMsg = sqlite3_errmsg(dbHandle);
-    goto Fail;
+  if (options.applyChanges) {
+    ret = runApplyChanges(&options);
+    goto Done;
   }
 
-  if (stats.insertNodeContext.insertTagStmt != NULL) {
-    ret = sqlite3_finalize(stats.insertNodeContext.insertTagStmt);
-    if (ret != SQLITE_OK) {
-      errMsg = "Failed to finalize tag statement";
+  if (options.keepReferencedNodes) {
+    if ((ret = collectReferencedNodes(&options, &referencedNodes)) !=
+        READOSM_OK) {
+      errMsg = "Fail to parse OSM";
       goto Fail;
     }
+    options.referencedNodes = &referencedNodes;
   }
 
-  if (stats.insertNodeContext.insertNodeStmt != NULL) {
-    ret = sqlite3_finalize(stats.insertNodeContext.insertNodeStmt);
-    if (ret != SQLITE_OK) {
-      errMsg = "insert_node: Failed to finalize node statement";
-      goto Fail;
-    }
+  if (options.columnarPath != NULL &&
+      (options.columnar = columnarExportOpen(options.columnarPath)) == NULL) {
+    ret = 1;
+    errMsg = "Failed to open the columnar export";
+    goto Fail;
   }
 
-  sqlite3_close(dbHandle);
-  readosm_close(osmHandle);
-  printStats(&stats);
-  return 0;
+  if (options.shards > 0) {
+    ret = runSharded(&options);
+  } else if (options.splitTables) {
+    ret = runSplitTables(&options);
+  } else {
+    ret = runImport(&options);
+  }
+  goto Done;
 
 Fail:
   fprintf(stderr, "%s\n", errMsg);
-  sqlite3_close(dbHandle);
-  readosm_close(osmHandle);
+  struct MetricsProgress failedProgress = {0, 0, 0, -1};
+  metricsFinish(NULL, &failedProgress, "failed");
+Done:
+  freeOptions(&options);
+  idSetFree(&referencedNodes);
   return ret;
-}
\ No newline at end of file
+}
@@ -0,0 +1,83 @@
+#include "memory_budget.h"
+
+#include <sqlite3.h>
+#include <stdatomic.h>
+
+static const char *consumerNames[MEMORY_CONSUMER_COUNT] = {
+    "pipeline", "pbf",          "dictionaries", "names",
+    "id_sets",  "write_behind", "columnar"};
+
+static struct {
+  long long limit;
+  atomic_llong used[MEMORY_CONSUMER_COUNT];
+  atomic_llong total;
+  atomic_llong peak;
+} budget;
+
+void memoryBudgetInit(long long bytes) {
+  budget.limit = bytes > 0 ? bytes : 0;
+  if (budget.limit != 0) {
+    // The soft limit makes SQLite recycle cache pages rather than allocate
+    // new ones once it is reached.
+    sqlite3_soft_heap_limit64(memoryBudgetSqliteShare());
+  }
+}
+
+long long memoryBudgetLimit(void) { return budget.limit; }
+
+long long memoryBudgetSqliteShare(void) { return budget.limit / 2; }
+
+static void updatePeak(long long total) {
+  long long peak = atomic_load_explicit(&budget.peak, memory_order_relaxed);
+  while (total > peak &&
+         !atomic_compare_exchange_weak_explicit(&budget.peak, &peak, total,
+                                                memory_order_relaxed,
+                                                memory_order_relaxed)) {
+  }
+}
+
+int memoryBudgetReserve(enum MemoryConsumer consumer, long long bytes) {
+  long long total = atomic_load_explicit(&budget.total, memory_order_relaxed);
+  do {
+    if (budget.limit != 0 &&
+        total + bytes > budget.limit - memoryBudgetSqliteShare()) {
+      return 0;
+    }
+  } while (!atomic_compare_exchange_weak_explicit(
+      &budget.total, &total, total + bytes, memory_order_relaxed,
+      memory_order_relaxed));
+  atomic_fetch_add_explicit(&budget.used[consumer], bytes,
+                            memory_order_relaxed);
+  updatePeak(total + bytes);
+  return 1;
+}
+
+void memoryBudgetCharge(enum MemoryConsumer consumer, long long bytes) {
+  long long total =
+      atomic_fetch_add_explicit(&budget.total, bytes, memory_order_relaxed);
+  atomic_fetch_add_explicit(&budget.used[consumer], bytes,
+                            memory_order_relaxed);
+  updatePeak(total + bytes);
+}
+
+void memoryBudgetRelease(enum MemoryConsumer consumer, long long bytes) {
+  atomic_fetch_sub_explicit(&budget.total, bytes, memory_order_relaxed);
+  atomic_fetch_sub_explicit(&budget.used[consumer], bytes,
+                            memory_order_relaxed);
+}
+
+long long memoryBudgetUsed(enum MemoryConsumer consumer) {
+  return atomic_load_explicit(&budget.used[consumer], memory_order_relaxed);
+}
+
+long long memoryBudgetTotal(void) {
+  return atomic_load_explicit(&budget.total, memory_order_relaxed);
+}
+
+long long memoryBudgetPeak(void) {
+  return atomic_load_explicit(&budget.peak, memory_order_relaxed);
+}
+
+const char *memoryBudgetConsumerName(enum MemoryConsumer consumer) {
+  return consumerNames[consumer];
+}
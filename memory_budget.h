@@ -0,0 +1,51 @@
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+// Process-wide memory budget of --memory-budget. Half of it is left to
+// SQLite (page caches, sorters) through its soft heap limit; the import's
+// own buffers draw from the other half. A consumer that can spill, shrink
+// or fall back to disk reserves before it grows and takes the slower path
+// when the reservation is refused; the others are only charged, so their
+// use still shows in the reports.
+//
+// The counters are updated atomically and may be used from any thread.
+// Without a budget every reservation succeeds and the counters only serve
+// reporting.
+enum MemoryConsumer {
+  // Element batches of the writer pipelines.
+  MEMORY_PIPELINE,
+  // Decoded PBF blocks waiting for the parser.
+  MEMORY_PBF,
+  // In-memory caches of the interned string tables.
+  MEMORY_DICTIONARIES,
+  // Word counts collected for the vocabulary.
+  MEMORY_NAMES,
+  // Bitmaps of --keep-referenced-nodes and --bbox/--poly.
+  MEMORY_ID_SETS,
+  // Writes buffered by --write-behind.
+  MEMORY_WRITE_BEHIND,
+  // Row groups and the string dictionary of --columnar.
+  MEMORY_COLUMNAR,
+  MEMORY_CONSUMER_COUNT
+};
+
+// bytes <= 0 disables the budget.
+void memoryBudgetInit(long long bytes);
+long long memoryBudgetLimit(void);
+
+// Bytes SQLite is allowed to use, 0 without a budget.
+long long memoryBudgetSqliteShare(void);
+
+// Returns 1 and counts bytes against consumer if they fit in the budget,
+// 0 otherwise.
+int memoryBudgetReserve(enum MemoryConsumer consumer, long long bytes);
+// Counts bytes whether or not they fit.
+void memoryBudgetCharge(enum MemoryConsumer consumer, long long bytes);
+void memoryBudgetRelease(enum MemoryConsumer consumer, long long bytes);
+
+long long memoryBudgetUsed(enum MemoryConsumer consumer);
+long long memoryBudgetTotal(void);
+long long memoryBudgetPeak(void);
+const char *memoryBudgetConsumerName(enum MemoryConsumer consumer);
+
+#endif
@@ -0,0 +1,213 @@
+#include "metrics.h"
+#include "memory_budget.h"
+#include "timing.h"
+#include "write_behind_vfs.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+// Bucket i counts step() calls taking [2^i, 2^(i+1)) nanoseconds.
+#define METRICS_LATENCY_BUCKETS 40
+
+static const char *phaseNames[METRICS_PHASE_COUNT] = {
+    "load",          "parse", "bind",       "step",    "indexes", "node_ways",
+    "spatial_index", "names", "vocabulary", "restore", "merge",
+};
+
+struct Metrics {
+  int enabled;
+  FILE *output;
+  long long started;
+  long long interval;
+  long long nextEmit;
+  unsigned calls;
+  long long inputSize;
+
+  // Added to by the writer threads of a sharded import at the same time.
+  atomic_llong phaseNanoseconds[METRICS_PHASE_COUNT];
+  atomic_llong steps;
+  atomic_llong rows;
+  atomic_llong latency[METRICS_LATENCY_BUCKETS];
+};
+
+static struct Metrics metrics;
+
+int metricsOpen(const char *path, double intervalSeconds,
+                const char *inputPath) {
+  memset(&metrics, 0, sizeof(metrics));
+  if (strcmp(path, "-") == 0) {
+    metrics.output = stdout;
+  } else if ((metrics.output = fopen(path, "a")) == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  struct stat st;
+  metrics.inputSize = stat(inputPath, &st) == 0 ? st.st_size : -1;
+  metrics.started = monotonicNanoseconds();
+  metrics.interval =
+      intervalSeconds > 0 ? (long long)(intervalSeconds * 1e9) : 0;
+  metrics.nextEmit = metrics.started + metrics.interval;
+  metrics.enabled = 1;
+  return 0;
+}
+
+int metricsEnabled(void) { return metrics.enabled; }
+
+long long metricsBegin(void) {
+  return metrics.enabled ? monotonicNanoseconds() : 0;
+}
+
+void metricsEnd(enum MetricsPhase phase, long long begin) {
+  if (begin != 0) {
+    counterAdd(&metrics.phaseNanoseconds[phase],
+               monotonicNanoseconds() - begin);
+  }
+}
+
+void metricsEndStep(long long begin, int rows) {
+  if (begin == 0) {
+    return;
+  }
+  long long elapsed = monotonicNanoseconds() - begin;
+  counterAdd(&metrics.phaseNanoseconds[METRICS_PHASE_STEP], elapsed);
+  counterAdd(&metrics.steps, 1);
+  counterAdd(&metrics.rows, rows);
+
+  int bucket = 0;
+  while (elapsed > 1 && bucket < METRICS_LATENCY_BUCKETS - 1) {
+    elapsed >>= 1;
+    ++bucket;
+  }
+  counterAdd(&metrics.latency[bucket], 1);
+}
+
+void metricsAddPhase(enum MetricsPhase phase, double seconds) {
+  counterAdd(&metrics.phaseNanoseconds[phase], (long long)(seconds * 1e9));
+}
+
+static double perSecond(double value, double seconds) {
+  return seconds > 0 ? value / seconds : 0;
+}
+
+static void emit(sqlite3 *db, const struct MetricsProgress *progress,
+                 const char *event, const char *status) {
+  FILE *out = metrics.output;
+  double elapsed = (monotonicNanoseconds() - metrics.started) / 1e9;
+  long long elements = progress->nodes + progress->ways + progress->relations;
+  long long inputBytes = progress->inputPosition;
+  if (status != NULL && strcmp(status, "ok") == 0) {
+    // Positions lag behind the reader; a finished import read everything.
+    inputBytes = metrics.inputSize;
+  }
+
+  fprintf(out, "{\"event\":\"%s\",", event);
+  if (status != NULL) {
+    fprintf(out, "\"status\":\"%s\",", status);
+  }
+  fprintf(out,
+          "\"elapsed_seconds\":%.3f,"
+          "\"elements\":{\"nodes\":%lld,\"ways\":%lld,\"relations\":%lld},"
+          "\"elements_per_second\":%.1f,",
+          elapsed, progress->nodes, progress->ways, progress->relations,
+          perSecond(elements, elapsed));
+  long long rows = counterLoad(&metrics.rows);
+  fprintf(out, "\"rows\":%lld,\"rows_per_second\":%.1f,", rows,
+          perSecond(rows, elapsed));
+  fprintf(out, "\"input_bytes\":%lld,\"input_size\":%lld,", inputBytes,
+          metrics.inputSize);
+  fprintf(out, "\"input_bytes_per_second\":%.1f,",
+          inputBytes >= 0 ? perSecond(inputBytes, elapsed) : 0.0);
+
+  fprintf(out, "\"phases\":{");
+  for (int i = 0; i < METRICS_PHASE_COUNT; ++i) {
+    fprintf(out, "%s\"%s\":%.3f", i ? "," : "", phaseNames[i],
+            counterLoad(&metrics.phaseNanoseconds[i]) / 1e9);
+  }
+  fprintf(out, "},");
+
+  // Only the occupied buckets, as [upper bound in ns, count].
+  fprintf(out, "\"step_latency\":{\"count\":%lld,\"buckets\":[",
+          counterLoad(&metrics.steps));
+  int first = 1;
+  for (int i = 0; i < METRICS_LATENCY_BUCKETS; ++i) {
+    long long count = counterLoad(&metrics.latency[i]);
+    if (count != 0) {
+      fprintf(out, "%s[%lld,%lld]", first ? "" : ",", 2LL << i, count);
+      first = 0;
+    }
+  }
+  fprintf(out, "]},");
+
+  if (db != NULL) {
+    int hit = 0, miss = 0, write = 0, spill = 0, highwater;
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_HIT, &hit, &highwater, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_MISS, &miss, &highwater, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_WRITE, &write, &highwater, 0);
+    sqlite3_db_status(db, SQLITE_DBSTATUS_CACHE_SPILL, &spill, &highwater,
+                      0);
+    fprintf(out,
+            "\"page_cache\":{\"hit\":%d,\"miss\":%d,\"write\":%d,"
+            "\"spill\":%d,\"hit_ratio\":%.4f},",
+            hit, miss, write, spill,
+            hit + miss > 0 ? (double)hit / (hit + miss) : 0.0);
+  }
+
+  fprintf(out, "\"memory\":{\"budget\":%lld,\"buffers\":%lld,",
+          memoryBudgetLimit(), memoryBudgetTotal());
+  for (int i = 0; i < MEMORY_CONSUMER_COUNT; ++i) {
+    fprintf(out, "\"%s\":%lld,", memoryBudgetConsumerName(i),
+            memoryBudgetUsed(i));
+  }
+  fprintf(out,
+          "\"buffers_peak\":%lld,\"sqlite\":%lld,\"sqlite_peak\":%lld},",
+          memoryBudgetPeak(), (long long)sqlite3_memory_used(),
+          (long long)sqlite3_memory_highwater(0));
+
+  if (writeBehindVfsEnabled()) {
+    struct WriteBehindStats wb;
+    writeBehindVfsStats(&wb);
+    fprintf(out,
+            "\"write_behind\":{\"writes\":%lld,\"calls\":%lld,"
+            "\"bytes\":%lld,\"batches\":%lld,\"queue_depth\":%d,"
+            "\"queue_depth_peak\":%d,\"busy_seconds\":%.3f,"
+            "\"stall_seconds\":%.3f},",
+            wb.writes, wb.calls, wb.bytes, wb.batches, wb.queueDepth,
+            wb.peakQueueDepth, wb.busySeconds, wb.stallSeconds);
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  // ru_maxrss is in KiB on Linux.
+  fprintf(out, "\"peak_rss_bytes\":%lld}\n", (long long)usage.ru_maxrss * 1024);
+  fflush(out);
+}
+
+void metricsMaybeEmit(sqlite3 *db, const struct MetricsProgress *progress) {
+  // Only look at the clock every 4096 calls.
+  if (!metrics.enabled || metrics.interval == 0 ||
+      (++metrics.calls & 4095) != 0) {
+    return;
+  }
+  long long now = monotonicNanoseconds();
+  if (now < metrics.nextEmit) {
+    return;
+  }
+  metrics.nextEmit = now + metrics.interval;
+  emit(db, progress, "progress", NULL);
+}
+
+void metricsFinish(sqlite3 *db, const struct MetricsProgress *progress,
+                   const char *status) {
+  if (!metrics.enabled) {
+    return;
+  }
+  emit(db, progress, "final", status);
+  if (metrics.output != stdout) {
+    fclose(metrics.output);
+  }
+  metrics.enabled = 0;
+}
@@ -0,0 +1,65 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <sqlite3.h>
+
+// Import instrumentation. Phase times, row counts and the step() latency
+// histogram are kept in process-wide counters and written as one JSON
+// object per line: periodically during the load and once at exit. Each
+// object also carries the memory_budget.h counters, and the
+// write_behind_vfs.h ones with --write-behind.
+//
+// The per-statement timers cost two clock reads and are only taken when
+// metrics are enabled. The counters are updated atomically, so the writers
+// of a sharded or split import share them; phase times are then summed
+// over the writers.
+enum MetricsPhase {
+  METRICS_PHASE_LOAD,
+  // The parsing thread's time in the reader, outside the element callbacks.
+  // Part of load; with --pipeline it overlaps bind and step.
+  METRICS_PHASE_PARSE,
+  METRICS_PHASE_BIND,
+  METRICS_PHASE_STEP,
+  METRICS_PHASE_INDEXES,
+  METRICS_PHASE_NODE_WAYS,
+  METRICS_PHASE_SPATIAL_INDEX,
+  METRICS_PHASE_NAMES,
+  METRICS_PHASE_VOCABULARY,
+  METRICS_PHASE_RESTORE,
+  // Copying the tables of --split-tables into the output.
+  METRICS_PHASE_MERGE,
+  METRICS_PHASE_COUNT
+};
+
+struct MetricsProgress {
+  long long nodes;
+  long long ways;
+  long long relations;
+  // Bytes of input consumed, -1 if the reader does not report it.
+  long long inputPosition;
+};
+
+// Enables metrics. path is a file the JSON lines are appended to, "-" for
+// stdout. intervalSeconds <= 0 only writes the final object. inputPath is
+// used for the input size.
+int metricsOpen(const char *path, double intervalSeconds,
+                const char *inputPath);
+int metricsEnabled(void);
+
+// Nanosecond timestamp for metricsEnd, 0 while metrics are disabled.
+long long metricsBegin(void);
+void metricsEnd(enum MetricsPhase phase, long long begin);
+// metricsEnd for METRICS_PHASE_STEP, also adding to the latency histogram
+// and counting rows written by the statement.
+void metricsEndStep(long long begin, int rows);
+
+void metricsAddPhase(enum MetricsPhase phase, double seconds);
+
+// Writes a progress object if the interval has passed. Cheap enough to
+// call per element.
+void metricsMaybeEmit(sqlite3 *db, const struct MetricsProgress *progress);
+// Writes the final object; status is "ok" or "failed". db may be NULL.
+void metricsFinish(sqlite3 *db, const struct MetricsProgress *progress,
+                   const char *status);
+
+#endif
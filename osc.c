@@ -0,0 +1,274 @@
+#include "osc.h"
+#include "arena.h"
+
+#include <expat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+enum OscElement { OSC_NONE, OSC_NODE, OSC_WAY, OSC_RELATION };
+
+struct OscParser {
+  XML_Parser xml;
+  const void *userData;
+  osc_node_callback nodeFnct;
+  osc_way_callback wayFnct;
+  osc_relation_callback relationFnct;
+  int ret;
+
+  // Set between <create>/<modify>/<delete> and its end tag.
+  int inAction;
+  enum OscAction action;
+
+  // The element being read. Strings live in arena until it is delivered.
+  enum OscElement element;
+  struct Arena arena;
+  long long id;
+  double latitude, longitude;
+  int version;
+  long long changeset;
+  const char *user;
+  int uid;
+  const char *timestamp;
+
+  readosm_tag *tags;
+  int tagCount, tagCapacity;
+  long long *refs;
+  int refCount, refCapacity;
+  readosm_member *members;
+  int memberCount, memberCapacity;
+};
+
+static const char *attribute(const XML_Char **attrs, const char *name) {
+  for (int i = 0; attrs[i] != NULL; i += 2) {
+    if (strcmp(attrs[i], name) == 0) {
+      return attrs[i + 1];
+    }
+  }
+  return NULL;
+}
+
+static long long integerAttribute(const XML_Char **attrs, const char *name) {
+  const char *value = attribute(attrs, name);
+  return value != NULL ? strtoll(value, NULL, 10) : 0;
+}
+
+static const char *stringAttribute(struct OscParser *p,
+                                   const XML_Char **attrs, const char *name) {
+  const char *value = attribute(attrs, name);
+  return value != NULL ? arenaStrdup(&p->arena, value) : NULL;
+}
+
+// Grows one of the element arrays; count is the number of items in use.
+static int reserve(void **items, int *capacity, int count, size_t size) {
+  if (count < *capacity) {
+    return 0;
+  }
+  int grown = *capacity ? *capacity * 2 : 64;
+  void *resized = realloc(*items, grown * size);
+  if (resized == NULL) {
+    return -1;
+  }
+  *items = resized;
+  *capacity = grown;
+  return 0;
+}
+
+static void stop(struct OscParser *p, int ret) {
+  p->ret = ret;
+  XML_StopParser(p->xml, XML_FALSE);
+}
+
+static void startElement(struct OscParser *p, const XML_Char **attrs,
+                         enum OscElement element) {
+  p->element = element;
+  arenaReset(&p->arena);
+  p->tagCount = p->refCount = p->memberCount = 0;
+  p->id = integerAttribute(attrs, "id");
+  p->version = (int)integerAttribute(attrs, "version");
+  p->changeset = integerAttribute(attrs, "changeset");
+  p->uid = (int)integerAttribute(attrs, "uid");
+  p->user = stringAttribute(p, attrs, "user");
+  p->timestamp = stringAttribute(p, attrs, "timestamp");
+  const char *lat = attribute(attrs, "lat");
+  const char *lon = attribute(attrs, "lon");
+  p->latitude = lat != NULL ? strtod(lat, NULL) : 0;
+  p->longitude = lon != NULL ? strtod(lon, NULL) : 0;
+}
+
+static int memberType(const char *type) {
+  if (type == NULL) {
+    return READOSM_UNDEFINED;
+  }
+  if (strcmp(type, "node") == 0) {
+    return READOSM_MEMBER_NODE;
+  }
+  if (strcmp(type, "way") == 0) {
+    return READOSM_MEMBER_WAY;
+  }
+  if (strcmp(type, "relation") == 0) {
+    return READOSM_MEMBER_RELATION;
+  }
+  return READOSM_UNDEFINED;
+}
+
+static void XMLCALL onStart(void *userData, const XML_Char *name,
+                            const XML_Char **attrs) {
+  struct OscParser *p = userData;
+  if (!p->inAction) {
+    if (strcmp(name, "create") == 0) {
+      p->inAction = 1;
+      p->action = OSC_CREATE;
+    } else if (strcmp(name, "modify") == 0) {
+      p->inAction = 1;
+      p->action = OSC_MODIFY;
+    } else if (strcmp(name, "delete") == 0) {
+      p->inAction = 1;
+      p->action = OSC_DELETE;
+    }
+    return;
+  }
+
+  if (p->element == OSC_NONE) {
+    if (strcmp(name, "node") == 0) {
+      startElement(p, attrs, OSC_NODE);
+    } else if (strcmp(name, "way") == 0) {
+      startElement(p, attrs, OSC_WAY);
+    } else if (strcmp(name, "relation") == 0) {
+      startElement(p, attrs, OSC_RELATION);
+    }
+    return;
+  }
+
+  if (strcmp(name, "tag") == 0) {
+    if (reserve((void **)&p->tags, &p->tagCapacity, p->tagCount,
+                sizeof(readosm_tag)) != 0) {
+      stop(p, READOSM_INSUFFICIENT_MEMORY);
+      return;
+    }
+    readosm_tag tag = {stringAttribute(p, attrs, "k"),
+                       stringAttribute(p, attrs, "v")};
+    memcpy(&p->tags[p->tagCount++], &tag, sizeof(tag));
+  } else if (strcmp(name, "nd") == 0 && p->element == OSC_WAY) {
+    if (reserve((void **)&p->refs, &p->refCapacity, p->refCount,
+                sizeof(long long)) != 0) {
+      stop(p, READOSM_INSUFFICIENT_MEMORY);
+      return;
+    }
+    p->refs[p->refCount++] = integerAttribute(attrs, "ref");
+  } else if (strcmp(name, "member") == 0 && p->element == OSC_RELATION) {
+    if (reserve((void **)&p->members, &p->memberCapacity, p->memberCount,
+                sizeof(readosm_member)) != 0) {
+      stop(p, READOSM_INSUFFICIENT_MEMORY);
+      return;
+    }
+    readosm_member member = {memberType(attribute(attrs, "type")),
+                             integerAttribute(attrs, "ref"),
+                             stringAttribute(p, attrs, "role")};
+    memcpy(&p->members[p->memberCount++], &member, sizeof(member));
+  }
+}
+
+static int deliver(struct OscParser *p) {
+  switch (p->element) {
+  case OSC_NODE: {
+    readosm_node node = {p->id,       p->latitude,  p->longitude,
+                         p->version,  p->changeset, p->user,
+                         p->uid,      p->timestamp, p->tagCount,
+                         p->tags};
+    return p->nodeFnct != NULL ? p->nodeFnct(p->userData, p->action, &node)
+                               : READOSM_OK;
+  }
+  case OSC_WAY: {
+    readosm_way way = {p->id,  p->version,   p->changeset, p->user,
+                       p->uid, p->timestamp, p->refCount,  p->refs,
+                       p->tagCount, p->tags};
+    return p->wayFnct != NULL ? p->wayFnct(p->userData, p->action, &way)
+                              : READOSM_OK;
+  }
+  case OSC_RELATION: {
+    readosm_relation relation = {p->id,          p->version, p->changeset,
+                                 p->user,        p->uid,     p->timestamp,
+                                 p->memberCount, p->members, p->tagCount,
+                                 p->tags};
+    return p->relationFnct != NULL
+               ? p->relationFnct(p->userData, p->action, &relation)
+               : READOSM_OK;
+  }
+  default:
+    return READOSM_OK;
+  }
+}
+
+static void XMLCALL onEnd(void *userData, const XML_Char *name) {
+  struct OscParser *p = userData;
+  if (p->element != OSC_NONE) {
+    static const char *names[] = {NULL, "node", "way", "relation"};
+    if (strcmp(name, names[p->element]) == 0) {
+      int ret = deliver(p);
+      p->element = OSC_NONE;
+      if (ret != READOSM_OK) {
+        stop(p, READOSM_ABORT);
+      }
+    }
+    return;
+  }
+  if (p->inAction &&
+      (strcmp(name, "create") == 0 || strcmp(name, "modify") == 0 ||
+       strcmp(name, "delete") == 0)) {
+    p->inAction = 0;
+  }
+}
+
+int oscParse(const char *path, const void *user_data,
+             osc_node_callback node_fnct, osc_way_callback way_fnct,
+             osc_relation_callback relation_fnct) {
+  // gzread reads uncompressed files unchanged.
+  gzFile file = gzopen(path, "rb");
+  if (file == NULL) {
+    return READOSM_FILE_NOT_FOUND;
+  }
+
+  struct OscParser p;
+  memset(&p, 0, sizeof(p));
+  p.userData = user_data;
+  p.nodeFnct = node_fnct;
+  p.wayFnct = way_fnct;
+  p.relationFnct = relation_fnct;
+  p.ret = READOSM_OK;
+  arenaInit(&p.arena, 4096);
+  if ((p.xml = XML_ParserCreate(NULL)) == NULL) {
+    gzclose(file);
+    arenaFree(&p.arena);
+    return READOSM_CREATE_XML_PARSER_ERROR;
+  }
+  XML_SetUserData(p.xml, &p);
+  XML_SetElementHandler(p.xml, onStart, onEnd);
+
+  char buffer[64 * 1024];
+  int done = 0;
+  while (!done && p.ret == READOSM_OK) {
+    int length = gzread(file, buffer, sizeof(buffer));
+    if (length < 0) {
+      p.ret = READOSM_READ_ERROR;
+      break;
+    }
+    done = length == 0;
+    if (XML_Parse(p.xml, buffer, length, done) == XML_STATUS_ERROR &&
+        p.ret == READOSM_OK) {
+      fprintf(stderr, "%s:%lu: %s\n", path,
+              (unsigned long)XML_GetCurrentLineNumber(p.xml),
+              XML_ErrorString(XML_GetErrorCode(p.xml)));
+      p.ret = READOSM_XML_ERROR;
+    }
+  }
+
+  XML_ParserFree(p.xml);
+  gzclose(file);
+  arenaFree(&p.arena);
+  free(p.tags);
+  free(p.refs);
+  free(p.members);
+  return p.ret;
+}
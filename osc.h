@@ -0,0 +1,26 @@
+#ifndef OSC_H
+#define OSC_H
+
+#include <readosm.h>
+
+// Streaming reader for osmChange (.osc, .osc.gz) files. Elements are
+// delivered in file order with the action of the block they appear in,
+// using the readosm element structs; pointers are only valid during the
+// callback. Elements of delete blocks may have no tags or coordinates.
+enum OscAction { OSC_CREATE, OSC_MODIFY, OSC_DELETE };
+
+typedef int (*osc_node_callback)(const void *user_data, enum OscAction action,
+                                 const readosm_node *node);
+typedef int (*osc_way_callback)(const void *user_data, enum OscAction action,
+                                const readosm_way *way);
+typedef int (*osc_relation_callback)(const void *user_data,
+                                     enum OscAction action,
+                                     const readosm_relation *relation);
+
+// Returns READOSM_OK or a READOSM_* error code. READOSM_ABORT means a
+// callback stopped the parse.
+int oscParse(const char *path, const void *user_data,
+             osc_node_callback node_fnct, osc_way_callback way_fnct,
+             osc_relation_callback relation_fnct);
+
+#endif
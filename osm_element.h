@@ -0,0 +1,19 @@
+#ifndef OSM_ELEMENT_H
+#define OSM_ELEMENT_H
+
+#include <readosm.h>
+
+enum OsmElementType { OSM_ELEMENT_NODE, OSM_ELEMENT_WAY, OSM_ELEMENT_RELATION };
+
+// An owned copy of a readosm element. readosm structs have const members,
+// so copies are built on the stack and memcpy'd into the union.
+struct OsmElement {
+  enum OsmElementType type;
+  union {
+    readosm_node node;
+    readosm_way way;
+    readosm_relation relation;
+  } u;
+};
+
+#endif
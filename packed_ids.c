@@ -0,0 +1,308 @@
+#include "packed_ids.h"
+
+// Compiled into the importer, or on its own as a loadable extension with
+// PACKED_IDS_EXTENSION defined.
+#ifdef PACKED_IDS_EXTENSION
+#include <sqlite3ext.h>
+SQLITE_EXTENSION_INIT1
+#else
+#include <sqlite3.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned char *writeVarint(unsigned char *out, uint64_t value) {
+  while (value >= 0x80) {
+    *out++ = (unsigned char)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (unsigned char)value;
+  return out;
+}
+
+size_t packIds(const long long *ids, int count, unsigned char *out) {
+  unsigned char *start = out;
+  long long previous = 0;
+  for (int i = 0; i < count; ++i) {
+    // Wrapping subtraction, the delta of far apart IDs may overflow.
+    int64_t delta = (int64_t)((uint64_t)ids[i] - (uint64_t)previous);
+    out = writeVarint(out, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    previous = ids[i];
+  }
+  return out - start;
+}
+
+// Decodes the next ID after *previous. Returns 0 at the end of the list or
+// on a truncated varint.
+static int unpackNext(const unsigned char **pos, const unsigned char *end,
+                      long long *previous) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64 && *pos < end; shift += 7) {
+    unsigned char byte = *(*pos)++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      int64_t delta = (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+      *previous = (long long)((uint64_t)*previous + (uint64_t)delta);
+      return 1;
+    }
+  }
+  *pos = end;
+  return 0;
+}
+
+// unpack_ids(blob): eponymous table-valued function.
+
+#define UNPACK_COLUMN_ID 0
+#define UNPACK_COLUMN_SEQUENCE 1
+#define UNPACK_COLUMN_PACKED 2
+
+struct UnpackCursor {
+  sqlite3_vtab_cursor base;
+  unsigned char *packed;
+  const unsigned char *pos;
+  const unsigned char *end;
+  long long id;
+  sqlite3_int64 sequence;
+  int eof;
+};
+
+static int unpackConnect(sqlite3 *db, void *aux, int argc,
+                         const char *const *argv, sqlite3_vtab **vtab,
+                         char **errMsg) {
+  int ret = sqlite3_declare_vtab(
+      db, "CREATE TABLE x(id INTEGER, sequence INTEGER, packed HIDDEN)");
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  // Reads nothing but its argument, so views may use it with
+  // trusted_schema off.
+  sqlite3_vtab_config(db, SQLITE_VTAB_INNOCUOUS);
+  *vtab = sqlite3_malloc(sizeof(sqlite3_vtab));
+  if (*vtab == NULL) {
+    return SQLITE_NOMEM;
+  }
+  memset(*vtab, 0, sizeof(sqlite3_vtab));
+  return SQLITE_OK;
+}
+
+static int unpackDisconnect(sqlite3_vtab *vtab) {
+  sqlite3_free(vtab);
+  return SQLITE_OK;
+}
+
+static int unpackOpen(sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor) {
+  struct UnpackCursor *c = sqlite3_malloc(sizeof(struct UnpackCursor));
+  if (c == NULL) {
+    return SQLITE_NOMEM;
+  }
+  memset(c, 0, sizeof(*c));
+  *cursor = &c->base;
+  return SQLITE_OK;
+}
+
+static int unpackClose(sqlite3_vtab_cursor *cursor) {
+  struct UnpackCursor *c = (struct UnpackCursor *)cursor;
+  sqlite3_free(c->packed);
+  sqlite3_free(c);
+  return SQLITE_OK;
+}
+
+static int unpackNextRow(sqlite3_vtab_cursor *cursor) {
+  struct UnpackCursor *c = (struct UnpackCursor *)cursor;
+  if (!unpackNext(&c->pos, c->end, &c->id)) {
+    c->eof = 1;
+    return SQLITE_OK;
+  }
+  c->sequence++;
+  return SQLITE_OK;
+}
+
+static int unpackFilter(sqlite3_vtab_cursor *cursor, int indexNum,
+                        const char *indexStr, int argc,
+                        sqlite3_value **argv) {
+  struct UnpackCursor *c = (struct UnpackCursor *)cursor;
+  sqlite3_free(c->packed);
+  c->packed = NULL;
+  c->pos = c->end = NULL;
+  c->id = 0;
+  c->sequence = -1;
+  c->eof = 0;
+
+  // Without the packed argument there is nothing to unpack.
+  if (argc == 1 && sqlite3_value_type(argv[0]) == SQLITE_BLOB) {
+    int size = sqlite3_value_bytes(argv[0]);
+    if (size > 0) {
+      c->packed = sqlite3_malloc(size);
+      if (c->packed == NULL) {
+        return SQLITE_NOMEM;
+      }
+      memcpy(c->packed, sqlite3_value_blob(argv[0]), size);
+      c->pos = c->packed;
+      c->end = c->packed + size;
+    }
+  }
+  return unpackNextRow(cursor);
+}
+
+static int unpackEof(sqlite3_vtab_cursor *cursor) {
+  return ((struct UnpackCursor *)cursor)->eof;
+}
+
+static int unpackColumn(sqlite3_vtab_cursor *cursor, sqlite3_context *ctx,
+                        int column) {
+  struct UnpackCursor *c = (struct UnpackCursor *)cursor;
+  switch (column) {
+  case UNPACK_COLUMN_ID:
+    sqlite3_result_int64(ctx, c->id);
+    break;
+  case UNPACK_COLUMN_SEQUENCE:
+    sqlite3_result_int64(ctx, c->sequence);
+    break;
+  default:
+    sqlite3_result_blob(ctx, c->packed, (int)(c->end - c->packed),
+                        SQLITE_TRANSIENT);
+    break;
+  }
+  return SQLITE_OK;
+}
+
+static int unpackRowid(sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid) {
+  *rowid = ((struct UnpackCursor *)cursor)->sequence;
+  return SQLITE_OK;
+}
+
+static int unpackBestIndex(sqlite3_vtab *vtab, sqlite3_index_info *info) {
+  for (int i = 0; i < info->nConstraint; ++i) {
+    const struct sqlite3_index_constraint *constraint = &info->aConstraint[i];
+    if (constraint->iColumn == UNPACK_COLUMN_PACKED &&
+        constraint->op == SQLITE_INDEX_CONSTRAINT_EQ) {
+      if (!constraint->usable) {
+        // Ask for a plan where the argument is known.
+        return SQLITE_CONSTRAINT;
+      }
+      info->aConstraintUsage[i].argvIndex = 1;
+      info->aConstraintUsage[i].omit = 1;
+      info->estimatedCost = 10;
+      info->estimatedRows = 10;
+      return SQLITE_OK;
+    }
+  }
+  info->estimatedCost = 1e9;
+  return SQLITE_OK;
+}
+
+static sqlite3_module unpackModule = {
+    0,                /* iVersion */
+    0,                /* xCreate: eponymous only */
+    unpackConnect,    /* xConnect */
+    unpackBestIndex,  /* xBestIndex */
+    unpackDisconnect, /* xDisconnect */
+    0,                /* xDestroy */
+    unpackOpen,       /* xOpen */
+    unpackClose,      /* xClose */
+    unpackFilter,     /* xFilter */
+    unpackNextRow,    /* xNext */
+    unpackEof,        /* xEof */
+    unpackColumn,     /* xColumn */
+    unpackRowid,      /* xRowid */
+};
+
+// pack_sorted_ids(id): aggregate collecting IDs, sorted and deduplicated
+// when the group is complete.
+
+struct PackAggregate {
+  long long *ids;
+  int count;
+  int capacity;
+};
+
+static void packStep(sqlite3_context *ctx, int argc, sqlite3_value **argv) {
+  if (sqlite3_value_type(argv[0]) == SQLITE_NULL) {
+    return;
+  }
+  struct PackAggregate *agg =
+      sqlite3_aggregate_context(ctx, sizeof(struct PackAggregate));
+  if (agg == NULL) {
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+  if (agg->count == agg->capacity) {
+    int capacity = agg->capacity ? agg->capacity * 2 : 16;
+    long long *ids = sqlite3_realloc64(agg->ids, sizeof(long long) * capacity);
+    if (ids == NULL) {
+      sqlite3_result_error_nomem(ctx);
+      return;
+    }
+    agg->ids = ids;
+    agg->capacity = capacity;
+  }
+  agg->ids[agg->count++] = sqlite3_value_int64(argv[0]);
+}
+
+static int compareIds(const void *a, const void *b) {
+  long long x = *(const long long *)a, y = *(const long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+static void packFinal(sqlite3_context *ctx) {
+  struct PackAggregate *agg = sqlite3_aggregate_context(ctx, 0);
+  if (agg == NULL || agg->count == 0) {
+    sqlite3_result_null(ctx);
+    return;
+  }
+
+  qsort(agg->ids, agg->count, sizeof(long long), compareIds);
+  int count = 1;
+  for (int i = 1; i < agg->count; ++i) {
+    if (agg->ids[i] != agg->ids[count - 1]) {
+      agg->ids[count++] = agg->ids[i];
+    }
+  }
+
+  unsigned char *out = sqlite3_malloc64(PACKED_IDS_MAX_SIZE(count));
+  if (out == NULL) {
+    sqlite3_free(agg->ids);
+    sqlite3_result_error_nomem(ctx);
+    return;
+  }
+  size_t size = packIds(agg->ids, count, out);
+  sqlite3_free(agg->ids);
+  sqlite3_result_blob(ctx, out, (int)size, sqlite3_free);
+}
+
+static void packedCount(sqlite3_context *ctx, int argc,
+                        sqlite3_value **argv) {
+  const unsigned char *pos = sqlite3_value_blob(argv[0]);
+  const unsigned char *end = pos + sqlite3_value_bytes(argv[0]);
+  sqlite3_int64 count = 0;
+  // Every varint ends with a byte below 0x80.
+  for (; pos != NULL && pos < end; ++pos) {
+    count += *pos < 0x80;
+  }
+  sqlite3_result_int64(ctx, count);
+}
+
+// Registers unpack_ids, pack_sorted_ids and packed_ids_count. Same
+// signature as an extension entry point, so it can be passed to
+// sqlite3_auto_extension.
+int sqlite3_packedids_init(sqlite3 *db, char **pzErrMsg,
+                           const sqlite3_api_routines *pApi) {
+#ifdef PACKED_IDS_EXTENSION
+  SQLITE_EXTENSION_INIT2(pApi);
+#endif
+  int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS;
+  int ret;
+  if ((ret = sqlite3_create_module(db, "unpack_ids", &unpackModule, NULL)) !=
+      SQLITE_OK) {
+    return ret;
+  }
+  if ((ret = sqlite3_create_function(db, "pack_sorted_ids", 1, flags, NULL,
+                                     NULL, packStep, packFinal)) !=
+      SQLITE_OK) {
+    return ret;
+  }
+  return sqlite3_create_function(db, "packed_ids_count", 1, flags, NULL,
+                                 packedCount, NULL, NULL);
+}
@@ -0,0 +1,20 @@
+#ifndef PACKED_IDS_H
+#define PACKED_IDS_H
+
+#include <stddef.h>
+
+// Packed ID lists are the deltas between consecutive IDs (the first one
+// relative to 0), zigzag encoded and written as little-endian base-128
+// varints, the integer encoding of the PBF format. A way's node list costs
+// one or two bytes per reference instead of a way_nodes row.
+//
+// The SQL side lives in the same file, see sqlite3_packedids_init.
+
+// Upper bound for the size of count packed IDs.
+#define PACKED_IDS_MAX_SIZE(count) ((size_t)(count) * 10)
+
+// Writes the packed form of ids to out, which must hold
+// PACKED_IDS_MAX_SIZE(count) bytes, and returns its size.
+size_t packIds(const long long *ids, int count, unsigned char *out);
+
+#endif
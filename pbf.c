@@ -0,0 +1,1164 @@
+#include "pbf.h"
+#include "arena.h"
+#include "memory_budget.h"
+#include "osm_element.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#define MAX_BLOB_HEADER_SIZE (64 * 1024)
+#define MAX_BLOB_SIZE (32 * 1024 * 1024)
+#define SLOTS_PER_THREAD 2
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+// What a slot typically holds: a compressed and an inflated block of a
+// megabyte or two, and the decoded elements.
+#define SLOT_BUDGET_BYTES (4 * 1024 * 1024)
+
+#define WIRE_VARINT 0
+#define WIRE_FIXED64 1
+#define WIRE_BYTES 2
+#define WIRE_FIXED32 5
+
+// Protobuf decoding. Errors are sticky: once set, every read returns zero
+// and the message loops terminate.
+struct PbfCursor {
+  const uint8_t *pos;
+  const uint8_t *end;
+  int error;
+};
+
+static uint64_t readVarint(struct PbfCursor *c) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (c->pos >= c->end) {
+      c->error = 1;
+      return 0;
+    }
+    uint8_t byte = *c->pos++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return value;
+    }
+  }
+  c->error = 1;
+  return 0;
+}
+
+static int64_t readSint(struct PbfCursor *c) {
+  uint64_t value = readVarint(c);
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static int atEnd(const struct PbfCursor *c) {
+  return c->error || c->pos >= c->end;
+}
+
+static int nextField(struct PbfCursor *c, int *field, int *wireType) {
+  if (atEnd(c)) {
+    return 0;
+  }
+  uint64_t key = readVarint(c);
+  *field = (int)(key >> 3);
+  *wireType = (int)(key & 7);
+  return !c->error;
+}
+
+static struct PbfCursor readBytes(struct PbfCursor *c) {
+  struct PbfCursor sub = {NULL, NULL, 0};
+  uint64_t length = readVarint(c);
+  if (c->error || length > (uint64_t)(c->end - c->pos)) {
+    c->error = 1;
+    sub.error = 1;
+    return sub;
+  }
+  sub.pos = c->pos;
+  sub.end = c->pos + length;
+  c->pos += length;
+  return sub;
+}
+
+static void skipField(struct PbfCursor *c, int wireType) {
+  switch (wireType) {
+  case WIRE_VARINT:
+    readVarint(c);
+    break;
+  case WIRE_FIXED64:
+  case WIRE_FIXED32: {
+    size_t size = wireType == WIRE_FIXED64 ? 8 : 4;
+    if ((size_t)(c->end - c->pos) < size) {
+      c->error = 1;
+    } else {
+      c->pos += size;
+    }
+    break;
+  }
+  case WIRE_BYTES:
+    readBytes(c);
+    break;
+  default:
+    c->error = 1;
+  }
+}
+
+// Packed repeated fields are the only encoding osmosis, osmium and the
+// planet dumps use, so other wire types for array fields are skipped.
+static int readPacked(struct PbfCursor *c, int wireType,
+                      struct PbfCursor *packed) {
+  if (wireType != WIRE_BYTES) {
+    skipField(c, wireType);
+    return 0;
+  }
+  *packed = readBytes(c);
+  return 1;
+}
+
+static int countVarints(struct PbfCursor packed) {
+  int count = 0;
+  while (!atEnd(&packed)) {
+    readVarint(&packed);
+    count++;
+  }
+  return packed.error ? -1 : count;
+}
+
+struct BlockDecoder {
+  struct Arena *arena;
+  const char **strings;
+  int stringCount;
+  long long granularity;
+  long long latOffset;
+  long long lonOffset;
+  long long dateGranularity;
+
+  struct OsmElement *elements;
+  int count;
+  int capacity;
+};
+
+struct ElementInfo {
+  int version;
+  long long changeset;
+  int uid;
+  const char *user;
+  const char *timestamp;
+};
+
+static const struct ElementInfo noInfo = {READOSM_UNDEFINED, READOSM_UNDEFINED,
+                                          READOSM_UNDEFINED, NULL, NULL};
+
+static struct OsmElement *appendElement(struct BlockDecoder *d) {
+  if (d->count == d->capacity) {
+    int capacity = d->capacity ? d->capacity * 2 : 8192;
+    struct OsmElement *elements =
+        realloc(d->elements, sizeof(struct OsmElement) * capacity);
+    if (elements == NULL) {
+      return NULL;
+    }
+    d->elements = elements;
+    d->capacity = capacity;
+  }
+  return &d->elements[d->count++];
+}
+
+static const char *lookupString(struct BlockDecoder *d, uint64_t index,
+                                int *error) {
+  if (index >= (uint64_t)d->stringCount) {
+    *error = 1;
+    return NULL;
+  }
+  return d->strings[index];
+}
+
+// Sets *error for timestamps before 1970 or after year 9999, which corrupt
+// blocks produce and which would overflow the multiplication or the buffer.
+static const char *formatTimestamp(struct BlockDecoder *d, long long timestamp,
+                                   int *error) {
+  // 9999-12-31T23:59:59Z in milliseconds.
+  static const long long maxMilliseconds = 253402300799LL * 1000;
+  if (d->dateGranularity <= 0 || timestamp < 0 ||
+      timestamp > maxMilliseconds / d->dateGranularity) {
+    *error = 1;
+    return NULL;
+  }
+  time_t seconds = (time_t)(timestamp * d->dateGranularity / 1000);
+  struct tm tm;
+  if (gmtime_r(&seconds, &tm) == NULL) {
+    *error = 1;
+    return NULL;
+  }
+  char *out = arenaAlloc(d->arena, 24);
+  if (out != NULL && strftime(out, 24, "%Y-%m-%dT%H:%M:%SZ", &tm) == 0) {
+    *error = 1;
+    return NULL;
+  }
+  return out;
+}
+
+static int decodeStringTable(struct BlockDecoder *d, struct PbfCursor c) {
+  int field, wireType;
+  struct PbfCursor scan = c;
+  int count = 0;
+  while (nextField(&scan, &field, &wireType)) {
+    if (field == 1 && wireType == WIRE_BYTES) {
+      count++;
+    }
+    skipField(&scan, wireType);
+  }
+  if (scan.error) {
+    return -1;
+  }
+
+  d->strings = arenaAlloc(d->arena, sizeof(const char *) * (count + 1));
+  if (d->strings == NULL) {
+    return -1;
+  }
+
+  d->stringCount = 0;
+  while (nextField(&c, &field, &wireType)) {
+    if (field != 1 || wireType != WIRE_BYTES) {
+      skipField(&c, wireType);
+      continue;
+    }
+    struct PbfCursor s = readBytes(&c);
+    size_t length = s.end - s.pos;
+    char *copy = arenaAlloc(d->arena, length + 1);
+    if (copy == NULL) {
+      return -1;
+    }
+    memcpy(copy, s.pos, length);
+    copy[length] = '\0';
+    d->strings[d->stringCount++] = copy;
+  }
+  return c.error ? -1 : 0;
+}
+
+static int decodeInfo(struct BlockDecoder *d, struct PbfCursor c,
+                      struct ElementInfo *info) {
+  int field, wireType, error = 0;
+  *info = noInfo;
+  while (nextField(&c, &field, &wireType)) {
+    switch (field) {
+    case 1:
+      info->version = (int)readVarint(&c);
+      break;
+    case 2:
+      info->timestamp =
+          formatTimestamp(d, (long long)readVarint(&c), &error);
+      break;
+    case 3:
+      info->changeset = (long long)readVarint(&c);
+      break;
+    case 4:
+      info->uid = (int)readVarint(&c);
+      break;
+    case 5:
+      info->user = lookupString(d, readVarint(&c), &error);
+      break;
+    default:
+      skipField(&c, wireType);
+    }
+  }
+  return c.error || error ? -1 : 0;
+}
+
+static const readosm_tag *decodeTags(struct BlockDecoder *d,
+                                     struct PbfCursor keys,
+                                     struct PbfCursor values, int *count) {
+  *count = countVarints(keys);
+  if (*count <= 0) {
+    return NULL;
+  }
+  readosm_tag *tags = arenaAlloc(d->arena, sizeof(readosm_tag) * *count);
+  if (tags == NULL) {
+    *count = -1;
+    return NULL;
+  }
+  int error = 0;
+  for (int i = 0; i < *count; ++i) {
+    tags[i].key = lookupString(d, readVarint(&keys), &error);
+    tags[i].value = lookupString(d, readVarint(&values), &error);
+  }
+  if (error || values.error) {
+    *count = -1;
+  }
+  return tags;
+}
+
+static int decodeNode(struct BlockDecoder *d, struct PbfCursor c) {
+  int field, wireType;
+  long long id = 0, lat = 0, lon = 0;
+  struct PbfCursor keys = {NULL, NULL, 0}, values = {NULL, NULL, 0};
+  struct ElementInfo info = noInfo;
+
+  while (nextField(&c, &field, &wireType)) {
+    switch (field) {
+    case 1:
+      id = readSint(&c);
+      break;
+    case 2:
+      readPacked(&c, wireType, &keys);
+      break;
+    case 3:
+      readPacked(&c, wireType, &values);
+      break;
+    case 4:
+      if (decodeInfo(d, readBytes(&c), &info) != 0) {
+        return -1;
+      }
+      break;
+    case 8:
+      lat = readSint(&c);
+      break;
+    case 9:
+      lon = readSint(&c);
+      break;
+    default:
+      skipField(&c, wireType);
+    }
+  }
+
+  int tagCount;
+  const readosm_tag *tags = decodeTags(d, keys, values, &tagCount);
+  struct OsmElement *element = appendElement(d);
+  if (c.error || tagCount < 0 || element == NULL) {
+    return -1;
+  }
+
+  readosm_node node = {id,
+                       1e-9 * (d->latOffset + d->granularity * lat),
+                       1e-9 * (d->lonOffset + d->granularity * lon),
+                       info.version,
+                       info.changeset,
+                       info.user,
+                       info.uid,
+                       info.timestamp,
+                       tagCount,
+                       tags};
+  element->type = OSM_ELEMENT_NODE;
+  memcpy(&element->u.node, &node, sizeof(node));
+  return 0;
+}
+
+static int decodeDenseNodes(struct BlockDecoder *d, struct PbfCursor c) {
+  int field, wireType;
+  struct PbfCursor ids = {NULL, NULL, 0}, lats = ids, lons = ids,
+                   keysVals = ids, versions = ids, timestamps = ids,
+                   changesets = ids, uids = ids, userSids = ids;
+  int hasKeysVals = 0, hasInfo = 0;
+
+  while (nextField(&c, &field, &wireType)) {
+    switch (field) {
+    case 1:
+      readPacked(&c, wireType, &ids);
+      break;
+    case 5: {
+      struct PbfCursor denseInfo = readBytes(&c);
+      int infoField, infoWireType;
+      hasInfo = 1;
+      while (nextField(&denseInfo, &infoField, &infoWireType)) {
+        switch (infoField) {
+        case 1:
+          readPacked(&denseInfo, infoWireType, &versions);
+          break;
+        case 2:
+          readPacked(&denseInfo, infoWireType, &timestamps);
+          break;
+        case 3:
+          readPacked(&denseInfo, infoWireType, &changesets);
+          break;
+        case 4:
+          readPacked(&denseInfo, infoWireType, &uids);
+          break;
+        case 5:
+          readPacked(&denseInfo, infoWireType, &userSids);
+          break;
+        default:
+          skipField(&denseInfo, infoWireType);
+        }
+      }
+      if (denseInfo.error) {
+        return -1;
+      }
+      break;
+    }
+    case 8:
+      readPacked(&c, wireType, &lats);
+      break;
+    case 9:
+      readPacked(&c, wireType, &lons);
+      break;
+    case 10:
+      hasKeysVals = readPacked(&c, wireType, &keysVals);
+      break;
+    default:
+      skipField(&c, wireType);
+    }
+  }
+  if (c.error) {
+    return -1;
+  }
+
+  long long id = 0, lat = 0, lon = 0, timestamp = 0, changeset = 0;
+  long long uid = 0, userSid = 0;
+  int error = 0;
+
+  while (!atEnd(&ids)) {
+    id += readSint(&ids);
+    lat += readSint(&lats);
+    lon += readSint(&lons);
+
+    // Writers may leave out any of the DenseInfo columns.
+    struct ElementInfo info = noInfo;
+    if (hasInfo) {
+      if (versions.pos != NULL) {
+        info.version = (int)readVarint(&versions);
+      }
+      if (timestamps.pos != NULL) {
+        timestamp += readSint(&timestamps);
+        info.timestamp = formatTimestamp(d, timestamp, &error);
+      }
+      if (changesets.pos != NULL) {
+        changeset += readSint(&changesets);
+        info.changeset = changeset;
+      }
+      if (uids.pos != NULL) {
+        uid += readSint(&uids);
+        info.uid = (int)uid;
+      }
+      if (userSids.pos != NULL) {
+        userSid += readSint(&userSids);
+        info.user = lookupString(d, (uint64_t)userSid, &error);
+      }
+    }
+
+    int tagCount = 0;
+    readosm_tag *tags = NULL;
+    if (hasKeysVals) {
+      // Tags of one node are key/value string indexes terminated by 0.
+      struct PbfCursor scan = keysVals;
+      while (!atEnd(&scan) && readVarint(&scan) != 0) {
+        readVarint(&scan);
+        tagCount++;
+      }
+      if (tagCount != 0 &&
+          (tags = arenaAlloc(d->arena, sizeof(readosm_tag) * tagCount)) ==
+              NULL) {
+        return -1;
+      }
+      for (int i = 0; i < tagCount; ++i) {
+        tags[i].key = lookupString(d, readVarint(&keysVals), &error);
+        tags[i].value = lookupString(d, readVarint(&keysVals), &error);
+      }
+      if (!atEnd(&keysVals)) {
+        readVarint(&keysVals);
+      }
+    }
+
+    struct OsmElement *element = appendElement(d);
+    if (element == NULL || error || lats.error || lons.error ||
+        keysVals.error || versions.error || timestamps.error ||
+        changesets.error || uids.error || userSids.error) {
+      return -1;
+    }
+
+    readosm_node node = {id,
+                         1e-9 * (d->latOffset + d->granularity * lat),
+                         1e-9 * (d->lonOffset + d->granularity * lon),
+                         info.version,
+                         info.changeset,
+                         info.user,
+                         info.uid,
+                         info.timestamp,
+                         tagCount,
+                         tags};
+    element->type = OSM_ELEMENT_NODE;
+    memcpy(&element->u.node, &node, sizeof(node));
+  }
+
+  return ids.error ? -1 : 0;
+}
+
+static int decodeWay(struct BlockDecoder *d, struct PbfCursor c) {
+  int field, wireType;
+  long long id = 0;
+  struct PbfCursor keys = {NULL, NULL, 0}, values = keys, refs = keys;
+  struct ElementInfo info = noInfo;
+
+  while (nextField(&c, &field, &wireType)) {
+    switch (field) {
+    case 1:
+      id = (long long)readVarint(&c);
+      break;
+    case 2:
+      readPacked(&c, wireType, &keys);
+      break;
+    case 3:
+      readPacked(&c, wireType, &values);
+      break;
+    case 4:
+      if (decodeInfo(d, readBytes(&c), &info) != 0) {
+        return -1;
+      }
+      break;
+    case 8:
+      readPacked(&c, wireType, &refs);
+      break;
+    default:
+      skipField(&c, wireType);
+    }
+  }
+
+  int refCount = countVarints(refs);
+  long long *nodeRefs = NULL;
+  if (refCount > 0) {
+    if ((nodeRefs = arenaAlloc(d->arena, sizeof(long long) * refCount)) ==
+        NULL) {
+      return -1;
+    }
+    long long ref = 0;
+    for (int i = 0; i < refCount; ++i) {
+      ref += readSint(&refs);
+      nodeRefs[i] = ref;
+    }
+  }
+
+  int tagCount;
+  const readosm_tag *tags = decodeTags(d, keys, values, &tagCount);
+  struct OsmElement *element = appendElement(d);
+  if (c.error || refCount < 0 || tagCount < 0 || element == NULL) {
+    return -1;
+  }
+
+  readosm_way way = {id,         info.version,   info.changeset, info.user,
+                     info.uid,   info.timestamp, refCount,       nodeRefs,
+                     tagCount,   tags};
+  element->type = OSM_ELEMENT_WAY;
+  memcpy(&element->u.way, &way, sizeof(way));
+  return 0;
+}
+
+static int decodeRelation(struct BlockDecoder *d, struct PbfCursor c) {
+  static const int memberTypes[] = {READOSM_MEMBER_NODE, READOSM_MEMBER_WAY,
+                                    READOSM_MEMBER_RELATION};
+  int field, wireType;
+  long long id = 0;
+  struct PbfCursor keys = {NULL, NULL, 0}, values = keys, roles = keys,
+                   memberIds = keys, types = keys;
+  struct ElementInfo info = noInfo;
+
+  while (nextField(&c, &field, &wireType)) {
+    switch (field) {
+    case 1:
+      id = (long long)readVarint(&c);
+      break;
+    case 2:
+      readPacked(&c, wireType, &keys);
+      break;
+    case 3:
+      readPacked(&c, wireType, &values);
+      break;
+    case 4:
+      if (decodeInfo(d, readBytes(&c), &info) != 0) {
+        return -1;
+      }
+      break;
+    case 8:
+      readPacked(&c, wireType, &roles);
+      break;
+    case 9:
+      readPacked(&c, wireType, &memberIds);
+      break;
+    case 10:
+      readPacked(&c, wireType, &types);
+      break;
+    default:
+      skipField(&c, wireType);
+    }
+  }
+
+  int memberCount = countVarints(memberIds);
+  readosm_member *members = NULL;
+  int error = 0;
+  if (memberCount > 0) {
+    if ((members = arenaAlloc(d->arena, sizeof(readosm_member) *
+                                            memberCount)) == NULL) {
+      return -1;
+    }
+    long long memberId = 0;
+    for (int i = 0; i < memberCount; ++i) {
+      memberId += readSint(&memberIds);
+      uint64_t type = readVarint(&types);
+      const char *role = lookupString(d, readVarint(&roles), &error);
+      if (type > 2) {
+        error = 1;
+        type = 0;
+      }
+      readosm_member member = {memberTypes[type], memberId, role};
+      memcpy(&members[i], &member, sizeof(member));
+    }
+  }
+
+  int tagCount;
+  const readosm_tag *tags = decodeTags(d, keys, values, &tagCount);
+  struct OsmElement *element = appendElement(d);
+  if (c.error || error || roles.error || types.error || memberCount < 0 ||
+      tagCount < 0 || element == NULL) {
+    return -1;
+  }
+
+  readosm_relation relation = {id,         info.version,   info.changeset,
+                               info.user,  info.uid,       info.timestamp,
+                               memberCount, members,       tagCount,
+                               tags};
+  element->type = OSM_ELEMENT_RELATION;
+  memcpy(&element->u.relation, &relation, sizeof(relation));
+  return 0;
+}
+
+static int decodePrimitiveGroup(struct BlockDecoder *d, struct PbfCursor c) {
+  int field, wireType, ret = 0;
+  while (ret == 0 && nextField(&c, &field, &wireType)) {
+    if (wireType != WIRE_BYTES) {
+      skipField(&c, wireType);
+      continue;
+    }
+    struct PbfCursor message = readBytes(&c);
+    switch (field) {
+    case 1:
+      ret = decodeNode(d, message);
+      break;
+    case 2:
+      ret = decodeDenseNodes(d, message);
+      break;
+    case 3:
+      ret = decodeWay(d, message);
+      break;
+    case 4:
+      ret = decodeRelation(d, message);
+      break;
+    default:
+      // Changesets are not imported.
+      break;
+    }
+  }
+  return c.error ? -1 : ret;
+}
+
+static int decodePrimitiveBlock(struct BlockDecoder *d, struct PbfCursor c) {
+  int field, wireType;
+  struct PbfCursor stringTable = {NULL, NULL, 1};
+
+  d->granularity = 100;
+  d->latOffset = 0;
+  d->lonOffset = 0;
+  d->dateGranularity = 1000;
+
+  // The scalars usually follow the groups, so collect them first.
+  struct PbfCursor scan = c;
+  while (nextField(&scan, &field, &wireType)) {
+    switch (field) {
+    case 1:
+      stringTable = readBytes(&scan);
+      break;
+    case 17:
+      d->granularity = (long long)readVarint(&scan);
+      break;
+    case 18:
+      d->dateGranularity = (long long)readVarint(&scan);
+      break;
+    case 19:
+      d->latOffset = (long long)readVarint(&scan);
+      break;
+    case 20:
+      d->lonOffset = (long long)readVarint(&scan);
+      break;
+    default:
+      skipField(&scan, wireType);
+    }
+  }
+  if (scan.error || stringTable.error ||
+      decodeStringTable(d, stringTable) != 0) {
+    return -1;
+  }
+
+  while (nextField(&c, &field, &wireType)) {
+    if (field == 2 && wireType == WIRE_BYTES) {
+      if (decodePrimitiveGroup(d, readBytes(&c)) != 0) {
+        return -1;
+      }
+    } else {
+      skipField(&c, wireType);
+    }
+  }
+  return c.error ? -1 : 0;
+}
+
+// Extracts the payload of a Blob message, inflating it into *buffer if it
+// is zlib-compressed. Returns READOSM_OK or a READOSM_* error.
+static int unpackBlob(const uint8_t *blob, size_t size, uint8_t **buffer,
+                      size_t *capacity, struct PbfCursor *payload) {
+  struct PbfCursor c = {blob, blob + size, 0};
+  struct PbfCursor raw = {NULL, NULL, 1}, zlibData = raw;
+  uint64_t rawSize = 0;
+  int field, wireType;
+
+  while (nextField(&c, &field, &wireType)) {
+    switch (field) {
+    case 1:
+      raw = readBytes(&c);
+      break;
+    case 2:
+      rawSize = readVarint(&c);
+      break;
+    case 3:
+      zlibData = readBytes(&c);
+      break;
+    default:
+      // lzma, bzip2, lz4 and zstd payloads are not supported.
+      skipField(&c, wireType);
+    }
+  }
+  if (c.error) {
+    return READOSM_INVALID_PBF_HEADER;
+  }
+
+  if (!raw.error) {
+    *payload = raw;
+    return READOSM_OK;
+  }
+  if (zlibData.error || rawSize > MAX_BLOB_SIZE) {
+    return READOSM_INVALID_PBF_HEADER;
+  }
+
+  if (*capacity < rawSize) {
+    uint8_t *grown = realloc(*buffer, rawSize);
+    if (grown == NULL) {
+      return READOSM_INSUFFICIENT_MEMORY;
+    }
+    *buffer = grown;
+    *capacity = rawSize;
+  }
+
+  uLongf inflated = rawSize;
+  if (uncompress(*buffer, &inflated, zlibData.pos,
+                 zlibData.end - zlibData.pos) != Z_OK ||
+      inflated != rawSize) {
+    return READOSM_UNZIP_ERROR;
+  }
+
+  payload->pos = *buffer;
+  payload->end = *buffer + rawSize;
+  payload->error = 0;
+  return READOSM_OK;
+}
+
+enum SlotState { SLOT_FREE, SLOT_PENDING, SLOT_DECODING, SLOT_DONE };
+
+struct BlobSlot {
+  enum SlotState state;
+  int result;
+  long long offset;
+
+  uint8_t *blob;
+  size_t blobSize;
+  size_t blobCapacity;
+  uint8_t *inflated;
+  size_t inflatedCapacity;
+
+  struct Arena arena;
+  struct OsmElement *elements;
+  int count;
+  int capacity;
+};
+
+struct PbfReader {
+  FILE *file;
+  int slotCount;
+  struct BlobSlot *slots;
+
+  // Sequence numbers of blobs read, handed to a worker and delivered.
+  unsigned long nextRead;
+  unsigned long nextDecode;
+  unsigned long nextDeliver;
+
+  pthread_mutex_t mutex;
+  pthread_cond_t workAvailable;
+  pthread_cond_t slotDone;
+  int stopping;
+
+  pthread_t *workers;
+  int workerCount;
+};
+
+static void decodeSlot(struct BlobSlot *slot) {
+  struct PbfCursor payload;
+  slot->result = unpackBlob(slot->blob, slot->blobSize, &slot->inflated,
+                            &slot->inflatedCapacity, &payload);
+  if (slot->result != READOSM_OK) {
+    return;
+  }
+
+  struct BlockDecoder decoder;
+  memset(&decoder, 0, sizeof(decoder));
+  decoder.arena = &slot->arena;
+  decoder.elements = slot->elements;
+  decoder.capacity = slot->capacity;
+
+  if (decodePrimitiveBlock(&decoder, payload) != 0) {
+    slot->result = READOSM_INVALID_PBF_HEADER;
+  }
+
+  slot->elements = decoder.elements;
+  slot->capacity = decoder.capacity;
+  slot->count = decoder.count;
+}
+
+static void *workerMain(void *arg) {
+  struct PbfReader *reader = arg;
+
+  pthread_mutex_lock(&reader->mutex);
+  for (;;) {
+    while (!reader->stopping && reader->nextDecode == reader->nextRead) {
+      pthread_cond_wait(&reader->workAvailable, &reader->mutex);
+    }
+    if (reader->stopping) {
+      break;
+    }
+
+    struct BlobSlot *slot =
+        &reader->slots[reader->nextDecode++ % reader->slotCount];
+    slot->state = SLOT_DECODING;
+    pthread_mutex_unlock(&reader->mutex);
+
+    decodeSlot(slot);
+
+    pthread_mutex_lock(&reader->mutex);
+    slot->state = SLOT_DONE;
+    pthread_cond_broadcast(&reader->slotDone);
+  }
+  pthread_mutex_unlock(&reader->mutex);
+  return NULL;
+}
+
+static int readFully(FILE *file, void *buffer, size_t size) {
+  return fread(buffer, 1, size, file) == size;
+}
+
+// Reads the next BlobHeader and its Blob into slot. Returns READOSM_OK,
+// READOSM_ABORT at a clean end of file, or an error.
+static int readBlob(FILE *file, struct BlobSlot *slot, char *type,
+                    size_t typeSize) {
+  uint8_t lengthBytes[4];
+  uint8_t header[MAX_BLOB_HEADER_SIZE];
+
+  slot->offset = ftello(file);
+  size_t got = fread(lengthBytes, 1, 4, file);
+  if (got == 0 && feof(file)) {
+    return READOSM_ABORT;
+  }
+  if (got != 4) {
+    return READOSM_READ_ERROR;
+  }
+
+  uint32_t headerSize = (uint32_t)lengthBytes[0] << 24 |
+                        (uint32_t)lengthBytes[1] << 16 |
+                        (uint32_t)lengthBytes[2] << 8 | lengthBytes[3];
+  if (headerSize > MAX_BLOB_HEADER_SIZE) {
+    return READOSM_INVALID_PBF_HEADER;
+  }
+  if (!readFully(file, header, headerSize)) {
+    return READOSM_READ_ERROR;
+  }
+
+  struct PbfCursor c = {header, header + headerSize, 0};
+  uint64_t dataSize = 0;
+  int field, wireType;
+  type[0] = '\0';
+  while (nextField(&c, &field, &wireType)) {
+    if (field == 1 && wireType == WIRE_BYTES) {
+      struct PbfCursor s = readBytes(&c);
+      size_t length = s.end - s.pos;
+      if (length >= typeSize) {
+        length = typeSize - 1;
+      }
+      memcpy(type, s.pos, length);
+      type[length] = '\0';
+    } else if (field == 3 && wireType == WIRE_VARINT) {
+      dataSize = readVarint(&c);
+    } else {
+      skipField(&c, wireType);
+    }
+  }
+  if (c.error || dataSize > MAX_BLOB_SIZE) {
+    return READOSM_INVALID_PBF_HEADER;
+  }
+
+  if (slot->blobCapacity < dataSize) {
+    uint8_t *grown = realloc(slot->blob, dataSize);
+    if (grown == NULL) {
+      return READOSM_INSUFFICIENT_MEMORY;
+    }
+    slot->blob = grown;
+    slot->blobCapacity = dataSize;
+  }
+  if (!readFully(file, slot->blob, dataSize)) {
+    return READOSM_READ_ERROR;
+  }
+  slot->blobSize = dataSize;
+  return READOSM_OK;
+}
+
+static int checkHeaderBlock(struct BlobSlot *slot) {
+  static const char *supported[] = {"OsmSchema-V0.6", "DenseNodes"};
+  struct PbfCursor payload;
+  int ret = unpackBlob(slot->blob, slot->blobSize, &slot->inflated,
+                       &slot->inflatedCapacity, &payload);
+  if (ret != READOSM_OK) {
+    return ret;
+  }
+
+  int field, wireType;
+  while (nextField(&payload, &field, &wireType)) {
+    if (field != 4 || wireType != WIRE_BYTES) {
+      skipField(&payload, wireType);
+      continue;
+    }
+    struct PbfCursor feature = readBytes(&payload);
+    size_t length = feature.end - feature.pos;
+    int known = 0;
+    for (int i = 0; i < sizeof(supported) / sizeof(supported[0]); ++i) {
+      if (strlen(supported[i]) == length &&
+          memcmp(supported[i], feature.pos, length) == 0) {
+        known = 1;
+      }
+    }
+    if (!known) {
+      fprintf(stderr, "pbfParse: Unsupported required feature %.*s\n",
+              (int)length, (const char *)feature.pos);
+      return READOSM_INVALID_PBF_HEADER;
+    }
+  }
+  return payload.error ? READOSM_INVALID_PBF_HEADER : READOSM_OK;
+}
+
+static int deliverSlot(struct BlobSlot *slot, const void *user_data,
+                       readosm_node_callback node_fnct,
+                       readosm_way_callback way_fnct,
+                       readosm_relation_callback relation_fnct) {
+  for (int i = 0; i < slot->count; ++i) {
+    struct OsmElement *element = &slot->elements[i];
+    int ret = READOSM_OK;
+    switch (element->type) {
+    case OSM_ELEMENT_NODE:
+      if (node_fnct != NULL) {
+        ret = node_fnct(user_data, &element->u.node);
+      }
+      break;
+    case OSM_ELEMENT_WAY:
+      if (way_fnct != NULL) {
+        ret = way_fnct(user_data, &element->u.way);
+      }
+      break;
+    case OSM_ELEMENT_RELATION:
+      if (relation_fnct != NULL) {
+        ret = relation_fnct(user_data, &element->u.relation);
+      }
+      break;
+    }
+    if (ret != READOSM_OK) {
+      return READOSM_ABORT;
+    }
+  }
+  return READOSM_OK;
+}
+
+static void resetSlot(struct BlobSlot *slot) {
+  slot->state = SLOT_FREE;
+  slot->count = 0;
+  arenaReset(&slot->arena);
+}
+
+static void stopWorkers(struct PbfReader *reader) {
+  pthread_mutex_lock(&reader->mutex);
+  reader->stopping = 1;
+  pthread_cond_broadcast(&reader->workAvailable);
+  pthread_mutex_unlock(&reader->mutex);
+  for (int i = 0; i < reader->workerCount; ++i) {
+    pthread_join(reader->workers[i], NULL);
+  }
+  reader->workerCount = 0;
+}
+
+static void freeReader(struct PbfReader *reader) {
+  if (reader->slots != NULL) {
+    for (int i = 0; i < reader->slotCount; ++i) {
+      struct BlobSlot *slot = &reader->slots[i];
+      free(slot->blob);
+      free(slot->inflated);
+      free(slot->elements);
+      arenaFree(&slot->arena);
+    }
+  }
+  free(reader->slots);
+  memoryBudgetRelease(MEMORY_PBF,
+                      (long long)reader->slotCount * SLOT_BUDGET_BYTES);
+  free(reader->workers);
+  if (reader->file != NULL) {
+    fclose(reader->file);
+  }
+  pthread_mutex_destroy(&reader->mutex);
+  pthread_cond_destroy(&reader->workAvailable);
+  pthread_cond_destroy(&reader->slotDone);
+}
+
+static int runReader(struct PbfReader *reader, const struct PbfOptions *options,
+                     const void *user_data, readosm_node_callback node_fnct,
+                     readosm_way_callback way_fnct,
+                     readosm_relation_callback relation_fnct) {
+  char type[32];
+  int ret;
+
+  // The OSMHeader blob always comes first; it is checked synchronously.
+  struct BlobSlot *first = &reader->slots[0];
+  if ((ret = readBlob(reader->file, first, type, sizeof(type))) != READOSM_OK) {
+    return ret == READOSM_ABORT ? READOSM_INVALID_PBF_HEADER : ret;
+  }
+  if (strcmp(type, "OSMHeader") != 0) {
+    return READOSM_INVALID_PBF_HEADER;
+  }
+  if ((ret = checkHeaderBlock(first)) != READOSM_OK) {
+    return ret;
+  }
+
+  if (options->startOffset > 0 &&
+      fseeko(reader->file, options->startOffset, SEEK_SET) != 0) {
+    return READOSM_READ_ERROR;
+  }
+
+  int endOfFile = 0;
+  for (;;) {
+    // Keep every slot busy; stop reading early if the oldest blob is ready
+    // so delivery is not delayed by a long read-ahead.
+    while (!endOfFile && reader->nextRead - reader->nextDeliver <
+                             (unsigned long)reader->slotCount) {
+      struct BlobSlot *slot =
+          &reader->slots[reader->nextRead % reader->slotCount];
+      ret = readBlob(reader->file, slot, type, sizeof(type));
+      if (ret == READOSM_ABORT) {
+        endOfFile = 1;
+        break;
+      }
+      if (ret != READOSM_OK) {
+        return ret;
+      }
+      if (strcmp(type, "OSMData") != 0) {
+        continue;
+      }
+
+      pthread_mutex_lock(&reader->mutex);
+      slot->state = SLOT_PENDING;
+      reader->nextRead++;
+      pthread_cond_signal(&reader->workAvailable);
+      int oldestReady =
+          reader->slots[reader->nextDeliver % reader->slotCount].state ==
+          SLOT_DONE;
+      pthread_mutex_unlock(&reader->mutex);
+      if (oldestReady) {
+        break;
+      }
+    }
+
+    if (reader->nextDeliver == reader->nextRead) {
+      return READOSM_OK;
+    }
+
+    struct BlobSlot *slot =
+        &reader->slots[reader->nextDeliver % reader->slotCount];
+    pthread_mutex_lock(&reader->mutex);
+    while (slot->state != SLOT_DONE) {
+      pthread_cond_wait(&reader->slotDone, &reader->mutex);
+    }
+    pthread_mutex_unlock(&reader->mutex);
+
+    if (slot->result != READOSM_OK) {
+      fprintf(stderr, "pbfParse: Failed to decode blob at offset %lld\n",
+              slot->offset);
+      return slot->result;
+    }
+
+    if (options->blobOffset != NULL) {
+      *options->blobOffset = slot->offset;
+    }
+    if ((ret = deliverSlot(slot, user_data, node_fnct, way_fnct,
+                           relation_fnct)) != READOSM_OK) {
+      return ret;
+    }
+    resetSlot(slot);
+    reader->nextDeliver++;
+  }
+}
+
+int pbfParse(const char *path, const struct PbfOptions *options,
+             const void *user_data, readosm_node_callback node_fnct,
+             readosm_way_callback way_fnct,
+             readosm_relation_callback relation_fnct) {
+  struct PbfReader reader;
+  memset(&reader, 0, sizeof(reader));
+  pthread_mutex_init(&reader.mutex, NULL);
+  pthread_cond_init(&reader.workAvailable, NULL);
+  pthread_cond_init(&reader.slotDone, NULL);
+
+  int threads = options->threads > 0 ? options->threads : 1;
+  int ret = READOSM_OK;
+
+  if ((reader.file = fopen(path, "rb")) == NULL) {
+    freeReader(&reader);
+    return READOSM_FILE_NOT_FOUND;
+  }
+
+  // Under a memory budget fewer blocks are decoded ahead, down to two.
+  for (reader.slotCount = 0; reader.slotCount < threads * SLOTS_PER_THREAD;
+       ++reader.slotCount) {
+    if (reader.slotCount < 2) {
+      memoryBudgetCharge(MEMORY_PBF, SLOT_BUDGET_BYTES);
+    } else if (!memoryBudgetReserve(MEMORY_PBF, SLOT_BUDGET_BYTES)) {
+      break;
+    }
+  }
+  reader.slots = calloc(reader.slotCount, sizeof(struct BlobSlot));
+  reader.workers = calloc(threads, sizeof(pthread_t));
+  if (reader.slots == NULL || reader.workers == NULL) {
+    freeReader(&reader);
+    return READOSM_INSUFFICIENT_MEMORY;
+  }
+  for (int i = 0; i < reader.slotCount; ++i) {
+    arenaInit(&reader.slots[i].arena, ARENA_CHUNK_SIZE);
+  }
+
+  for (int i = 0; i < threads; ++i) {
+    if (pthread_create(&reader.workers[i], NULL, workerMain, &reader) != 0) {
+      ret = READOSM_ABORT;
+      break;
+    }
+    reader.workerCount++;
+  }
+
+  if (ret == READOSM_OK) {
+    ret = runReader(&reader, options, user_data, node_fnct, way_fnct,
+                    relation_fnct);
+  }
+
+  stopWorkers(&reader);
+  freeReader(&reader);
+  return ret;
+}
+
+int pbfIsPbfPath(const char *path) {
+  size_t length = strlen(path);
+  return length >= 4 && strcmp(path + length - 4, ".pbf") == 0;
+}
@@ -0,0 +1,29 @@
+#ifndef PBF_H
+#define PBF_H
+
+#include <readosm.h>
+
+// Native .osm.pbf reader. Blob headers are read sequentially on the calling
+// thread; inflating and decoding the PrimitiveBlocks runs on a worker pool.
+// Elements are delivered to the callbacks on the calling thread in file
+// order, the same contract as readosm_parse.
+struct PbfOptions {
+  int threads;
+  // Offset of the first data blob to decode (0 = start of file). Must be a
+  // value previously reported through blobOffset.
+  long long startOffset;
+  // Updated with the file offset of the blob whose elements are being
+  // delivered, before the first callback for that blob.
+  long long *blobOffset;
+};
+
+// Returns READOSM_OK or a READOSM_* error code. READOSM_ABORT means a
+// callback stopped the parse.
+int pbfParse(const char *path, const struct PbfOptions *options,
+             const void *user_data, readosm_node_callback node_fnct,
+             readosm_way_callback way_fnct,
+             readosm_relation_callback relation_fnct);
+
+int pbfIsPbfPath(const char *path);
+
+#endif
@@ -0,0 +1,434 @@
+#include "pipeline.h"
+#include "arena.h"
+#include "memory_budget.h"
+#include "osm_element.h"
+#include "timing.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ARENA_CHUNK_SIZE (256 * 1024)
+
+struct QueuedElement {
+  struct OsmElement element;
+  long long position;
+};
+
+struct ElementBatch {
+  int count;
+  struct QueuedElement *elements;
+  struct Arena arena;
+};
+
+struct Pipeline {
+  struct PipelineOptions options;
+  struct ElementBatch *slots;
+
+  // head is written only by the producer and tail only by the writer. A slot
+  // belongs to the producer while head - tail < queueDepth.
+  _Atomic unsigned long head;
+  _Atomic unsigned long tail;
+  atomic_int closed;
+  atomic_int failed;
+
+  const void *sinkData;
+  readosm_node_callback nodeSink;
+  readosm_way_callback waySink;
+  readosm_relation_callback relationSink;
+
+  // Slots counted against the memory budget.
+  long long reservedBytes;
+
+  pthread_t writer;
+  int writerResult;
+  long long writerPosition;
+
+  long long batches;
+  long long elements;
+  double producerBlockedSeconds;
+  double writerBlockedSeconds;
+};
+
+// Spin briefly, then yield, then sleep with a growing interval. Queue waits
+// are either very short (the other side is mid-batch) or long (one side is
+// the bottleneck), and the latter should not burn a core.
+static void backoff(int *attempt) {
+  int n = (*attempt)++;
+  if (n < 64) {
+    return;
+  }
+  if (n < 128) {
+    sched_yield();
+    return;
+  }
+  long micros = 20L << (n - 128 < 6 ? n - 128 : 6);
+  struct timespec ts = {0, micros * 1000};
+  nanosleep(&ts, NULL);
+}
+
+static void *writerMain(void *arg) {
+  struct Pipeline *pipeline = arg;
+  unsigned long depth = pipeline->options.queueDepth;
+  int result = READOSM_OK;
+
+  for (;;) {
+    unsigned long tail = atomic_load_explicit(&pipeline->tail,
+                                              memory_order_relaxed);
+    unsigned long head = atomic_load_explicit(&pipeline->head,
+                                              memory_order_acquire);
+    if (tail == head) {
+      if (atomic_load_explicit(&pipeline->closed, memory_order_acquire)) {
+        // Re-check: the final batch may have been published just before
+        // closed was set.
+        if (tail == atomic_load_explicit(&pipeline->head,
+                                         memory_order_acquire)) {
+          break;
+        }
+        continue;
+      }
+
+      double started = monotonicSeconds();
+      int attempt = 0;
+      while (tail == atomic_load_explicit(&pipeline->head,
+                                          memory_order_acquire) &&
+             !atomic_load_explicit(&pipeline->closed, memory_order_acquire)) {
+        backoff(&attempt);
+      }
+      pipeline->writerBlockedSeconds += monotonicSeconds() - started;
+      continue;
+    }
+
+    struct ElementBatch *batch = &pipeline->slots[tail % depth];
+    for (int i = 0; i < batch->count && result == READOSM_OK; ++i) {
+      struct OsmElement *element = &batch->elements[i].element;
+      pipeline->writerPosition = batch->elements[i].position;
+      switch (element->type) {
+      case OSM_ELEMENT_NODE:
+        result = pipeline->nodeSink(pipeline->sinkData, &element->u.node);
+        break;
+      case OSM_ELEMENT_WAY:
+        result = pipeline->waySink(pipeline->sinkData, &element->u.way);
+        break;
+      case OSM_ELEMENT_RELATION:
+        result = pipeline->relationSink(pipeline->sinkData,
+                                        &element->u.relation);
+        break;
+      }
+    }
+    pipeline->elements += batch->count;
+    pipeline->batches++;
+    batch->count = 0;
+    arenaReset(&batch->arena);
+    atomic_store_explicit(&pipeline->tail, tail + 1, memory_order_release);
+
+    if (result != READOSM_OK) {
+      // Keep draining so the producer never waits on a dead consumer, but
+      // stop calling the sinks.
+      atomic_store_explicit(&pipeline->failed, 1, memory_order_release);
+      pipeline->writerResult = result;
+      break;
+    }
+  }
+
+  if (result != READOSM_OK) {
+    for (;;) {
+      unsigned long tail = atomic_load_explicit(&pipeline->tail,
+                                                memory_order_relaxed);
+      if (tail != atomic_load_explicit(&pipeline->head,
+                                       memory_order_acquire)) {
+        struct ElementBatch *batch =
+            &pipeline->slots[tail % pipeline->options.queueDepth];
+        batch->count = 0;
+        arenaReset(&batch->arena);
+        atomic_store_explicit(&pipeline->tail, tail + 1,
+                              memory_order_release);
+        continue;
+      }
+      if (atomic_load_explicit(&pipeline->closed, memory_order_acquire)) {
+        break;
+      }
+      int attempt = 64;
+      backoff(&attempt);
+    }
+  }
+
+  return NULL;
+}
+
+int pipelineStart(struct Pipeline **out, const struct PipelineOptions *options,
+                  const void *sinkData, readosm_node_callback nodeSink,
+                  readosm_way_callback waySink,
+                  readosm_relation_callback relationSink) {
+  struct Pipeline *pipeline = calloc(1, sizeof(struct Pipeline));
+  if (pipeline == NULL) {
+    return READOSM_INSUFFICIENT_MEMORY;
+  }
+
+  pipeline->options = *options;
+  pipeline->sinkData = sinkData;
+  pipeline->nodeSink = nodeSink;
+  pipeline->waySink = waySink;
+  pipeline->relationSink = relationSink;
+  atomic_init(&pipeline->head, 0);
+  atomic_init(&pipeline->tail, 0);
+  atomic_init(&pipeline->closed, 0);
+  atomic_init(&pipeline->failed, 0);
+
+  // Under a memory budget the ring gets the slots that fit, but at least
+  // two so parsing and writing still overlap.
+  long long slotBytes = ARENA_CHUNK_SIZE + sizeof(struct QueuedElement) *
+                                               (long long)options->batchSize;
+  int depth;
+  for (depth = 0; depth < options->queueDepth; ++depth) {
+    if (depth < 2) {
+      memoryBudgetCharge(MEMORY_PIPELINE, slotBytes);
+    } else if (!memoryBudgetReserve(MEMORY_PIPELINE, slotBytes)) {
+      break;
+    }
+  }
+  pipeline->options.queueDepth = depth;
+  pipeline->reservedBytes = slotBytes * depth;
+
+  pipeline->slots = calloc(depth, sizeof(struct ElementBatch));
+  if (pipeline->slots == NULL) {
+    pipelineFree(pipeline);
+    return READOSM_INSUFFICIENT_MEMORY;
+  }
+
+  for (int i = 0; i < depth; ++i) {
+    struct ElementBatch *batch = &pipeline->slots[i];
+    arenaInit(&batch->arena, ARENA_CHUNK_SIZE);
+    batch->elements =
+        malloc(sizeof(struct QueuedElement) * (size_t)options->batchSize);
+    if (batch->elements == NULL) {
+      pipelineFree(pipeline);
+      return READOSM_INSUFFICIENT_MEMORY;
+    }
+  }
+
+  if (pthread_create(&pipeline->writer, NULL, writerMain, pipeline) != 0) {
+    fprintf(stderr, "pipelineStart: Failed to start writer thread\n");
+    pipelineFree(pipeline);
+    return READOSM_ABORT;
+  }
+
+  *out = pipeline;
+  return READOSM_OK;
+}
+
+// Returns the batch the producer is filling, waiting for the writer to free
+// a slot if the ring is full.
+static struct ElementBatch *producerBatch(struct Pipeline *pipeline) {
+  unsigned long depth = pipeline->options.queueDepth;
+  unsigned long head =
+      atomic_load_explicit(&pipeline->head, memory_order_relaxed);
+
+  if (head - atomic_load_explicit(&pipeline->tail, memory_order_acquire) >=
+      depth) {
+    double started = monotonicSeconds();
+    int attempt = 0;
+    while (head - atomic_load_explicit(&pipeline->tail,
+                                       memory_order_acquire) >=
+           depth) {
+      backoff(&attempt);
+    }
+    pipeline->producerBlockedSeconds += monotonicSeconds() - started;
+  }
+
+  return &pipeline->slots[head % depth];
+}
+
+static void publish(struct Pipeline *pipeline) {
+  unsigned long head =
+      atomic_load_explicit(&pipeline->head, memory_order_relaxed);
+  atomic_store_explicit(&pipeline->head, head + 1, memory_order_release);
+}
+
+// The copy* helpers set *failed when the arena runs out of memory, so an
+// element is never queued with a NULL array behind a non-zero count.
+static const char *copyString(struct Arena *arena, const char *str,
+                              int *failed) {
+  const char *copy = arenaStrdup(arena, str);
+  if (copy == NULL && str != NULL) {
+    *failed = 1;
+  }
+  return copy;
+}
+
+static void *copyArray(struct Arena *arena, const void *items, int count,
+                       size_t size, int *failed) {
+  if (count == 0) {
+    return NULL;
+  }
+  void *copy = arenaAlloc(arena, size * count);
+  if (copy == NULL) {
+    *failed = 1;
+    return NULL;
+  }
+  memcpy(copy, items, size * count);
+  return copy;
+}
+
+static const readosm_tag *copyTags(struct Arena *arena, int count,
+                                   const readosm_tag *tags, int *failed) {
+  readosm_tag *copy =
+      copyArray(arena, tags, count, sizeof(readosm_tag), failed);
+  if (copy == NULL) {
+    return NULL;
+  }
+  for (int i = 0; i < count; ++i) {
+    copy[i].key = copyString(arena, tags[i].key, failed);
+    copy[i].value = copyString(arena, tags[i].value, failed);
+  }
+  return copy;
+}
+
+static const readosm_member *copyMembers(struct Arena *arena, int count,
+                                         const readosm_member *members,
+                                         int *failed) {
+  readosm_member *copy =
+      copyArray(arena, members, count, sizeof(readosm_member), failed);
+  if (copy == NULL) {
+    return NULL;
+  }
+  for (int i = 0; i < count; ++i) {
+    readosm_member member = {members[i].member_type, members[i].id,
+                             copyString(arena, members[i].role, failed)};
+    memcpy(&copy[i], &member, sizeof(member));
+  }
+  return copy;
+}
+
+static int afterPush(struct Pipeline *pipeline, struct ElementBatch *batch) {
+  if (pipeline->options.sourcePosition != NULL) {
+    batch->elements[batch->count].position = *pipeline->options.sourcePosition;
+  }
+  if (++batch->count == pipeline->options.batchSize) {
+    publish(pipeline);
+  }
+  if (atomic_load_explicit(&pipeline->failed, memory_order_acquire)) {
+    return READOSM_ABORT;
+  }
+  return READOSM_OK;
+}
+
+int pipelinePushNode(struct Pipeline *pipeline, const readosm_node *node) {
+  struct ElementBatch *batch = producerBatch(pipeline);
+  struct Arena *arena = &batch->arena;
+  int failed = 0;
+  readosm_node copy = {node->id,
+                       node->latitude,
+                       node->longitude,
+                       node->version,
+                       node->changeset,
+                       copyString(arena, node->user, &failed),
+                       node->uid,
+                       copyString(arena, node->timestamp, &failed),
+                       node->tag_count,
+                       copyTags(arena, node->tag_count, node->tags, &failed)};
+  if (failed) {
+    return READOSM_INSUFFICIENT_MEMORY;
+  }
+
+  struct OsmElement *element = &batch->elements[batch->count].element;
+  element->type = OSM_ELEMENT_NODE;
+  memcpy(&element->u.node, &copy, sizeof(copy));
+  return afterPush(pipeline, batch);
+}
+
+int pipelinePushWay(struct Pipeline *pipeline, const readosm_way *way) {
+  struct ElementBatch *batch = producerBatch(pipeline);
+  struct Arena *arena = &batch->arena;
+  int failed = 0;
+  readosm_way copy = {way->id,
+                      way->version,
+                      way->changeset,
+                      copyString(arena, way->user, &failed),
+                      way->uid,
+                      copyString(arena, way->timestamp, &failed),
+                      way->node_ref_count,
+                      copyArray(arena, way->node_refs, way->node_ref_count,
+                                sizeof(long long), &failed),
+                      way->tag_count,
+                      copyTags(arena, way->tag_count, way->tags, &failed)};
+  if (failed) {
+    return READOSM_INSUFFICIENT_MEMORY;
+  }
+
+  struct OsmElement *element = &batch->elements[batch->count].element;
+  element->type = OSM_ELEMENT_WAY;
+  memcpy(&element->u.way, &copy, sizeof(copy));
+  return afterPush(pipeline, batch);
+}
+
+int pipelinePushRelation(struct Pipeline *pipeline,
+                         const readosm_relation *relation) {
+  struct ElementBatch *batch = producerBatch(pipeline);
+  struct Arena *arena = &batch->arena;
+  int failed = 0;
+  readosm_relation copy = {
+      relation->id,
+      relation->version,
+      relation->changeset,
+      copyString(arena, relation->user, &failed),
+      relation->uid,
+      copyString(arena, relation->timestamp, &failed),
+      relation->member_count,
+      copyMembers(arena, relation->member_count, relation->members, &failed),
+      relation->tag_count,
+      copyTags(arena, relation->tag_count, relation->tags, &failed)};
+  if (failed) {
+    return READOSM_INSUFFICIENT_MEMORY;
+  }
+
+  struct OsmElement *element = &batch->elements[batch->count].element;
+  element->type = OSM_ELEMENT_RELATION;
+  memcpy(&element->u.relation, &copy, sizeof(copy));
+  return afterPush(pipeline, batch);
+}
+
+int pipelineFinish(struct Pipeline *pipeline) {
+  unsigned long head =
+      atomic_load_explicit(&pipeline->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&pipeline->tail, memory_order_acquire) <
+          (unsigned long)pipeline->options.queueDepth &&
+      pipeline->slots[head % pipeline->options.queueDepth].count != 0) {
+    publish(pipeline);
+  }
+
+  atomic_store_explicit(&pipeline->closed, 1, memory_order_release);
+  pthread_join(pipeline->writer, NULL);
+  return pipeline->writerResult;
+}
+
+long long pipelineWriterPosition(const struct Pipeline *pipeline) {
+  return pipeline->writerPosition;
+}
+
+void pipelineGetStats(const struct Pipeline *pipeline,
+                      struct PipelineStats *stats) {
+  stats->batches = pipeline->batches;
+  stats->elements = pipeline->elements;
+  stats->producerBlockedSeconds = pipeline->producerBlockedSeconds;
+  stats->writerBlockedSeconds = pipeline->writerBlockedSeconds;
+}
+
+void pipelineFree(struct Pipeline *pipeline) {
+  if (pipeline == NULL) {
+    return;
+  }
+  if (pipeline->slots != NULL) {
+    for (int i = 0; i < pipeline->options.queueDepth; ++i) {
+      free(pipeline->slots[i].elements);
+      arenaFree(&pipeline->slots[i].arena);
+    }
+    free(pipeline->slots);
+  }
+  memoryBudgetRelease(MEMORY_PIPELINE, pipeline->reservedBytes);
+  free(pipeline);
+}
@@ -0,0 +1,54 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <readosm.h>
+
+// Producer/consumer bridge between readosm_parse and the SQLite writer.
+//
+// The parsing thread copies every element into a batch and publishes full
+// batches through a bounded single-producer/single-consumer ring. A writer
+// thread drains the ring and hands the copies to the sink callbacks, so the
+// callbacks see exactly the sequence readosm produced, just on another core.
+struct PipelineOptions {
+  // Upper bound; the ring is shorter when the memory budget runs out.
+  int queueDepth;
+  int batchSize;
+  // Optional producer-side input position (e.g. a PBF blob offset), sampled
+  // for every pushed element; see pipelineWriterPosition.
+  const long long *sourcePosition;
+};
+
+struct PipelineStats {
+  long long batches;
+  long long elements;
+  double producerBlockedSeconds;
+  double writerBlockedSeconds;
+};
+
+struct Pipeline;
+
+int pipelineStart(struct Pipeline **pipeline,
+                  const struct PipelineOptions *options, const void *sinkData,
+                  readosm_node_callback nodeSink, readosm_way_callback waySink,
+                  readosm_relation_callback relationSink);
+
+// Push functions have readosm callback semantics: they return READOSM_OK, or
+// READOSM_ABORT once the writer has failed so the parser stops early.
+int pipelinePushNode(struct Pipeline *pipeline, const readosm_node *node);
+int pipelinePushWay(struct Pipeline *pipeline, const readosm_way *way);
+int pipelinePushRelation(struct Pipeline *pipeline,
+                         const readosm_relation *relation);
+
+// Publishes the last partial batch, waits for the writer to drain the queue
+// and returns READOSM_OK or the first error a sink callback reported.
+int pipelineFinish(struct Pipeline *pipeline);
+
+// Input position of the element the writer is currently passing to a sink.
+// Only meaningful when called from inside a sink callback.
+long long pipelineWriterPosition(const struct Pipeline *pipeline);
+
+void pipelineGetStats(const struct Pipeline *pipeline,
+                      struct PipelineStats *stats);
+void pipelineFree(struct Pipeline *pipeline);
+
+#endif
@@ -0,0 +1,144 @@
+#include "pragma_profile.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static const struct PragmaProfile profiles[] = {
+    {"default", 0, NULL, NULL, NULL, 0, 0, NULL},
+    {"bulk", 16384, "OFF", "OFF", "EXCLUSIVE", 1024 * 1024, 1LL << 30,
+     "MEMORY"},
+};
+
+const struct PragmaProfile *pragmaProfileFind(const char *name) {
+  for (int i = 0; i < sizeof(profiles) / sizeof(profiles[0]); ++i) {
+    if (strcmp(profiles[i].name, name) == 0) {
+      return &profiles[i];
+    }
+  }
+  return NULL;
+}
+
+static int execPragma(sqlite3 *db, const char *query) {
+  char *errMsg = NULL;
+  int ret = sqlite3_exec(db, query, NULL, NULL, &errMsg);
+  if (ret != SQLITE_OK) {
+    fprintf(stderr, "sqlite3_exec error: %s, running query\"%s\"\n", errMsg,
+            query);
+    sqlite3_free(errMsg);
+  }
+  return ret;
+}
+
+int pragmaProfileApply(sqlite3 *db, const struct PragmaProfile *profile) {
+  char query[128];
+  int ret;
+
+  if (profile->pageSize != 0) {
+    snprintf(query, sizeof(query), "PRAGMA page_size = %d;", profile->pageSize);
+    if ((ret = execPragma(db, query)) != SQLITE_OK) {
+      return ret;
+    }
+  }
+
+  if (profile->journalMode != NULL) {
+    snprintf(query, sizeof(query), "PRAGMA journal_mode = %s;",
+             profile->journalMode);
+    if ((ret = execPragma(db, query)) != SQLITE_OK) {
+      return ret;
+    }
+  }
+
+  if (profile->synchronous != NULL) {
+    snprintf(query, sizeof(query), "PRAGMA synchronous = %s;",
+             profile->synchronous);
+    if ((ret = execPragma(db, query)) != SQLITE_OK) {
+      return ret;
+    }
+  }
+
+  if (profile->lockingMode != NULL) {
+    snprintf(query, sizeof(query), "PRAGMA locking_mode = %s;",
+             profile->lockingMode);
+    if ((ret = execPragma(db, query)) != SQLITE_OK) {
+      return ret;
+    }
+  }
+
+  if (profile->cacheSizeKiB != 0) {
+    // Negative cache_size is in KiB rather than pages.
+    snprintf(query, sizeof(query), "PRAGMA cache_size = -%lld;",
+             profile->cacheSizeKiB);
+    if ((ret = execPragma(db, query)) != SQLITE_OK) {
+      return ret;
+    }
+  }
+
+  if (profile->mmapSize != 0) {
+    snprintf(query, sizeof(query), "PRAGMA mmap_size = %lld;",
+             profile->mmapSize);
+    if ((ret = execPragma(db, query)) != SQLITE_OK) {
+      return ret;
+    }
+  }
+
+  if (profile->tempStore != NULL) {
+    snprintf(query, sizeof(query), "PRAGMA temp_store = %s;",
+             profile->tempStore);
+    if ((ret = execPragma(db, query)) != SQLITE_OK) {
+      return ret;
+    }
+  }
+
+  return SQLITE_OK;
+}
+
+int pragmaProfileRestore(sqlite3 *db, const struct PragmaProfile *profile) {
+  static const char *servingQueries[] = {
+      "PRAGMA journal_mode = WAL;",
+      "PRAGMA synchronous = NORMAL;",
+      "PRAGMA locking_mode = NORMAL;",
+      "PRAGMA temp_store = DEFAULT;",
+      "PRAGMA wal_checkpoint(TRUNCATE);",
+  };
+
+  if (profile->journalMode == NULL) {
+    return SQLITE_OK;
+  }
+
+  int ret;
+  for (int i = 0; i < sizeof(servingQueries) / sizeof(servingQueries[0]);
+       ++i) {
+    if ((ret = execPragma(db, servingQueries[i])) != SQLITE_OK) {
+      return ret;
+    }
+  }
+
+  return SQLITE_OK;
+}
+
+static void printPragma(sqlite3 *db, const char *pragma) {
+  char query[64];
+  sqlite3_stmt *stmt;
+  snprintf(query, sizeof(query), "PRAGMA %s;", pragma);
+  if (sqlite3_prepare_v2(db, query, -1, &stmt, NULL) != SQLITE_OK) {
+    return;
+  }
+  if (sqlite3_step(stmt) == SQLITE_ROW) {
+    fprintf(stdout, " %s=%s", pragma,
+            (const char *)sqlite3_column_text(stmt, 0));
+  }
+  sqlite3_finalize(stmt);
+}
+
+void pragmaProfilePrint(sqlite3 *db, const struct PragmaProfile *profile) {
+  static const char *pragmas[] = {"page_size",    "journal_mode",
+                                  "synchronous",  "locking_mode",
+                                  "cache_size",   "mmap_size",
+                                  "temp_store"};
+
+  fprintf(stdout, "Profile %s:", profile->name);
+  for (int i = 0; i < sizeof(pragmas) / sizeof(pragmas[0]); ++i) {
+    printPragma(db, pragmas[i]);
+  }
+  fprintf(stdout, "\n");
+}
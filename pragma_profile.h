@@ -0,0 +1,33 @@
+#ifndef PRAGMA_PROFILE_H
+#define PRAGMA_PROFILE_H
+
+#include <sqlite3.h>
+
+// Connection settings used while loading. The default profile leaves every
+// SQLite default untouched; the bulk profile trades durability for speed
+// until pragmaProfileRestore switches the database to a serving setup.
+struct PragmaProfile {
+  const char *name;
+  int pageSize; // 0 keeps the default
+  const char *journalMode;
+  const char *synchronous;
+  const char *lockingMode;
+  long long cacheSizeKiB;
+  long long mmapSize;
+  const char *tempStore;
+};
+
+const struct PragmaProfile *pragmaProfileFind(const char *name);
+
+// Applies the load settings. Must run before the first table is created so
+// page_size takes effect on new databases.
+int pragmaProfileApply(sqlite3 *db, const struct PragmaProfile *profile);
+
+// Switches a bulk-loaded database to WAL with synchronous=NORMAL, releases
+// the exclusive lock and checkpoints. No-op for the default profile.
+int pragmaProfileRestore(sqlite3 *db, const struct PragmaProfile *profile);
+
+// Prints the effective settings as reported back by SQLite.
+void pragmaProfilePrint(sqlite3 *db, const struct PragmaProfile *profile);
+
+#endif
@@ -0,0 +1,288 @@
+#include "region.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum CellState { CELL_OUTSIDE, CELL_INSIDE, CELL_BORDER };
+
+static void initRegion(struct Region *region) {
+  memset(region, 0, sizeof(*region));
+  idSetInit(&region->nodes);
+  idSetInit(&region->ways);
+  idSetInit(&region->relations);
+}
+
+int regionInitBox(struct Region *region, const char *spec) {
+  initRegion(region);
+  char end;
+  if (sscanf(spec, "%lf,%lf,%lf,%lf%c", &region->minLon, &region->minLat,
+             &region->maxLon, &region->maxLat, &end) != 4 ||
+      region->minLon > region->maxLon || region->minLat > region->maxLat) {
+    fprintf(stderr, "Invalid bounding box, expected "
+                    "min_lon,min_lat,max_lon,max_lat: %s\n",
+            spec);
+    return -1;
+  }
+  return 0;
+}
+
+static int clampCell(double offset, double size) {
+  int cell = (int)(offset / size);
+  return cell < 0 ? 0 : cell >= REGION_GRID_SIZE ? REGION_GRID_SIZE - 1 : cell;
+}
+
+static int rowOf(const struct Region *region, double latitude) {
+  return clampCell(latitude - region->minLat, region->cellHeight);
+}
+
+static int columnOf(const struct Region *region, double longitude) {
+  return clampCell(longitude - region->minLon, region->cellWidth);
+}
+
+// Even-odd test with a ray towards the east, over the edges of the row.
+static int polygonContains(const struct Region *region, double latitude,
+                           double longitude) {
+  int row = rowOf(region, latitude);
+  int inside = 0;
+  for (int i = region->rowStart[row]; i < region->rowStart[row + 1]; ++i) {
+    const struct RegionEdge *edge = &region->edges[region->rowEdges[i]];
+    if ((edge->lat1 > latitude) != (edge->lat2 > latitude) &&
+        longitude < edge->lon1 + (edge->lon2 - edge->lon1) *
+                                     (latitude - edge->lat1) /
+                                     (edge->lat2 - edge->lat1)) {
+      inside = !inside;
+    }
+  }
+  return inside;
+}
+
+static int buildGrid(struct Region *region) {
+  region->cellHeight = (region->maxLat - region->minLat) / REGION_GRID_SIZE;
+  region->cellWidth = (region->maxLon - region->minLon) / REGION_GRID_SIZE;
+  if (region->cellHeight <= 0 || region->cellWidth <= 0) {
+    fprintf(stderr, "Polygon has no area\n");
+    return -1;
+  }
+  region->cells = calloc(REGION_GRID_SIZE * REGION_GRID_SIZE, 1);
+  region->rowStart = calloc(REGION_GRID_SIZE + 1, sizeof(int));
+  if (region->cells == NULL || region->rowStart == NULL) {
+    return -1;
+  }
+
+  // Rows and cells an edge overlaps, through its bounding box.
+  for (int pass = 0; pass < 2; ++pass) {
+    for (int i = 0; i < region->edgeCount; ++i) {
+      const struct RegionEdge *edge = &region->edges[i];
+      int firstRow = rowOf(region, edge->lat1 < edge->lat2 ? edge->lat1
+                                                           : edge->lat2);
+      int lastRow = rowOf(region, edge->lat1 < edge->lat2 ? edge->lat2
+                                                          : edge->lat1);
+      int firstColumn = columnOf(region, edge->lon1 < edge->lon2 ? edge->lon1
+                                                                 : edge->lon2);
+      int lastColumn = columnOf(region, edge->lon1 < edge->lon2 ? edge->lon2
+                                                                : edge->lon1);
+      for (int row = firstRow; row <= lastRow; ++row) {
+        if (pass == 0) {
+          region->rowStart[row + 1]++;
+          for (int column = firstColumn; column <= lastColumn; ++column) {
+            region->cells[row * REGION_GRID_SIZE + column] = CELL_BORDER;
+          }
+        } else {
+          region->rowEdges[region->rowStart[row]++] = i;
+        }
+      }
+    }
+    if (pass == 0) {
+      for (int row = 0; row < REGION_GRID_SIZE; ++row) {
+        region->rowStart[row + 1] += region->rowStart[row];
+      }
+      region->rowEdges =
+          malloc((region->rowStart[REGION_GRID_SIZE] + 1) * sizeof(int));
+      if (region->rowEdges == NULL) {
+        return -1;
+      }
+    }
+  }
+  // The second pass advanced every start to the next row's.
+  for (int row = REGION_GRID_SIZE; row > 0; --row) {
+    region->rowStart[row] = region->rowStart[row - 1];
+  }
+  region->rowStart[0] = 0;
+
+  // Cells without an edge are inside or outside as a whole.
+  for (int row = 0; row < REGION_GRID_SIZE; ++row) {
+    for (int column = 0; column < REGION_GRID_SIZE; ++column) {
+      unsigned char *cell = &region->cells[row * REGION_GRID_SIZE + column];
+      if (*cell != CELL_BORDER) {
+        *cell = polygonContains(
+                    region, region->minLat + (row + 0.5) * region->cellHeight,
+                    region->minLon + (column + 0.5) * region->cellWidth)
+                    ? CELL_INSIDE
+                    : CELL_OUTSIDE;
+      }
+    }
+  }
+  return 0;
+}
+
+static int addEdge(struct Region *region, int *capacity, double lat1,
+                   double lon1, double lat2, double lon2) {
+  if (region->edgeCount == *capacity) {
+    int grown = *capacity ? *capacity * 2 : 256;
+    struct RegionEdge *edges =
+        realloc(region->edges, grown * sizeof(struct RegionEdge));
+    if (edges == NULL) {
+      return -1;
+    }
+    region->edges = edges;
+    *capacity = grown;
+  }
+  struct RegionEdge *edge = &region->edges[region->edgeCount++];
+  edge->lat1 = lat1;
+  edge->lon1 = lon1;
+  edge->lat2 = lat2;
+  edge->lon2 = lon2;
+  return 0;
+}
+
+int regionLoadPoly(struct Region *region, const char *path) {
+  initRegion(region);
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  // Line 1 names the polygon; then rings of "lon lat" lines, each opened
+  // by a name line and closed by END, and a final END.
+  char line[256];
+  int capacity = 0;
+  int inRing = 0, points = 0;
+  double firstLat = 0, firstLon = 0, lastLat = 0, lastLon = 0;
+  int lineNumber = 0;
+  int ret = -1;
+  region->minLat = region->minLon = HUGE_VAL;
+  region->maxLat = region->maxLon = -HUGE_VAL;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char word[sizeof(line)];
+    ++lineNumber;
+    if (lineNumber == 1 || sscanf(line, "%s", word) != 1) {
+      continue;
+    }
+    if (strcmp(word, "END") == 0) {
+      if (!inRing) {
+        ret = 0;
+        break;
+      }
+      // Rings are closed implicitly.
+      if (points > 0 && addEdge(region, &capacity, lastLat, lastLon, firstLat,
+                                firstLon) != 0) {
+        goto OutOfMemory;
+      }
+      inRing = 0;
+      continue;
+    }
+    if (!inRing) {
+      inRing = 1;
+      points = 0;
+      continue;
+    }
+    double lat, lon;
+    if (sscanf(line, "%lf %lf", &lon, &lat) != 2) {
+      fprintf(stderr, "%s:%d: expected a longitude and a latitude\n", path,
+              lineNumber);
+      fclose(file);
+      return -1;
+    }
+    if (points++ == 0) {
+      firstLat = lat;
+      firstLon = lon;
+    } else if (addEdge(region, &capacity, lastLat, lastLon, lat, lon) != 0) {
+      goto OutOfMemory;
+    }
+    lastLat = lat;
+    lastLon = lon;
+    region->minLat = lat < region->minLat ? lat : region->minLat;
+    region->maxLat = lat > region->maxLat ? lat : region->maxLat;
+    region->minLon = lon < region->minLon ? lon : region->minLon;
+    region->maxLon = lon > region->maxLon ? lon : region->maxLon;
+  }
+  fclose(file);
+  if (ret != 0 || region->edgeCount == 0) {
+    fprintf(stderr, "%s: incomplete polygon file\n", path);
+    return -1;
+  }
+  if (buildGrid(region) != 0) {
+    fprintf(stderr, "%s: failed to build the polygon grid\n", path);
+    return -1;
+  }
+  return 0;
+
+OutOfMemory:
+  fprintf(stderr, "regionLoadPoly: out of memory\n");
+  fclose(file);
+  return -1;
+}
+
+int regionContains(const struct Region *region, double latitude,
+                   double longitude) {
+  if (latitude < region->minLat || latitude > region->maxLat ||
+      longitude < region->minLon || longitude > region->maxLon) {
+    return 0;
+  }
+  if (region->edges == NULL) {
+    return 1;
+  }
+  switch (region->cells[rowOf(region, latitude) * REGION_GRID_SIZE +
+                        columnOf(region, longitude)]) {
+  case CELL_INSIDE:
+    return 1;
+  case CELL_OUTSIDE:
+    return 0;
+  }
+  return polygonContains(region, latitude, longitude);
+}
+
+int regionKeepNode(struct Region *region, const readosm_node *node) {
+  if (!regionContains(region, node->latitude, node->longitude)) {
+    return 0;
+  }
+  return idSetAdd(&region->nodes, node->id) == 0 ? 1 : -1;
+}
+
+int regionKeepWay(struct Region *region, const readosm_way *way) {
+  for (int i = 0; i < way->node_ref_count; ++i) {
+    if (idSetContains(&region->nodes, way->node_refs[i])) {
+      return idSetAdd(&region->ways, way->id) == 0 ? 1 : -1;
+    }
+  }
+  return 0;
+}
+
+int regionKeepRelation(struct Region *region,
+                       const readosm_relation *relation) {
+  for (int i = 0; i < relation->member_count; ++i) {
+    const readosm_member *member = &relation->members[i];
+    const struct IdSet *kept =
+        member->member_type == READOSM_MEMBER_NODE  ? &region->nodes
+        : member->member_type == READOSM_MEMBER_WAY ? &region->ways
+                                                    : &region->relations;
+    if (idSetContains(kept, member->id)) {
+      return idSetAdd(&region->relations, relation->id) == 0 ? 1 : -1;
+    }
+  }
+  return 0;
+}
+
+void regionFree(struct Region *region) {
+  free(region->edges);
+  free(region->cells);
+  free(region->rowStart);
+  free(region->rowEdges);
+  idSetFree(&region->nodes);
+  idSetFree(&region->ways);
+  idSetFree(&region->relations);
+  memset(region, 0, sizeof(*region));
+}
@@ -0,0 +1,61 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include "id_set.h"
+
+#include <readosm.h>
+
+// Region of --bbox and --poly imports. Nodes are kept when their location
+// is inside, ways when one of their nodes was kept, relations when one of
+// their members was. Ways crossing the border keep the references to their
+// nodes outside it.
+//
+// Polygons come from Osmosis .poly files; rings starting with '!' are
+// holes. The point-in-polygon test is accelerated with a grid over the
+// bounding box: cells without an edge are classified once, and the exact
+// even-odd ray test for the rest only looks at the edges overlapping the
+// point's row of cells.
+#define REGION_GRID_SIZE 256
+
+struct RegionEdge {
+  double lat1, lon1;
+  double lat2, lon2;
+};
+
+struct Region {
+  double minLat, maxLat, minLon, maxLon;
+
+  // Polygon only; NULL for a box.
+  struct RegionEdge *edges;
+  int edgeCount;
+  // REGION_GRID_SIZE^2 cells by row, see regionContains.
+  unsigned char *cells;
+  double cellHeight, cellWidth;
+  // Edges overlapping every row of cells: rowEdges[rowStart[r] ...
+  // rowStart[r + 1] - 1] are indexes into edges.
+  int *rowStart;
+  int *rowEdges;
+
+  // IDs of the elements kept so far.
+  struct IdSet nodes;
+  struct IdSet ways;
+  struct IdSet relations;
+};
+
+// spec is "min_lon,min_lat,max_lon,max_lat" in degrees. Both return 0, or
+// -1 after printing the error.
+int regionInitBox(struct Region *region, const char *spec);
+int regionLoadPoly(struct Region *region, const char *path);
+
+int regionContains(const struct Region *region, double latitude,
+                   double longitude);
+
+// Return 1 if the element is kept, 0 if not, -1 when out of memory.
+int regionKeepNode(struct Region *region, const readosm_node *node);
+int regionKeepWay(struct Region *region, const readosm_way *way);
+int regionKeepRelation(struct Region *region,
+                       const readosm_relation *relation);
+
+void regionFree(struct Region *region);
+
+#endif
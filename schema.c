@@ -0,0 +1,544 @@
+#include "schema.h"
+
+#include "timing.h"
+
+#include <sqlite3.h>
+#include <stdio.h>
+#include <string.h>
+
+struct LayoutName {
+  int flag;
+  const char *name;
+};
+
+static const struct LayoutName layoutNames[] = {
+    {LAYOUT_INTERNED_TAGS, "interned_tags"},
+    {LAYOUT_PACKED_WAY_NODES, "packed_way_nodes"},
+    {LAYOUT_COMPACT_NODES, "compact_nodes"},
+    {LAYOUT_NO_NODE_METADATA, "no_node_metadata"},
+    {LAYOUT_SPATIAL_INDEX, "spatial_index"},
+};
+
+// Schema objects belonging to a layout are created only when the layout
+// has all the flags in required and none of those in excluded.
+struct IndexDefinition {
+  const char *name;
+  const char *query;
+  int required;
+  int excluded;
+};
+
+int inLayout(int layout, int required, int excluded) {
+  return (layout & required) == required && (layout & excluded) == 0;
+}
+
+static const struct IndexDefinition indexDefinitions[] = {
+    {"index_node_id", "CREATE INDEX IF NOT EXISTS index_node_id ON nodes(id);",
+     0, LAYOUT_COMPACT_NODES},
+    {"index_node_tags_id",
+     "CREATE INDEX IF NOT EXISTS index_node_tags_id ON node_tags(node_id);", 0,
+     LAYOUT_INTERNED_TAGS},
+    {"index_node_tags_key",
+     "CREATE INDEX IF NOT EXISTS index_node_tags_key ON node_tags(key);", 0,
+     LAYOUT_INTERNED_TAGS},
+    {"index_node_tags_id",
+     "CREATE INDEX IF NOT EXISTS index_node_tags_id ON node_tag_ids(node_id);",
+     LAYOUT_INTERNED_TAGS},
+    {"index_node_tags_key",
+     "CREATE INDEX IF NOT EXISTS index_node_tags_key ON "
+     "node_tag_ids(key_id, value_id);",
+     LAYOUT_INTERNED_TAGS},
+    {"index_way_id", "CREATE INDEX IF NOT EXISTS index_way_id ON ways(id);"},
+    {"index_way_tags_id",
+     "CREATE INDEX IF NOT EXISTS index_way_tags_id ON way_tags(way_id);", 0,
+     LAYOUT_INTERNED_TAGS},
+    {"index_way_tags_key",
+     "CREATE INDEX IF NOT EXISTS index_way_tags_key ON way_tags(key);", 0,
+     LAYOUT_INTERNED_TAGS},
+    {"index_way_tags_id",
+     "CREATE INDEX IF NOT EXISTS index_way_tags_id ON way_tag_ids(way_id);",
+     LAYOUT_INTERNED_TAGS},
+    {"index_way_tags_key",
+     "CREATE INDEX IF NOT EXISTS index_way_tags_key ON "
+     "way_tag_ids(key_id, value_id);",
+     LAYOUT_INTERNED_TAGS},
+    {"index_way_nodes_way_id",
+     "CREATE INDEX IF NOT EXISTS index_way_nodes_way_id ON way_nodes(way_id);",
+     0, LAYOUT_PACKED_WAY_NODES},
+    {"index_way_nodes_node_id",
+     "CREATE INDEX IF NOT EXISTS index_way_nodes_node_id ON "
+     "way_nodes(node_id);",
+     0, LAYOUT_PACKED_WAY_NODES},
+    {"index_relation_tags_id",
+     "CREATE INDEX IF NOT EXISTS index_relation_tags_id ON "
+     "relation_tags(relation_id);",
+     0, LAYOUT_INTERNED_TAGS},
+    {"index_relation_tags_key",
+     "CREATE INDEX IF NOT EXISTS index_relation_tags_key ON "
+     "relation_tags(key);",
+     0, LAYOUT_INTERNED_TAGS},
+    {"index_relation_tags_id",
+     "CREATE INDEX IF NOT EXISTS index_relation_tags_id ON "
+     "relation_tag_ids(relation_id);",
+     LAYOUT_INTERNED_TAGS},
+    {"index_relation_tags_key",
+     "CREATE INDEX IF NOT EXISTS index_relation_tags_key ON "
+     "relation_tag_ids(key_id, value_id);",
+     LAYOUT_INTERNED_TAGS},
+    // The dictionaries are looked up in memory during the import, these
+    // only serve queries through the tag views.
+    {"index_tag_keys_key",
+     "CREATE INDEX IF NOT EXISTS index_tag_keys_key ON tag_keys(key);",
+     LAYOUT_INTERNED_TAGS},
+    {"index_tag_values_value",
+     "CREATE INDEX IF NOT EXISTS index_tag_values_value ON tag_values(value);",
+     LAYOUT_INTERNED_TAGS},
+    {"index_node_names_node_id",
+     "CREATE INDEX IF NOT EXISTS index_node_names_node_id ON "
+     "node_names(node_id);"},
+    {"index_relation_members_id",
+     "CREATE INDEX IF NOT EXISTS index_relation_members_id ON "
+     "relation_members(relation_id);"},
+    {"index_relation_members_member",
+     "CREATE INDEX IF NOT EXISTS index_relation_members_member ON "
+     "relation_members(member_id, member_type);"},
+};
+
+int createIndexes(sqlite3 *handle, int layout, int report) {
+  char *errMsg = NULL;
+  int ret;
+
+  for (int i = 0; i < sizeof(indexDefinitions) / sizeof(indexDefinitions[0]);
+       ++i) {
+    const struct IndexDefinition *index = &indexDefinitions[i];
+    if (!inLayout(layout, index->required, index->excluded)) {
+      continue;
+    }
+    double started = monotonicSeconds();
+    ret = sqlite3_exec(handle, index->query, NULL, NULL, &errMsg);
+    if (ret != SQLITE_OK) {
+      fprintf(stderr, "sqlite3_exec error: %s, running query\"%s\"", errMsg,
+              index->query);
+      sqlite3_free(errMsg);
+      return ret;
+    }
+    if (report) {
+      fprintf(stdout, "Index %-24s built in %.2fs\n", index->name,
+              monotonicSeconds() - started);
+    }
+  }
+
+  return SQLITE_OK;
+}
+
+int hasSchemaObject(sqlite3 *handle, const char *type,
+                    const char *name, int *exists) {
+  sqlite3_stmt *stmt;
+  int ret = sqlite3_prepare_v2(
+      handle, "SELECT 1 FROM sqlite_master WHERE type = ?1 AND name = ?2", -1,
+      &stmt, NULL);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  sqlite3_bind_text(stmt, 1, type, -1, SQLITE_STATIC);
+  sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+  ret = sqlite3_step(stmt);
+  *exists = ret == SQLITE_ROW;
+  sqlite3_finalize(stmt);
+  return ret == SQLITE_ROW || ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+int buildNodeWays(sqlite3 *handle) {
+  static const char *query =
+      "DELETE FROM node_ways;"
+      "INSERT INTO node_ways(node_id, way_ids) "
+      "SELECT u.id, pack_sorted_ids(w.id) FROM ways w, unpack_ids(w.nodes) u "
+      "GROUP BY u.id;";
+  char *errMsg = NULL;
+  double started = monotonicSeconds();
+  int ret = sqlite3_exec(handle, query, NULL, NULL, &errMsg);
+  if (ret != SQLITE_OK) {
+    fprintf(stderr, "sqlite3_exec error: %s, running query\"%s\"", errMsg,
+            query);
+    sqlite3_free(errMsg);
+    return ret;
+  }
+  fprintf(stdout, "Table %-24s built in %.2fs\n", "node_ways",
+          monotonicSeconds() - started);
+  return SQLITE_OK;
+}
+
+int loadLayout(sqlite3 *handle, int *layout) {
+  sqlite3_stmt *stmt;
+  int ret = sqlite3_prepare_v2(handle, "SELECT name FROM schema_layout;", -1,
+                               &stmt, NULL);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  *layout = 0;
+  while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+    const char *name = (const char *)sqlite3_column_text(stmt, 0);
+    for (int i = 0; i < sizeof(layoutNames) / sizeof(layoutNames[0]); ++i) {
+      if (name != NULL && strcmp(name, layoutNames[i].name) == 0) {
+        *layout |= layoutNames[i].flag;
+      }
+    }
+  }
+  sqlite3_finalize(stmt);
+  return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+int saveLayout(sqlite3 *handle, int layout) {
+  sqlite3_stmt *stmt;
+  int ret = sqlite3_prepare_v2(
+      handle, "INSERT OR IGNORE INTO schema_layout(name) VALUES (?1);", -1,
+      &stmt, NULL);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  for (int i = 0; i < sizeof(layoutNames) / sizeof(layoutNames[0]); ++i) {
+    if ((layout & layoutNames[i].flag) == 0) {
+      continue;
+    }
+    sqlite3_bind_text(stmt, 1, layoutNames[i].name, -1, SQLITE_STATIC);
+    if ((ret = sqlite3_step(stmt)) != SQLITE_DONE ||
+        (ret = sqlite3_reset(stmt)) != SQLITE_OK) {
+      break;
+    }
+  }
+  sqlite3_finalize(stmt);
+  return ret;
+}
+
+int runTableDefinitions(sqlite3 *handle, int layout,
+                        const struct TableDefinition *definitions,
+                        int count) {
+  char *errMsg = NULL;
+  int ret;
+
+  for (int i = 0; i < count; ++i) {
+    const struct TableDefinition *table = &definitions[i];
+    if (!inLayout(layout, table->required, table->excluded)) {
+      continue;
+    }
+    const char *tableQuery = table->query;
+    ret = sqlite3_exec(handle, tableQuery, NULL, NULL, &errMsg);
+    if (ret != SQLITE_OK) {
+      fprintf(stderr, "sqlite3_exec error: %s, running query\"%s\"", errMsg,
+              tableQuery);
+      sqlite3_free(errMsg);
+      return ret;
+    }
+  }
+
+  return SQLITE_OK;
+}
+
+int createTables(sqlite3 *handle, int layout) {
+
+  const struct TableDefinition tableDefinitions[] = {
+      {"CREATE TABLE IF NOT EXISTS nodes ("
+       "        id        INTEGER PRIMARY KEY,"
+       "        latitude  REAL,"
+       "        longitude REAL,"
+       "        version   INTEGER,"
+       "        changeset INTEGER,"
+       "        user      TEXT,"
+       "        uid       INTEGER,"
+       "        timestamp TEXT"
+       ");",
+       0, LAYOUT_COMPACT_NODES | LAYOUT_NO_NODE_METADATA},
+      {"CREATE TABLE IF NOT EXISTS nodes ("
+       "        id        INTEGER PRIMARY KEY,"
+       "        latitude  REAL,"
+       "        longitude REAL"
+       ");",
+       LAYOUT_NO_NODE_METADATA, LAYOUT_COMPACT_NODES},
+      // LAYOUT_COMPACT_NODES: the rows are clustered by the INTEGER PRIMARY
+      // KEY already, which WITHOUT ROWID would not improve on.
+      {"CREATE TABLE IF NOT EXISTS nodes ("
+       "        id        INTEGER PRIMARY KEY,"
+       "        lat       INTEGER,"
+       "        lon       INTEGER,"
+       "        version   INTEGER,"
+       "        changeset INTEGER,"
+       "        user      TEXT,"
+       "        uid       INTEGER,"
+       "        timestamp TEXT"
+       ");",
+       LAYOUT_COMPACT_NODES, LAYOUT_NO_NODE_METADATA},
+      {"CREATE TABLE IF NOT EXISTS nodes ("
+       "        id        INTEGER PRIMARY KEY,"
+       "        lat       INTEGER,"
+       "        lon       INTEGER"
+       ");",
+       LAYOUT_COMPACT_NODES | LAYOUT_NO_NODE_METADATA},
+      // Degrees without the helper functions, see coordinates.c.
+      {"CREATE VIEW IF NOT EXISTS node_locations AS "
+       "SELECT id, lat / 10000000.0 AS latitude, lon / 10000000.0 AS longitude "
+       "FROM nodes;",
+       LAYOUT_COMPACT_NODES},
+      {"CREATE TABLE IF NOT EXISTS node_tags ("
+       "       node_id  INTEGER,"
+       "       key      TEXT,"
+       "       value    TEXT,"
+       "       FOREIGN KEY (node_id) REFERENCES nodes(id)"
+       ");",
+       0, LAYOUT_INTERNED_TAGS},
+      {"CREATE TABLE IF NOT EXISTS ways ("
+       "       id        INTEGER PRIMARY KEY,"
+       "       changeset INTEGER,"
+       "       user      TEXT,"
+       "       uid       INTEGER,"
+       "       timestamp TEXT"
+       ");",
+       0, LAYOUT_PACKED_WAY_NODES},
+      {"CREATE TABLE IF NOT EXISTS ways ("
+       "       id        INTEGER PRIMARY KEY,"
+       "       changeset INTEGER,"
+       "       user      TEXT,"
+       "       uid       INTEGER,"
+       "       timestamp TEXT,"
+       "       nodes     BLOB"
+       ");",
+       LAYOUT_PACKED_WAY_NODES},
+      {"CREATE TABLE IF NOT EXISTS way_tags ("
+       "       way_id    INTEGER,"
+       "       key       TEXT,"
+       "       value     TEXT,"
+       "       FOREIGN KEY (way_id) REFERENCES ways(id)"
+       ");",
+       0, LAYOUT_INTERNED_TAGS},
+      {"CREATE TABLE IF NOT EXISTS way_nodes ("
+       "       way_id    INTEGER,"
+       "       node_id   INTEGER,"
+       "       FOREIGN KEY (node_id) REFERENCES nodes(id),"
+       "       FOREIGN KEY (way_id) REFERENCES ways(id)"
+       ");",
+       0, LAYOUT_PACKED_WAY_NODES},
+      // LAYOUT_PACKED_WAY_NODES: unpack_ids is provided by packed_ids.c,
+      // other clients load it as an extension.
+      {"CREATE VIEW IF NOT EXISTS way_nodes AS "
+       "SELECT w.id AS way_id, u.id AS node_id, u.sequence "
+       "FROM ways w, unpack_ids(w.nodes) u;",
+       LAYOUT_PACKED_WAY_NODES},
+      {"CREATE TABLE IF NOT EXISTS node_ways ("
+       "       node_id   INTEGER PRIMARY KEY,"
+       "       way_ids   BLOB"
+       ");",
+       LAYOUT_PACKED_WAY_NODES},
+      {"CREATE TABLE IF NOT EXISTS relations ("
+       "       id        INTEGER PRIMARY KEY,"
+       "       changeset INTEGER,"
+       "       user      TEXT,"
+       "       uid       INTEGER,"
+       "       timestamp TEXT"
+       ");"},
+      {"CREATE TABLE IF NOT EXISTS relation_tags ("
+       "       relation_id INTEGER,"
+       "       key         TEXT,"
+       "       value       TEXT,"
+       "       FOREIGN KEY (relation_id) REFERENCES relations(id)"
+       ");",
+       0, LAYOUT_INTERNED_TAGS},
+      {"CREATE TABLE IF NOT EXISTS relation_roles ("
+       "       id        INTEGER PRIMARY KEY,"
+       "       role      TEXT UNIQUE"
+       ");"},
+      // member_type: 0 node, 1 way, 2 relation.
+      {"CREATE TABLE IF NOT EXISTS relation_members ("
+       "       relation_id INTEGER,"
+       "       sequence    INTEGER,"
+       "       member_type INTEGER,"
+       "       member_id   INTEGER,"
+       "       role_id     INTEGER,"
+       "       FOREIGN KEY (relation_id) REFERENCES relations(id),"
+       "       FOREIGN KEY (role_id) REFERENCES relation_roles(id)"
+       ");"},
+      {"CREATE VIEW IF NOT EXISTS relation_members_view AS "
+       "SELECT m.relation_id, m.sequence,"
+       "       CASE m.member_type WHEN 0 THEN 'node' WHEN 1 THEN 'way'"
+       "                          ELSE 'relation' END AS member_type,"
+       "       m.member_id, r.role "
+       "FROM relation_members m JOIN relation_roles r ON r.id = m.role_id;"},
+
+      // LAYOUT_INTERNED_TAGS: the views keep the columns of the plain tag
+      // tables, so existing queries keep working.
+      {"CREATE TABLE IF NOT EXISTS tag_keys ("
+       "       id        INTEGER PRIMARY KEY,"
+       "       key       TEXT"
+       ");",
+       LAYOUT_INTERNED_TAGS},
+      {"CREATE TABLE IF NOT EXISTS tag_values ("
+       "       id        INTEGER PRIMARY KEY,"
+       "       value     TEXT"
+       ");",
+       LAYOUT_INTERNED_TAGS},
+      {"CREATE TABLE IF NOT EXISTS node_tag_ids ("
+       "       node_id   INTEGER,"
+       "       key_id    INTEGER,"
+       "       value_id  INTEGER,"
+       "       FOREIGN KEY (node_id) REFERENCES nodes(id),"
+       "       FOREIGN KEY (key_id) REFERENCES tag_keys(id),"
+       "       FOREIGN KEY (value_id) REFERENCES tag_values(id)"
+       ");",
+       LAYOUT_INTERNED_TAGS},
+      {"CREATE TABLE IF NOT EXISTS way_tag_ids ("
+       "       way_id    INTEGER,"
+       "       key_id    INTEGER,"
+       "       value_id  INTEGER,"
+       "       FOREIGN KEY (way_id) REFERENCES ways(id),"
+       "       FOREIGN KEY (key_id) REFERENCES tag_keys(id),"
+       "       FOREIGN KEY (value_id) REFERENCES tag_values(id)"
+       ");",
+       LAYOUT_INTERNED_TAGS},
+      {"CREATE TABLE IF NOT EXISTS relation_tag_ids ("
+       "       relation_id INTEGER,"
+       "       key_id      INTEGER,"
+       "       value_id    INTEGER,"
+       "       FOREIGN KEY (relation_id) REFERENCES relations(id),"
+       "       FOREIGN KEY (key_id) REFERENCES tag_keys(id),"
+       "       FOREIGN KEY (value_id) REFERENCES tag_values(id)"
+       ");",
+       LAYOUT_INTERNED_TAGS},
+      {"CREATE VIEW IF NOT EXISTS node_tags AS "
+       "SELECT t.node_id, k.key, v.value FROM node_tag_ids t "
+       "JOIN tag_keys k ON k.id = t.key_id "
+       "JOIN tag_values v ON v.id = t.value_id;",
+       LAYOUT_INTERNED_TAGS},
+      {"CREATE VIEW IF NOT EXISTS way_tags AS "
+       "SELECT t.way_id, k.key, v.value FROM way_tag_ids t "
+       "JOIN tag_keys k ON k.id = t.key_id "
+       "JOIN tag_values v ON v.id = t.value_id;",
+       LAYOUT_INTERNED_TAGS},
+      {"CREATE VIEW IF NOT EXISTS relation_tags AS "
+       "SELECT t.relation_id, k.key, v.value FROM relation_tag_ids t "
+       "JOIN tag_keys k ON k.id = t.key_id "
+       "JOIN tag_values v ON v.id = t.value_id;",
+       LAYOUT_INTERNED_TAGS},
+
+      // LAYOUT_SPATIAL_INDEX: the staging tables are filled during the load
+      // and emptied into the R*Trees after it, see spatial_index.h.
+      {"CREATE VIRTUAL TABLE IF NOT EXISTS node_rtree USING rtree("
+       "       id, min_lat, max_lat, min_lon, max_lon"
+       ");",
+       LAYOUT_SPATIAL_INDEX},
+      {"CREATE VIRTUAL TABLE IF NOT EXISTS way_rtree USING rtree("
+       "       id, min_lat, max_lat, min_lon, max_lon"
+       ");",
+       LAYOUT_SPATIAL_INDEX},
+      {"CREATE TABLE IF NOT EXISTS node_rtree_staging ("
+       "       hilbert   INTEGER,"
+       "       id        INTEGER,"
+       "       lat       INTEGER,"
+       "       lon       INTEGER"
+       ");",
+       LAYOUT_SPATIAL_INDEX},
+      {"CREATE TABLE IF NOT EXISTS way_rtree_staging ("
+       "       hilbert   INTEGER,"
+       "       id        INTEGER,"
+       "       min_lat   INTEGER,"
+       "       max_lat   INTEGER,"
+       "       min_lon   INTEGER,"
+       "       max_lon   INTEGER"
+       ");",
+       LAYOUT_SPATIAL_INDEX},
+
+      {"CREATE TABLE IF NOT EXISTS schema_layout ("
+       "       name      TEXT PRIMARY KEY"
+       ");"},
+      {"CREATE TABLE IF NOT EXISTS import_progress ("
+       "       id               INTEGER PRIMARY KEY CHECK (id = 1),"
+       "       last_node_id     INTEGER,"
+       "       last_way_id      INTEGER,"
+       "       last_relation_id INTEGER,"
+       "       blob_offset      INTEGER"
+       ");"},
+      {"CREATE TABLE IF NOT EXISTS node_names ("
+       "       node_id   INTEGER,"
+       "       name      TEXT,"
+       "       FOREIGN KEY (node_id) REFERENCES nodes(id)"
+       ");"},
+
+      {"CREATE VIRTUAL TABLE IF NOT EXISTS named_nodes_fts5 "
+       "USING fts5(id, name);"},
+      {"CREATE VIRTUAL TABLE IF NOT EXISTS named_nodes_spellfix "
+       "USING spellfix1;"},
+  };
+
+  return runTableDefinitions(handle, layout, tableDefinitions,
+                             sizeof(tableDefinitions) /
+                                 sizeof(tableDefinitions[0]));
+}
+
+// Keep node_names and named_nodes_fts5 in sync with later edits. They are
+// dropped for the duration of an import, which extracts the names itself
+// and builds the full-text index in bulk, see buildNameIndex.
+static const struct TableDefinition triggerDefinitions[] = {
+    {"CREATE TRIGGER IF NOT EXISTS node_names AFTER INSERT ON node_tags "
+     "WHEN new.key LIKE 'name%'"
+     "BEGIN"
+     "   INSERT INTO"
+     "       node_names(node_id, name)"
+     "   VALUES"
+     "       (new.node_id, new.value);"
+     "END;",
+     0, LAYOUT_INTERNED_TAGS},
+    {"CREATE TRIGGER IF NOT EXISTS node_names AFTER INSERT ON node_tag_ids "
+     "WHEN (SELECT key FROM tag_keys WHERE id = new.key_id) LIKE 'name%'"
+     "BEGIN"
+     "   INSERT INTO"
+     "       node_names(node_id, name)"
+     "   SELECT"
+     "       new.node_id, value FROM tag_values WHERE id = new.value_id;"
+     "END;",
+     LAYOUT_INTERNED_TAGS},
+    {"CREATE TRIGGER IF NOT EXISTS node_names_fts_insert "
+     "AFTER INSERT ON node_names "
+     "BEGIN"
+     "   INSERT INTO"
+     "       named_nodes_fts5(rowid, id, name)"
+     "   VALUES"
+     "       (new.rowid, new.node_id, new.name);"
+     "END;"},
+    {"CREATE TRIGGER IF NOT EXISTS node_names_fts_delete "
+     "AFTER DELETE ON node_names "
+     "BEGIN"
+     "   DELETE FROM named_nodes_fts5 WHERE rowid = old.rowid;"
+     "END;"},
+};
+
+int installTriggers(sqlite3 *handle, int layout) {
+  return runTableDefinitions(handle, layout, triggerDefinitions,
+                             sizeof(triggerDefinitions) /
+                                 sizeof(triggerDefinitions[0]));
+}
+
+int dropTriggers(sqlite3 *handle) {
+  return sqlite3_exec(handle,
+                      "DROP TRIGGER IF EXISTS node_names;"
+                      "DROP TRIGGER IF EXISTS node_names_fts_insert;"
+                      "DROP TRIGGER IF EXISTS node_names_fts_delete;",
+                      NULL, NULL, NULL);
+}
+
+int buildNameIndex(sqlite3 *handle) {
+  static const char *query =
+      "INSERT INTO named_nodes_fts5(rowid, id, name) "
+      "SELECT rowid, node_id, name FROM node_names WHERE rowid > "
+      "coalesce((SELECT rowid FROM named_nodes_fts5 "
+      "          ORDER BY rowid DESC LIMIT 1), 0);"
+      "INSERT INTO named_nodes_fts5(named_nodes_fts5) VALUES ('optimize');";
+  char *errMsg = NULL;
+  double started = monotonicSeconds();
+  int ret = sqlite3_exec(handle, query, NULL, NULL, &errMsg);
+  if (ret != SQLITE_OK) {
+    fprintf(stderr, "sqlite3_exec error: %s, running query\"%s\"", errMsg,
+            query);
+    sqlite3_free(errMsg);
+    return ret;
+  }
+  fprintf(stdout, "Table %-24s built in %.2fs\n", "named_nodes_fts5",
+          monotonicSeconds() - started);
+  return SQLITE_OK;
+}
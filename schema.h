@@ -0,0 +1,69 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <sqlite3.h>
+
+// Optional storage layouts. The layout is chosen when a database is created
+// and recorded in schema_layout; appends keep the layout of the database.
+enum SchemaLayout {
+  // Tag keys and values are stored as IDs into tag_keys and tag_values;
+  // node_tags, way_tags and relation_tags become views.
+  LAYOUT_INTERNED_TAGS = 1 << 0,
+  // Ways keep their node list in a packed_ids.h BLOB column instead of
+  // way_nodes rows, which becomes a view. node_ways holds the reverse
+  // lists and is rebuilt after every import.
+  LAYOUT_PACKED_WAY_NODES = 1 << 1,
+  // Node coordinates are stored as integers in 1e-7 degrees (coordinates.h)
+  // in columns lat and lon, without the index duplicating the primary key.
+  LAYOUT_COMPACT_NODES = 1 << 2,
+  // Nodes have no version, changeset, user, uid and timestamp columns.
+  LAYOUT_NO_NODE_METADATA = 1 << 3,
+  // Tagged nodes and way bounding boxes are indexed in the node_rtree and
+  // way_rtree R*Trees, see spatial_index.h.
+  LAYOUT_SPATIAL_INDEX = 1 << 4,
+};
+
+// Statements run for the layouts that have all the flags in required and
+// none of those in excluded, see inLayout.
+struct TableDefinition {
+  const char *query;
+  int required;
+  int excluded;
+};
+
+int inLayout(int layout, int required, int excluded);
+
+// Creates the secondary indexes. With report set, prints how long each one
+// took, which is only interesting when they are built over loaded tables.
+int createIndexes(sqlite3 *handle, int layout, int report);
+
+// Sets *exists to whether sqlite_master has an object of the type and
+// name.
+int hasSchemaObject(sqlite3 *handle, const char *type,
+                    const char *name, int *exists);
+
+// Rebuilds node_ways from the packed node lists of all ways. The GROUP BY
+// sorts the (node, way) pairs with SQLite's external sorter, so memory use
+// does not grow with the number of ways.
+int buildNodeWays(sqlite3 *handle);
+
+// The layout recorded in schema_layout, and recording one.
+int loadLayout(sqlite3 *handle, int *layout);
+int saveLayout(sqlite3 *handle, int layout);
+
+// Runs the definitions belonging to layout, in order.
+int runTableDefinitions(sqlite3 *handle, int layout,
+                        const struct TableDefinition *definitions,
+                        int count);
+
+// Creates the tables without their secondary indexes; see createIndexes.
+int createTables(sqlite3 *handle, int layout);
+
+int installTriggers(sqlite3 *handle, int layout);
+int dropTriggers(sqlite3 *handle);
+
+// Adds the node_names rows written since the last build to the full-text
+// index under the same rowids, then merges its segments into one b-tree.
+int buildNameIndex(sqlite3 *handle);
+
+#endif
@@ -0,0 +1,184 @@
+#include "shard.h"
+#include "coordinates.h"
+#include "spatial_index.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+int shardRouterInit(struct ShardRouter *router, enum ShardScheme scheme,
+                    int count) {
+  router->scheme = scheme;
+  router->count = count;
+  router->extents = calloc(count, sizeof(struct ShardExtent));
+  router->ways = malloc(count * sizeof(struct IdSet));
+  router->firstHilbert = malloc(count * sizeof(uint32_t));
+  if (router->extents == NULL || router->ways == NULL ||
+      router->firstHilbert == NULL) {
+    fprintf(stderr, "shardRouterInit: out of memory\n");
+    goto Fail;
+  }
+  for (int i = 0; i < count; ++i) {
+    router->extents[i].minLat = router->extents[i].minLon = 1LL << 40;
+    router->extents[i].maxLat = router->extents[i].maxLon = -(1LL << 40);
+    idSetInit(&router->ways[i]);
+    // The smallest index with floor(index * count / 2^32) == i.
+    router->firstHilbert[i] =
+        (uint32_t)((((uint64_t)i << 32) + count - 1) / count);
+  }
+  if (scheme == SHARD_BY_TILE &&
+      locationStoreOpen(&router->locations, NULL) != 0) {
+    goto Fail;
+  }
+  return 0;
+
+Fail:
+  free(router->extents);
+  free(router->ways);
+  free(router->firstHilbert);
+  router->extents = NULL;
+  router->ways = NULL;
+  router->firstHilbert = NULL;
+  return -1;
+}
+
+static int compareHilbert(const void *a, const void *b) {
+  uint32_t left = *(const uint32_t *)a;
+  uint32_t right = *(const uint32_t *)b;
+  return left < right ? -1 : left > right;
+}
+
+void shardRouterSetRanges(struct ShardRouter *router, uint32_t *sample,
+                          long long count) {
+  if (count == 0) {
+    return;
+  }
+  qsort(sample, count, sizeof(uint32_t), compareHilbert);
+  router->firstHilbert[0] = 0;
+  for (int i = 1; i < router->count; ++i) {
+    router->firstHilbert[i] = sample[count * i / router->count];
+  }
+}
+
+static int shardOfId(const struct ShardRouter *router, long long id) {
+  long long block = (id < 0 ? -id : id) / SHARD_ID_BLOCK;
+  return (int)(block % router->count);
+}
+
+// The last shard starting at or before the index, so of shards with the
+// same start only the last gets nodes.
+static int shardOfLocation(const struct ShardRouter *router, long long latE7,
+                           long long lonE7) {
+  uint32_t index = hilbertIndex(latE7, lonE7);
+  int shard = router->count - 1;
+  while (shard > 0 && router->firstHilbert[shard] > index) {
+    shard--;
+  }
+  return shard;
+}
+
+// Shard of a node placed earlier, -1 if the router has not seen it.
+static int shardOfNodeId(const struct ShardRouter *router, long long id) {
+  if (router->scheme == SHARD_BY_ID) {
+    return shardOfId(router, id);
+  }
+  long long lat, lon;
+  if (!locationStoreGet(&router->locations, id, &lat, &lon)) {
+    return -1;
+  }
+  return shardOfLocation(router, lat, lon);
+}
+
+// Shard of a way routed earlier, -1 if the router has not seen it.
+static int shardOfWayId(const struct ShardRouter *router, long long id) {
+  for (int i = 0; i < router->count; ++i) {
+    if (idSetContains(&router->ways[i], id)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int shardOfNode(struct ShardRouter *router, const readosm_node *node) {
+  long long lat = coordinateToE7(node->latitude);
+  long long lon = coordinateToE7(node->longitude);
+  int shard;
+  if (router->scheme == SHARD_BY_ID) {
+    shard = shardOfId(router, node->id);
+  } else {
+    if (locationStoreSet(&router->locations, node->id, lat, lon) != 0) {
+      return -1;
+    }
+    shard = shardOfLocation(router, lat, lon);
+  }
+
+  struct ShardExtent *extent = &router->extents[shard];
+  extent->nodes++;
+  extent->minLat = lat < extent->minLat ? lat : extent->minLat;
+  extent->maxLat = lat > extent->maxLat ? lat : extent->maxLat;
+  extent->minLon = lon < extent->minLon ? lon : extent->minLon;
+  extent->maxLon = lon > extent->maxLon ? lon : extent->maxLon;
+  return shard;
+}
+
+int shardOfWay(struct ShardRouter *router, const readosm_way *way) {
+  int shard = -1;
+  // Nodes outside an extract have no location; the next one may.
+  for (int i = 0; shard < 0 && i < way->node_ref_count; ++i) {
+    shard = shardOfNodeId(router, way->node_refs[i]);
+  }
+  if (shard < 0) {
+    shard = shardOfId(router, way->id);
+  }
+  if (idSetAdd(&router->ways[shard], way->id) != 0) {
+    return -1;
+  }
+  router->extents[shard].ways++;
+  return shard;
+}
+
+int shardOfRelation(struct ShardRouter *router,
+                    const readosm_relation *relation) {
+  int shard = -1;
+  for (int i = 0; shard < 0 && i < relation->member_count; ++i) {
+    const readosm_member *member = &relation->members[i];
+    if (member->member_type == READOSM_MEMBER_NODE) {
+      shard = shardOfNodeId(router, member->id);
+    } else if (member->member_type == READOSM_MEMBER_WAY) {
+      shard = shardOfWayId(router, member->id);
+    }
+  }
+  if (shard < 0) {
+    shard = shardOfId(router, relation->id);
+  }
+  router->extents[shard].relations++;
+  return shard;
+}
+
+int shardHilbertRange(const struct ShardRouter *router, int shard,
+                      uint32_t *first, uint32_t *last) {
+  *first = router->firstHilbert[shard];
+  if (shard == router->count - 1) {
+    *last = UINT32_MAX;
+    return 1;
+  }
+  uint32_t next = router->firstHilbert[shard + 1];
+  *last = next - 1;
+  return next > *first;
+}
+
+void shardRouterFree(struct ShardRouter *router) {
+  if (router->scheme == SHARD_BY_TILE && router->extents != NULL) {
+    locationStoreClose(&router->locations);
+  }
+  if (router->ways != NULL) {
+    for (int i = 0; i < router->count; ++i) {
+      idSetFree(&router->ways[i]);
+    }
+  }
+  free(router->extents);
+  free(router->ways);
+  free(router->firstHilbert);
+  router->extents = NULL;
+  router->ways = NULL;
+  router->firstHilbert = NULL;
+}
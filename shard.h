@@ -0,0 +1,76 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "id_set.h"
+#include "location_store.h"
+
+#include <readosm.h>
+#include <stdint.h>
+
+// Assignment of elements to the shards of a sharded import. Nodes are
+// placed by their ID or their location; ways follow their first node and
+// relations their first node or way member, so most of a region's data
+// ends up in one shard. Elements without such a member are placed by their
+// own ID.
+enum ShardScheme {
+  // Blocks of SHARD_ID_BLOCK consecutive node IDs, dealt out in turn.
+  SHARD_BY_ID,
+  // Ranges of the Hilbert curve of spatial_index.h, so each shard covers a
+  // contiguous area. The ranges split a sample of the input's nodes into
+  // equal shares, see shardRouterSetRanges; the globe's equal ranges would
+  // put all of a regional extract into one shard.
+  SHARD_BY_TILE,
+};
+
+#define SHARD_ID_BLOCK (1LL << 20)
+
+// What the router sent to one shard, for the manifest.
+struct ShardExtent {
+  long long nodes;
+  long long ways;
+  long long relations;
+  // Bounding box of the nodes in 1e-7 degrees; min > max while empty.
+  long long minLat, maxLat, minLon, maxLon;
+};
+
+struct ShardRouter {
+  enum ShardScheme scheme;
+  int count;
+  struct ShardExtent *extents;
+  // SHARD_BY_TILE: the location of every node seen, to place the ways and
+  // relations referencing it.
+  struct LocationStore locations;
+  // SHARD_BY_TILE: the first Hilbert index of every shard, ascending; a
+  // shard ends where the next one starts.
+  uint32_t *firstHilbert;
+  // The IDs of the ways sent to each shard, for the relations referencing
+  // them.
+  struct IdSet *ways;
+};
+
+// Returns 0, or -1 after printing the error.
+int shardRouterInit(struct ShardRouter *router, enum ShardScheme scheme,
+                    int count);
+
+// SHARD_BY_TILE: splits the Hilbert curve at the quantiles of the indexes
+// in sample, which is sorted in place. Without a sample the shards keep the
+// equal ranges shardRouterInit starts with.
+void shardRouterSetRanges(struct ShardRouter *router, uint32_t *sample,
+                          long long count);
+
+// Return the shard of the element, or -1 if the node location or the way
+// ID could not be recorded.
+int shardOfNode(struct ShardRouter *router, const readosm_node *node);
+int shardOfWay(struct ShardRouter *router, const readosm_way *way);
+int shardOfRelation(struct ShardRouter *router,
+                    const readosm_relation *relation);
+
+// First and last Hilbert index of a SHARD_BY_TILE shard. Returns 0 if the
+// shard's range is empty, which happens when many sampled nodes share a
+// cell.
+int shardHilbertRange(const struct ShardRouter *router, int shard,
+                      uint32_t *first, uint32_t *last);
+
+void shardRouterFree(struct ShardRouter *router);
+
+#endif
@@ -0,0 +1,453 @@
+#include "shard_import.h"
+
+#include "columnar.h"
+#include "coordinates.h"
+#include "import.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "region.h"
+#include "schema.h"
+#include "shard.h"
+#include "spatial_index.h"
+#include "tag_filter.h"
+#include "timing.h"
+
+#include <pthread.h>
+#include <readosm.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// --shards: every shard is a database of its own with its own connection,
+// fed by a pipeline writer thread, so the B-tree work of the load and the
+// index builds after it run on as many cores as there are shards. The
+// parsing thread routes the elements, see shard.h.
+struct Shard {
+  struct ImportOptions options;
+  struct OsmParseContext stats;
+  int deferIndexes;
+  pthread_t thread;
+  int started;
+  int ret;
+  const char *errMsg;
+};
+
+struct ShardedImport {
+  struct ShardRouter router;
+  struct Shard *shards;
+  // Totals over all shards for the progress output and the metrics, and
+  // the input position for the pipelines.
+  struct OsmParseContext progress;
+};
+
+static int route_node(const void *user_data, const readosm_node *node) {
+  struct ShardedImport *import = (struct ShardedImport *)user_data;
+  int dropped = filterNode(&import->progress, node);
+  if (dropped != 0) {
+    return dropped < 0 ? READOSM_ABORT : READOSM_OK;
+  }
+  int shard = shardOfNode(&import->router, node);
+  if (shard < 0) {
+    fprintf(stderr, "Failed to record node location\n");
+    return READOSM_ABORT;
+  }
+  maybePrintStats(&import->progress, ++import->progress.nodes);
+  maybeEmitMetrics(&import->progress);
+  return pipelinePushNode(import->shards[shard].stats.pipeline, node);
+}
+
+static int route_way(const void *user_data, const readosm_way *way) {
+  struct ShardedImport *import = (struct ShardedImport *)user_data;
+  int dropped = filterWay(&import->progress, way);
+  if (dropped != 0) {
+    return dropped < 0 ? READOSM_ABORT : READOSM_OK;
+  }
+  int shard = shardOfWay(&import->router, way);
+  if (shard < 0) {
+    fprintf(stderr, "Failed to record way ID\n");
+    return READOSM_ABORT;
+  }
+  maybePrintStats(&import->progress, ++import->progress.ways);
+  maybeEmitMetrics(&import->progress);
+  return pipelinePushWay(import->shards[shard].stats.pipeline, way);
+}
+
+static int route_relation(const void *user_data,
+                          const readosm_relation *relation) {
+  struct ShardedImport *import = (struct ShardedImport *)user_data;
+  int dropped = filterRelation(&import->progress, relation);
+  if (dropped != 0) {
+    return dropped < 0 ? READOSM_ABORT : READOSM_OK;
+  }
+  int shard = shardOfRelation(&import->router, relation);
+  maybePrintStats(&import->progress, ++import->progress.relation);
+  maybeEmitMetrics(&import->progress);
+  return pipelinePushRelation(import->shards[shard].stats.pipeline,
+                              relation);
+}
+
+// --shard-by=tile: a first pass over the nodes keeps the Hilbert index of
+// every stride-th node the import would keep. When the sample fills up,
+// every other entry is dropped and the stride doubles, so it stays spread
+// over all nodes. The pass stops at the first way.
+#define SHARD_SAMPLE_SIZE (1 << 16)
+
+struct NodeSample {
+  const struct ImportOptions *options;
+  uint32_t *hilbert;
+  long long count;
+  long long stride;
+  long long seen;
+  int complete;
+};
+
+static int sample_node(const void *user_data, const readosm_node *node) {
+  struct NodeSample *sample = (struct NodeSample *)user_data;
+  const struct ImportOptions *options = sample->options;
+  if ((options->region != NULL &&
+       !regionContains(options->region, node->latitude, node->longitude)) ||
+      (options->filter != NULL &&
+       !tagFilterMatch(options->filter, node->tags, node->tag_count) &&
+       (options->referencedNodes == NULL ||
+        !idSetContains(options->referencedNodes, node->id)))) {
+    return READOSM_OK;
+  }
+  if (sample->seen++ % sample->stride != 0) {
+    return READOSM_OK;
+  }
+  if (sample->count == SHARD_SAMPLE_SIZE) {
+    for (long long i = 0; i < SHARD_SAMPLE_SIZE / 2; ++i) {
+      sample->hilbert[i] = sample->hilbert[2 * i];
+    }
+    sample->count = SHARD_SAMPLE_SIZE / 2;
+    sample->stride *= 2;
+  }
+  sample->hilbert[sample->count++] =
+      hilbertIndex(coordinateToE7(node->latitude),
+                   coordinateToE7(node->longitude));
+  return READOSM_OK;
+}
+
+static int sample_way(const void *user_data, const readosm_way *way) {
+  struct NodeSample *sample = (struct NodeSample *)user_data;
+  sample->complete = 1;
+  return READOSM_ABORT;
+}
+
+// Sets the shard ranges of the router from the sampled nodes.
+static int sampleShardRanges(const struct ImportOptions *options,
+                             struct ShardRouter *router) {
+  struct NodeSample sample = {options, NULL, 0, 1, 0, 0};
+  if ((sample.hilbert = malloc(SHARD_SAMPLE_SIZE * sizeof(uint32_t))) ==
+      NULL) {
+    return READOSM_INSUFFICIENT_MEMORY;
+  }
+  long long sourceOffset = 0;
+  double started = monotonicSeconds();
+  int ret = parseInput(options, &sample, &sourceOffset, 0, sample_node,
+                       sample_way, NULL);
+  if (ret == READOSM_OK || sample.complete) {
+    shardRouterSetRanges(router, sample.hilbert, sample.count);
+    fprintf(stdout, "Sampled %lld of %lld nodes for the shard ranges in "
+                    "%.2fs\n",
+            sample.count, sample.seen, monotonicSeconds() - started);
+    ret = READOSM_OK;
+  }
+  free(sample.hilbert);
+  return ret;
+}
+
+static void *completeShard(void *arg) {
+  struct Shard *shard = arg;
+  if ((shard->ret = finishLoad(&shard->stats, &shard->errMsg)) == SQLITE_OK) {
+    shard->ret = completeOutput(&shard->options, &shard->stats,
+                                shard->deferIndexes, &shard->errMsg);
+  }
+  return NULL;
+}
+
+// Tables and views unioned over the shards by the attach script. Interned
+// tag and role IDs differ between shards, so only the views resolving them
+// are included.
+static const struct TableDefinition shardViewDefinitions[] = {
+    {"nodes"},
+    {"node_locations", LAYOUT_COMPACT_NODES},
+    {"node_tags"},
+    {"node_names"},
+    {"ways"},
+    {"way_tags"},
+    {"way_nodes"},
+    {"node_ways", LAYOUT_PACKED_WAY_NODES},
+    {"relations"},
+    {"relation_tags"},
+    {"relation_members_view"},
+};
+
+// Writes the script attaching all shards to a connection and creating
+// TEMP views over them under the table names of a single database. Views
+// in a database file cannot refer to attached databases, so this has to
+// run on every connection.
+static int writeShardScript(const char *path, struct Shard *shards,
+                            int count) {
+  FILE *script = fopen(path, "w");
+  if (script == NULL) {
+    perror(path);
+    return -1;
+  }
+  for (int i = 0; i < count; ++i) {
+    char *attach = sqlite3_mprintf("ATTACH DATABASE %Q AS shard%d;\n",
+                                   shards[i].options.outputPath, i);
+    fputs(attach, script);
+    sqlite3_free(attach);
+  }
+  for (int i = 0; i < sizeof(shardViewDefinitions) /
+                          sizeof(shardViewDefinitions[0]);
+       ++i) {
+    const struct TableDefinition *view = &shardViewDefinitions[i];
+    if (!inLayout(shards[0].options.layout, view->required, view->excluded)) {
+      continue;
+    }
+    fprintf(script, "CREATE TEMP VIEW IF NOT EXISTS %s AS", view->query);
+    for (int j = 0; j < count; ++j) {
+      fprintf(script, "%s\n  SELECT * FROM shard%d.%s", j ? " UNION ALL" : "",
+              j, view->query);
+    }
+    fprintf(script, ";\n");
+  }
+  return fclose(script) == 0 ? 0 : -1;
+}
+
+// The database at the output path is the manifest of a sharded import:
+// shards lists the shard files with their scheme, area and element counts,
+// accumulated over the runs appending to them.
+static int writeShardManifest(const struct ImportOptions *options,
+                              struct ShardedImport *import,
+                              const char **errMsg) {
+  static const char *schema =
+      "CREATE TABLE IF NOT EXISTS shards ("
+      "       shard         INTEGER PRIMARY KEY,"
+      "       path          TEXT,"
+      "       scheme        TEXT,"
+      "       first_hilbert INTEGER,"
+      "       last_hilbert  INTEGER,"
+      "       min_lat       REAL,"
+      "       max_lat       REAL,"
+      "       min_lon       REAL,"
+      "       max_lon       REAL,"
+      "       nodes         INTEGER,"
+      "       ways          INTEGER,"
+      "       relations     INTEGER"
+      ");";
+  static const char *upsert =
+      "INSERT INTO shards VALUES (?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, "
+      "?11, ?12) "
+      "ON CONFLICT(shard) DO UPDATE SET "
+      "min_lat = min(coalesce(min_lat, excluded.min_lat), excluded.min_lat),"
+      "max_lat = max(coalesce(max_lat, excluded.max_lat), excluded.max_lat),"
+      "min_lon = min(coalesce(min_lon, excluded.min_lon), excluded.min_lon),"
+      "max_lon = max(coalesce(max_lon, excluded.max_lon), excluded.max_lon),"
+      "nodes = nodes + excluded.nodes, ways = ways + excluded.ways,"
+      "relations = relations + excluded.relations;";
+  struct ShardRouter *router = &import->router;
+  sqlite3 *dbHandle = NULL;
+  sqlite3_stmt *stmt = NULL;
+  int ret;
+  if ((ret = sqlite3_open(options->outputPath, &dbHandle)) != SQLITE_OK ||
+      (ret = sqlite3_exec(dbHandle, schema, NULL, NULL, NULL)) != SQLITE_OK ||
+      (ret = sqlite3_exec(dbHandle, "BEGIN TRANSACTION", NULL, NULL, NULL)) !=
+          SQLITE_OK ||
+      (ret = sqlite3_prepare_v2(dbHandle, upsert, -1, &stmt, NULL)) !=
+          SQLITE_OK) {
+    goto Fail;
+  }
+
+  for (int i = 0; i < router->count; ++i) {
+    const struct ShardExtent *extent = &router->extents[i];
+    sqlite3_bind_int(stmt, 1, i);
+    sqlite3_bind_text(stmt, 2, import->shards[i].options.outputPath, -1,
+                      SQLITE_STATIC);
+    sqlite3_bind_text(stmt, 3,
+                      router->scheme == SHARD_BY_TILE ? "tile" : "id", -1,
+                      SQLITE_STATIC);
+    if (router->scheme == SHARD_BY_TILE) {
+      uint32_t first, last;
+      if (shardHilbertRange(router, i, &first, &last)) {
+        sqlite3_bind_int64(stmt, 4, first);
+        sqlite3_bind_int64(stmt, 5, last);
+      }
+    }
+    if (extent->nodes != 0) {
+      sqlite3_bind_double(stmt, 6, coordinateFromE7(extent->minLat));
+      sqlite3_bind_double(stmt, 7, coordinateFromE7(extent->maxLat));
+      sqlite3_bind_double(stmt, 8, coordinateFromE7(extent->minLon));
+      sqlite3_bind_double(stmt, 9, coordinateFromE7(extent->maxLon));
+    }
+    sqlite3_bind_int64(stmt, 10, extent->nodes);
+    sqlite3_bind_int64(stmt, 11, extent->ways);
+    sqlite3_bind_int64(stmt, 12, extent->relations);
+    if ((ret = stepStatement(stmt)) != SQLITE_OK) {
+      goto Fail;
+    }
+  }
+
+  if ((ret = sqlite3_exec(dbHandle, "END TRANSACTION", NULL, NULL, NULL)) !=
+      SQLITE_OK) {
+    goto Fail;
+  }
+  sqlite3_finalize(stmt);
+  sqlite3_close(dbHandle);
+  return SQLITE_OK;
+
+Fail:
+  *errMsg = sqlite3_errmsg(dbHandle);
+  sqlite3_finalize(stmt);
+  sqlite3_close(dbHandle);
+  return ret;
+}
+
+int runSharded(struct ImportOptions *options) {
+  int ret = SQLITE_OK;
+  const char *errMsg = NULL;
+  int count = options->shards;
+  char *scriptPath = NULL;
+  struct ShardedImport import;
+  memset(&import, 0, sizeof(import));
+  import.progress.filter = options->filter;
+  import.progress.referencedNodes = options->referencedNodes;
+  import.progress.region = options->region;
+  import.progress.columnar = options->columnar;
+  if (shardRouterInit(&import.router, options->shardScheme, count) != 0 ||
+      (import.shards = calloc(count, sizeof(struct Shard))) == NULL) {
+    shardRouterFree(&import.router);
+    return SQLITE_NOMEM;
+  }
+  if (options->shardScheme == SHARD_BY_TILE &&
+      (ret = sampleShardRanges(options, &import.router)) != READOSM_OK) {
+    errMsg = "Fail to parse OSM";
+    goto Done;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    struct Shard *shard = &import.shards[i];
+    shard->options = *options;
+    shard->options.outputPath =
+        sqlite3_mprintf("%s.shard%d", options->outputPath, i);
+    shard->stats.shardWriter = 1;
+    if (shard->options.outputPath == NULL) {
+      ret = SQLITE_NOMEM;
+      errMsg = "Out of memory";
+      goto Done;
+    }
+    if ((ret = openOutput(&shard->options, &shard->stats,
+                          &shard->deferIndexes, &errMsg)) != SQLITE_OK) {
+      goto Done;
+    }
+  }
+
+  double loadStarted = monotonicSeconds();
+  struct PipelineOptions pipelineOptions = options->pipelineOptions;
+  pipelineOptions.sourcePosition = &import.progress.sourceOffset;
+  for (int i = 0; i < count; ++i) {
+    struct Shard *shard = &import.shards[i];
+    if ((ret = pipelineStart(&shard->stats.pipeline, &pipelineOptions,
+                             &shard->stats, write_node, write_way,
+                             write_relation)) != READOSM_OK) {
+      for (int j = 0; j < i; ++j) {
+        pipelineFinish(import.shards[j].stats.pipeline);
+      }
+      errMsg = "Failed to start writer pipeline";
+      goto Done;
+    }
+  }
+
+  ret = parseInput(options, &import, &import.progress.sourceOffset, 0,
+                   route_node, route_way, route_relation);
+  for (int i = 0; i < count; ++i) {
+    int writerRet = pipelineFinish(import.shards[i].stats.pipeline);
+    if (ret == READOSM_OK) {
+      ret = writerRet;
+    }
+  }
+  if (ret != READOSM_OK) {
+    errMsg = "Fail to parse OSM";
+    goto Done;
+  }
+  if (finishColumnar(options) != 0) {
+    ret = SQLITE_IOERR;
+    errMsg = "Failed to finish the columnar export";
+    goto Done;
+  }
+
+  double loadSeconds = monotonicSeconds() - loadStarted;
+  metricsAddPhase(METRICS_PHASE_LOAD, loadSeconds);
+  struct OsmParseContext *total = &import.progress;
+  long long elements = (long long)total->nodes + total->ways + total->relation;
+  fprintf(stdout, "Load: %lld elements in %.2fs (%.0f elements/s)\n",
+          elements, loadSeconds, loadSeconds > 0 ? elements / loadSeconds : 0);
+
+  // The shards build their indexes and derived tables side by side.
+  for (int i = 0; i < count; ++i) {
+    struct Shard *shard = &import.shards[i];
+    if (pthread_create(&shard->thread, NULL, completeShard, shard) == 0) {
+      shard->started = 1;
+    } else {
+      completeShard(shard);
+    }
+  }
+  for (int i = 0; i < count; ++i) {
+    struct Shard *shard = &import.shards[i];
+    if (shard->started) {
+      pthread_join(shard->thread, NULL);
+    }
+    if (shard->ret != SQLITE_OK && ret == SQLITE_OK) {
+      ret = shard->ret;
+      errMsg = shard->errMsg;
+    }
+  }
+  if (ret != SQLITE_OK) {
+    goto Done;
+  }
+
+  if ((ret = writeShardManifest(options, &import, &errMsg)) != SQLITE_OK) {
+    goto Done;
+  }
+  scriptPath = sqlite3_mprintf("%s.sql", options->outputPath);
+  if (scriptPath == NULL ||
+      writeShardScript(scriptPath, import.shards, count) != 0) {
+    ret = SQLITE_CANTOPEN;
+    errMsg = "Failed to write the shard attach script";
+    goto Done;
+  }
+
+  for (int i = 0; i < count; ++i) {
+    const struct ShardExtent *extent = &import.router.extents[i];
+    fprintf(stdout, "Shard %d: nodes=%lld ways=%lld relations=%lld in %s\n",
+            i, extent->nodes, extent->ways, extent->relations,
+            import.shards[i].options.outputPath);
+  }
+  fprintf(stdout, "Manifest in %s, attach script in %s\n",
+          options->outputPath, scriptPath);
+
+Done:
+  if (ret != SQLITE_OK && errMsg != NULL) {
+    fprintf(stderr, "%s\n", errMsg);
+  }
+  struct MetricsProgress progress;
+  metricsProgress(&import.progress, &progress);
+  metricsFinish(NULL, &progress, ret == SQLITE_OK ? "ok" : "failed");
+  printStats(&import.progress);
+  printFilterStats(&import.progress);
+  printMemoryStats();
+  printWriteBehindStats();
+  for (int i = 0; i < count; ++i) {
+    struct Shard *shard = &import.shards[i];
+    sqlite3_close(shard->stats.dbHandle);
+    pipelineFree(shard->stats.pipeline);
+    sqlite3_free((char *)shard->options.outputPath);
+  }
+  sqlite3_free(scriptPath);
+  free(import.shards);
+  shardRouterFree(&import.router);
+  return ret;
+}
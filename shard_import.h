@@ -0,0 +1,15 @@
+#ifndef SHARD_IMPORT_H
+#define SHARD_IMPORT_H
+
+#include "import.h"
+
+// SQLite attaches at most 10 databases unless built with a higher
+// SQLITE_MAX_ATTACHED; the shard attach script needs one per shard.
+#define SQLITE_MAX_SHARDS 10
+
+// --shards: imports into the databases <output>.shard0 ... and writes a
+// manifest of what each holds to <output>, with a script attaching them
+// all in <output>.sql.
+int runSharded(struct ImportOptions *options);
+
+#endif
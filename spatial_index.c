@@ -0,0 +1,211 @@
+#include "spatial_index.h"
+#include "coordinates.h"
+#include "timing.h"
+
+#include <stdio.h>
+
+#define HILBERT_ORDER 16
+
+static uint32_t hilbertCell(long long e7, long long range) {
+  if (e7 < -range) {
+    e7 = -range;
+  } else if (e7 > range) {
+    e7 = range;
+  }
+  return (uint32_t)((e7 + range) * ((1 << HILBERT_ORDER) - 1) / (2 * range));
+}
+
+uint32_t hilbertIndex(long long latE7, long long lonE7) {
+  uint32_t x = hilbertCell(lonE7, 1800000000LL);
+  uint32_t y = hilbertCell(latE7, 900000000LL);
+  uint32_t n = 1u << HILBERT_ORDER;
+  uint32_t d = 0;
+  for (uint32_t s = n / 2; s > 0; s /= 2) {
+    uint32_t rx = (x & s) != 0;
+    uint32_t ry = (y & s) != 0;
+    d += s * s * ((3 * rx) ^ ry);
+    // Rotate the quadrant so the curve stays continuous.
+    if (ry == 0) {
+      if (rx == 1) {
+        x = n - 1 - x;
+        y = n - 1 - y;
+      }
+      uint32_t t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return d;
+}
+
+int spatialIndexInit(struct SpatialIndex *index, sqlite3 *db,
+                     struct LocationStore *locations, int compactNodes) {
+  index->dbHandle = db;
+  index->locations = locations;
+  index->compactNodes = compactNodes;
+  index->locationStmt = NULL;
+
+  int ret;
+  if ((ret = batchInsertInit(&index->nodeBatch, db,
+                             "INSERT INTO node_rtree_staging(hilbert, id, "
+                             "lat, lon)",
+                             "iiii")) != SQLITE_OK ||
+      (ret = batchInsertInit(&index->wayBatch, db,
+                             "INSERT INTO way_rtree_staging(hilbert, id, "
+                             "min_lat, max_lat, min_lon, max_lon)",
+                             "iiiiii")) != SQLITE_OK) {
+    return ret;
+  }
+
+  const char *query = compactNodes
+                          ? "SELECT lat, lon FROM nodes WHERE id = ?1;"
+                          : "SELECT latitude, longitude FROM nodes "
+                            "WHERE id = ?1;";
+  if ((ret = sqlite3_prepare_v2(db, query, -1, &index->locationStmt, NULL)) !=
+      SQLITE_OK) {
+    fprintf(stderr, "spatialIndexInit: Failed to prepare location query: %s\n",
+            sqlite3_errmsg(db));
+  }
+  return ret;
+}
+
+int spatialIndexAddNode(struct SpatialIndex *index, long long id,
+                        double latitude, double longitude, int tagged) {
+  long long lat = coordinateToE7(latitude);
+  long long lon = coordinateToE7(longitude);
+  if (index->locations != NULL &&
+      locationStoreSet(index->locations, id, lat, lon) != 0) {
+    return SQLITE_IOERR;
+  }
+  if (!tagged) {
+    return SQLITE_OK;
+  }
+
+  struct BatchInsert *batch = &index->nodeBatch;
+  batchInsertInt64(batch, 0, hilbertIndex(lat, lon));
+  batchInsertInt64(batch, 1, id);
+  batchInsertInt64(batch, 2, lat);
+  batchInsertInt64(batch, 3, lon);
+  return batchInsertEndRow(batch);
+}
+
+// Returns SQLITE_ROW if the node has a location, SQLITE_DONE if not.
+static int lookupLocation(struct SpatialIndex *index, long long id,
+                          long long *lat, long long *lon) {
+  if (index->locations != NULL &&
+      locationStoreGet(index->locations, id, lat, lon)) {
+    return SQLITE_ROW;
+  }
+
+  sqlite3_stmt *stmt = index->locationStmt;
+  sqlite3_bind_int64(stmt, 1, id);
+  int ret = sqlite3_step(stmt);
+  if (ret == SQLITE_ROW) {
+    if (index->compactNodes) {
+      *lat = sqlite3_column_int64(stmt, 0);
+      *lon = sqlite3_column_int64(stmt, 1);
+    } else {
+      *lat = coordinateToE7(sqlite3_column_double(stmt, 0));
+      *lon = coordinateToE7(sqlite3_column_double(stmt, 1));
+    }
+  }
+  int resetRet = sqlite3_reset(stmt);
+  if (ret == SQLITE_ROW || ret == SQLITE_DONE) {
+    ret = resetRet == SQLITE_OK ? ret : resetRet;
+  }
+  return ret;
+}
+
+int spatialIndexAddWay(struct SpatialIndex *index, long long id,
+                       const long long *nodeRefs, int nodeRefCount) {
+  long long minLat = 0, maxLat = 0, minLon = 0, maxLon = 0;
+  int found = 0;
+  for (int i = 0; i < nodeRefCount; ++i) {
+    long long lat = 0, lon = 0;
+    int ret = lookupLocation(index, nodeRefs[i], &lat, &lon);
+    if (ret == SQLITE_DONE) {
+      continue;
+    }
+    if (ret != SQLITE_ROW) {
+      return ret;
+    }
+    if (!found++) {
+      minLat = maxLat = lat;
+      minLon = maxLon = lon;
+      continue;
+    }
+    minLat = lat < minLat ? lat : minLat;
+    maxLat = lat > maxLat ? lat : maxLat;
+    minLon = lon < minLon ? lon : minLon;
+    maxLon = lon > maxLon ? lon : maxLon;
+  }
+  if (!found) {
+    return SQLITE_OK;
+  }
+
+  struct BatchInsert *batch = &index->wayBatch;
+  batchInsertInt64(batch, 0,
+                   hilbertIndex((minLat + maxLat) / 2, (minLon + maxLon) / 2));
+  batchInsertInt64(batch, 1, id);
+  batchInsertInt64(batch, 2, minLat);
+  batchInsertInt64(batch, 3, maxLat);
+  batchInsertInt64(batch, 4, minLon);
+  batchInsertInt64(batch, 5, maxLon);
+  return batchInsertEndRow(batch);
+}
+
+int spatialIndexFlush(struct SpatialIndex *index) {
+  int ret;
+  if ((ret = batchInsertFlush(&index->nodeBatch)) != SQLITE_OK) {
+    return ret;
+  }
+  return batchInsertFlush(&index->wayBatch);
+}
+
+int spatialIndexFinalize(struct SpatialIndex *index) {
+  int ret = sqlite3_finalize(index->locationStmt);
+  int nodeRet = batchInsertFinalize(&index->nodeBatch);
+  int wayRet = batchInsertFinalize(&index->wayBatch);
+  index->locationStmt = NULL;
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  return nodeRet != SQLITE_OK ? nodeRet : wayRet;
+}
+
+// R*Tree coordinates are 32-bit floats; SQLite rounds minima down and
+// maxima up, so boxes only ever grow. REPLACE keeps the latest extent of
+// an element imported twice.
+int spatialIndexBuild(sqlite3 *db) {
+  static const struct {
+    const char *table;
+    const char *query;
+  } builds[] = {
+      {"node_rtree",
+       "INSERT OR REPLACE INTO node_rtree "
+       "SELECT id, lat / 1e7, lat / 1e7, lon / 1e7, lon / 1e7 "
+       "FROM node_rtree_staging ORDER BY hilbert;"
+       "DELETE FROM node_rtree_staging;"},
+      {"way_rtree",
+       "INSERT OR REPLACE INTO way_rtree "
+       "SELECT id, min_lat / 1e7, max_lat / 1e7, min_lon / 1e7, "
+       "max_lon / 1e7 "
+       "FROM way_rtree_staging ORDER BY hilbert;"
+       "DELETE FROM way_rtree_staging;"},
+  };
+
+  for (int i = 0; i < sizeof(builds) / sizeof(builds[0]); ++i) {
+    char *errMsg = NULL;
+    double started = monotonicSeconds();
+    int ret = sqlite3_exec(db, builds[i].query, NULL, NULL, &errMsg);
+    if (ret != SQLITE_OK) {
+      fprintf(stderr, "sqlite3_exec error: %s, running query\"%s\"", errMsg,
+              builds[i].query);
+      sqlite3_free(errMsg);
+      return ret;
+    }
+    fprintf(stdout, "Table %-24s built in %.2fs\n", builds[i].table,
+            monotonicSeconds() - started);
+  }
+  return SQLITE_OK;
+}
@@ -0,0 +1,49 @@
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include "batch_insert.h"
+#include "location_store.h"
+
+#include <sqlite3.h>
+#include <stdint.h>
+
+// R*Trees of the LAYOUT_SPATIAL_INDEX layout: node_rtree holds the tagged
+// nodes, way_rtree the bounding box of every way. During the load entries
+// are only staged, in 1e-7 degrees and with the Hilbert index of their
+// centre; spatialIndexBuild inserts them in Hilbert order afterwards, so
+// neighbouring entries end up in the same tree nodes.
+struct SpatialIndex {
+  sqlite3 *dbHandle;
+  struct BatchInsert nodeBatch;
+  struct BatchInsert wayBatch;
+  // Way extents are computed from the locations of the nodes. Nodes
+  // missing from the store, written by an earlier run, are looked up in
+  // the nodes table. NULL looks up every node there.
+  struct LocationStore *locations;
+  sqlite3_stmt *locationStmt;
+  int compactNodes;
+};
+
+// Position of a point along a Hilbert curve of 2^16 x 2^16 cells over the
+// whole globe. Coordinates are in 1e-7 degrees.
+uint32_t hilbertIndex(long long latE7, long long lonE7);
+
+// compactNodes selects the coordinate columns of nodes, see
+// LAYOUT_COMPACT_NODES.
+int spatialIndexInit(struct SpatialIndex *index, sqlite3 *db,
+                     struct LocationStore *locations, int compactNodes);
+
+// Records the location of every node; only tagged ones go into node_rtree.
+int spatialIndexAddNode(struct SpatialIndex *index, long long id,
+                        double latitude, double longitude, int tagged);
+// Ways whose nodes are all missing from the database are left out.
+int spatialIndexAddWay(struct SpatialIndex *index, long long id,
+                       const long long *nodeRefs, int nodeRefCount);
+
+int spatialIndexFlush(struct SpatialIndex *index);
+int spatialIndexFinalize(struct SpatialIndex *index);
+
+// Moves the staged entries into the R*Trees.
+int spatialIndexBuild(sqlite3 *db);
+
+#endif
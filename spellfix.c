@@ -2845,6 +2845,43 @@ static const char *spellfix1GetConflict(sqlite3 *db){
   return azConflict[eConflict-1];
 }
 
+/*
+** Compute the k1 and k2 columns of a %_vocab row for the word zWord the
+** same way the xUpdate() method does, so that callers can fill the vocab
+** table directly.  k1 is the lower-cased transliteration and k2 its
+** phonetic hash.  *pzK1 is set to NULL when k1 equals the word, which is
+** how xUpdate() stores it.  Both results are freed with sqlite3_free().
+**
+** Uses no database connection and may be called from any thread.
+*/
+int sqlite3_spellfix_vocab_keys(
+  const char *zWord,
+  int nWord,
+  char **pzK1,
+  char **pzK2
+){
+  char *zK1, *zK2;
+  int i;
+  char c;
+  zK1 = (char*)transliterate((const unsigned char*)zWord, nWord);
+  if( zK1==0 ) return SQLITE_NOMEM;
+  for(i=0; (c = zK1[i])!=0; i++){
+     if( c>='A' && c<='Z' ) zK1[i] += 'a' - 'A';
+  }
+  zK2 = (char*)phoneticHash((const unsigned char*)zK1, i);
+  if( zK2==0 ){
+    sqlite3_free(zK1);
+    return SQLITE_NOMEM;
+  }
+  if( i==nWord && memcmp(zK1, zWord, nWord)==0 ){
+    sqlite3_free(zK1);
+    zK1 = 0;
+  }
+  *pzK1 = zK1;
+  *pzK2 = zK2;
+  return SQLITE_OK;
+}
+
 /*
 ** The xUpdate() method.
 */
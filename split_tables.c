@@ -0,0 +1,412 @@
+#include "split_tables.h"
+
+#include "columnar.h"
+#include "import.h"
+#include "metrics.h"
+#include "pipeline.h"
+#include "pragma_profile.h"
+#include "schema.h"
+#include "timing.h"
+
+#include <pthread.h>
+#include <readosm.h>
+#include <sqlite3.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// The tables each part fills, copied into the output by the merge.
+static const struct TableDefinition nodePartTables[] = {
+    {"nodes"},
+    {"node_tags", 0, LAYOUT_INTERNED_TAGS},
+    {"node_tag_ids", LAYOUT_INTERNED_TAGS},
+    {"node_names"},
+    {"node_rtree_staging", LAYOUT_SPATIAL_INDEX},
+};
+
+static const struct TableDefinition wayPartTables[] = {
+    {"ways"},
+    {"way_tags", 0, LAYOUT_INTERNED_TAGS},
+    {"way_tag_ids", LAYOUT_INTERNED_TAGS},
+    {"way_nodes", 0, LAYOUT_PACKED_WAY_NODES},
+    {"way_rtree_staging", LAYOUT_SPATIAL_INDEX},
+};
+
+static const struct TableDefinition relationPartTables[] = {
+    {"relations"},
+    {"relation_tags", 0, LAYOUT_INTERNED_TAGS},
+    {"relation_tag_ids", LAYOUT_INTERNED_TAGS},
+    {"relation_roles"},
+    {"relation_members"},
+};
+
+struct TablePartDefinition {
+  const char *name;
+  const struct TableDefinition *tables;
+  int tableCount;
+};
+
+static const struct TablePartDefinition tablePartDefinitions[] = {
+    {"nodes", nodePartTables,
+     sizeof(nodePartTables) / sizeof(nodePartTables[0])},
+    {"ways", wayPartTables, sizeof(wayPartTables) / sizeof(wayPartTables[0])},
+    {"relations", relationPartTables,
+     sizeof(relationPartTables) / sizeof(relationPartTables[0])},
+};
+
+struct TablePart {
+  const struct TablePartDefinition *definition;
+  struct ImportOptions options;
+  struct OsmParseContext stats;
+  // The writer has been drained and the indexes are being built.
+  int finished;
+  pthread_t thread;
+  int started;
+  int ret;
+  const char *errMsg;
+};
+
+struct SplitImport {
+  struct TablePart parts[TABLE_PART_COUNT];
+  // Part receiving the elements being parsed.
+  int current;
+  // The output database. Its tag dictionary and location store are shared
+  // by the parts, whose writers never run at the same time.
+  struct OsmParseContext output;
+  // Totals over all parts for the progress output and the metrics, and
+  // the input position for the pipelines.
+  struct OsmParseContext progress;
+};
+
+static void *completeTablePart(void *arg) {
+  struct TablePart *part = arg;
+  sqlite3 *dbHandle = part->stats.dbHandle;
+  double started = monotonicSeconds();
+  if ((part->ret = finishLoad(&part->stats, &part->errMsg)) != SQLITE_OK) {
+    return NULL;
+  }
+  if ((part->ret = sqlite3_exec(dbHandle, "BEGIN TRANSACTION", NULL, NULL,
+                                NULL)) != SQLITE_OK ||
+      (part->ret = createIndexes(dbHandle, part->options.layout, 0)) !=
+          SQLITE_OK ||
+      (part->ret = sqlite3_exec(dbHandle, "END TRANSACTION", NULL, NULL,
+                                NULL)) != SQLITE_OK) {
+    part->errMsg = sqlite3_errmsg(dbHandle);
+    return NULL;
+  }
+  double seconds = monotonicSeconds() - started;
+  metricsAddPhase(METRICS_PHASE_INDEXES, seconds);
+  fprintf(stdout, "Indexes of %-18s built in %.2fs\n",
+          part->definition->name, seconds);
+  part->ret = finalizeOutput(&part->options, &part->stats, &part->errMsg);
+  return NULL;
+}
+
+// Completes the parts before the one for the element being parsed.
+static int enterTablePart(struct SplitImport *import, int kind) {
+  if (kind < import->current) {
+    fprintf(stderr, "--split-tables needs the input sorted by element type\n");
+    return -1;
+  }
+  for (; import->current < kind; ++import->current) {
+    struct TablePart *part = &import->parts[import->current];
+    part->finished = 1;
+    if ((part->ret = pipelineFinish(part->stats.pipeline)) != READOSM_OK) {
+      part->errMsg = "Failed to write the elements";
+      return -1;
+    }
+    if (pthread_create(&part->thread, NULL, completeTablePart, part) == 0) {
+      part->started = 1;
+    } else {
+      completeTablePart(part);
+    }
+  }
+  return 0;
+}
+
+static int split_node(const void *user_data, const readosm_node *node) {
+  struct SplitImport *import = (struct SplitImport *)user_data;
+  int dropped = filterNode(&import->progress, node);
+  if (dropped != 0) {
+    return dropped < 0 ? READOSM_ABORT : READOSM_OK;
+  }
+  if (enterTablePart(import, TABLE_PART_NODES) != 0) {
+    return READOSM_ABORT;
+  }
+  maybePrintStats(&import->progress, ++import->progress.nodes);
+  maybeEmitMetrics(&import->progress);
+  return pipelinePushNode(import->parts[TABLE_PART_NODES].stats.pipeline,
+                          node);
+}
+
+static int split_way(const void *user_data, const readosm_way *way) {
+  struct SplitImport *import = (struct SplitImport *)user_data;
+  int dropped = filterWay(&import->progress, way);
+  if (dropped != 0) {
+    return dropped < 0 ? READOSM_ABORT : READOSM_OK;
+  }
+  if (enterTablePart(import, TABLE_PART_WAYS) != 0) {
+    return READOSM_ABORT;
+  }
+  maybePrintStats(&import->progress, ++import->progress.ways);
+  maybeEmitMetrics(&import->progress);
+  return pipelinePushWay(import->parts[TABLE_PART_WAYS].stats.pipeline, way);
+}
+
+static int split_relation(const void *user_data,
+                          const readosm_relation *relation) {
+  struct SplitImport *import = (struct SplitImport *)user_data;
+  int dropped = filterRelation(&import->progress, relation);
+  if (dropped != 0) {
+    return dropped < 0 ? READOSM_ABORT : READOSM_OK;
+  }
+  if (enterTablePart(import, TABLE_PART_RELATIONS) != 0) {
+    return READOSM_ABORT;
+  }
+  maybePrintStats(&import->progress, ++import->progress.relation);
+  maybeEmitMetrics(&import->progress);
+  return pipelinePushRelation(
+      import->parts[TABLE_PART_RELATIONS].stats.pipeline, relation);
+}
+
+// Copies the tables of a completed part into the empty tables of the
+// output. A plain INSERT INTO ... SELECT * between tables with the same
+// columns and indexes is done by SQLite's transfer optimization: the rows
+// and the index entries are appended in key order without being decoded,
+// so the output's indexes come out of the parts' index builds.
+static int mergeTablePart(sqlite3 *dbHandle, struct TablePart *part) {
+  const struct TablePartDefinition *definition = part->definition;
+  char *query = sqlite3_mprintf("ATTACH DATABASE %Q AS part;",
+                                part->options.outputPath);
+  if (query == NULL) {
+    return SQLITE_NOMEM;
+  }
+  int ret = sqlite3_exec(dbHandle, query, NULL, NULL, NULL);
+  sqlite3_free(query);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+
+  double started = monotonicSeconds();
+  if ((ret = sqlite3_exec(dbHandle, "BEGIN TRANSACTION", NULL, NULL, NULL)) !=
+      SQLITE_OK) {
+    goto Done;
+  }
+  for (int i = 0; i < definition->tableCount; ++i) {
+    const struct TableDefinition *table = &definition->tables[i];
+    if (!inLayout(part->options.layout, table->required, table->excluded)) {
+      continue;
+    }
+    query = sqlite3_mprintf("INSERT INTO main.%s SELECT * FROM part.%s;",
+                            table->query, table->query);
+    if (query == NULL) {
+      ret = SQLITE_NOMEM;
+      goto Done;
+    }
+    ret = sqlite3_exec(dbHandle, query, NULL, NULL, NULL);
+    sqlite3_free(query);
+    if (ret != SQLITE_OK) {
+      goto Done;
+    }
+  }
+  if ((ret = sqlite3_exec(dbHandle, "END TRANSACTION", NULL, NULL, NULL)) !=
+      SQLITE_OK) {
+    goto Done;
+  }
+  fprintf(stdout, "Merged %-23s in %.2fs\n", definition->name,
+          monotonicSeconds() - started);
+
+Done:
+  if (ret != SQLITE_OK) {
+    fprintf(stderr, "Failed to merge %s: %s\n", definition->name,
+            sqlite3_errmsg(dbHandle));
+    sqlite3_exec(dbHandle, "ROLLBACK", NULL, NULL, NULL);
+  }
+  sqlite3_exec(dbHandle, "DETACH DATABASE part;", NULL, NULL, NULL);
+  return ret;
+}
+
+static void removeTablePart(struct TablePart *part) {
+  static const char *suffixes[] = {"", "-journal", "-wal", "-shm"};
+  for (int i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); ++i) {
+    char *path = sqlite3_mprintf("%s%s", part->options.outputPath,
+                                 suffixes[i]);
+    if (path != NULL) {
+      unlink(path);
+      sqlite3_free(path);
+    }
+  }
+}
+
+int runSplitTables(struct ImportOptions *options) {
+  int ret = SQLITE_OK;
+  const char *errMsg = NULL;
+  struct SplitImport import;
+  memset(&import, 0, sizeof(import));
+  import.progress.filter = options->filter;
+  import.progress.referencedNodes = options->referencedNodes;
+  import.progress.region = options->region;
+  import.progress.columnar = options->columnar;
+
+  // The parts' tables are copied into empty ones, keeping their rowids.
+  if (access(options->outputPath, F_OK) == 0) {
+    fprintf(stderr, "--split-tables writes a new database, %s exists\n",
+            options->outputPath);
+    return SQLITE_CANTOPEN;
+  }
+
+  int deferIndexes;
+  if ((ret = openOutput(options, &import.output, &deferIndexes, &errMsg)) !=
+      SQLITE_OK) {
+    goto Done;
+  }
+
+  for (int i = 0; i < TABLE_PART_COUNT; ++i) {
+    struct TablePart *part = &import.parts[i];
+    part->definition = &tablePartDefinitions[i];
+    part->options = *options;
+    part->options.outputPath = sqlite3_mprintf("%s.%s.tmp",
+                                               options->outputPath,
+                                               part->definition->name);
+    if (part->options.outputPath == NULL) {
+      ret = SQLITE_NOMEM;
+      errMsg = "Out of memory";
+      goto Done;
+    }
+    // Scratch files: durability does not matter, and the indexes are
+    // built when the part is complete.
+    part->options.profile = pragmaProfileFind("bulk");
+    part->options.indexMode = INDEX_MODE_DEFERRED;
+    part->options.locationStorePath = NULL;
+    part->stats.shardWriter = 1;
+    removeTablePart(part);
+    int partDeferIndexes;
+    if ((ret = openOutput(&part->options, &part->stats, &partDeferIndexes,
+                          &errMsg)) != SQLITE_OK) {
+      goto Done;
+    }
+    if (options->layout & LAYOUT_INTERNED_TAGS) {
+      part->stats.insertNodeContext.tags = &import.output.tagDictionary;
+      part->stats.insertWayContext.tags = &import.output.tagDictionary;
+      part->stats.insertRelationContext.tags = &import.output.tagDictionary;
+    }
+    if (options->layout & LAYOUT_SPATIAL_INDEX) {
+      part->stats.spatialIndex.locations = &import.output.locationStore;
+    }
+  }
+
+  double loadStarted = monotonicSeconds();
+  struct PipelineOptions pipelineOptions = options->pipelineOptions;
+  pipelineOptions.sourcePosition = &import.progress.sourceOffset;
+  for (int i = 0; i < TABLE_PART_COUNT; ++i) {
+    struct TablePart *part = &import.parts[i];
+    if ((ret = pipelineStart(&part->stats.pipeline, &pipelineOptions,
+                             &part->stats, write_node, write_way,
+                             write_relation)) != READOSM_OK) {
+      errMsg = "Failed to start writer pipeline";
+      goto Done;
+    }
+  }
+
+  ret = parseInput(options, &import, &import.progress.sourceOffset, 0,
+                   split_node, split_way, split_relation);
+  if (ret == READOSM_OK &&
+      enterTablePart(&import, TABLE_PART_COUNT) != 0) {
+    ret = READOSM_ABORT;
+  }
+  if (ret != READOSM_OK) {
+    errMsg = "Fail to parse OSM";
+    goto Done;
+  }
+  if (finishColumnar(options) != 0) {
+    ret = SQLITE_IOERR;
+    errMsg = "Failed to finish the columnar export";
+    goto Done;
+  }
+  for (int i = 0; i < TABLE_PART_COUNT; ++i) {
+    struct TablePart *part = &import.parts[i];
+    if (part->started) {
+      pthread_join(part->thread, NULL);
+      part->started = 0;
+    }
+    if (part->ret != SQLITE_OK && ret == SQLITE_OK) {
+      ret = part->ret;
+      errMsg = part->errMsg;
+    }
+  }
+  if (ret != SQLITE_OK) {
+    goto Done;
+  }
+
+  double loadSeconds = monotonicSeconds() - loadStarted;
+  metricsAddPhase(METRICS_PHASE_LOAD, loadSeconds);
+  struct OsmParseContext *total = &import.progress;
+  long long elements = (long long)total->nodes + total->ways + total->relation;
+  fprintf(stdout, "Load: %lld elements in %.2fs (%.0f elements/s)\n",
+          elements, loadSeconds, loadSeconds > 0 ? elements / loadSeconds : 0);
+
+  // The output's indexes have to exist before the merge for the transfer
+  // to fill them.
+  struct OsmParseContext *output = &import.output;
+  sqlite3 *dbHandle = output->dbHandle;
+  output->progress.lastNodeId =
+      import.parts[TABLE_PART_NODES].stats.progress.lastNodeId;
+  output->progress.lastWayId =
+      import.parts[TABLE_PART_WAYS].stats.progress.lastWayId;
+  output->progress.lastRelationId =
+      import.parts[TABLE_PART_RELATIONS].stats.progress.lastRelationId;
+  if ((ret = finishLoad(output, &errMsg)) != SQLITE_OK) {
+    goto Done;
+  }
+  if ((ret = createIndexes(dbHandle, options->layout, 0)) != SQLITE_OK) {
+    errMsg = sqlite3_errmsg(dbHandle);
+    goto Done;
+  }
+  double mergeStarted = monotonicSeconds();
+  for (int i = 0; i < TABLE_PART_COUNT; ++i) {
+    struct TablePart *part = &import.parts[i];
+    sqlite3_close(part->stats.dbHandle);
+    part->stats.dbHandle = NULL;
+    if ((ret = mergeTablePart(dbHandle, part)) != SQLITE_OK) {
+      errMsg = "Failed to merge the tables";
+      goto Done;
+    }
+    removeTablePart(part);
+  }
+  metricsAddPhase(METRICS_PHASE_MERGE, monotonicSeconds() - mergeStarted);
+
+  ret = completeOutput(options, output, 0, &errMsg);
+
+Done:
+  for (int i = 0; i < TABLE_PART_COUNT; ++i) {
+    struct TablePart *part = &import.parts[i];
+    if (!part->finished && part->stats.pipeline != NULL) {
+      pipelineFinish(part->stats.pipeline);
+    }
+    if (part->started) {
+      pthread_join(part->thread, NULL);
+    }
+  }
+  if (ret != SQLITE_OK && errMsg != NULL) {
+    fprintf(stderr, "%s\n", errMsg);
+  }
+  struct MetricsProgress progress;
+  metricsProgress(&import.progress, &progress);
+  metricsFinish(import.output.dbHandle, &progress,
+                ret == SQLITE_OK ? "ok" : "failed");
+  sqlite3_close(import.output.dbHandle);
+  printStats(&import.progress);
+  printFilterStats(&import.progress);
+  printMemoryStats();
+  printWriteBehindStats();
+  for (int i = 0; i < TABLE_PART_COUNT; ++i) {
+    struct TablePart *part = &import.parts[i];
+    sqlite3_close(part->stats.dbHandle);
+    pipelineFree(part->stats.pipeline);
+    if (part->options.outputPath != NULL) {
+      removeTablePart(part);
+      sqlite3_free((char *)part->options.outputPath);
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,21 @@
+#ifndef SPLIT_TABLES_H
+#define SPLIT_TABLES_H
+
+#include "import.h"
+
+// --split-tables: nodes, ways and relations are loaded into temporary
+// databases of their own, each with its own connection and writer thread.
+// The input is sorted by element type, so a part is complete once the next
+// type starts; its indexes are then built on another thread while the next
+// part loads. The finished tables are copied into the output with their
+// indexes, see mergeTablePart.
+enum TablePartKind {
+  TABLE_PART_NODES,
+  TABLE_PART_WAYS,
+  TABLE_PART_RELATIONS,
+  TABLE_PART_COUNT
+};
+
+int runSplitTables(struct ImportOptions *options);
+
+#endif
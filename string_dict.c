@@ -0,0 +1,101 @@
+#include "string_dict.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_CAPACITY 1024
+
+static uint64_t hashString(const char *str) {
+  // FNV-1a
+  uint64_t hash = 14695981039346656037ULL;
+  for (const unsigned char *p = (const unsigned char *)str; *p; ++p) {
+    hash ^= *p;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+void stringDictInit(struct StringDict *dict) {
+  dict->entries = NULL;
+  dict->capacity = 0;
+  dict->count = 0;
+  arenaInit(&dict->arena, 64 * 1024);
+}
+
+static struct StringDictEntry *findSlot(struct StringDictEntry *entries,
+                                        size_t capacity, const char *str,
+                                        uint64_t hash) {
+  size_t mask = capacity - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    struct StringDictEntry *entry = &entries[i];
+    if (entry->str == NULL ||
+        (entry->hash == hash && strcmp(entry->str, str) == 0)) {
+      return entry;
+    }
+  }
+}
+
+long long *stringDictLookup(const struct StringDict *dict, const char *str) {
+  if (dict->count == 0) {
+    return NULL;
+  }
+  struct StringDictEntry *entry =
+      findSlot(dict->entries, dict->capacity, str, hashString(str));
+  return entry->str != NULL ? &entry->id : NULL;
+}
+
+int stringDictFind(const struct StringDict *dict, const char *str,
+                   long long *id) {
+  long long *found = stringDictLookup(dict, str);
+  if (found == NULL) {
+    return 0;
+  }
+  *id = *found;
+  return 1;
+}
+
+static int grow(struct StringDict *dict) {
+  size_t capacity = dict->capacity ? dict->capacity * 2 : INITIAL_CAPACITY;
+  struct StringDictEntry *entries =
+      calloc(capacity, sizeof(struct StringDictEntry));
+  if (entries == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < dict->capacity; ++i) {
+    struct StringDictEntry *entry = &dict->entries[i];
+    if (entry->str != NULL) {
+      *findSlot(entries, capacity, entry->str, entry->hash) = *entry;
+    }
+  }
+  free(dict->entries);
+  dict->entries = entries;
+  dict->capacity = capacity;
+  return 0;
+}
+
+int stringDictInsert(struct StringDict *dict, const char *str, long long id) {
+  // Keep the load factor below 3/4.
+  if ((dict->count + 1) * 4 > dict->capacity * 3 && grow(dict) != 0) {
+    return -1;
+  }
+  const char *copy = arenaStrdup(&dict->arena, str);
+  if (copy == NULL) {
+    return -1;
+  }
+  uint64_t hash = hashString(str);
+  struct StringDictEntry *entry =
+      findSlot(dict->entries, dict->capacity, str, hash);
+  entry->str = copy;
+  entry->hash = hash;
+  entry->id = id;
+  dict->count++;
+  return 0;
+}
+
+void stringDictFree(struct StringDict *dict) {
+  free(dict->entries);
+  dict->entries = NULL;
+  dict->capacity = 0;
+  dict->count = 0;
+  arenaFree(&dict->arena);
+}
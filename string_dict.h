@@ -0,0 +1,38 @@
+#ifndef STRING_DICT_H
+#define STRING_DICT_H
+
+#include "arena.h"
+
+#include <stdint.h>
+
+struct StringDictEntry {
+  const char *str;
+  uint64_t hash;
+  long long id;
+};
+
+// Open-addressing hash map from strings to integer IDs. Keys are copied
+// into the dictionary's arena.
+struct StringDict {
+  struct StringDictEntry *entries;
+  size_t capacity;
+  size_t count;
+  struct Arena arena;
+};
+
+void stringDictInit(struct StringDict *dict);
+
+// Returns 1 and sets *id if str is present, 0 otherwise.
+int stringDictFind(const struct StringDict *dict, const char *str,
+                   long long *id);
+
+// Returns the id stored for str so callers can update it, or NULL.
+long long *stringDictLookup(const struct StringDict *dict, const char *str);
+
+// Adds str with the given id. Returns 0, or -1 when out of memory. The
+// caller checks stringDictFind first; duplicates are not detected.
+int stringDictInsert(struct StringDict *dict, const char *str, long long id);
+
+void stringDictFree(struct StringDict *dict);
+
+#endif
@@ -0,0 +1,208 @@
+#include "tag_filter.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Copy of [begin, end) without surrounding whitespace.
+static char *trimmedCopy(const char *begin, const char *end) {
+  while (begin < end && isspace((unsigned char)*begin)) {
+    ++begin;
+  }
+  while (end > begin && isspace((unsigned char)end[-1])) {
+    --end;
+  }
+  char *copy = malloc(end - begin + 1);
+  if (copy != NULL) {
+    memcpy(copy, begin, end - begin);
+    copy[end - begin] = '\0';
+  }
+  return copy;
+}
+
+static int keySlot(struct TagFilter *filter, const char *key) {
+  long long slot;
+  if (stringDictFind(&filter->keys, key, &slot)) {
+    return (int)slot;
+  }
+  if (filter->keyCount == TAG_FILTER_MAX_KEYS) {
+    fprintf(stderr, "Filter tests more than %d keys\n", TAG_FILTER_MAX_KEYS);
+    return -1;
+  }
+  if (stringDictInsert(&filter->keys, key, filter->keyCount) != 0) {
+    fprintf(stderr, "tagFilterCompile: out of memory\n");
+    return -1;
+  }
+  return filter->keyCount++;
+}
+
+// Parses the condition in [begin, end) into the next condition slot.
+static int compileCondition(struct TagFilter *filter, const char *begin,
+                            const char *end) {
+  struct TagCondition *condition =
+      &filter->conditions[filter->conditionCount];
+  const char *op = begin;
+  while (op < end && *op != '=' && *op != '~' && *op != '!') {
+    ++op;
+  }
+  char *key = trimmedCopy(begin, op);
+  if (key == NULL) {
+    fprintf(stderr, "tagFilterCompile: out of memory\n");
+    return -1;
+  }
+  if (key[0] == '\0') {
+    fprintf(stderr, "Filter condition without a key: %.*s\n",
+            (int)(end - begin), begin);
+    free(key);
+    return -1;
+  }
+  condition->key = keySlot(filter, key);
+  free(key);
+  if (condition->key < 0) {
+    return -1;
+  }
+
+  const char *value = op;
+  if (op == end) {
+    condition->op = TAG_HAS;
+  } else if (op[0] == '=') {
+    condition->op = TAG_EQUALS;
+    value = op + 1;
+  } else if (op[0] == '~') {
+    condition->op = TAG_MATCHES;
+    value = op + 1;
+  } else if (op + 1 < end && op[1] == '=') {
+    condition->op = TAG_NOT_EQUALS;
+    value = op + 2;
+  } else if (op + 1 < end && op[1] == '~') {
+    condition->op = TAG_NOT_MATCHES;
+    value = op + 2;
+  } else {
+    fprintf(stderr, "Invalid filter condition: %.*s\n", (int)(end - begin),
+            begin);
+    return -1;
+  }
+  if (condition->op == TAG_HAS) {
+    ++filter->conditionCount;
+    return 0;
+  }
+
+  if ((condition->value = trimmedCopy(value, end)) == NULL) {
+    fprintf(stderr, "tagFilterCompile: out of memory\n");
+    return -1;
+  }
+  // The regex is compiled before the condition is counted, so
+  // tagFilterFree only frees compiled ones.
+  if (condition->op == TAG_MATCHES || condition->op == TAG_NOT_MATCHES) {
+    int ret = regcomp(&condition->regex, condition->value,
+                      REG_EXTENDED | REG_NOSUB);
+    if (ret != 0) {
+      char message[256];
+      regerror(ret, &condition->regex, message, sizeof(message));
+      fprintf(stderr, "Invalid filter regex %s: %s\n", condition->value,
+              message);
+      free(condition->value);
+      return -1;
+    }
+  } else if (condition->op == TAG_EQUALS &&
+             strcmp(condition->value, "*") == 0) {
+    free(condition->value);
+    condition->value = NULL;
+    condition->op = TAG_HAS;
+  }
+  ++filter->conditionCount;
+  return 0;
+}
+
+int tagFilterCompile(struct TagFilter *filter, const char *expression) {
+  memset(filter, 0, sizeof(*filter));
+  stringDictInit(&filter->keys);
+
+  // Every condition ends at '|', '&' or the end of the expression.
+  int capacity = 1;
+  for (const char *c = expression; *c != '\0'; ++c) {
+    capacity += *c == '|' || *c == '&';
+  }
+  filter->conditions = calloc(capacity, sizeof(struct TagCondition));
+  if (filter->conditions == NULL) {
+    fprintf(stderr, "tagFilterCompile: out of memory\n");
+    return -1;
+  }
+
+  const char *begin = expression;
+  for (;;) {
+    const char *end = begin + strcspn(begin, "|&");
+    if (compileCondition(filter, begin, end) != 0) {
+      tagFilterFree(filter);
+      return -1;
+    }
+    filter->conditions[filter->conditionCount - 1].endsClause = *end != '&';
+    if (*end == '\0') {
+      break;
+    }
+    begin = end + 1;
+  }
+  return 0;
+}
+
+static int conditionHolds(const struct TagCondition *condition,
+                          const char *value) {
+  switch (condition->op) {
+  case TAG_HAS:
+    return value != NULL;
+  case TAG_EQUALS:
+    return value != NULL && strcmp(value, condition->value) == 0;
+  case TAG_NOT_EQUALS:
+    return value == NULL || strcmp(value, condition->value) != 0;
+  case TAG_MATCHES:
+    return value != NULL && regexec(&condition->regex, value, 0, NULL, 0) == 0;
+  case TAG_NOT_MATCHES:
+    return value == NULL || regexec(&condition->regex, value, 0, NULL, 0) != 0;
+  }
+  return 0;
+}
+
+int tagFilterMatch(const struct TagFilter *filter, const readosm_tag *tags,
+                   int tagCount) {
+  // Value of every tested key, NULL while the element does not have it.
+  const char *values[TAG_FILTER_MAX_KEYS];
+  for (int i = 0; i < filter->keyCount; ++i) {
+    values[i] = NULL;
+  }
+  for (int i = 0; i < tagCount; ++i) {
+    long long slot;
+    if (stringDictFind(&filter->keys, tags[i].key, &slot) &&
+        values[slot] == NULL) {
+      values[slot] = tags[i].value;
+    }
+  }
+
+  int clauseHolds = 1;
+  for (int i = 0; i < filter->conditionCount; ++i) {
+    const struct TagCondition *condition = &filter->conditions[i];
+    clauseHolds =
+        clauseHolds && conditionHolds(condition, values[condition->key]);
+    if (condition->endsClause) {
+      if (clauseHolds) {
+        return 1;
+      }
+      clauseHolds = 1;
+    }
+  }
+  return 0;
+}
+
+void tagFilterFree(struct TagFilter *filter) {
+  for (int i = 0; i < filter->conditionCount; ++i) {
+    struct TagCondition *condition = &filter->conditions[i];
+    if (condition->op == TAG_MATCHES || condition->op == TAG_NOT_MATCHES) {
+      regfree(&condition->regex);
+    }
+    free(condition->value);
+  }
+  free(filter->conditions);
+  filter->conditions = NULL;
+  filter->conditionCount = 0;
+  stringDictFree(&filter->keys);
+}
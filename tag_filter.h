@@ -0,0 +1,60 @@
+#ifndef TAG_FILTER_H
+#define TAG_FILTER_H
+
+#include "string_dict.h"
+
+#include <readosm.h>
+#include <regex.h>
+
+// Tag filter expressions of --filter, compiled once and matched against
+// the tags of every element before it is written:
+//
+//   expression := clause ('|' clause)*
+//   clause     := condition ('&' condition)*
+//   condition  := key | key '=*' | key '=' value | key '!=' value
+//               | key '~' regex | key '!~' regex
+//
+// e.g. "highway=* | amenity=restaurant | name~^A". Regexes are POSIX
+// extended ones on the whole value, unanchored unless they say otherwise.
+// The negated conditions also hold for elements without the key. Values
+// and regexes cannot contain '|' or '&'; whitespace around them is
+// ignored.
+enum TagConditionOp {
+  TAG_HAS,
+  TAG_EQUALS,
+  TAG_NOT_EQUALS,
+  TAG_MATCHES,
+  TAG_NOT_MATCHES,
+};
+
+// Distinct keys one expression may test.
+#define TAG_FILTER_MAX_KEYS 64
+
+struct TagCondition {
+  // Slot of the key in TagFilter.keys.
+  int key;
+  enum TagConditionOp op;
+  char *value;
+  regex_t regex;
+  // Last condition of its clause.
+  int endsClause;
+};
+
+struct TagFilter {
+  // Key to slot; matching looks every tag key up once.
+  struct StringDict keys;
+  int keyCount;
+  struct TagCondition *conditions;
+  int conditionCount;
+};
+
+// Returns 0, or -1 after printing the error.
+int tagFilterCompile(struct TagFilter *filter, const char *expression);
+
+// 1 if the tags satisfy the expression. Safe to call from several threads.
+int tagFilterMatch(const struct TagFilter *filter, const readosm_tag *tags,
+                   int tagCount);
+
+void tagFilterFree(struct TagFilter *filter);
+
+#endif
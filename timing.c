@@ -0,0 +1,23 @@
+#include "timing.h"
+
+#include <time.h>
+
+long long monotonicNanoseconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+double monotonicSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void counterAdd(atomic_llong *counter, long long value) {
+  atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+long long counterLoad(atomic_llong *counter) {
+  return atomic_load_explicit(counter, memory_order_relaxed);
+}
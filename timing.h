@@ -0,0 +1,15 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdatomic.h>
+
+// CLOCK_MONOTONIC readings for phase timers and throughput reports.
+long long monotonicNanoseconds(void);
+double monotonicSeconds(void);
+
+// Relaxed updates of statistics counters shared between threads: the
+// totals only need to be exact once the threads are joined.
+void counterAdd(atomic_llong *counter, long long value);
+long long counterLoad(atomic_llong *counter);
+
+#endif
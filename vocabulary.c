@@ -0,0 +1,769 @@
+#include "vocabulary.h"
+#include "arena.h"
+#include "batch_insert.h"
+#include "memory_budget.h"
+#include "string_dict.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Words merged from spilled runs are given keys and written in chunks of
+// this many.
+#define MERGE_CHUNK_WORDS 65536
+// Spilled runs hold at least this many words, and are merged into one
+// when there are MAX_RUNS of them.
+#define MIN_RUN_WORDS 4096
+#define MAX_RUNS 64
+
+// Exported by spellfix.c.
+int sqlite3_spellfix_vocab_keys(const char *zWord, int nWord, char **pzK1,
+                                char **pzK2);
+
+struct VocabularyWord {
+  const char *word;
+  long long count;
+  char *k1;
+  char *k2;
+};
+
+// Word counts of the names read so far. With spill set, the words are
+// written sorted to a temporary file, one "word\tcount" line each, when
+// the memory budget refuses to grow dict; counting then starts over and
+// the runs are merged once all names are read. Words contain no tabs or
+// newlines.
+struct WordCounts {
+  struct StringDict dict;
+  long long reservedBytes;
+  int spill;
+  FILE **runs;
+  size_t runCount;
+};
+
+struct KeyWorker {
+  pthread_t thread;
+  struct VocabularyWord *words;
+  size_t count;
+  int started;
+  int ret;
+};
+
+static int isWordByte(unsigned char c) {
+  // Bytes of multi-byte UTF-8 sequences belong to the word, so non-Latin
+  // scripts are kept whole.
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+         (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+// Lower case of the two-byte UTF-8 code points with simple case mappings
+// in the Latin-1, Latin Extended-A, Greek and Cyrillic blocks. Others are
+// returned unchanged.
+static unsigned foldCodePoint(unsigned c) {
+  if ((c >= 0xc0 && c <= 0xde && c != 0xd7) ||
+      (c >= 0x391 && c <= 0x3a9 && c != 0x3a2) ||
+      (c >= 0x410 && c <= 0x42f)) {
+    return c + 0x20;
+  }
+  if (c >= 0x400 && c <= 0x40f) {
+    return c + 0x50;
+  }
+  if ((c >= 0x100 && c <= 0x137) || (c >= 0x14a && c <= 0x177)) {
+    return c | 1;
+  }
+  if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17e)) {
+    return c + (c & 1);
+  }
+  return c;
+}
+
+static int compareWords(const void *a, const void *b) {
+  return strcmp(((const struct VocabularyWord *)a)->word,
+                ((const struct VocabularyWord *)b)->word);
+}
+
+static void wordCountsInit(struct WordCounts *counts, int spill) {
+  memset(counts, 0, sizeof(*counts));
+  stringDictInit(&counts->dict);
+  counts->spill = spill;
+}
+
+static void wordCountsFree(struct WordCounts *counts) {
+  stringDictFree(&counts->dict);
+  memoryBudgetRelease(MEMORY_NAMES, counts->reservedBytes);
+  counts->reservedBytes = 0;
+  for (size_t i = 0; i < counts->runCount; ++i) {
+    fclose(counts->runs[i]);
+  }
+  free(counts->runs);
+  counts->runs = NULL;
+  counts->runCount = 0;
+}
+
+// The words of dict with their counts, sorted. *count is set to their
+// number; the words point into dict.
+static struct VocabularyWord *sortedWords(const struct StringDict *dict,
+                                          size_t *count) {
+  struct VocabularyWord *words =
+      calloc(dict->count ? dict->count : 1, sizeof(struct VocabularyWord));
+  if (words == NULL) {
+    return NULL;
+  }
+  *count = 0;
+  for (size_t i = 0; i < dict->capacity; ++i) {
+    const struct StringDictEntry *entry = &dict->entries[i];
+    if (entry->str != NULL) {
+      words[*count].word = entry->str;
+      words[*count].count = entry->id;
+      ++*count;
+    }
+  }
+  qsort(words, *count, sizeof(struct VocabularyWord), compareWords);
+  return words;
+}
+
+static FILE *openTemporary(void) {
+  const char *dir = getenv("TMPDIR");
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/vocabulary-XXXXXX",
+           dir != NULL && *dir != '\0' ? dir : "/tmp");
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    return NULL;
+  }
+  unlink(path);
+  FILE *file = fdopen(fd, "w+");
+  if (file == NULL) {
+    close(fd);
+  }
+  return file;
+}
+
+struct RunReader {
+  FILE *file;
+  char *line;
+  size_t capacity;
+  long long count;
+  int done;
+};
+
+// Reads the next word of run into run->line and its count.
+static int readRunWord(struct RunReader *run) {
+  ssize_t length = getline(&run->line, &run->capacity, run->file);
+  if (length < 0) {
+    run->done = 1;
+    return ferror(run->file) ? SQLITE_IOERR : SQLITE_OK;
+  }
+  char *tab = strchr(run->line, '\t');
+  if (tab == NULL) {
+    return SQLITE_CORRUPT;
+  }
+  *tab = '\0';
+  run->count = strtoll(tab + 1, NULL, 10);
+  return SQLITE_OK;
+}
+
+typedef int (*MergedWordCallback)(void *arg, const char *word,
+                                  long long count);
+
+// Merges the sorted runs in files, passing every word in order with the
+// sum of its counts to callback.
+static int mergeRuns(FILE **files, size_t fileCount,
+                     MergedWordCallback callback, void *arg) {
+  struct RunReader *runs = calloc(fileCount, sizeof(struct RunReader));
+  if (runs == NULL) {
+    return SQLITE_NOMEM;
+  }
+
+  int ret = SQLITE_OK;
+  for (size_t i = 0; i < fileCount && ret == SQLITE_OK; ++i) {
+    runs[i].file = files[i];
+    rewind(runs[i].file);
+    ret = readRunWord(&runs[i]);
+  }
+
+  // Runs are few, a linear scan for the smallest word is enough.
+  struct RunReader *smallest;
+  while (ret == SQLITE_OK) {
+    smallest = NULL;
+    for (size_t i = 0; i < fileCount; ++i) {
+      if (!runs[i].done &&
+          (smallest == NULL || strcmp(runs[i].line, smallest->line) < 0)) {
+        smallest = &runs[i];
+      }
+    }
+    if (smallest == NULL) {
+      break;
+    }
+
+    long long count = 0;
+    for (size_t i = 0; i < fileCount; ++i) {
+      if (&runs[i] != smallest && !runs[i].done &&
+          strcmp(runs[i].line, smallest->line) == 0) {
+        count += runs[i].count;
+        if ((ret = readRunWord(&runs[i])) != SQLITE_OK) {
+          break;
+        }
+      }
+    }
+    if (ret == SQLITE_OK &&
+        (ret = callback(arg, smallest->line, count + smallest->count)) ==
+            SQLITE_OK) {
+      ret = readRunWord(smallest);
+    }
+  }
+
+  for (size_t i = 0; i < fileCount; ++i) {
+    free(runs[i].line);
+  }
+  free(runs);
+  return ret;
+}
+
+static int writeRunWord(void *arg, const char *word, long long count) {
+  return fprintf(arg, "%s\t%lld\n", word, count) < 0 ? SQLITE_IOERR
+                                                      : SQLITE_OK;
+}
+
+// Replaces the runs of counts by their merge, which keeps the number of
+// open files bounded.
+static int compactRuns(struct WordCounts *counts) {
+  FILE *file = openTemporary();
+  if (file == NULL) {
+    return SQLITE_CANTOPEN;
+  }
+  int ret = mergeRuns(counts->runs, counts->runCount, writeRunWord, file);
+  if (ret == SQLITE_OK && fflush(file) != 0) {
+    ret = SQLITE_IOERR;
+  }
+  if (ret != SQLITE_OK) {
+    fclose(file);
+    return ret;
+  }
+  for (size_t i = 0; i < counts->runCount; ++i) {
+    fclose(counts->runs[i]);
+  }
+  counts->runs[0] = file;
+  counts->runCount = 1;
+  return SQLITE_OK;
+}
+
+// Writes the words counted so far to a new run and empties dict.
+static int spillRun(struct WordCounts *counts) {
+  int ret;
+  if (counts->runCount == MAX_RUNS &&
+      (ret = compactRuns(counts)) != SQLITE_OK) {
+    return ret;
+  }
+  FILE **runs =
+      realloc(counts->runs, (counts->runCount + 1) * sizeof(FILE *));
+  if (runs == NULL) {
+    return SQLITE_NOMEM;
+  }
+  counts->runs = runs;
+
+  size_t count;
+  struct VocabularyWord *words = sortedWords(&counts->dict, &count);
+  if (words == NULL) {
+    return SQLITE_NOMEM;
+  }
+  FILE *file = openTemporary();
+  if (file == NULL) {
+    free(words);
+    return SQLITE_CANTOPEN;
+  }
+  ret = SQLITE_OK;
+  for (size_t i = 0; i < count && ret == SQLITE_OK; ++i) {
+    ret = writeRunWord(file, words[i].word, words[i].count);
+  }
+  free(words);
+  if (ret == SQLITE_OK && fflush(file) != 0) {
+    ret = SQLITE_IOERR;
+  }
+  if (ret != SQLITE_OK) {
+    fclose(file);
+    return ret;
+  }
+  counts->runs[counts->runCount++] = file;
+
+  stringDictFree(&counts->dict);
+  stringDictInit(&counts->dict);
+  memoryBudgetRelease(MEMORY_NAMES, counts->reservedBytes);
+  counts->reservedBytes = 0;
+  return SQLITE_OK;
+}
+
+// Counts a new word of length bytes against the memory budget, spilling
+// the words counted so far first if it does not fit. Without a place to
+// spill, or with less than MIN_RUN_WORDS to spill, it is counted over
+// budget: runs of a few words, while other buffers hold the budget, would
+// cost more than they save.
+static int reserveWord(struct WordCounts *counts, size_t length) {
+  long long bytes = length + 1 + 2 * sizeof(struct StringDictEntry);
+  if (!memoryBudgetReserve(MEMORY_NAMES, bytes)) {
+    int ret;
+    if (counts->spill && counts->dict.count >= MIN_RUN_WORDS &&
+        (ret = spillRun(counts)) != SQLITE_OK) {
+      return ret;
+    }
+    memoryBudgetCharge(MEMORY_NAMES, bytes);
+  }
+  counts->reservedBytes += bytes;
+  return SQLITE_OK;
+}
+
+// Splits name into words, folds case and adds delta to the count of each
+// word in counts. Single characters and numbers are skipped, they make no
+// useful corrections.
+static int countWords(struct WordCounts *counts, const char *name,
+                      char *buffer, long long delta) {
+  const unsigned char *p = (const unsigned char *)name;
+  while (*p != '\0') {
+    while (*p != '\0' && !isWordByte(*p)) {
+      ++p;
+    }
+    size_t length = 0;
+    int digits = 1;
+    while (*p != '\0' && isWordByte(*p)) {
+      unsigned char c = *p++;
+      if (c >= 'A' && c <= 'Z') {
+        c += 'a' - 'A';
+      } else if ((c & 0xe0) == 0xc0 && (*p & 0xc0) == 0x80) {
+        // Folding within these blocks keeps the sequence length.
+        unsigned folded = foldCodePoint((c & 0x1f) << 6 | (*p++ & 0x3f));
+        buffer[length++] = (char)(0xc0 | folded >> 6);
+        c = 0x80 | (folded & 0x3f);
+        digits = 0;
+      }
+      digits = digits && c >= '0' && c <= '9';
+      buffer[length++] = (char)c;
+    }
+    buffer[length] = '\0';
+    if (length < 2 || digits) {
+      continue;
+    }
+
+    long long *count = stringDictLookup(&counts->dict, buffer);
+    if (count != NULL) {
+      *count += delta;
+      continue;
+    }
+    int ret;
+    if ((ret = reserveWord(counts, length)) != SQLITE_OK) {
+      return ret;
+    }
+    if (stringDictInsert(&counts->dict, buffer, delta) != 0) {
+      return SQLITE_NOMEM;
+    }
+  }
+  return SQLITE_OK;
+}
+
+// Counts the words of the names returned by query, a single text column.
+static int countNameWords(sqlite3 *db, const char *query,
+                          struct WordCounts *counts, long long delta,
+                          long long *names) {
+  sqlite3_stmt *stmt;
+  int ret = sqlite3_prepare_v2(db, query, -1, &stmt, NULL);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+
+  char *buffer = NULL;
+  size_t capacity = 0;
+  while ((ret = sqlite3_step(stmt)) == SQLITE_ROW) {
+    const char *name = (const char *)sqlite3_column_text(stmt, 0);
+    size_t length = sqlite3_column_bytes(stmt, 0);
+    if (name == NULL) {
+      continue;
+    }
+    if (length + 1 > capacity) {
+      char *grown = realloc(buffer, length + 1);
+      if (grown == NULL) {
+        ret = SQLITE_NOMEM;
+        break;
+      }
+      buffer = grown;
+      capacity = length + 1;
+    }
+    if ((ret = countWords(counts, name, buffer, delta)) != SQLITE_OK) {
+      break;
+    }
+    ++*names;
+  }
+  free(buffer);
+  sqlite3_finalize(stmt);
+  return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+static void *computeKeys(void *arg) {
+  struct KeyWorker *worker = arg;
+  for (size_t i = 0; i < worker->count; ++i) {
+    struct VocabularyWord *word = &worker->words[i];
+    if (sqlite3_spellfix_vocab_keys(word->word, (int)strlen(word->word),
+                                    &word->k1, &word->k2) != SQLITE_OK) {
+      worker->ret = SQLITE_NOMEM;
+      break;
+    }
+  }
+  return NULL;
+}
+
+// Computes k1 and k2 of all words, split in contiguous ranges over the
+// workers. transliterate and phoneticHash only read static tables.
+static int computeAllKeys(struct VocabularyWord *words, size_t count,
+                          int threads) {
+  if (threads < 1) {
+    threads = 1;
+  }
+  // Short vocabularies are not worth a thread each.
+  if ((size_t)threads > count / 1024 + 1) {
+    threads = (int)(count / 1024 + 1);
+  }
+  struct KeyWorker *workers = calloc(threads, sizeof(struct KeyWorker));
+  if (workers == NULL) {
+    return SQLITE_NOMEM;
+  }
+
+  size_t chunk = (count + threads - 1) / threads;
+  for (int i = 0; i < threads; ++i) {
+    struct KeyWorker *worker = &workers[i];
+    size_t begin = chunk * i < count ? chunk * i : count;
+    size_t end = begin + chunk < count ? begin + chunk : count;
+    worker->words = words + begin;
+    worker->count = end - begin;
+    worker->ret = SQLITE_OK;
+    // The calling thread takes the last range, and any range a thread
+    // could not be started for.
+    if (i == threads - 1 ||
+        pthread_create(&worker->thread, NULL, computeKeys, worker) != 0) {
+      computeKeys(worker);
+    } else {
+      worker->started = 1;
+    }
+  }
+
+  int ret = SQLITE_OK;
+  for (int i = 0; i < threads; ++i) {
+    if (workers[i].started) {
+      pthread_join(workers[i].thread, NULL);
+    }
+    if (workers[i].ret != SQLITE_OK) {
+      ret = workers[i].ret;
+    }
+  }
+  free(workers);
+  return ret;
+}
+
+static int execFormatted(sqlite3 *db, const char *format,
+                         const char *table) {
+  char *query = sqlite3_mprintf(format, table, table);
+  if (query == NULL) {
+    return SQLITE_NOMEM;
+  }
+  int ret = sqlite3_exec(db, query, NULL, NULL, NULL);
+  sqlite3_free(query);
+  return ret;
+}
+
+// Empties the vocabulary and starts batch on it.
+static int beginVocabulary(sqlite3 *db, const char *spellfixTable,
+                           struct BatchInsert *batch) {
+  int ret;
+  // Building the (langid, k2) index once afterwards is cheaper than
+  // maintaining it for rows arriving in word order.
+  if ((ret = execFormatted(db,
+                           "DELETE FROM \"%w_vocab\";"
+                           "DROP INDEX IF EXISTS \"%w_vocab_index_langid_k2\";",
+                           spellfixTable)) != SQLITE_OK) {
+    return ret;
+  }
+
+  char *prefix = sqlite3_mprintf(
+      "INSERT INTO \"%w_vocab\"(rank, langid, word, k1, k2)", spellfixTable);
+  if (prefix == NULL) {
+    return SQLITE_NOMEM;
+  }
+  ret = batchInsertInit(batch, db, prefix, "iittt");
+  sqlite3_free(prefix);
+  if (ret != SQLITE_OK) {
+    batchInsertFinalize(batch);
+  }
+  return ret;
+}
+
+static int writeVocabularyRows(struct BatchInsert *batch,
+                               const struct VocabularyWord *words,
+                               size_t count) {
+  int ret = SQLITE_OK;
+  for (size_t i = 0; ret == SQLITE_OK && i < count; ++i) {
+    batchInsertInt64(batch, 0, words[i].count);
+    batchInsertInt64(batch, 1, 0);
+    if (batchInsertText(batch, 2, words[i].word) != SQLITE_OK ||
+        batchInsertText(batch, 3, words[i].k1) != SQLITE_OK ||
+        batchInsertText(batch, 4, words[i].k2) != SQLITE_OK) {
+      return SQLITE_NOMEM;
+    }
+    ret = batchInsertEndRow(batch);
+  }
+  return ret;
+}
+
+// Flushes and finalizes batch unless ret reports an earlier error, then
+// builds the index.
+static int endVocabulary(sqlite3 *db, const char *spellfixTable,
+                         struct BatchInsert *batch, int ret) {
+  if (ret == SQLITE_OK) {
+    ret = batchInsertFlush(batch);
+  }
+  int finalizeRet = batchInsertFinalize(batch);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  if (finalizeRet != SQLITE_OK) {
+    return finalizeRet;
+  }
+
+  char *index = sqlite3_mprintf("CREATE INDEX IF NOT EXISTS "
+                                "\"%w_vocab_index_langid_k2\" "
+                                "ON \"%w_vocab\"(langid, k2);",
+                                spellfixTable, spellfixTable);
+  if (index == NULL) {
+    return SQLITE_NOMEM;
+  }
+  ret = sqlite3_exec(db, index, NULL, NULL, NULL);
+  sqlite3_free(index);
+  return ret;
+}
+
+static int writeVocabulary(sqlite3 *db, const char *spellfixTable,
+                           const struct VocabularyWord *words, size_t count) {
+  struct BatchInsert batch;
+  int ret;
+  if ((ret = beginVocabulary(db, spellfixTable, &batch)) != SQLITE_OK) {
+    return ret;
+  }
+  ret = writeVocabularyRows(&batch, words, count);
+  return endVocabulary(db, spellfixTable, &batch, ret);
+}
+
+// Collects merged words and writes them, with their keys, a chunk at a
+// time.
+struct ChunkWriter {
+  struct BatchInsert batch;
+  struct VocabularyWord *words;
+  size_t count;
+  struct Arena arena;
+  int threads;
+  long long written;
+};
+
+static int writeChunk(struct ChunkWriter *writer) {
+  struct VocabularyWord *words = writer->words;
+  int ret = computeAllKeys(words, writer->count, writer->threads);
+  if (ret == SQLITE_OK) {
+    ret = writeVocabularyRows(&writer->batch, words, writer->count);
+  }
+  for (size_t i = 0; i < writer->count; ++i) {
+    sqlite3_free(words[i].k1);
+    sqlite3_free(words[i].k2);
+    words[i].k1 = words[i].k2 = NULL;
+  }
+  writer->written += writer->count;
+  writer->count = 0;
+  arenaReset(&writer->arena);
+  return ret;
+}
+
+static int addChunkWord(void *arg, const char *word, long long count) {
+  struct ChunkWriter *writer = arg;
+  struct VocabularyWord *entry = &writer->words[writer->count++];
+  if ((entry->word = arenaStrdup(&writer->arena, word)) == NULL) {
+    return SQLITE_NOMEM;
+  }
+  entry->count = count;
+  return writer->count == MERGE_CHUNK_WORDS ? writeChunk(writer) : SQLITE_OK;
+}
+
+// Writes the vocabulary from the spilled runs of counts.
+static int writeMergedVocabulary(sqlite3 *db, const char *spellfixTable,
+                                 int threads, struct WordCounts *counts,
+                                 long long *wordCount) {
+  struct ChunkWriter writer;
+  memset(&writer, 0, sizeof(writer));
+  writer.threads = threads;
+  arenaInit(&writer.arena, 64 * 1024);
+  writer.words = calloc(MERGE_CHUNK_WORDS, sizeof(struct VocabularyWord));
+  if (writer.words == NULL) {
+    arenaFree(&writer.arena);
+    return SQLITE_NOMEM;
+  }
+
+  int ret;
+  if ((ret = beginVocabulary(db, spellfixTable, &writer.batch)) ==
+      SQLITE_OK) {
+    ret = mergeRuns(counts->runs, counts->runCount, addChunkWord, &writer);
+    if (ret == SQLITE_OK) {
+      ret = writeChunk(&writer);
+    }
+    ret = endVocabulary(db, spellfixTable, &writer.batch, ret);
+  }
+  *wordCount = writer.written;
+  free(writer.words);
+  arenaFree(&writer.arena);
+  return ret;
+}
+
+int vocabularyBuild(sqlite3 *db, const char *spellfixTable, int threads,
+                    struct VocabularyStats *stats) {
+  struct WordCounts counts;
+  wordCountsInit(&counts, 1);
+  memset(stats, 0, sizeof(*stats));
+
+  int ret;
+  struct VocabularyWord *words = NULL;
+  size_t count = 0;
+  if ((ret = countNameWords(db, "SELECT name FROM node_names;", &counts, 1,
+                            &stats->names)) != SQLITE_OK) {
+    goto Done;
+  }
+
+  if (counts.runCount != 0) {
+    if ((ret = spillRun(&counts)) == SQLITE_OK) {
+      ret = writeMergedVocabulary(db, spellfixTable, threads, &counts,
+                                  &stats->words);
+    }
+    goto Done;
+  }
+
+  if ((words = sortedWords(&counts.dict, &count)) == NULL) {
+    ret = SQLITE_NOMEM;
+    goto Done;
+  }
+  stats->words = count;
+
+  if ((ret = computeAllKeys(words, count, threads)) != SQLITE_OK) {
+    goto Done;
+  }
+  ret = writeVocabulary(db, spellfixTable, words, count);
+
+Done:
+  for (size_t i = 0; words != NULL && i < count; ++i) {
+    sqlite3_free(words[i].k1);
+    sqlite3_free(words[i].k2);
+  }
+  free(words);
+  wordCountsFree(&counts);
+  return ret;
+}
+
+// Adds delta to the rank of word, inserting it when it is new and deleting
+// it when no name uses it any more.
+static int updateWord(sqlite3_stmt *update, sqlite3_stmt *insert,
+                      sqlite3_stmt *remove, const char *word,
+                      long long delta) {
+  char *k1 = NULL, *k2 = NULL;
+  int ret;
+  if ((ret = sqlite3_spellfix_vocab_keys(word, (int)strlen(word), &k1,
+                                         &k2)) != SQLITE_OK) {
+    return ret;
+  }
+
+  sqlite3_bind_int64(update, 1, delta);
+  sqlite3_bind_text(update, 2, k2, -1, SQLITE_STATIC);
+  sqlite3_bind_text(update, 3, word, -1, SQLITE_STATIC);
+  if ((ret = sqlite3_step(update)) != SQLITE_DONE) {
+    goto Done;
+  }
+
+  if (sqlite3_changes(sqlite3_db_handle(update)) == 0 && delta > 0) {
+    sqlite3_bind_int64(insert, 1, delta);
+    sqlite3_bind_text(insert, 2, word, -1, SQLITE_STATIC);
+    sqlite3_bind_text(insert, 3, k1, -1, SQLITE_STATIC);
+    sqlite3_bind_text(insert, 4, k2, -1, SQLITE_STATIC);
+    ret = sqlite3_step(insert);
+  } else if (delta < 0) {
+    sqlite3_bind_text(remove, 1, k2, -1, SQLITE_STATIC);
+    sqlite3_bind_text(remove, 2, word, -1, SQLITE_STATIC);
+    ret = sqlite3_step(remove);
+  }
+
+Done:
+  sqlite3_reset(update);
+  sqlite3_reset(insert);
+  sqlite3_reset(remove);
+  sqlite3_free(k1);
+  sqlite3_free(k2);
+  return ret == SQLITE_DONE ? SQLITE_OK : ret;
+}
+
+int vocabularyUpdate(sqlite3 *db, const char *spellfixTable,
+                     const char *removedQuery, const char *addedQuery,
+                     struct VocabularyStats *stats) {
+  // The words of a change set are few, and removals must meet the
+  // additions they cancel out, so they are never spilled.
+  struct WordCounts counts;
+  wordCountsInit(&counts, 0);
+  memset(stats, 0, sizeof(*stats));
+
+  sqlite3_stmt *update = NULL, *insert = NULL, *remove = NULL;
+  char *updateQuery = sqlite3_mprintf(
+      "UPDATE \"%w_vocab\" SET rank = rank + ?1 "
+      "WHERE langid = 0 AND k2 = ?2 AND word = ?3;",
+      spellfixTable);
+  char *insertQuery = sqlite3_mprintf(
+      "INSERT INTO \"%w_vocab\"(rank, langid, word, k1, k2) "
+      "VALUES (?1, 0, ?2, ?3, ?4);",
+      spellfixTable);
+  char *removeQuery = sqlite3_mprintf(
+      "DELETE FROM \"%w_vocab\" "
+      "WHERE langid = 0 AND k2 = ?1 AND word = ?2 AND rank <= 0;",
+      spellfixTable);
+
+  int ret;
+  if (updateQuery == NULL || insertQuery == NULL || removeQuery == NULL) {
+    ret = SQLITE_NOMEM;
+    goto Done;
+  }
+  if ((ret = sqlite3_prepare_v2(db, updateQuery, -1, &update, NULL)) !=
+          SQLITE_OK ||
+      (ret = sqlite3_prepare_v2(db, insertQuery, -1, &insert, NULL)) !=
+          SQLITE_OK ||
+      (ret = sqlite3_prepare_v2(db, removeQuery, -1, &remove, NULL)) !=
+          SQLITE_OK) {
+    goto Done;
+  }
+
+  // A name that was removed and added again cancels out.
+  long long removed = 0;
+  if ((ret = countNameWords(db, removedQuery, &counts, -1, &removed)) !=
+          SQLITE_OK ||
+      (ret = countNameWords(db, addedQuery, &counts, 1, &stats->names)) !=
+          SQLITE_OK) {
+    goto Done;
+  }
+
+  for (size_t i = 0; i < counts.dict.capacity; ++i) {
+    const struct StringDictEntry *entry = &counts.dict.entries[i];
+    if (entry->str == NULL || entry->id == 0) {
+      continue;
+    }
+    if ((ret = updateWord(update, insert, remove, entry->str, entry->id)) !=
+        SQLITE_OK) {
+      goto Done;
+    }
+    ++stats->words;
+  }
+
+Done:
+  sqlite3_finalize(update);
+  sqlite3_finalize(insert);
+  sqlite3_finalize(remove);
+  sqlite3_free(updateQuery);
+  sqlite3_free(insertQuery);
+  sqlite3_free(removeQuery);
+  wordCountsFree(&counts);
+  return ret;
+}
@@ -0,0 +1,30 @@
+#ifndef VOCABULARY_H
+#define VOCABULARY_H
+
+#include <sqlite3.h>
+
+struct VocabularyStats {
+  long long names;
+  long long words;
+};
+
+// Rebuilds the vocabulary of the spellfix1 table spellfixTable from the
+// words of all node_names rows. Words are counted in memory, their k1/k2
+// keys are computed on threads workers, and the rows are written to the
+// %_vocab shadow table sorted by word with the word count as rank, instead
+// of one spellfix1 INSERT per word. Counts that do not fit the memory
+// budget are spilled to sorted temporary files and merged back. Runs
+// inside the caller's transaction.
+int vocabularyBuild(sqlite3 *db, const char *spellfixTable, int threads,
+                    struct VocabularyStats *stats);
+
+// Applies the names returned by removedQuery and addedQuery, each a single
+// text column, to the vocabulary instead of rebuilding it: the rank of
+// every word they contain moves by the difference of its counts, and
+// words left with no names are deleted. stats counts the added names and
+// the words whose rank changed.
+int vocabularyUpdate(sqlite3 *db, const char *spellfixTable,
+                     const char *removedQuery, const char *addedQuery,
+                     struct VocabularyStats *stats);
+
+#endif
@@ -0,0 +1,688 @@
+#include "write_behind_vfs.h"
+#include "memory_budget.h"
+#include "timing.h"
+
+#include <pthread.h>
+#include <sqlite3.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Bytes buffered for a file before they are queued, as a share of the
+// buffer.
+#define BATCH_SHARE 4
+#define MIN_BATCH_BYTES (256 * 1024)
+// The unix VFS writes less than 128 KiB per call.
+#define MAX_CALL_BYTES (128 * 1024 - 1)
+
+static const int reorderedWrites =
+    SQLITE_IOCAP_ATOMIC | SQLITE_IOCAP_ATOMIC512 | SQLITE_IOCAP_ATOMIC1K |
+    SQLITE_IOCAP_ATOMIC2K | SQLITE_IOCAP_ATOMIC4K | SQLITE_IOCAP_ATOMIC8K |
+    SQLITE_IOCAP_ATOMIC16K | SQLITE_IOCAP_ATOMIC32K | SQLITE_IOCAP_ATOMIC64K |
+    SQLITE_IOCAP_SAFE_APPEND | SQLITE_IOCAP_BATCH_ATOMIC;
+
+struct Extent {
+  sqlite3_int64 offset;
+  int length;
+  unsigned char *data;
+};
+
+// Non-overlapping extents sorted by offset.
+struct ExtentSet {
+  struct Extent *extents;
+  int count;
+  int capacity;
+  long long bytes;
+};
+
+struct Batch {
+  struct WriteBehindFile *file;
+  struct ExtentSet set;
+  // Next in the I/O queue, and next of the same file.
+  struct Batch *next;
+  struct Batch *fileNext;
+};
+
+struct WriteBehindFile {
+  sqlite3_file base;
+  // The underlying file, allocated right after this struct.
+  sqlite3_file *real;
+
+  // Written by the caller only.
+  struct ExtentSet pending;
+  // End of the furthest write not known to be in the file.
+  sqlite3_int64 writtenEnd;
+
+  // Guards the fields below, and reads of the real file, which must not
+  // miss a batch the I/O thread is done with.
+  pthread_mutex_t mutex;
+  pthread_cond_t drained;
+  // Queued batches, oldest first.
+  struct Batch *batches;
+  struct Batch *lastBatch;
+  // First error of a background write, returned from then on.
+  int ioError;
+};
+
+static struct {
+  sqlite3_vfs vfs;
+  sqlite3_vfs *real;
+  long long bufferBytes;
+  long long batchBytes;
+
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t work;
+  pthread_cond_t space;
+  struct Batch *head;
+  struct Batch *tail;
+  long long queuedBytes;
+  int queueDepth;
+  int peakQueueDepth;
+
+  atomic_llong writes;
+  atomic_llong calls;
+  atomic_llong bytes;
+  atomic_llong batches;
+  atomic_llong busyNanoseconds;
+  atomic_llong stallNanoseconds;
+
+  // Used by the I/O thread only.
+  unsigned char staging[MAX_CALL_BYTES];
+} writeBehind;
+
+static const sqlite3_io_methods writeBehindIoMethods;
+
+static void clearSet(struct ExtentSet *set) {
+  for (int i = 0; i < set->count; ++i) {
+    free(set->extents[i].data);
+  }
+  memoryBudgetRelease(MEMORY_WRITE_BEHIND, set->bytes);
+  free(set->extents);
+  memset(set, 0, sizeof(*set));
+}
+
+// Index of the first extent ending after offset.
+static int findExtent(const struct ExtentSet *set, sqlite3_int64 offset) {
+  int low = 0, high = set->count;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    const struct Extent *extent = &set->extents[middle];
+    if (extent->offset + extent->length <= offset) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+// Copies the data of amount bytes from data to offset into the set. A
+// write of the same range as an extent, the usual page rewrite, reuses it;
+// otherwise the extents it overlaps are merged into one.
+static int addWrite(struct ExtentSet *set, const void *data, int amount,
+                    sqlite3_int64 offset) {
+  sqlite3_int64 end = offset + amount;
+  int first = findExtent(set, offset);
+  int last = first;
+  while (last < set->count && set->extents[last].offset < end) {
+    ++last;
+  }
+
+  if (last == first + 1 && set->extents[first].offset == offset &&
+      set->extents[first].length == amount) {
+    memcpy(set->extents[first].data, data, amount);
+    return SQLITE_OK;
+  }
+
+  sqlite3_int64 start = offset;
+  if (last > first) {
+    const struct Extent *lastExtent = &set->extents[last - 1];
+    if (set->extents[first].offset < start) {
+      start = set->extents[first].offset;
+    }
+    if (lastExtent->offset + lastExtent->length > end) {
+      end = lastExtent->offset + lastExtent->length;
+    }
+  }
+  if (end - start > 1 << 30) {
+    return SQLITE_IOERR_WRITE;
+  }
+  struct Extent merged = {start, (int)(end - start), malloc(end - start)};
+  if (merged.data == NULL) {
+    return SQLITE_NOMEM;
+  }
+  long long replaced = 0;
+  for (int i = first; i < last; ++i) {
+    struct Extent *extent = &set->extents[i];
+    memcpy(merged.data + (extent->offset - start), extent->data,
+           extent->length);
+    replaced += extent->length;
+    free(extent->data);
+  }
+  memcpy(merged.data + (offset - start), data, amount);
+
+  if (last == first) {
+    if (set->count == set->capacity) {
+      int capacity = set->capacity ? set->capacity * 2 : 256;
+      struct Extent *grown =
+          realloc(set->extents, capacity * sizeof(struct Extent));
+      if (grown == NULL) {
+        free(merged.data);
+        return SQLITE_NOMEM;
+      }
+      set->extents = grown;
+      set->capacity = capacity;
+    }
+    memmove(&set->extents[first + 1], &set->extents[first],
+            (set->count - first) * sizeof(struct Extent));
+    ++set->count;
+  } else {
+    memmove(&set->extents[first + 1], &set->extents[last],
+            (set->count - last) * sizeof(struct Extent));
+    set->count -= last - first - 1;
+  }
+  set->extents[first] = merged;
+  set->bytes += merged.length - replaced;
+  memoryBudgetCharge(MEMORY_WRITE_BEHIND, merged.length - replaced);
+  return SQLITE_OK;
+}
+
+// Copies the parts of the set within amount bytes from offset into out.
+static void overlaySet(const struct ExtentSet *set, unsigned char *out,
+                       int amount, sqlite3_int64 offset) {
+  sqlite3_int64 end = offset + amount;
+  for (int i = findExtent(set, offset);
+       i < set->count && set->extents[i].offset < end; ++i) {
+    const struct Extent *extent = &set->extents[i];
+    sqlite3_int64 from =
+        extent->offset > offset ? extent->offset : offset;
+    sqlite3_int64 to = extent->offset + extent->length < end
+                           ? extent->offset + extent->length
+                           : end;
+    memcpy(out + (from - offset), extent->data + (from - extent->offset),
+           to - from);
+  }
+}
+
+static int writeStaged(sqlite3_file *real, sqlite3_int64 offset,
+                       int length) {
+  counterAdd(&writeBehind.calls, 1);
+  counterAdd(&writeBehind.bytes, length);
+  return real->pMethods->xWrite(real, writeBehind.staging, length, offset);
+}
+
+// Writes the batch in as few calls as the real VFS allows, gathering runs
+// of adjacent extents into the staging buffer.
+static int writeBatch(const struct Batch *batch) {
+  sqlite3_file *real = batch->file->real;
+  const struct ExtentSet *set = &batch->set;
+  sqlite3_int64 callOffset = 0;
+  int callLength = 0;
+  int ret = SQLITE_OK;
+  for (int i = 0; i < set->count && ret == SQLITE_OK; ++i) {
+    const struct Extent *extent = &set->extents[i];
+    for (int done = 0; done < extent->length && ret == SQLITE_OK;) {
+      if (callLength != 0 &&
+          (callOffset + callLength != extent->offset + done ||
+           callLength == MAX_CALL_BYTES)) {
+        ret = writeStaged(real, callOffset, callLength);
+        callLength = 0;
+      }
+      int n = extent->length - done < MAX_CALL_BYTES - callLength
+                  ? extent->length - done
+                  : MAX_CALL_BYTES - callLength;
+      if (callLength == 0) {
+        callOffset = extent->offset + done;
+      }
+      memcpy(writeBehind.staging + callLength, extent->data + done, n);
+      callLength += n;
+      done += n;
+    }
+  }
+  if (ret == SQLITE_OK && callLength != 0) {
+    ret = writeStaged(real, callOffset, callLength);
+  }
+  return ret;
+}
+
+static void *ioThreadMain(void *arg) {
+  for (;;) {
+    pthread_mutex_lock(&writeBehind.mutex);
+    while (writeBehind.head == NULL) {
+      pthread_cond_wait(&writeBehind.work, &writeBehind.mutex);
+    }
+    struct Batch *batch = writeBehind.head;
+    if ((writeBehind.head = batch->next) == NULL) {
+      writeBehind.tail = NULL;
+    }
+    pthread_mutex_unlock(&writeBehind.mutex);
+
+    long long begin = monotonicNanoseconds();
+    int ret = writeBatch(batch);
+    counterAdd(&writeBehind.busyNanoseconds, monotonicNanoseconds() - begin);
+
+    struct WriteBehindFile *file = batch->file;
+    pthread_mutex_lock(&file->mutex);
+    if ((file->batches = batch->fileNext) == NULL) {
+      file->lastBatch = NULL;
+      pthread_cond_broadcast(&file->drained);
+    }
+    if (ret != SQLITE_OK && file->ioError == SQLITE_OK) {
+      file->ioError = ret;
+    }
+    pthread_mutex_unlock(&file->mutex);
+
+    pthread_mutex_lock(&writeBehind.mutex);
+    writeBehind.queuedBytes -= batch->set.bytes;
+    --writeBehind.queueDepth;
+    pthread_cond_broadcast(&writeBehind.space);
+    pthread_mutex_unlock(&writeBehind.mutex);
+
+    clearSet(&batch->set);
+    free(batch);
+  }
+  return arg;
+}
+
+// Hands the buffered writes of file to the I/O thread, once the queue has
+// room for them.
+static int submitPending(struct WriteBehindFile *file) {
+  if (file->pending.count == 0) {
+    return SQLITE_OK;
+  }
+  struct Batch *batch = calloc(1, sizeof(struct Batch));
+  if (batch == NULL) {
+    return SQLITE_NOMEM;
+  }
+  batch->file = file;
+  batch->set = file->pending;
+  memset(&file->pending, 0, sizeof(file->pending));
+
+  pthread_mutex_lock(&writeBehind.mutex);
+  if (writeBehind.head != NULL &&
+      writeBehind.queuedBytes + batch->set.bytes > writeBehind.bufferBytes) {
+    long long begin = monotonicNanoseconds();
+    while (writeBehind.head != NULL &&
+           writeBehind.queuedBytes + batch->set.bytes >
+               writeBehind.bufferBytes) {
+      pthread_cond_wait(&writeBehind.space, &writeBehind.mutex);
+    }
+    counterAdd(&writeBehind.stallNanoseconds, monotonicNanoseconds() - begin);
+  }
+
+  // Linked to the file before the I/O thread can take it.
+  pthread_mutex_lock(&file->mutex);
+  if (file->lastBatch != NULL) {
+    file->lastBatch->fileNext = batch;
+  } else {
+    file->batches = batch;
+  }
+  file->lastBatch = batch;
+  pthread_mutex_unlock(&file->mutex);
+
+  if (writeBehind.tail != NULL) {
+    writeBehind.tail->next = batch;
+  } else {
+    writeBehind.head = batch;
+  }
+  writeBehind.tail = batch;
+  writeBehind.queuedBytes += batch->set.bytes;
+  if (++writeBehind.queueDepth > writeBehind.peakQueueDepth) {
+    writeBehind.peakQueueDepth = writeBehind.queueDepth;
+  }
+  pthread_cond_signal(&writeBehind.work);
+  pthread_mutex_unlock(&writeBehind.mutex);
+  counterAdd(&writeBehind.batches, 1);
+  return SQLITE_OK;
+}
+
+// Returns once every write to file is in the real file, with the first
+// error of the background writes.
+static int drain(struct WriteBehindFile *file) {
+  int ret = submitPending(file);
+  pthread_mutex_lock(&file->mutex);
+  if (file->batches != NULL) {
+    long long begin = monotonicNanoseconds();
+    while (file->batches != NULL) {
+      pthread_cond_wait(&file->drained, &file->mutex);
+    }
+    counterAdd(&writeBehind.stallNanoseconds, monotonicNanoseconds() - begin);
+  }
+  if (ret == SQLITE_OK) {
+    ret = file->ioError;
+  }
+  pthread_mutex_unlock(&file->mutex);
+  if (ret == SQLITE_OK) {
+    file->writtenEnd = 0;
+  }
+  return ret;
+}
+
+static int writeBehindClose(sqlite3_file *base) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  int ret = drain(file);
+  int closeRet = file->real->pMethods->xClose(file->real);
+  clearSet(&file->pending);
+  pthread_cond_destroy(&file->drained);
+  pthread_mutex_destroy(&file->mutex);
+  return ret != SQLITE_OK ? ret : closeRet;
+}
+
+static int writeBehindRead(sqlite3_file *base, void *out, int amount,
+                           sqlite3_int64 offset) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  pthread_mutex_lock(&file->mutex);
+  int ret = file->real->pMethods->xRead(file->real, out, amount, offset);
+  for (struct Batch *batch = file->batches; batch != NULL;
+       batch = batch->fileNext) {
+    overlaySet(&batch->set, out, amount, offset);
+  }
+  pthread_mutex_unlock(&file->mutex);
+  overlaySet(&file->pending, out, amount, offset);
+
+  if (ret == SQLITE_IOERR_SHORT_READ && offset + amount <= file->writtenEnd) {
+    ret = SQLITE_OK;
+  }
+  return ret;
+}
+
+static int writeBehindWrite(sqlite3_file *base, const void *data, int amount,
+                            sqlite3_int64 offset) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  int ret;
+  pthread_mutex_lock(&file->mutex);
+  ret = file->ioError;
+  pthread_mutex_unlock(&file->mutex);
+  if (ret != SQLITE_OK ||
+      (ret = addWrite(&file->pending, data, amount, offset)) != SQLITE_OK) {
+    return ret;
+  }
+  counterAdd(&writeBehind.writes, 1);
+  if (offset + amount > file->writtenEnd) {
+    file->writtenEnd = offset + amount;
+  }
+  return file->pending.bytes >= writeBehind.batchBytes ? submitPending(file)
+                                                       : SQLITE_OK;
+}
+
+static int writeBehindTruncate(sqlite3_file *base, sqlite3_int64 size) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  int ret = drain(file);
+  return ret != SQLITE_OK
+             ? ret
+             : file->real->pMethods->xTruncate(file->real, size);
+}
+
+static int writeBehindSync(sqlite3_file *base, int flags) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  int ret = drain(file);
+  return ret != SQLITE_OK ? ret
+                          : file->real->pMethods->xSync(file->real, flags);
+}
+
+static int writeBehindFileSize(sqlite3_file *base, sqlite3_int64 *size) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  int ret = file->real->pMethods->xFileSize(file->real, size);
+  if (ret == SQLITE_OK && file->writtenEnd > *size) {
+    *size = file->writtenEnd;
+  }
+  return ret;
+}
+
+static int writeBehindLock(sqlite3_file *base, int level) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  return file->real->pMethods->xLock(file->real, level);
+}
+
+// Others may read the file once the lock is gone.
+static int writeBehindUnlock(sqlite3_file *base, int level) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  int ret = drain(file);
+  return ret != SQLITE_OK ? ret
+                          : file->real->pMethods->xUnlock(file->real, level);
+}
+
+static int writeBehindCheckReservedLock(sqlite3_file *base, int *reserved) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  return file->real->pMethods->xCheckReservedLock(file->real, reserved);
+}
+
+static int writeBehindFileControl(sqlite3_file *base, int op, void *arg) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  int ret;
+  switch (op) {
+  case SQLITE_FCNTL_SYNC:
+    // Sent at every commit: start on the writes without waiting for them.
+    ret = submitPending(file);
+    break;
+  case SQLITE_FCNTL_CKPT_DONE:
+    // Readers go to the database file for the checkpointed pages next.
+    ret = drain(file);
+    break;
+  case SQLITE_FCNTL_SIZE_HINT:
+  case SQLITE_FCNTL_CHUNK_SIZE:
+    // The real VFS would extend the file behind the queued writes.
+    return SQLITE_OK;
+  case SQLITE_FCNTL_VFSNAME:
+    ret = file->real->pMethods->xFileControl(file->real, op, arg);
+    if (ret == SQLITE_OK) {
+      *(char **)arg =
+          sqlite3_mprintf("%s/%z", WRITE_BEHIND_VFS_NAME, *(char **)arg);
+    }
+    return ret;
+  default:
+    return file->real->pMethods->xFileControl(file->real, op, arg);
+  }
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  ret = file->real->pMethods->xFileControl(file->real, op, arg);
+  return ret == SQLITE_NOTFOUND ? SQLITE_OK : ret;
+}
+
+static int writeBehindSectorSize(sqlite3_file *base) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  return file->real->pMethods->xSectorSize(file->real);
+}
+
+static int writeBehindDeviceCharacteristics(sqlite3_file *base) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  return file->real->pMethods->xDeviceCharacteristics(file->real) &
+         ~reorderedWrites;
+}
+
+static int writeBehindShmMap(sqlite3_file *base, int region, int size,
+                             int extend, void volatile **memory) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  return file->real->pMethods->xShmMap(file->real, region, size, extend,
+                                       memory);
+}
+
+static int writeBehindShmLock(sqlite3_file *base, int offset, int count,
+                              int flags) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  return file->real->pMethods->xShmLock(file->real, offset, count, flags);
+}
+
+static void writeBehindShmBarrier(sqlite3_file *base) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  file->real->pMethods->xShmBarrier(file->real);
+}
+
+static int writeBehindShmUnmap(sqlite3_file *base, int deleteFlag) {
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  return file->real->pMethods->xShmUnmap(file->real, deleteFlag);
+}
+
+// A mapping would not show the buffered writes, SQLite falls back to
+// xRead.
+static int writeBehindFetch(sqlite3_file *base, sqlite3_int64 offset,
+                            int amount, void **pages) {
+  *pages = NULL;
+  return SQLITE_OK;
+}
+
+static int writeBehindUnfetch(sqlite3_file *base, sqlite3_int64 offset,
+                              void *page) {
+  return SQLITE_OK;
+}
+
+static const sqlite3_io_methods writeBehindIoMethods = {
+    3,
+    writeBehindClose,
+    writeBehindRead,
+    writeBehindWrite,
+    writeBehindTruncate,
+    writeBehindSync,
+    writeBehindFileSize,
+    writeBehindLock,
+    writeBehindUnlock,
+    writeBehindCheckReservedLock,
+    writeBehindFileControl,
+    writeBehindSectorSize,
+    writeBehindDeviceCharacteristics,
+    writeBehindShmMap,
+    writeBehindShmLock,
+    writeBehindShmBarrier,
+    writeBehindShmUnmap,
+    writeBehindFetch,
+    writeBehindUnfetch,
+};
+
+static int writeBehindOpen(sqlite3_vfs *vfs, const char *name,
+                           sqlite3_file *base, int flags, int *outFlags) {
+  if (flags & (SQLITE_OPEN_WAL | SQLITE_OPEN_SUPER_JOURNAL)) {
+    return writeBehind.real->xOpen(writeBehind.real, name, base, flags,
+                                   outFlags);
+  }
+
+  struct WriteBehindFile *file = (struct WriteBehindFile *)base;
+  memset(file, 0, sizeof(*file));
+  file->real = (sqlite3_file *)(file + 1);
+  int ret = writeBehind.real->xOpen(writeBehind.real, name, file->real,
+                                    flags, outFlags);
+  if (ret != SQLITE_OK) {
+    return ret;
+  }
+  pthread_mutex_init(&file->mutex, NULL);
+  pthread_cond_init(&file->drained, NULL);
+  base->pMethods = &writeBehindIoMethods;
+  return SQLITE_OK;
+}
+
+static int writeBehindDelete(sqlite3_vfs *vfs, const char *name,
+                             int syncDir) {
+  return writeBehind.real->xDelete(writeBehind.real, name, syncDir);
+}
+
+static int writeBehindAccess(sqlite3_vfs *vfs, const char *name, int flags,
+                             int *result) {
+  return writeBehind.real->xAccess(writeBehind.real, name, flags, result);
+}
+
+static int writeBehindFullPathname(sqlite3_vfs *vfs, const char *name,
+                                   int size, char *out) {
+  return writeBehind.real->xFullPathname(writeBehind.real, name, size, out);
+}
+
+static void *writeBehindDlOpen(sqlite3_vfs *vfs, const char *path) {
+  return writeBehind.real->xDlOpen(writeBehind.real, path);
+}
+
+static void writeBehindDlError(sqlite3_vfs *vfs, int size, char *message) {
+  writeBehind.real->xDlError(writeBehind.real, size, message);
+}
+
+static void (*writeBehindDlSym(sqlite3_vfs *vfs, void *handle,
+                               const char *symbol))(void) {
+  return writeBehind.real->xDlSym(writeBehind.real, handle, symbol);
+}
+
+static void writeBehindDlClose(sqlite3_vfs *vfs, void *handle) {
+  writeBehind.real->xDlClose(writeBehind.real, handle);
+}
+
+static int writeBehindRandomness(sqlite3_vfs *vfs, int size, char *out) {
+  return writeBehind.real->xRandomness(writeBehind.real, size, out);
+}
+
+static int writeBehindSleep(sqlite3_vfs *vfs, int micros) {
+  return writeBehind.real->xSleep(writeBehind.real, micros);
+}
+
+static int writeBehindCurrentTime(sqlite3_vfs *vfs, double *now) {
+  return writeBehind.real->xCurrentTime(writeBehind.real, now);
+}
+
+static int writeBehindGetLastError(sqlite3_vfs *vfs, int size, char *out) {
+  return writeBehind.real->xGetLastError(writeBehind.real, size, out);
+}
+
+static int writeBehindCurrentTimeInt64(sqlite3_vfs *vfs,
+                                       sqlite3_int64 *now) {
+  return writeBehind.real->xCurrentTimeInt64(writeBehind.real, now);
+}
+
+int writeBehindVfsRegister(long long bufferBytes, int makeDefault) {
+  if (writeBehind.real != NULL) {
+    return SQLITE_MISUSE;
+  }
+  sqlite3_vfs *real = sqlite3_vfs_find(NULL);
+  if (real == NULL) {
+    return SQLITE_ERROR;
+  }
+  writeBehind.bufferBytes = bufferBytes;
+  writeBehind.batchBytes = bufferBytes / BATCH_SHARE;
+  if (writeBehind.batchBytes < MIN_BATCH_BYTES) {
+    writeBehind.batchBytes = MIN_BATCH_BYTES;
+  }
+  pthread_mutex_init(&writeBehind.mutex, NULL);
+  pthread_cond_init(&writeBehind.work, NULL);
+  pthread_cond_init(&writeBehind.space, NULL);
+  // Runs until the process exits; files are drained when they close.
+  if (pthread_create(&writeBehind.thread, NULL, ioThreadMain, NULL) != 0) {
+    return SQLITE_ERROR;
+  }
+  pthread_detach(writeBehind.thread);
+  writeBehind.real = real;
+
+  sqlite3_vfs *vfs = &writeBehind.vfs;
+  vfs->iVersion = 2;
+  vfs->szOsFile = (int)sizeof(struct WriteBehindFile) + real->szOsFile;
+  vfs->mxPathname = real->mxPathname;
+  vfs->zName = WRITE_BEHIND_VFS_NAME;
+  vfs->xOpen = writeBehindOpen;
+  vfs->xDelete = writeBehindDelete;
+  vfs->xAccess = writeBehindAccess;
+  vfs->xFullPathname = writeBehindFullPathname;
+  vfs->xDlOpen = writeBehindDlOpen;
+  vfs->xDlError = writeBehindDlError;
+  vfs->xDlSym = writeBehindDlSym;
+  vfs->xDlClose = writeBehindDlClose;
+  vfs->xRandomness = writeBehindRandomness;
+  vfs->xSleep = writeBehindSleep;
+  vfs->xCurrentTime = writeBehindCurrentTime;
+  vfs->xGetLastError = writeBehindGetLastError;
+  vfs->xCurrentTimeInt64 = writeBehindCurrentTimeInt64;
+  return sqlite3_vfs_register(vfs, makeDefault);
+}
+
+int writeBehindVfsEnabled(void) { return writeBehind.real != NULL; }
+
+void writeBehindVfsStats(struct WriteBehindStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  if (writeBehind.real == NULL) {
+    return;
+  }
+  stats->writes = counterLoad(&writeBehind.writes);
+  stats->calls = counterLoad(&writeBehind.calls);
+  stats->bytes = counterLoad(&writeBehind.bytes);
+  stats->batches = counterLoad(&writeBehind.batches);
+  pthread_mutex_lock(&writeBehind.mutex);
+  stats->queueDepth = writeBehind.queueDepth;
+  stats->peakQueueDepth = writeBehind.peakQueueDepth;
+  pthread_mutex_unlock(&writeBehind.mutex);
+  stats->busySeconds = counterLoad(&writeBehind.busyNanoseconds) / 1e9;
+  stats->stallSeconds = counterLoad(&writeBehind.stallNanoseconds) / 1e9;
+}
@@ -0,0 +1,45 @@
+#ifndef WRITE_BEHIND_VFS_H
+#define WRITE_BEHIND_VFS_H
+
+// SQLite VFS buffering the writes to database, journal and temporary files
+// in memory and issuing them from a background thread, for --write-behind.
+// It sits on top of the default VFS.
+//
+// Writes to a file collect in a set of extents sorted by offset, a page
+// written again replacing the earlier copy. Once a file has a batch worth
+// of buffered bytes the set is queued for the I/O thread, which writes
+// every run of adjacent extents with one call. Reads see the queued and
+// buffered data. A file is drained, all its writes waited for, before
+// xSync, xTruncate and xClose, before its lock is released and after a
+// checkpoint, so other connections and processes never see it behind; the
+// importer only waits when the buffers are full or SQLite syncs.
+//
+// WAL files pass through: other connections read their frames as soon as
+// the WAL index says so, without a call on this VFS in between.
+#define WRITE_BEHIND_VFS_NAME "writebehind"
+
+struct WriteBehindStats {
+  // xWrite calls buffered, and the write calls the I/O thread made for
+  // them.
+  long long writes;
+  long long calls;
+  long long bytes;
+  long long batches;
+  // Batches queued or being written now, and at most.
+  int queueDepth;
+  int peakQueueDepth;
+  // Time the I/O thread spent writing, and callers waited on it.
+  double busySeconds;
+  double stallSeconds;
+};
+
+// Registers the VFS over the current default, as the new default if
+// makeDefault is set, and starts the I/O thread. bufferBytes bounds the
+// bytes buffered and queued over all files.
+int writeBehindVfsRegister(long long bufferBytes, int makeDefault);
+
+// 0 if the VFS is not registered.
+int writeBehindVfsEnabled(void);
+void writeBehindVfsStats(struct WriteBehindStats *stats);
+
+#endif